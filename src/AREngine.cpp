@@ -27,14 +27,14 @@ namespace AREngine
 {
 
 // AR code file - frontend is responsible for managing this
-ARCodeFile* CodeFile;
-
-u8 (*BusRead8)(u32 addr);
-u16 (*BusRead16)(u32 addr);
-u32 (*BusRead32)(u32 addr);
-void (*BusWrite8)(u32 addr, u8 val);
-void (*BusWrite16)(u32 addr, u16 val);
-void (*BusWrite32)(u32 addr, u32 val);
+INSTANCE_LOCAL ARCodeFile* CodeFile;
+
+INSTANCE_LOCAL u8 (*BusRead8)(u32 addr);
+INSTANCE_LOCAL u16 (*BusRead16)(u32 addr);
+INSTANCE_LOCAL u32 (*BusRead32)(u32 addr);
+INSTANCE_LOCAL void (*BusWrite8)(u32 addr, u8 val);
+INSTANCE_LOCAL void (*BusWrite16)(u32 addr, u16 val);
+INSTANCE_LOCAL void (*BusWrite32)(u32 addr, u32 val);
 
 
 bool Init()
@@ -191,6 +191,8 @@ public:
 
     // all code accesses are forced nonseq 32bit
     u32 CodeRead32(u32 addr, bool branch);
+    // the cycles CodeRead32 would take with the given region timing, without reading anything
+    s32 CodeFetchCycles(u32 addr, bool branch, s32 regionCodeCycles);
 
     void DataRead8(u32 addr, u32* val);
     void DataRead16(u32 addr, u32* val);
@@ -301,6 +303,22 @@ public:
     u8* CurICacheLine;
 
     bool (*GetMemRegion)(u32 addr, bool write, NDS::MemRegion* region);
+
+    // host memory behind each 4K page of the first 256MB, for the interpreter
+    // null where accesses have to go through the bus handlers (see NDS::UpdatePageMap)
+    // kept last, the JIT wants the members above at small offsets
+    u8* PageReadMap[0x10000];
+    u8* PageWriteMap[0x10000];
+
+    u8* GetReadPage(u32 addr)
+    {
+        return (addr < 0x10000000) ? PageReadMap[addr >> 12] : NULL;
+    }
+
+    u8* GetWritePage(u32 addr)
+    {
+        return (addr < 0x10000000) ? PageWriteMap[addr >> 12] : NULL;
+    }
 };
 
 class ARMv4 : public ARM
@@ -321,17 +339,20 @@ public:
 
     u16 CodeRead16(u32 addr)
     {
-        return BusRead16(addr);
+        u8* page = GetReadPage(addr);
+        return page ? *(u16*)&page[addr & 0xFFF] : BusRead16(addr);
     }
 
     u32 CodeRead32(u32 addr)
     {
-        return BusRead32(addr);
+        u8* page = GetReadPage(addr);
+        return page ? *(u32*)&page[addr & 0xFFF] : BusRead32(addr);
     }
 
     void DataRead8(u32 addr, u32* val)
     {
-        *val = BusRead8(addr);
+        u8* page = GetReadPage(addr);
+        *val = page ? *(u8*)&page[addr & 0xFFF] : BusRead8(addr);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][0];
     }
@@ -340,7 +361,8 @@ public:
     {
         addr &= ~1;
 
-        *val = BusRead16(addr);
+        u8* page = GetReadPage(addr);
+        *val = page ? *(u16*)&page[addr & 0xFFF] : BusRead16(addr);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][0];
     }
@@ -349,7 +371,8 @@ public:
     {
         addr &= ~3;
 
-        *val = BusRead32(addr);
+        u8* page = GetReadPage(addr);
+        *val = page ? *(u32*)&page[addr & 0xFFF] : BusRead32(addr);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][2];
     }
@@ -358,13 +381,16 @@ public:
     {
         addr &= ~3;
 
-        *val = BusRead32(addr);
+        u8* page = GetReadPage(addr);
+        *val = page ? *(u32*)&page[addr & 0xFFF] : BusRead32(addr);
         DataCycles += NDS::ARM7MemTimings[addr >> 15][3];
     }
 
     void DataWrite8(u32 addr, u8 val)
     {
-        BusWrite8(addr, val);
+        u8* page = GetWritePage(addr);
+        if (page) *(u8*)&page[addr & 0xFFF] = val;
+        else      BusWrite8(addr, val);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][0];
     }
@@ -373,7 +399,9 @@ public:
     {
         addr &= ~1;
 
-        BusWrite16(addr, val);
+        u8* page = GetWritePage(addr);
+        if (page) *(u16*)&page[addr & 0xFFF] = val;
+        else      BusWrite16(addr, val);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][0];
     }
@@ -382,7 +410,9 @@ public:
     {
         addr &= ~3;
 
-        BusWrite32(addr, val);
+        u8* page = GetWritePage(addr);
+        if (page) *(u32*)&page[addr & 0xFFF] = val;
+        else      BusWrite32(addr, val);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][2];
     }
@@ -391,7 +421,9 @@ public:
     {
         addr &= ~3;
 
-        BusWrite32(addr, val);
+        u8* page = GetWritePage(addr);
+        if (page) *(u32*)&page[addr & 0xFFF] = val;
+        else      BusWrite32(addr, val);
         DataCycles += NDS::ARM7MemTimings[addr >> 15][3];
     }
 
@@ -457,6 +489,20 @@ public:
             Cycles += numC + numD;
         }
     }
+
+    // see ARMv5
+    u8* PageReadMap[0x10000];
+    u8* PageWriteMap[0x10000];
+
+    u8* GetReadPage(u32 addr)
+    {
+        return (addr < 0x10000000) ? PageReadMap[addr >> 12] : NULL;
+    }
+
+    u8* GetWritePage(u32 addr)
+    {
+        return (addr < 0x10000000) ? PageWriteMap[addr >> 12] : NULL;
+    }
 };
 
 namespace ARMInterpreter
@@ -470,8 +516,8 @@ void T_UNK(ARM* cpu);
 namespace NDS
 {
 
-extern ARMv5* ARM9;
-extern ARMv4* ARM7;
+extern INSTANCE_LOCAL ARMv5* ARM9;
+extern INSTANCE_LOCAL ARMv4* ARM7;
 
 }
 
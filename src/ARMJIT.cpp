@@ -8,6 +8,7 @@
 #include "xxhash/xxhash.h"
 
 #include "Config.h"
+#include "Platform.h"
 
 #include "ARMJIT_Internal.h"
 #include "ARMJIT_Memory.h"
@@ -44,6 +45,103 @@ std::unordered_map<u32, JitBlock*> JitBlocks7;
 
 std::unordered_map<u32, JitBlock*> RestoreCandidates;
 
+/*
+    Block linking
+
+    Exits of a block which go to a known address get patched to jump
+    straight into the block there once it's compiled. They're unlinked
+    again when the block they go to is invalidated or retired.
+
+    The links bypass the address translation, so only code in ITCM, main RAM,
+    the BIOSes and ARM7 WRAM is linked to. Of those, ITCM (size changes),
+    the ARM7 WRAM mirrors (WRAMCNT, DSi NWRAM) and whatever DTCM gets put over
+    can still be remapped. Before that happens, every exit going there is
+    unlinked (UnlinkExitsInRange), and is only linked again when a block
+    there becomes live.
+*/
+// all live blocks which have an exit going to the given address (| cpu num)
+std::unordered_map<u32, TinyVector<JitBlock*>> BlockExitsTo;
+
+/*
+    Persistent block cache
+
+    The code of all blocks is written to disk along with the metadata
+    of the blocks, keyed by the ROM, the console type and the JIT settings.
+    When it's loaded again the code is put back at the same place and
+    the blocks become restore candidates, so they are picked up lazily
+    when the CPU first arrives at them and they still match
+    (same instruction hash, start address, literals and address ranges).
+*/
+struct PersistentCacheHeader
+{
+    u32 Magic;
+    u32 Version;
+    u32 GameCode;
+    u32 CartCRC;
+    u32 ConsoleType;
+    u32 JITConfig;
+    u64 Fingerprint;
+    u32 NumBlocks;
+};
+
+const u32 PersistentCacheMagic = 0x54494A4D; // MJIT
+const u32 PersistentCacheVersion = 2;
+
+bool PersistentCacheActive = false;
+PersistentCacheHeader PersistentCacheKey;
+
+void InstallPersistentCache();
+
+/*
+    Background compilation
+
+    With JIT_AsyncCompile blocks are still fetched (and thereby executed
+    through the interpreter) on the emulation thread, but generating their code
+    is left to the compile thread. Until it's done the block sits in the block
+    maps without an entry point and is interpreted whenever the CPU gets there.
+
+    Compiled blocks are only published on the emulation thread, so nothing
+    can race with the invalidation. If a block is invalidated before it's
+    published the job is cancelled and the code is thrown away.
+
+    The compiler also looks at the memory map and the access timings. Whatever
+    changes them first waits for the queue to be drained (SyncCompileThread),
+    so every block is compiled with the state it was fetched under.
+*/
+struct CompileJob
+{
+    // only ever touched by the emulation thread
+    // NULL if the block was invalidated in the meantime
+    JitBlock* Block;
+
+    ARM* CPU;
+    bool Thumb;
+    int NumInstrs;
+    FetchedInstr Instrs[32];
+
+    // NULL if the code memory was full
+    JitBlockEntry EntryPoint;
+    int NumExits;
+    BlockExit Exits[MaxBlockExits];
+};
+
+const u32 CompileQueueSize = 64;
+CompileJob CompileQueue[CompileQueueSize];
+// jobs from CompilePublishPos to CompileReadPos are compiled and wait to be published,
+// the ones from CompileReadPos to CompileWritePos still need to be compiled
+u32 CompileWritePos, CompileReadPos, CompilePublishPos;
+bool CompileSyncWaiting;
+
+bool AsyncCompileActive = false;
+
+Platform::Thread* CompileThread;
+bool CompileThreadRunning = false;
+Platform::Semaphore* Sema_CompileStart;
+Platform::Semaphore* Sema_CompileDone;
+Platform::Mutex* CompileLock;
+
+void PublishCompiledBlocks();
+
 TinyVector<u32> InvalidLiterals;
 
 AddressRange CodeIndexITCM[ITCMPhysicalSize / 512];
@@ -289,26 +387,136 @@ void SlowBlockTransfer7(u32 addr, u64* data, u32 num)
 INSTANTIATE_SLOWMEM(0)
 INSTANTIATE_SLOWMEM(1)
 
+void CompileThreadFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_CompileStart);
+        if (!CompileThreadRunning) return;
+
+        for (;;)
+        {
+            Platform::Mutex_Lock(CompileLock);
+            u32 pos = CompileReadPos;
+            bool empty = pos == CompileWritePos;
+            Platform::Mutex_Unlock(CompileLock);
+
+            if (empty) break;
+
+            // running out of space is left to the emulation thread to handle
+            CompileJob* job = &CompileQueue[pos];
+            if (JITCompiler->CodeMemoryFull())
+                job->EntryPoint = NULL;
+            else
+            {
+                job->EntryPoint = JITCompiler->CompileBlock(job->CPU, job->Thumb, job->Instrs, job->NumInstrs);
+                job->NumExits = JITCompiler->NumExits;
+                memcpy(job->Exits, JITCompiler->Exits, JITCompiler->NumExits * sizeof(BlockExit));
+            }
+
+            Platform::Mutex_Lock(CompileLock);
+            CompileReadPos = (pos + 1) & (CompileQueueSize-1);
+            bool wake = CompileSyncWaiting && CompileReadPos == CompileWritePos;
+            if (wake) CompileSyncWaiting = false;
+            Platform::Mutex_Unlock(CompileLock);
+
+            if (wake) Platform::Semaphore_Post(Sema_CompileDone);
+        }
+    }
+}
+
+void StopCompileThread()
+{
+    if (CompileThreadRunning)
+    {
+        SyncCompileThread();
+
+        CompileThreadRunning = false;
+        Platform::Semaphore_Post(Sema_CompileStart);
+        Platform::Thread_Wait(CompileThread);
+        Platform::Thread_Free(CompileThread);
+    }
+}
+
+void SyncCompileThread()
+{
+    if (!CompileThreadRunning)
+        return;
+
+    Platform::Mutex_Lock(CompileLock);
+    bool done = CompileReadPos == CompileWritePos;
+    if (!done) CompileSyncWaiting = true;
+    Platform::Mutex_Unlock(CompileLock);
+
+    if (!done)
+        Platform::Semaphore_Wait(Sema_CompileDone);
+}
+
+void UpdateAsyncCompile()
+{
+    bool async = Config::JIT_AsyncCompile && JITCompiler->SupportsAsyncCompile();
+    if (async == AsyncCompileActive)
+        return;
+
+    // there mustn't be anything in flight when switching
+    StopCompileThread();
+    CompileWritePos = CompileReadPos = CompilePublishPos = 0;
+    CompileSyncWaiting = false;
+
+    if (async)
+    {
+        Platform::Semaphore_Reset(Sema_CompileStart);
+        Platform::Semaphore_Reset(Sema_CompileDone);
+
+        CompileThreadRunning = true;
+        CompileThread = Platform::Thread_Create(CompileThreadFunc);
+    }
+
+    JITCompiler->CompilingAsync = async;
+    AsyncCompileActive = async;
+}
+
 void Init()
 {
     JITCompiler = new Compiler();
 
+    Sema_CompileStart = Platform::Semaphore_Create();
+    Sema_CompileDone = Platform::Semaphore_Create();
+    CompileLock = Platform::Mutex_Create();
+
     ARMJIT_Memory::Init();
 }
 
 void DeInit()
 {
+    SavePersistentCache();
+    PersistentCacheActive = false;
+
     ResetBlockCache();
+
+    StopCompileThread();
+    AsyncCompileActive = false;
+
     ARMJIT_Memory::DeInit();
 
+    Platform::Semaphore_Free(Sema_CompileStart);
+    Platform::Semaphore_Free(Sema_CompileDone);
+    Platform::Mutex_Free(CompileLock);
+
     delete JITCompiler;
 }
 
 void Reset()
 {
+    // the ROM might change after this
+    SavePersistentCache();
+    PersistentCacheActive = false;
+
     ResetBlockCache();
 
     ARMJIT_Memory::Reset();
+
+    UpdateAsyncCompile();
 }
 
 void FloodFillSetFlags(FetchedInstr instrs[], int start, u8 flags)
@@ -549,10 +757,216 @@ void RetireJitBlock(JitBlock* block)
     }
 }
 
+JitBlock* GetLinkTarget(u32 num, u32 addr)
+{
+    auto& map = num == 0 ? JitBlocks9 : JitBlocks7;
+    auto it = map.find(addr);
+    if (it == map.end() || !it->second->EntryPoint)
+        return NULL;
+
+    u32 localAddr = LocaliseCodeAddress(num, addr);
+    if (it->second->StartAddrLocal != localAddr)
+        return NULL;
+
+    switch (localAddr >> 27)
+    {
+    case ARMJIT_Memory::memregion_ITCM:
+    case ARMJIT_Memory::memregion_MainRAM:
+    case ARMJIT_Memory::memregion_BIOS9:
+    case ARMJIT_Memory::memregion_BIOS7:
+    case ARMJIT_Memory::memregion_WRAM7:
+        return it->second;
+    default:
+        return NULL;
+    }
+}
+
+// links a block which just became live in both directions
+void LinkBlock(JitBlock* block)
+{
+    for (int i = 0; i < block->NumExits; i++)
+    {
+        BlockExit& exit = block->Exits[i];
+        BlockExitsTo[exit.Target | block->Num].Add(block);
+
+        // the code might come from a retired block or the persistent cache
+        // so the exit is always set
+        JitBlock* target = GetLinkTarget(block->Num, exit.Target);
+        if (target)
+            JITCompiler->LinkBlockExit(exit.PatchOffset, target->EntryPoint);
+        else
+            JITCompiler->UnlinkBlockExit(exit.PatchOffset);
+    }
+
+    auto it = BlockExitsTo.find(block->StartAddr | block->Num);
+    if (it != BlockExitsTo.end() && GetLinkTarget(block->Num, block->StartAddr) == block)
+    {
+        for (int i = 0; i < it->second.Length; i++)
+        {
+            JitBlock* other = it->second[i];
+            for (int j = 0; j < other->NumExits; j++)
+            {
+                if (other->Exits[j].Target == block->StartAddr)
+                    JITCompiler->LinkBlockExit(other->Exits[j].PatchOffset, block->EntryPoint);
+            }
+        }
+    }
+}
+
+// for a live block which is about to be retired or deleted
+void UnlinkBlock(JitBlock* block)
+{
+    auto it = BlockExitsTo.find(block->StartAddr | block->Num);
+    if (it != BlockExitsTo.end())
+    {
+        for (int i = 0; i < it->second.Length; i++)
+        {
+            JitBlock* other = it->second[i];
+            for (int j = 0; j < other->NumExits; j++)
+            {
+                if (other->Exits[j].Target == block->StartAddr)
+                    JITCompiler->UnlinkBlockExit(other->Exits[j].PatchOffset);
+            }
+        }
+    }
+
+    for (int i = 0; i < block->NumExits; i++)
+    {
+        BlockExit& exit = block->Exits[i];
+        auto it = BlockExitsTo.find(exit.Target | block->Num);
+        assert(it != BlockExitsTo.end());
+        it->second.RemoveByValue(block);
+        if (it->second.Length == 0)
+            BlockExitsTo.erase(it);
+
+        JITCompiler->UnlinkBlockExit(exit.PatchOffset);
+    }
+}
+
+void UnlinkExitsInRange(u32 num, u32 start, u32 end)
+{
+    for (auto it = BlockExitsTo.begin(); it != BlockExitsTo.end(); it++)
+    {
+        u32 target = it->first & ~1;
+        if ((it->first & 1) != num || target < start || target >= end)
+            continue;
+
+        for (int i = 0; i < it->second.Length; i++)
+        {
+            JitBlock* block = it->second[i];
+            for (int j = 0; j < block->NumExits; j++)
+            {
+                if (block->Exits[j].Target == target)
+                    JITCompiler->UnlinkBlockExit(block->Exits[j].PatchOffset);
+            }
+        }
+    }
+}
+
+bool CompileQueueFull()
+{
+    return ((CompileWritePos + 1) & (CompileQueueSize-1)) == CompilePublishPos;
+}
+
+void QueueCompileJob(JitBlock* block, ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount)
+{
+    CompileJob* job = &CompileQueue[CompileWritePos];
+    job->Block = block;
+    job->CPU = cpu;
+    job->Thumb = thumb;
+    job->NumInstrs = instrsCount;
+    memcpy(job->Instrs, instrs, instrsCount * sizeof(FetchedInstr));
+    job->EntryPoint = NULL;
+
+    Platform::Mutex_Lock(CompileLock);
+    CompileWritePos = (CompileWritePos + 1) & (CompileQueueSize-1);
+    Platform::Mutex_Unlock(CompileLock);
+
+    Platform::Semaphore_Post(Sema_CompileStart);
+}
+
+void PublishCompiledBlocks()
+{
+    Platform::Mutex_Lock(CompileLock);
+    u32 end = CompileReadPos;
+    Platform::Mutex_Unlock(CompileLock);
+
+    if (CompilePublishPos == end)
+        return;
+
+    // the code of these blocks becomes reachable now
+    JITCompiler->PublishLoadStorePatches();
+
+    bool outOfMemory = false;
+    while (CompilePublishPos != end)
+    {
+        CompileJob* job = &CompileQueue[CompilePublishPos];
+        CompilePublishPos = (CompilePublishPos + 1) & (CompileQueueSize-1);
+
+        JitBlock* block = job->Block;
+        if (!block)
+            continue;
+        if (!job->EntryPoint)
+        {
+            outOfMemory = true;
+            continue;
+        }
+
+        block->EntryPoint = job->EntryPoint;
+        block->NumExits = job->NumExits;
+        memcpy(block->Exits, job->Exits, job->NumExits * sizeof(BlockExit));
+
+        u64* entry = &FastBlockLookupRegions[block->StartAddrLocal >> 27][(block->StartAddrLocal & 0x7FFFFFF) / 2];
+        *entry = ((u64)block->StartAddr | block->Num) << 32;
+        *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
+
+        LinkBlock(block);
+    }
+
+    if (outOfMemory)
+        ResetBlockCache();
+}
+
+// for blocks which are still waiting for the compile thread
+// there's no code which could be restored, so they're thrown away
+void CancelPendingBlock(JitBlock* block)
+{
+    for (u32 pos = CompilePublishPos; pos != CompileWritePos; pos = (pos + 1) & (CompileQueueSize-1))
+    {
+        if (CompileQueue[pos].Block == block)
+            CompileQueue[pos].Block = NULL;
+    }
+    delete block;
+}
+
+void DropPendingBlock(JitBlock* block)
+{
+    for (int j = 0; j < block->NumAddresses; j++)
+    {
+        u32 addr = block->AddressRanges()[j];
+        AddressRange* region = CodeMemRegions[addr >> 27];
+        AddressRange* range = &region[(addr & 0x7FFFFFF) / 512];
+
+        range->Blocks.RemoveByValue(block);
+        if (range->Blocks.Length == 0)
+        {
+            if (!PageContainsCode(&region[(addr & 0x7FFF000) / 512]))
+                ARMJIT_Memory::SetCodeProtection(addr >> 27, addr & 0x7FFFFFF, false);
+
+            range->Code = 0;
+        }
+    }
+
+    CancelPendingBlock(block);
+}
+
 void CompileBlock(ARM* cpu)
 {
     bool thumb = cpu->CPSR & 0x20;
 
+    if (AsyncCompileActive)
+        PublishCompiledBlocks();
+
     if (Config::JIT_MaxBlockSize < 1)
         Config::JIT_MaxBlockSize = 1;
     if (Config::JIT_MaxBlockSize > 32)
@@ -566,6 +980,10 @@ void CompileBlock(ARM* cpu)
         printf("trying to compile non executable code? %x\n", blockAddr);
     }
 
+    // the block is already queued for the compile thread
+    // so it only needs to be interpreted
+    bool compilePending = false;
+
     auto& map = cpu->Num == 0 ? JitBlocks9 : JitBlocks7;
     auto existingBlockIt = map.find(blockAddr);
     if (existingBlockIt != map.end())
@@ -575,7 +993,7 @@ void CompileBlock(ARM* cpu)
         // but different mirrors
         u32 otherLocalAddr = existingBlockIt->second->StartAddrLocal;
 
-        if (localAddr == otherLocalAddr)
+        if (localAddr == otherLocalAddr && existingBlockIt->second->EntryPoint)
         {
             JIT_DEBUGPRINT("switching out block %x %x %x\n", localAddr, blockAddr, existingBlockIt->second->StartAddr);
 
@@ -585,9 +1003,22 @@ void CompileBlock(ARM* cpu)
             return;
         }
 
-        // some memory has been remapped
-        RetireJitBlock(existingBlockIt->second);        
-        map.erase(existingBlockIt);
+        if (localAddr == otherLocalAddr)
+        {
+            compilePending = true;
+        }
+        else
+        {
+            // some memory has been remapped
+            if (existingBlockIt->second->EntryPoint)
+            {
+                UnlinkBlock(existingBlockIt->second);
+                RetireJitBlock(existingBlockIt->second);
+            }
+            else
+                DropPendingBlock(existingBlockIt->second);
+            map.erase(existingBlockIt);
+        }
     }
 
     FetchedInstr instrs[Config::JIT_MaxBlockSize];
@@ -604,6 +1035,9 @@ void CompileBlock(ARM* cpu)
     // they are going to be hashed
     u32 literalValues[Config::JIT_MaxBlockSize];
     u32 instrValues[Config::JIT_MaxBlockSize];
+    // invalid literals are only taken off the list once the block is queued
+    u32 numInvalidLiterals = 0;
+    u32 invalidLiteralAddrs[Config::JIT_MaxBlockSize];
 
     cpu->FillPipeline();
     u32 nextInstr[2] = {cpu->NextInstr[0], cpu->NextInstr[1]};
@@ -621,6 +1055,7 @@ void CompileBlock(ARM* cpu)
 
         instrs[i].BranchFlags = 0;
         instrs[i].SetFlags = 0;
+        instrs[i].LiteralFetched = false;
         instrs[i].Instr = nextInstr[0];
         nextInstr[0] = nextInstr[1];
     
@@ -735,6 +1170,22 @@ void CompileBlock(ARM* cpu)
             addressMasks[j] |= 1 << ((translatedAddr & 0x1FF) / 16);
             JIT_DEBUGPRINT("literal loading %08x %08x %08x %08x\n", literalAddr, translatedAddr, addressMasks[j], addressRanges[j]);
             cpu->DataRead32(literalAddr, &literalValues[numLiterals]);
+
+            // the compile thread can't read the literal itself
+            if (AsyncCompileActive && !compilePending)
+            {
+                if (InvalidLiterals.Find(translatedAddr) != -1)
+                {
+                    invalidLiteralAddrs[numInvalidLiterals++] = translatedAddr;
+                }
+                else
+                {
+                    instrs[i].LiteralFetched = true;
+                    instrs[i].LiteralAddr = literalAddr;
+                    instrs[i].LiteralValue = literalValues[numLiterals];
+                }
+            }
+
             literalLoadAddrs[numLiterals++] = translatedAddr;
         }
 
@@ -828,6 +1279,9 @@ void CompileBlock(ARM* cpu)
             FloodFillSetFlags(instrs, i - 2, !secondaryFlagReadCond ? instrs[i - 1].Info.ReadFlags : 0xF);
     } while(!instrs[i - 1].Info.EndBlock && i < Config::JIT_MaxBlockSize && !cpu->Halted && (!cpu->IRQ || (cpu->CPSR & 0x80)));
 
+    if (compilePending)
+        return;
+
     u32 literalHash = (u32)XXH3_64bits(literalValues, numLiterals * 4);
     u32 instrHash = (u32)XXH3_64bits(instrValues, i * 4);
 
@@ -839,7 +1293,7 @@ void CompileBlock(ARM* cpu)
         prevBlock = prevBlockIt->second;
         RestoreCandidates.erase(prevBlockIt);
 
-        mayRestore = prevBlock->StartAddr == blockAddr && prevBlock->LiteralHash == literalHash;
+        mayRestore = prevBlock->Num == cpu->Num && prevBlock->StartAddr == blockAddr && prevBlock->LiteralHash == literalHash;
 
         if (mayRestore && prevBlock->NumAddresses == numAddressRanges)
         {
@@ -867,6 +1321,11 @@ void CompileBlock(ARM* cpu)
         if (prevBlock)
             delete prevBlock;
 
+        // if the compile thread can't keep up the block
+        // was just interpreted this time
+        if (AsyncCompileActive && CompileQueueFull())
+            return;
+
         block = new JitBlock(cpu->Num, i, numAddressRanges, numLiterals);
         block->LiteralHash = literalHash;
         block->InstrHash = instrHash;
@@ -882,7 +1341,24 @@ void CompileBlock(ARM* cpu)
 
         FloodFillSetFlags(instrs, i - 1, 0xF);
 
-        block->EntryPoint = JITCompiler->CompileBlock(cpu, thumb, instrs, i);
+        if (AsyncCompileActive)
+        {
+            block->EntryPoint = NULL;
+            QueueCompileJob(block, cpu, thumb, instrs, i);
+
+            for (int j = 0; j < numInvalidLiterals; j++)
+            {
+                int invalidLiteralIdx = InvalidLiterals.Find(invalidLiteralAddrs[j]);
+                if (invalidLiteralIdx != -1)
+                    InvalidLiterals.Remove(invalidLiteralIdx);
+            }
+        }
+        else
+        {
+            block->EntryPoint = JITCompiler->CompileBlock(cpu, thumb, instrs, i);
+            block->NumExits = JITCompiler->NumExits;
+            memcpy(block->Exits, JITCompiler->Exits, JITCompiler->NumExits * sizeof(BlockExit));
+        }
 
         JIT_DEBUGPRINT("block start %p\n", block->EntryPoint);
     }
@@ -890,6 +1366,7 @@ void CompileBlock(ARM* cpu)
     {
         JIT_DEBUGPRINT("restored! %p\n", prevBlock);
         block = prevBlock;
+        block->StartAddrLocal = localAddr;
     }
 
     assert((localAddr & 1) == 0);
@@ -914,9 +1391,15 @@ void CompileBlock(ARM* cpu)
     else
         JitBlocks7[blockAddr] = block;
 
-    u64* entry = &FastBlockLookupRegions[(localAddr >> 27)][(localAddr & 0x7FFFFFF) / 2];
-    *entry = ((u64)blockAddr | cpu->Num) << 32;
-    *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
+    // blocks compiled in the background are published later
+    if (block->EntryPoint)
+    {
+        u64* entry = &FastBlockLookupRegions[(localAddr >> 27)][(localAddr & 0x7FFFFFF) / 2];
+        *entry = ((u64)blockAddr | cpu->Num) << 32;
+        *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
+
+        LinkBlock(block);
+    }
 }
 
 void InvalidateByAddr(u32 localAddr)
@@ -1002,14 +1485,17 @@ void InvalidateByAddr(u32 localAddr)
         else
             JitBlocks7.erase(block->StartAddr);
 
-        if (!literalInvalidation)
+        if (!block->EntryPoint)
         {
-            RetireJitBlock(block);
+            CancelPendingBlock(block);
+            continue;
         }
+
+        UnlinkBlock(block);
+        if (!literalInvalidation)
+            RetireJitBlock(block);
         else
-        {
             delete block;
-        }
     }
 }
 
@@ -1032,6 +1518,36 @@ void CheckAndInvalidate(u32 addr)
         InvalidateByAddr(localAddr);
 }
 
+void CheckAndInvalidateRange(u32 num, int region, u32 addr, u32 len)
+{
+    u32 end = addr + len;
+    while (addr < end)
+    {
+        // mappings are much coarser than this, so the whole 512 byte
+        // range localises the same way
+        u32 rangeend = (addr & ~0x1FF) + 0x200;
+        if (rangeend > end) rangeend = end;
+
+        u32 localAddr = ARMJIT_Memory::LocaliseAddress(region, num, addr);
+        AddressRange* range = &CodeMemRegions[region][(localAddr & 0x7FFFFFF) / 512];
+
+        u32 first = (localAddr & 0x1FF) / 16;
+        u32 last = ((localAddr & 0x1FF) + (rangeend - addr) - 1) / 16;
+        u32 mask = (last == 31 ? 0xFFFFFFFF : ((1u << (last + 1)) - 1)) & ~((1u << first) - 1);
+
+        // invalidating a block can clear other bits of the range as well
+        u32 pending = range->Code & mask;
+        while (pending)
+        {
+            u32 i = __builtin_ctz(pending);
+            InvalidateByAddr((localAddr & ~0x1FF) | (i * 16));
+            pending &= range->Code & ~(1u << i);
+        }
+
+        addr = rangeend;
+    }
+}
+
 JitBlockEntry LookUpBlock(u32 num, u64* entries, u32 offset, u32 addr)
 {
     u64* entry = &entries[offset / 2];
@@ -1083,6 +1599,10 @@ void ResetBlockCache()
 {
     printf("Resetting JIT block cache...\n");
 
+    // whatever is still being compiled is thrown away
+    SyncCompileThread();
+    CompilePublishPos = CompileReadPos;
+
     // could be replace through a function which only resets
     // the permissions but we're too lazy
     ARMJIT_Memory::Reset();
@@ -1096,6 +1616,7 @@ void ResetBlockCache()
     for (auto it = RestoreCandidates.begin(); it != RestoreCandidates.end(); it++)
         delete it->second;
     RestoreCandidates.clear();
+    BlockExitsTo.clear();
     for (auto it : JitBlocks9)
     {
         JitBlock* block = it.second;
@@ -1124,6 +1645,177 @@ void ResetBlockCache()
     JitBlocks7.clear();
 
     JITCompiler->Reset();
+
+    if (PersistentCacheActive)
+        InstallPersistentCache();
+}
+
+void GetPersistentCacheName(char* name)
+{
+    sprintf(name, "jitcache_%08X_%08X.bin", PersistentCacheKey.GameCode, PersistentCacheKey.CartCRC);
+}
+
+void InstallPersistentCache()
+{
+    char name[64];
+    GetPersistentCacheName(name);
+
+    FILE* f = Platform::OpenLocalFile(name, "rb");
+    if (!f)
+        return;
+
+    PersistentCacheHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1
+        || memcmp(&header, &PersistentCacheKey, offsetof(PersistentCacheHeader, NumBlocks)) != 0)
+    {
+        printf("JIT cache %s is outdated\n", name);
+        fclose(f);
+        return;
+    }
+
+    bool valid = true;
+    u32 numBlocks = 0;
+    for (; numBlocks < header.NumBlocks; numBlocks++)
+    {
+        u8 num;
+        u32 startAddr, instrHash, literalHash, entryOffset;
+        u16 numAddresses, numLiterals;
+        if (fread(&num, 1, 1, f) != 1
+            || fread(&startAddr, 4, 1, f) != 1
+            || fread(&instrHash, 4, 1, f) != 1
+            || fread(&literalHash, 4, 1, f) != 1
+            || fread(&entryOffset, 4, 1, f) != 1
+            || fread(&numAddresses, 2, 1, f) != 1
+            || fread(&numLiterals, 2, 1, f) != 1
+            || numAddresses == 0)
+        {
+            valid = false;
+            break;
+        }
+
+        JitBlock* block = new JitBlock(num, literalHash, numAddresses, numLiterals);
+        block->StartAddr = startAddr;
+        block->StartAddrLocal = 0;
+        block->InstrHash = instrHash;
+        block->LiteralHash = literalHash;
+        block->EntryPoint = JITCompiler->AddEntryOffset(entryOffset);
+
+        u32 dataLen = numAddresses * 2 + numLiterals;
+        if (fread(block->AddressRanges(), 4, dataLen, f) != dataLen
+            || fread(&block->NumExits, 1, 1, f) != 1
+            || block->NumExits > MaxBlockExits
+            || fread(block->Exits, sizeof(BlockExit), block->NumExits, f) != block->NumExits)
+        {
+            delete block;
+            valid = false;
+            break;
+        }
+
+        RetireJitBlock(block);
+    }
+
+    if (!valid || !JITCompiler->LoadImage(f))
+    {
+        printf("JIT cache %s is broken\n", name);
+        for (auto it = RestoreCandidates.begin(); it != RestoreCandidates.end(); it++)
+            delete it->second;
+        RestoreCandidates.clear();
+        JITCompiler->Reset();
+    }
+    else
+        printf("Loaded %d blocks from JIT cache %s\n", numBlocks, name);
+
+    fclose(f);
+}
+
+void LoadPersistentCache()
+{
+    PersistentCacheActive = false;
+    if (!Config::JIT_Enable || !Config::JIT_PersistentCache || !NDSCart::CartROM)
+        return;
+
+    memset(&PersistentCacheKey, 0, sizeof(PersistentCacheKey));
+    PersistentCacheKey.Magic = PersistentCacheMagic;
+    PersistentCacheKey.Version = PersistentCacheVersion;
+    PersistentCacheKey.GameCode = *(u32*)&NDSCart::CartROM[0x0C];
+    PersistentCacheKey.CartCRC = NDSCart::GetCartCRC();
+    PersistentCacheKey.ConsoleType = NDS::ConsoleType;
+    PersistentCacheKey.JITConfig = Config::JIT_MaxBlockSize
+        | (Config::JIT_BranchOptimisations ? (1 << 8) : 0)
+        | (Config::JIT_LiteralOptimisations ? (1 << 9) : 0)
+        | (Config::JIT_FastMemory ? (1 << 10) : 0);
+    PersistentCacheKey.Fingerprint = JITCompiler->GetImageFingerprint();
+    if (PersistentCacheKey.Fingerprint == 0)
+        return;
+
+    PersistentCacheActive = true;
+    ResetBlockCache();
+}
+
+void WritePersistentBlock(FILE* f, JitBlock* block)
+{
+    u32 entryOffset = JITCompiler->SubEntryOffset(block->EntryPoint);
+    fwrite(&block->Num, 1, 1, f);
+    fwrite(&block->StartAddr, 4, 1, f);
+    fwrite(&block->InstrHash, 4, 1, f);
+    fwrite(&block->LiteralHash, 4, 1, f);
+    fwrite(&entryOffset, 4, 1, f);
+    fwrite(&block->NumAddresses, 2, 1, f);
+    fwrite(&block->NumLiterals, 2, 1, f);
+    fwrite(block->AddressRanges(), 4, block->NumAddresses * 2 + block->NumLiterals, f);
+    fwrite(&block->NumExits, 1, 1, f);
+    fwrite(block->Exits, sizeof(BlockExit), block->NumExits, f);
+}
+
+void SavePersistentCache()
+{
+    if (!PersistentCacheActive)
+        return;
+
+    if (AsyncCompileActive)
+    {
+        SyncCompileThread();
+        PublishCompiledBlocks();
+    }
+
+    // blocks are restored by their instruction hash
+    // so there's no point in keeping more than one per hash
+    std::unordered_map<u32, JitBlock*> blocks = RestoreCandidates;
+    for (auto it : JitBlocks9)
+        if (it.second->EntryPoint)
+            blocks[it.second->InstrHash] = it.second;
+    for (auto it : JitBlocks7)
+        if (it.second->EntryPoint)
+            blocks[it.second->InstrHash] = it.second;
+
+    char name[64];
+    GetPersistentCacheName(name);
+
+    FILE* f = Platform::OpenLocalFile(name, "wb");
+    if (!f)
+    {
+        printf("Failed to write JIT cache %s\n", name);
+        return;
+    }
+
+    PersistentCacheHeader header = PersistentCacheKey;
+    header.NumBlocks = blocks.size();
+    fwrite(&header, sizeof(header), 1, f);
+
+    for (auto it : blocks)
+        WritePersistentBlock(f, it.second);
+
+    if (!JITCompiler->SaveImage(f))
+    {
+        // don't leave something behind which looks valid
+        fseek(f, 0, SEEK_SET);
+        u32 zero = 0;
+        fwrite(&zero, 4, 1, f);
+    }
+    else
+        printf("Saved %d blocks to JIT cache %s\n", header.NumBlocks, name);
+
+    fclose(f);
 }
 
 }
@@ -22,11 +22,25 @@ void InvalidateByAddr(u32 pseudoPhysical);
 
 template <u32 num, int region>
 void CheckAndInvalidate(u32 addr);
+// same for every address in [addr, addr+len), which must not cross
+// a change of mapping
+void CheckAndInvalidateRange(u32 num, int region, u32 addr, u32 len);
 
 void CompileBlock(ARM* cpu);
 
+// undoes the links into [start, end), before that range gets remapped
+void UnlinkExitsInRange(u32 num, u32 start, u32 end);
+
+// waits until the compile thread is through with all queued blocks
+// has to be called before anything the compiler looks at changes,
+// that is the memory map and the access timings
+void SyncCompileThread();
+
 void ResetBlockCache();
 
+void LoadPersistentCache();
+void SavePersistentCache();
+
 JitBlockEntry LookUpBlock(u32 num, u64* entries, u32 offset, u32 addr);
 bool SetupExecutableRegion(u32 num, u32 blockAddr, u64*& entry, u32& start, u32& size);
 
@@ -449,12 +449,12 @@ void Compiler::LoadReg(int reg, ARM64Reg nativeReg)
     if (reg == 15)
         MOVI2R(nativeReg, R15);
     else
-        LDR(INDEX_UNSIGNED, nativeReg, RCPU, offsetof(ARM, R[reg]));
+        LDR(INDEX_UNSIGNED, nativeReg, RCPU, offsetof(ARM, R) + reg*4);
 }
 
 void Compiler::SaveReg(int reg, ARM64Reg nativeReg)
 {
-    STR(INDEX_UNSIGNED, nativeReg, RCPU, offsetof(ARM, R[reg]));
+    STR(INDEX_UNSIGNED, nativeReg, RCPU, offsetof(ARM, R) + reg*4);
 }
 
 void Compiler::LoadCPSR()
@@ -639,18 +639,25 @@ void Compiler::Comp_BranchSpecialBehaviour(bool taken)
     }
 }
 
-JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount)
+bool Compiler::CodeMemoryFull()
 {
     if (JitMemMainSize - GetCodeOffset() < 1024 * 16)
     {
         printf("JIT near memory full, resetting...\n");
-        ResetBlockCache();
+        return true;
     }
     if ((JitMemMainSize +  JitMemSecondarySize) - OtherCodeRegion < 1024 * 8)
     {
         printf("JIT far memory full, resetting...\n");
-        ResetBlockCache();
+        return true;
     }
+    return false;
+}
+
+JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount)
+{
+    if (CodeMemoryFull())
+        ResetBlockCache();
 
     JitBlockEntry res = (JitBlockEntry)GetRXPtr();
 
@@ -796,6 +803,23 @@ void Compiler::Reset()
         *(((u32*)GetRWPtr()) + i) = brk_0;
 }
 
+// TODO: the generated code still contains absolute addresses
+// (MOVP2R and friends), so it can't be put into the persistent cache yet
+u64 Compiler::GetImageFingerprint()
+{
+    return 0;
+}
+
+bool Compiler::SaveImage(FILE* file)
+{
+    return false;
+}
+
+bool Compiler::LoadImage(FILE* file)
+{
+    return false;
+}
+
 void Compiler::Comp_AddCycles_C(bool forceNonConstant)
 {
     s32 cycles = Num ?
@@ -90,8 +90,25 @@ public:
         return RegCache.Mapping[reg];
     }
 
+    bool CodeMemoryFull();
+
     JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount);
 
+    // this backend reads the CPU state while compiling and W^X is switched
+    // per thread, so it can only compile on the emu thread. UpdateAsyncCompile()
+    // checks this and keeps compiling synchronously even with JIT_AsyncCompile on
+    bool SupportsAsyncCompile()
+    { return false; }
+    void PublishLoadStorePatches()
+    {}
+
+    // this backend doesn't record any block exits (NumExits stays 0), every
+    // block returns to the dispatcher, so these are never called
+    void LinkBlockExit(u32 patchOffset, JitBlockEntry target)
+    {}
+    void UnlinkBlockExit(u32 patchOffset)
+    {}
+
     bool CanCompile(bool thumb, u16 kind);
 
     bool FlagsNZNeeded()
@@ -217,6 +234,10 @@ public:
     bool IsJITFault(u8* pc);
     u8* RewriteMemAccess(u8* pc);
 
+    u64 GetImageFingerprint();
+    bool SaveImage(FILE* file);
+    bool LoadImage(FILE* file);
+
     void SwapCodeRegion()
     {
         ptrdiff_t offset = GetCodeOffset();
@@ -248,6 +269,11 @@ public:
 
     std::unordered_map<ptrdiff_t, LoadStorePatch> LoadStorePatches; 
 
+    bool CompilingAsync = false;
+
+    int NumExits = 0;
+    BlockExit Exits[MaxBlockExits];
+
     // [Console Type][Num][Size][Sign Extend][Output register]
     void* PatchedLoadFuncs[2][2][3][2][8];
     void* PatchedStoreFuncs[2][2][3][8];
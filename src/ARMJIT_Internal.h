@@ -48,6 +48,12 @@ struct FetchedInstr
     u16 CodeCycles;
     u32 DataRegion;
 
+    // the literal this instruction loads as read when the block was fetched
+    // only filled in when blocks are compiled in the background
+    bool LiteralFetched;
+    u32 LiteralAddr;
+    u32 LiteralValue;
+
     ARMInstrInfo::Info Info;
 };
 
@@ -153,6 +159,18 @@ struct __attribute__((packed)) TinyVector
     }
 };
 
+// a jump at the end of a block which can be patched
+// to go straight to the block following it
+struct BlockExit
+{
+    // start address of the following block
+    u32 Target;
+    // the end of the jump instruction, relative to the start of the code area
+    u32 PatchOffset;
+};
+
+const int MaxBlockExits = 2;
+
 class JitBlock
 {
 public:
@@ -173,6 +191,9 @@ public:
 
     JitBlockEntry EntryPoint;
 
+    u8 NumExits = 0;
+    BlockExit Exits[MaxBlockExits];
+
     u32* AddressRanges()
     { return &Data[0]; }
     u32* AddressMasks()
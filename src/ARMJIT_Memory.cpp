@@ -436,6 +436,8 @@ void SetCodeProtection(int region, u32 offset, bool protect)
 
 void RemapDTCM(u32 newBase, u32 newSize)
 {
+    ARMJIT::SyncCompileThread();
+
     // this first part could be made more efficient
     // by unmapping DTCM first and then map the holes
     u32 oldDTCMBase = NDS::ARM9->DTCMBase;
@@ -443,6 +445,12 @@ void RemapDTCM(u32 newBase, u32 newSize)
 
     u32 newEnd = newBase + newSize;
 
+    // DTCM can go over code which was linked to
+    if (NDS::ARM9->DTCMSize > 0)
+        ARMJIT::UnlinkExitsInRange(0, oldDTCMBase, oldDTCBEnd);
+    if (newSize > 0)
+        ARMJIT::UnlinkExitsInRange(0, newBase, newEnd);
+
     printf("remapping DTCM %x %x %x %x\n", newBase, newEnd, oldDTCMBase, oldDTCBEnd);
     // unmap all regions containing the old or the current DTCM mapping
     for (int region = 0; region < memregions_Count; region++)
@@ -483,6 +491,10 @@ void RemapDTCM(u32 newBase, u32 newSize)
 
 void RemapNWRAM(int num)
 {
+    ARMJIT::SyncCompileThread();
+    // the ARM7 windows can go over ARM7 WRAM
+    ARMJIT::UnlinkExitsInRange(1, 0x03000000, 0x04000000);
+
     for (int i = 0; i < Mappings[memregion_SharedWRAM].Length;)
     {
         Mapping& mapping = Mappings[memregion_SharedWRAM][i];
@@ -506,6 +518,10 @@ void RemapNWRAM(int num)
 
 void RemapSWRAM()
 {
+    ARMJIT::SyncCompileThread();
+    // where the shared WRAM isn't mapped for the ARM7, ARM7 WRAM is mirrored
+    ARMJIT::UnlinkExitsInRange(1, 0x03000000, 0x03800000);
+
     printf("remapping SWRAM\n");
     for (int i = 0; i < Mappings[memregion_WRAM7].Length;)
     {
@@ -7,11 +7,20 @@
 
 #include "../dolphin/CommonFuncs.h"
 
+#define XXH_STATIC_LINKING_ONLY
+#include "../xxhash/xxhash.h"
+
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <sys/mman.h>
 #include <unistd.h>
+#ifdef __APPLE__
+#include <dlfcn.h>
+#include <mach-o/getsect.h>
+#else
+#include <link.h>
+#endif
 #endif
 
 using namespace Gen;
@@ -225,6 +234,7 @@ Compiler::Compiler()
         mprotect(pageAligned, alignedSize, PROT_EXEC | PROT_READ | PROT_WRITE);
     #endif
 
+        CodeMemStart = pageAligned;
         ResetStart = pageAligned;
         CodeMemSize = alignedSize;
     }
@@ -423,6 +433,13 @@ Compiler::Compiler()
 
     NearSize = FarStart - ResetStart;
     FarSize = (ResetStart + CodeMemSize) - FarStart;
+
+    PendingPatchesLock = Platform::Mutex_Create();
+}
+
+Compiler::~Compiler()
+{
+    Platform::Mutex_Free(PendingPatchesLock);
 }
 
 void Compiler::LoadCPSR()
@@ -445,14 +462,14 @@ void Compiler::SaveCPSR(bool flagClean)
 void Compiler::LoadReg(int reg, X64Reg nativeReg)
 {
     if (reg != 15)
-        MOV(32, R(nativeReg), MDisp(RCPU, offsetof(ARM, R[reg])));
+        MOV(32, R(nativeReg), MDisp(RCPU, offsetof(ARM, R) + reg*4));
     else
         MOV(32, R(nativeReg), Imm32(R15));
 }
 
 void Compiler::SaveReg(int reg, X64Reg nativeReg)
 {
-    MOV(32, MDisp(RCPU, offsetof(ARM, R[reg])), R(nativeReg));
+    MOV(32, MDisp(RCPU, offsetof(ARM, R) + reg*4), R(nativeReg));
 }
 
 // invalidates RSCRATCH and RSCRATCH3
@@ -615,6 +632,22 @@ void Compiler::Reset()
     FarCode = FarStart;
 
     LoadStorePatches.clear();
+    PendingLoadStorePatches.clear();
+}
+
+bool Compiler::CodeMemoryFull()
+{
+    if (NearSize - (GetCodePtr() - NearStart) < 1024 * 32) // guess...
+    {
+        printf("near reset\n");
+        return true;
+    }
+    if (FarSize - (FarCode - FarStart) < 1024 * 32) // guess...
+    {
+        printf("far reset\n");
+        return true;
+    }
+    return false;
 }
 
 bool Compiler::IsJITFault(u8* addr)
@@ -622,6 +655,173 @@ bool Compiler::IsJITFault(u8* addr)
     return (u64)addr >= (u64)ResetStart && (u64)addr < (u64)ResetStart + CodeMemSize;
 }
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+struct TextHashContext
+{
+    void* Addr;
+    u64 Hash;
+};
+
+int HashTextSegments(dl_phdr_info* info, size_t size, void* data)
+{
+    TextHashContext* ctx = (TextHashContext*)data;
+
+    bool ours = false;
+    for (int i = 0; i < info->dlpi_phnum; i++)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        u64 start = info->dlpi_addr + phdr.p_vaddr;
+        if (phdr.p_type == PT_LOAD && (u64)ctx->Addr >= start && (u64)ctx->Addr < start + phdr.p_memsz)
+            ours = true;
+    }
+    if (!ours)
+        return 0;
+
+    for (int i = 0; i < info->dlpi_phnum; i++)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X))
+            ctx->Hash = XXH3_64bits_withSeed((void*)(info->dlpi_addr + phdr.p_vaddr), phdr.p_filesz, ctx->Hash);
+    }
+    return 1;
+}
+#endif
+
+// hash of the code of the module we're in, 0 if it can't be found
+u64 GetTextHash()
+{
+    void* addr = (void*)&ARM_Ret;
+    u64 hash = 0;
+
+#if defined(_WIN32)
+    HMODULE module;
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            (LPCSTR)addr, &module))
+        return 0;
+
+    u8* base = (u8*)module;
+    IMAGE_NT_HEADERS* nt = (IMAGE_NT_HEADERS*)(base + ((IMAGE_DOS_HEADER*)base)->e_lfanew);
+    IMAGE_SECTION_HEADER* section = IMAGE_FIRST_SECTION(nt);
+    for (int i = 0; i < nt->FileHeader.NumberOfSections; i++)
+    {
+        if (section[i].Characteristics & IMAGE_SCN_MEM_EXECUTE)
+        {
+            u32 size = section[i].Misc.VirtualSize;
+            if (size > section[i].SizeOfRawData) size = section[i].SizeOfRawData;
+            hash = XXH3_64bits_withSeed(base + section[i].VirtualAddress, size, hash);
+        }
+    }
+#elif defined(__APPLE__)
+    Dl_info info;
+    if (!dladdr(addr, &info) || !info.dli_fbase)
+        return 0;
+
+    unsigned long size;
+    u8* text = getsectiondata((const struct mach_header_64*)info.dli_fbase, "__TEXT", "__text", &size);
+    if (!text)
+        return 0;
+    hash = XXH3_64bits(text, size);
+#else
+    TextHashContext ctx = {addr, 0};
+    if (!dl_iterate_phdr(HashTextSegments, &ctx))
+        return 0;
+    hash = ctx.Hash;
+#endif
+
+    return hash;
+}
+
+/*
+    Saved code is only ever put back at the very same offset inside CodeMemory.
+    Blocks reach into the executable via rel32 calls (to the interpreter, IO
+    handlers and so on) and RIP relative loads, so this only works with the very
+    same binary. The fingerprint therefore covers all of the executable's code,
+    along with the functions generated in the constructor and the distance to
+    the assembly glue. If the code can't be found, the cache isn't used.
+*/
+u64 Compiler::GetImageFingerprint()
+{
+    u64 texthash = GetTextHash();
+    if (texthash == 0)
+        return 0;
+
+    u64 hash = XXH3_64bits_withSeed(CodeMemStart, ResetStart - CodeMemStart, texthash);
+    hash ^= (u64)((u8*)&ARM_Ret - ResetStart);
+    return hash ? hash : 1;
+}
+
+bool Compiler::SaveImage(FILE* file)
+{
+    u32 nearSize = GetWritableCodePtr() - NearStart;
+    u32 farSize = FarCode - FarStart;
+    u32 numPatches = LoadStorePatches.size();
+
+    fwrite(&nearSize, 4, 1, file);
+    fwrite(&farSize, 4, 1, file);
+    fwrite(&numPatches, 4, 1, file);
+
+    for (auto it : LoadStorePatches)
+    {
+        SavedLoadStorePatch patch;
+        patch.Addr = it.first - ResetStart;
+        patch.PatchFunc = (u8*)it.second.PatchFunc - ResetStart;
+        patch.Offset = it.second.Offset;
+        patch.Size = it.second.Size;
+        fwrite(&patch, sizeof(patch), 1, file);
+    }
+
+    fwrite(NearStart, nearSize, 1, file);
+    fwrite(FarStart, farSize, 1, file);
+
+    return true;
+}
+
+bool Compiler::LoadImage(FILE* file)
+{
+    if (GetWritableCodePtr() != NearStart || FarCode != FarStart)
+        return false;
+
+    u32 nearSize, farSize, numPatches;
+    if (fread(&nearSize, 4, 1, file) != 1
+        || fread(&farSize, 4, 1, file) != 1
+        || fread(&numPatches, 4, 1, file) != 1)
+        return false;
+
+    // leave enough space to compile new blocks
+    // otherwise we'd end up reloading the image over and over again
+    if (nearSize > NearSize / 2 || farSize > FarSize / 2)
+        return false;
+
+    for (u32 i = 0; i < numPatches; i++)
+    {
+        SavedLoadStorePatch saved;
+        if (fread(&saved, sizeof(saved), 1, file) != 1 || saved.Addr >= CodeMemSize)
+        {
+            Reset();
+            return false;
+        }
+
+        LoadStorePatch patch;
+        patch.PatchFunc = ResetStart + saved.PatchFunc;
+        patch.Offset = saved.Offset;
+        patch.Size = saved.Size;
+        LoadStorePatches[ResetStart + saved.Addr] = patch;
+    }
+
+    if (fread(NearStart, 1, nearSize, file) != nearSize
+        || fread(FarStart, 1, farSize, file) != farSize)
+    {
+        Reset();
+        return false;
+    }
+
+    SetCodePtr(NearStart + nearSize);
+    NearCode = NearStart + nearSize;
+    FarCode = FarStart + farSize;
+
+    return true;
+}
+
 void Compiler::Comp_SpecialBranchBehaviour(bool taken)
 {
     if (taken && CurInstr.BranchFlags & branch_IdleBranch)
@@ -637,19 +837,90 @@ void Compiler::Comp_SpecialBranchBehaviour(bool taken)
     }
 }
 
-JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount)
+void Compiler::AddBlockExit(u32 newPC, u32 target)
 {
-    if (NearSize - (GetCodePtr() - NearStart) < 1024 * 32) // guess...
+    for (int i = 0; i < NumExits; i++)
     {
-        printf("near reset\n");
-        ResetBlockCache();
+        if (ExitPCs[i] == newPC)
+            return;
     }
-    if (FarSize - (FarCode - FarStart) < 1024 * 32) // guess...
+    if (NumExits == MaxBlockExits)
+        return;
+
+    ExitPCs[NumExits] = newPC;
+    Exits[NumExits].Target = target;
+    NumExits++;
+}
+
+/*
+    If the block ends with a known PC it can continue with the following block
+    directly, if there is one. Until then (or when it's unlinked again) the jump
+    to it points just after itself and the block returns to the dispatcher.
+
+    Before that it has to do whatever the dispatcher loop would do between blocks.
+*/
+void Compiler::Comp_ExitBlock()
+{
+    ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm32(ConstantCycles));
+
+    if (NumExits == 0)
     {
-        printf("far reset\n");
-        ResetBlockCache();
+        JMP((u8*)ARM_Ret, true);
+        return;
+    }
+
+    // the next block expects to find the CPSR in memory
+    MOV(32, MDisp(RCPU, offsetof(ARM, CPSR)), R(RCPSR));
+
+    CMP(32, MDisp(RCPU, offsetof(ARM, StopExecution)), Imm8(0));
+    FixupBranch stopExecution = J_CC(CC_NZ, true);
+
+    u64* timestamp = Num == 0 ? &NDS::ARM9Timestamp : &NDS::ARM7Timestamp;
+    u64* target = Num == 0 ? &NDS::ARM9Target : &NDS::ARM7Target;
+    MOVSX(64, 32, RSCRATCH, MDisp(RCPU, offsetof(ARM, Cycles)));
+    ADD(64, R(RSCRATCH), M(timestamp));
+    MOV(64, M(timestamp), R(RSCRATCH));
+    MOV(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm32(0));
+    CMP(64, R(RSCRATCH), M(target));
+    FixupBranch outOfCycles = J_CC(CC_AE, true);
+
+    for (int i = 0; i < NumExits; i++)
+    {
+        // an interpreted instruction might have gone elsewhere
+        // or it's one of the two ways of a conditional branch
+        CMP(32, MDisp(RCPU, offsetof(ARM, R[15])), Imm32(ExitPCs[i]));
+        FixupBranch otherExit = J_CC(CC_NE, true);
+
+        FixupBranch link = J(true);
+        SetJumpTarget(link);
+        Exits[i].PatchOffset = GetWritableCodePtr() - ResetStart;
+        JMP((u8*)ARM_Ret, true);
+
+        SetJumpTarget(otherExit);
     }
 
+    SetJumpTarget(stopExecution);
+    SetJumpTarget(outOfCycles);
+    JMP((u8*)ARM_Ret, true);
+}
+
+void Compiler::LinkBlockExit(u32 patchOffset, JitBlockEntry target)
+{
+    u8* jumpEnd = ResetStart + patchOffset;
+    *(s32*)(jumpEnd - 4) = (s32)((u8*)target - jumpEnd);
+}
+
+void Compiler::UnlinkBlockExit(u32 patchOffset)
+{
+    *(s32*)(ResetStart + patchOffset - 4) = 0;
+}
+
+JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount)
+{
+    // the compile thread checks this itself before it gets here
+    if (!CompilingAsync && CodeMemoryFull())
+        ResetBlockCache();
+
     ConstantCycles = 0;
     Thumb = thumb;
     Num = cpu->Num;
@@ -657,6 +928,7 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
     CurCPU = cpu;
     // CPSR might have been modified in a previous block
     CPSRDirty = false;
+    NumExits = 0;
 
     JitBlockEntry res = (JitBlockEntry)GetWritableCodePtr();
 
@@ -678,6 +950,8 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
         if (comp == NULL || (CurInstr.BranchFlags & branch_FollowCondTaken) || (i == instrsCount - 1 && (!CurInstr.Info.Branches() || isConditional)))
         {
             MOV(32, MDisp(RCPU, offsetof(ARM, R[15])), Imm32(R15));
+            if (i == instrsCount - 1 && (!CurInstr.Info.Branches() || isConditional))
+                AddBlockExit(R15, R15 - (Thumb ? 2 : 4));
             if (comp == NULL)
             {
                 MOV(32, MDisp(RCPU, offsetof(ARM, CodeCycles)), Imm32(CurInstr.CodeCycles));
@@ -765,8 +1039,7 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
 
     RegCache.Flush();
 
-    ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm32(ConstantCycles));
-    JMP((u8*)ARM_Ret, true);
+    Comp_ExitBlock();
 
     /*FILE* codeout = fopen("codeout", "a");
     fprintf(codeout, "beginning block argargarg__ %x!!!", instrs[0].Addr);
@@ -6,6 +6,7 @@
 #include "../ARMJIT.h"
 #include "../ARMJIT_Internal.h"
 #include "../ARMJIT_RegisterCache.h"
+#include "../Platform.h"
 
 #include <unordered_map>
 
@@ -27,6 +28,16 @@ struct LoadStorePatch
     u16 Size;
 };
 
+// how a LoadStorePatch is stored in the persistent code cache
+// everything is relative to the start of the block code area
+struct __attribute__((packed)) SavedLoadStorePatch
+{
+    u32 Addr;
+    s32 PatchFunc;
+    s16 Offset;
+    u16 Size;
+};
+
 struct Op2
 {
     Op2()
@@ -58,11 +69,17 @@ class Compiler : public Gen::XEmitter
 {
 public:
     Compiler();
+    ~Compiler();
 
     void Reset();
 
+    bool CodeMemoryFull();
+
     JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount);
 
+    bool SupportsAsyncCompile()
+    { return true; }
+
     void LoadReg(int reg, Gen::X64Reg nativeReg);
     void SaveReg(int reg, Gen::X64Reg nativeReg);
 
@@ -160,6 +177,9 @@ public:
 
     void Comp_SpecialBranchBehaviour(bool taken);
 
+    void AddBlockExit(u32 newPC, u32 target);
+    void Comp_ExitBlock();
+
 
     Gen::OpArg Comp_RegShiftImm(int op, int amount, Gen::OpArg rm, bool S, bool& carryUsed);
     Gen::OpArg Comp_RegShiftReg(int op, Gen::OpArg rs, Gen::OpArg rm, bool S, bool& carryUsed);
@@ -212,6 +232,16 @@ public:
 
     u8* RewriteMemAccess(u8* pc);
 
+    void LinkBlockExit(u32 patchOffset, JitBlockEntry target);
+    void UnlinkBlockExit(u32 patchOffset);
+
+    void AddLoadStorePatch(u8* location, const LoadStorePatch& patch);
+    void PublishLoadStorePatches();
+
+    u64 GetImageFingerprint();
+    bool SaveImage(FILE* file);
+    bool LoadImage(FILE* file);
+
     u8* FarCode;
     u8* NearCode;
     u32 FarSize;
@@ -225,12 +255,25 @@ public:
 
     std::unordered_map<u8*, LoadStorePatch> LoadStorePatches;
 
+    // when compiling on the compile thread, the fault handler mustn't
+    // see the patches before the emulation thread publishes them
+    bool CompilingAsync = false;
+    std::unordered_map<u8*, LoadStorePatch> PendingLoadStorePatches;
+    Platform::Mutex* PendingPatchesLock;
+
+    u8* CodeMemStart;
     u8* ResetStart;
     u32 CodeMemSize;
 
     bool Exit;
     bool IrregularCycles;
 
+    // the places the last compiled block might continue at
+    // which are known in advance
+    int NumExits;
+    u32 ExitPCs[MaxBlockExits];
+    BlockExit Exits[MaxBlockExits];
+
     void* ReadBanked;
     void* WriteBanked;
 
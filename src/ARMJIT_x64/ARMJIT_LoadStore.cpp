@@ -39,6 +39,28 @@ u8* Compiler::RewriteMemAccess(u8* pc)
     abort();
 }
 
+void Compiler::AddLoadStorePatch(u8* location, const LoadStorePatch& patch)
+{
+    if (CompilingAsync)
+    {
+        Platform::Mutex_Lock(PendingPatchesLock);
+        PendingLoadStorePatches[location] = patch;
+        Platform::Mutex_Unlock(PendingPatchesLock);
+    }
+    else
+        LoadStorePatches[location] = patch;
+}
+
+// called from the emulation thread before blocks compiled
+// on the compile thread become reachable
+void Compiler::PublishLoadStorePatches()
+{
+    Platform::Mutex_Lock(PendingPatchesLock);
+    LoadStorePatches.insert(PendingLoadStorePatches.begin(), PendingLoadStorePatches.end());
+    PendingLoadStorePatches.clear();
+    Platform::Mutex_Unlock(PendingPatchesLock);
+}
+
 /*
     According to DeSmuME and my own research, approx. 99% (seriously, that's an empirical number)
     of all memory load and store instructions always access addresses in the same region as
@@ -51,39 +73,67 @@ u8* Compiler::RewriteMemAccess(u8* pc)
 
 bool Compiler::Comp_MemLoadLiteral(int size, bool signExtend, int rd, u32 addr)
 {
-    u32 localAddr = LocaliseCodeAddress(Num, addr);
-
-    int invalidLiteralIdx = InvalidLiterals.Find(localAddr);
-    if (invalidLiteralIdx != -1)
-    {
-        InvalidLiterals.Remove(invalidLiteralIdx);
-        return false;
-    }
-
-    Comp_AddCycles_CDI();
-
     u32 val;
-    // make sure arm7 bios is accessible
-    u32 tmpR15 = CurCPU->R[15];
-    CurCPU->R[15] = R15;
-    if (size == 32)
-    {
-        CurCPU->DataRead32(addr & ~0x3, &val);
-        val = ::ROR(val, (addr & 0x3) << 3);
-    }
-    else if (size == 16)
+    if (CompilingAsync)
     {
-        CurCPU->DataRead16(addr & ~0x1, &val);
-        if (signExtend)
-            val = ((s32)val << 16) >> 16;
+        // we can't touch the memory from the compile thread,
+        // so use what was read when the block was fetched
+        if (!CurInstr.LiteralFetched || (CurInstr.LiteralAddr & ~0x3) != (addr & ~0x3))
+            return false;
+
+        val = CurInstr.LiteralValue;
+        if (size == 32)
+        {
+            val = ::ROR(val, (addr & 0x3) << 3);
+        }
+        else if (size == 16)
+        {
+            val = (val >> ((addr & 0x2) << 3)) & 0xFFFF;
+            if (signExtend)
+                val = ((s32)val << 16) >> 16;
+        }
+        else
+        {
+            val = (val >> ((addr & 0x3) << 3)) & 0xFF;
+            if (signExtend)
+                val = ((s32)val << 24) >> 24;
+        }
     }
     else
     {
-        CurCPU->DataRead8(addr, &val);
-        if (signExtend)
-            val = ((s32)val << 24) >> 24;
+        u32 localAddr = LocaliseCodeAddress(Num, addr);
+
+        int invalidLiteralIdx = InvalidLiterals.Find(localAddr);
+        if (invalidLiteralIdx != -1)
+        {
+            InvalidLiterals.Remove(invalidLiteralIdx);
+            return false;
+        }
+
+        // make sure arm7 bios is accessible
+        u32 tmpR15 = CurCPU->R[15];
+        CurCPU->R[15] = R15;
+        if (size == 32)
+        {
+            CurCPU->DataRead32(addr & ~0x3, &val);
+            val = ::ROR(val, (addr & 0x3) << 3);
+        }
+        else if (size == 16)
+        {
+            CurCPU->DataRead16(addr & ~0x1, &val);
+            if (signExtend)
+                val = ((s32)val << 16) >> 16;
+        }
+        else
+        {
+            CurCPU->DataRead8(addr, &val);
+            if (signExtend)
+                val = ((s32)val << 24) >> 24;
+        }
+        CurCPU->R[15] = tmpR15;
     }
-    CurCPU->R[15] = tmpR15;
+
+    Comp_AddCycles_CDI();
 
     MOV(32, MapReg(rd), Imm32(val));
 
@@ -195,7 +245,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
 
         assert(patch.PatchFunc != NULL);
 
-        MOV(64, R(RSCRATCH), ImmPtr(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start));
+        MOV(64, R(RSCRATCH), M(Num == 0 ? &ARMJIT_Memory::FastMem9Start : &ARMJIT_Memory::FastMem7Start));
 
         X64Reg maskedAddr = RSCRATCH3;
         if (size > 8)
@@ -238,7 +288,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
 
         assert(patch.Size >= 5);
 
-        LoadStorePatches[memopLoadStoreLocation] = patch;
+        AddLoadStorePatch(memopLoadStoreLocation, patch);
     }
     else
     {
@@ -429,7 +479,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         u8* fastPathStart = GetWritableCodePtr();
         u8* loadStoreAddr[16];
 
-        MOV(64, R(RSCRATCH2), ImmPtr(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start));
+        MOV(64, R(RSCRATCH2), M(Num == 0 ? &ARMJIT_Memory::FastMem9Start : &ARMJIT_Memory::FastMem7Start));
         ADD(64, R(RSCRATCH2), R(RSCRATCH4));
 
         u32 offset = 0;
@@ -476,7 +526,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         for (i = 0; i < regsCount; i++)
         {
             patch.Offset = fastPathStart - loadStoreAddr[i];
-            LoadStorePatches[loadStoreAddr[i]] = patch;
+            AddLoadStorePatch(loadStoreAddr[i], patch);
         }
     }
 
@@ -127,16 +127,29 @@ void ARMv5::UpdateDTCMSetting()
 
 void ARMv5::UpdateITCMSetting()
 {
+    u32 newITCMSize;
     if (CP15Control & (1<<18))
     {
-        ITCMSize = 0x200 << ((ITCMSetting >> 1) & 0x1F);
-        //printf("ITCM [%08X] enabled at %08X, size %X\n", ITCMSetting, 0, ITCMSize);
+        newITCMSize = 0x200 << ((ITCMSetting >> 1) & 0x1F);
+        //printf("ITCM [%08X] enabled at %08X, size %X\n", ITCMSetting, 0, newITCMSize);
     }
     else
     {
-        ITCMSize = 0;
+        newITCMSize = 0;
         //printf("ITCM disabled\n");
     }
+    if (newITCMSize != ITCMSize)
+    {
+#ifdef JIT_ENABLED
+        ARMJIT::SyncCompileThread();
+        // whatever is between the old and the new end changes mapping
+        if (newITCMSize < ITCMSize)
+            ARMJIT::UnlinkExitsInRange(0, newITCMSize, ITCMSize);
+        else
+            ARMJIT::UnlinkExitsInRange(0, ITCMSize, newITCMSize);
+#endif
+        ITCMSize = newITCMSize;
+    }
 }
 
 
@@ -271,6 +284,10 @@ void ARMv5::UpdatePURegions(bool update_all)
 
 void ARMv5::UpdateRegionTimings(u32 addrstart, u32 addrend)
 {
+#ifdef JIT_ENABLED
+    ARMJIT::SyncCompileThread();
+#endif
+
     addrstart >>= 12;
     addrend   >>= 12;
 
@@ -767,6 +784,17 @@ u32 ARMv5::CodeRead32(u32 addr, bool branch)
     return BusRead32(addr);
 }
 
+s32 ARMv5::CodeFetchCycles(u32 addr, bool branch, s32 regionCodeCycles)
+{
+    if (addr < ITCMSize)
+        return 1;
+
+    if (regionCodeCycles == 0xFF)
+        return (branch || !(addr & 0x1F)) ? kCodeCacheTiming : 1;
+
+    return regionCodeCycles;
+}
+
 
 void ARMv5::DataRead8(u32 addr, u32* val)
 {
@@ -785,7 +813,8 @@ void ARMv5::DataRead8(u32 addr, u32* val)
         return;
     }
 
-    *val = BusRead8(addr);
+    u8* page = GetReadPage(addr);
+    *val = page ? *(u8*)&page[addr & 0xFFF] : BusRead8(addr);
     DataCycles = MemTimings[addr >> 12][1];
 }
 
@@ -808,7 +837,8 @@ void ARMv5::DataRead16(u32 addr, u32* val)
         return;
     }
 
-    *val = BusRead16(addr);
+    u8* page = GetReadPage(addr);
+    *val = page ? *(u16*)&page[addr & 0xFFF] : BusRead16(addr);
     DataCycles = MemTimings[addr >> 12][1];
 }
 
@@ -831,7 +861,8 @@ void ARMv5::DataRead32(u32 addr, u32* val)
         return;
     }
 
-    *val = BusRead32(addr);
+    u8* page = GetReadPage(addr);
+    *val = page ? *(u32*)&page[addr & 0xFFF] : BusRead32(addr);
     DataCycles = MemTimings[addr >> 12][2];
 }
 
@@ -852,7 +883,8 @@ void ARMv5::DataRead32S(u32 addr, u32* val)
         return;
     }
 
-    *val = BusRead32(addr);
+    u8* page = GetReadPage(addr);
+    *val = page ? *(u32*)&page[addr & 0xFFF] : BusRead32(addr);
     DataCycles += MemTimings[addr >> 12][3];
 }
 
@@ -876,7 +908,9 @@ void ARMv5::DataWrite8(u32 addr, u8 val)
         return;
     }
 
-    BusWrite8(addr, val);
+    u8* page = GetWritePage(addr);
+    if (page) *(u8*)&page[addr & 0xFFF] = val;
+    else      BusWrite8(addr, val);
     DataCycles = MemTimings[addr >> 12][1];
 }
 
@@ -902,7 +936,9 @@ void ARMv5::DataWrite16(u32 addr, u16 val)
         return;
     }
 
-    BusWrite16(addr, val);
+    u8* page = GetWritePage(addr);
+    if (page) *(u16*)&page[addr & 0xFFF] = val;
+    else      BusWrite16(addr, val);
     DataCycles = MemTimings[addr >> 12][1];
 }
 
@@ -928,7 +964,9 @@ void ARMv5::DataWrite32(u32 addr, u32 val)
         return;
     }
 
-    BusWrite32(addr, val);
+    u8* page = GetWritePage(addr);
+    if (page) *(u32*)&page[addr & 0xFFF] = val;
+    else      BusWrite32(addr, val);
     DataCycles = MemTimings[addr >> 12][2];
 }
 
@@ -952,7 +990,9 @@ void ARMv5::DataWrite32S(u32 addr, u32 val)
         return;
     }
 
-    BusWrite32(addr, val);
+    u8* page = GetWritePage(addr);
+    if (page) *(u32*)&page[addr & 0xFFF] = val;
+    else      BusWrite32(addr, val);
     DataCycles += MemTimings[addr >> 12][3];
 }
 
@@ -20,8 +20,8 @@
 
 // http://www.codeproject.com/KB/recipes/crc32_large.aspx
 
-u32 crctable[256];
-bool tableinited = false;
+INSTANCE_LOCAL u32 crctable[256];
+INSTANCE_LOCAL bool tableinited = false;
 
 u32 _reflect(u32 refl, char ch)
 {
@@ -52,7 +52,8 @@ void _inittable()
     }
 }
 
-u32 CRC32(u8 *data, int len)
+// start is the CRC of the data preceding this block, for computing a CRC piece by piece
+u32 CRC32(u8 *data, int len, u32 start)
 {
     if (!tableinited)
     {
@@ -60,7 +61,7 @@ u32 CRC32(u8 *data, int len)
         tableinited = true;
     }
 
-	u32 crc = 0xFFFFFFFF;
+	u32 crc = start ^ 0xFFFFFFFF;
 
 	while (len--)
         crc = (crc >> 8) ^ crctable[(crc & 0xFF) ^ *data++];
@@ -43,12 +43,16 @@ char DSiSDPath[1024];
 
 int RandomizeMAC;
 
+int MapCartROM;
+
 #ifdef JIT_ENABLED
 int JIT_Enable = false;
 int JIT_MaxBlockSize = 32;
 int JIT_BranchOptimisations = true;
 int JIT_LiteralOptimisations = true;
 int JIT_FastMemory = true;
+int JIT_PersistentCache = false;
+int JIT_AsyncCompile = false;
 #endif
 
 ConfigEntry ConfigFile[] =
@@ -68,12 +72,16 @@ ConfigEntry ConfigFile[] =
 
     {"RandomizeMAC", 0, &RandomizeMAC, 0, NULL, 0},
 
+    {"MapCartROM", 0, &MapCartROM, 0, NULL, 0},
+
 #ifdef JIT_ENABLED
     {"JIT_Enable", 0, &JIT_Enable, 0, NULL, 0},
     {"JIT_MaxBlockSize", 0, &JIT_MaxBlockSize, 32, NULL, 0},
     {"JIT_BranchOptimisations", 0, &JIT_BranchOptimisations, 1, NULL, 0},
     {"JIT_LiteralOptimisations", 0, &JIT_LiteralOptimisations, 1, NULL, 0},
     {"JIT_FastMemory", 0, &JIT_FastMemory, 1, NULL, 0},
+    {"JIT_PersistentCache", 0, &JIT_PersistentCache, 0, NULL, 0},
+    {"JIT_AsyncCompile", 0, &JIT_AsyncCompile, 0, NULL, 0},
 #endif
 
     {"", -1, NULL, 0, NULL, 0}
@@ -57,12 +57,16 @@ extern char DSiSDPath[1024];
 
 extern int RandomizeMAC;
 
+extern int MapCartROM;
+
 #ifdef JIT_ENABLED
 extern int JIT_Enable;
 extern int JIT_MaxBlockSize;
 extern int JIT_BranchOptimisations;
 extern int JIT_LiteralOptimisations;
 extern int JIT_FastMemory;
+extern int JIT_PersistentCache;
+extern int JIT_AsyncCompile;
 #endif
 
 }
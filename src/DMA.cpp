@@ -17,10 +17,17 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "NDS.h"
 #include "DSi.h"
 #include "DMA.h"
 #include "GPU.h"
+#include "SPU.h"
+
+#ifdef JIT_ENABLED
+#include "ARMJIT.h"
+#include "ARMJIT_Memory.h"
+#endif
 
 
 
@@ -44,6 +51,143 @@
 // TODO: timings are nonseq when address is fixed/decrementing
 
 
+// DIRECT TRANSFERS
+//
+// most transfers are plain copies or fills between memory that has no side
+// effects: main RAM, WRAM, and VRAM pages that map to a single bank. when
+// both ends resolve to host memory, the units that fit before the CPU target
+// are moved with one memcpy/fill, and JIT invalidation is done for the whole
+// range at once. the timing is the same as for unit-by-unit transfers.
+
+enum
+{
+    DMAMem_MainRAM = 0,
+    DMAMem_SharedWRAM,
+    DMAMem_WRAM7,
+    DMAMem_VRAM,
+};
+
+struct DMADirectMem
+{
+    u8* Ptr;
+    u32 Len; // bytes until the mapping changes
+    int Type;
+};
+
+const s8 DMALCDCBank[0x40] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2,  3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 5, 6, 7, 7,  8, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1,  -1, -1, -1, -1, -1, -1, -1, -1
+};
+const u32 DMALCDCMask[9] = {0x1FFFF, 0x1FFFF, 0x1FFFF, 0x1FFFF, 0xFFFF, 0x3FFF, 0x3FFF, 0x7FFF, 0x3FFF};
+
+void DMASetDirect(DMADirectMem& mem, u8* base, u32 offset, u32 size, int type)
+{
+    mem.Ptr = &base[offset];
+    mem.Len = size - offset;
+    mem.Type = type;
+}
+
+template <int ConsoleType>
+bool DMAGetDirect9(u32 addr, DMADirectMem& mem)
+{
+    switch (addr & 0xFF000000)
+    {
+    case 0x02000000:
+        DMASetDirect(mem, NDS::MainRAM, addr & NDS::MainRAMMask, NDS::MainRAMMask+1, DMAMem_MainRAM);
+        return true;
+
+    case 0x03000000:
+        // the DSi maps its new WRAM over this, and gates VRAM access
+        if (ConsoleType == 1 || !NDS::SWRAM_ARM9.Mem) return false;
+        DMASetDirect(mem, NDS::SWRAM_ARM9.Mem, addr & NDS::SWRAM_ARM9.Mask, NDS::SWRAM_ARM9.Mask+1, DMAMem_SharedWRAM);
+        return true;
+
+    case 0x06000000:
+        if (ConsoleType == 1) return false;
+        {
+            u8* ptr;
+            switch (addr & 0x00E00000)
+            {
+            case 0x00000000: ptr = GPU::VRAMPtr_ABG[(addr >> 14) & 0x1F]; break;
+            case 0x00200000: ptr = GPU::VRAMPtr_BBG[(addr >> 14) & 0x7]; break;
+            case 0x00400000: ptr = GPU::VRAMPtr_AOBJ[(addr >> 14) & 0xF]; break;
+            case 0x00600000: ptr = GPU::VRAMPtr_BOBJ[(addr >> 14) & 0x7]; break;
+            default:
+                {
+                    int bank = DMALCDCBank[(addr >> 14) & 0x3F];
+                    if (bank < 0 || !(GPU::VRAMMap_LCDC & (1<<bank))) return false;
+                    ptr = &GPU::VRAM[bank][addr & DMALCDCMask[bank] & ~0x3FFF];
+                }
+                break;
+            }
+            if (!ptr) return false;
+
+            // only go as far as this 16K page, the next one can map elsewhere
+            DMASetDirect(mem, ptr, addr & 0x3FFF, 0x4000, DMAMem_VRAM);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+template <int ConsoleType>
+bool DMAGetDirect7(u32 addr, DMADirectMem& mem)
+{
+    switch (addr & 0xFF800000)
+    {
+    case 0x02000000:
+    case 0x02800000:
+        DMASetDirect(mem, NDS::MainRAM, addr & NDS::MainRAMMask, NDS::MainRAMMask+1, DMAMem_MainRAM);
+        return true;
+
+    case 0x03000000:
+        if (ConsoleType == 1) return false;
+        if (NDS::SWRAM_ARM7.Mem)
+            DMASetDirect(mem, NDS::SWRAM_ARM7.Mem, addr & NDS::SWRAM_ARM7.Mask, NDS::SWRAM_ARM7.Mask+1, DMAMem_SharedWRAM);
+        else
+            DMASetDirect(mem, NDS::ARM7WRAM, addr & (NDS::ARM7WRAMSize-1), NDS::ARM7WRAMSize, DMAMem_WRAM7);
+        return true;
+
+    case 0x03800000:
+        if (ConsoleType == 1) return false;
+        DMASetDirect(mem, NDS::ARM7WRAM, addr & (NDS::ARM7WRAMSize-1), NDS::ARM7WRAMSize, DMAMem_WRAM7);
+        return true;
+
+    case 0x06000000:
+    case 0x06800000:
+        if (ConsoleType == 1) return false;
+        switch (GPU::VRAMMap_ARM7[(addr >> 17) & 0x1])
+        {
+        case (1<<2): DMASetDirect(mem, GPU::VRAM_C, addr & 0x1FFFF, 0x20000, DMAMem_VRAM); return true;
+        case (1<<3): DMASetDirect(mem, GPU::VRAM_D, addr & 0x1FFFF, 0x20000, DMAMem_VRAM); return true;
+        }
+        return false;
+    }
+
+    return false;
+}
+
+#ifdef JIT_ENABLED
+void DMAInvalidateJIT(u32 cpu, int type, u32 addr, u32 len)
+{
+    int region;
+    switch (type)
+    {
+    case DMAMem_MainRAM: region = ARMJIT_Memory::memregion_MainRAM; break;
+    case DMAMem_SharedWRAM: region = ARMJIT_Memory::memregion_SharedWRAM; break;
+    case DMAMem_WRAM7: region = ARMJIT_Memory::memregion_WRAM7; break;
+    default: region = cpu ? ARMJIT_Memory::memregion_VWRAM : ARMJIT_Memory::memregion_VRAM; break;
+    }
+
+    ARMJIT::CheckAndInvalidateRange(cpu, region, addr, len);
+}
+#endif
+
+
 DMA::DMA(u32 cpu, u32 num)
 {
     CPU = cpu;
@@ -183,6 +327,122 @@ void DMA::Start()
     NDS::StopCPU(CPU, 1<<Num);
 }
 
+void DMA::SyncSPU(u64 timestamp)
+{
+    // the range the rest of this transfer writes to
+    u32 unitsize = (Cnt & (1<<26)) ? 4 : 2;
+    u32 len = (DstAddrInc == 0) ? unitsize : (IterCount * unitsize);
+    u32 start = ((s32)DstAddrInc < 0) ? (CurDstAddr + unitsize - len) : CurDstAddr;
+
+    // the ARM9 doesn't see the ARM7's WRAM, it can only reach sample data in main RAM
+    if (CPU == 0 && (start >> 24) != 0x02) return;
+
+    SPU::SyncMemoryWrite(start, len, timestamp);
+}
+
+template <int ConsoleType>
+bool DMA::RunDirect(u32 unitshift, s32 unitcycles)
+{
+    // decrementing and reloading addresses go through the regular path
+    if (DstAddrInc != 1) return false;
+    if (SrcAddrInc != 1 && SrcAddrInc != 0) return false;
+
+    u32 unitsize = 1 << unitshift;
+    if ((CurSrcAddr | CurDstAddr) & (unitsize-1)) return false;
+
+    DMADirectMem dst, src;
+    bool dstok = (CPU == 0) ? DMAGetDirect9<ConsoleType>(CurDstAddr, dst) : DMAGetDirect7<ConsoleType>(CurDstAddr, dst);
+    if (!dstok) return false;
+
+    u32 fillval = 0;
+    bool srcok;
+    if (SrcAddrInc == 0 && CPU == 0 && (CurSrcAddr & 0xFFFFFFF0) == 0x040000E0)
+    {
+        // DMA fill registers, they can't change during the transfer
+        if (unitshift == 1)
+            fillval = (ConsoleType == 1) ? DSi::ARM9Read16(CurSrcAddr) : NDS::ARM9Read16(CurSrcAddr);
+        else
+            fillval = (ConsoleType == 1) ? DSi::ARM9Read32(CurSrcAddr) : NDS::ARM9Read32(CurSrcAddr);
+        // there's no source memory: the length only limits incrementing
+        // sources, and the fill value is repeated for the whole transfer
+        src.Ptr = nullptr;
+        src.Len = 0;
+        src.Type = -1;
+        srcok = true;
+    }
+    else
+    {
+        srcok = (CPU == 0) ? DMAGetDirect9<ConsoleType>(CurSrcAddr, src) : DMAGetDirect7<ConsoleType>(CurSrcAddr, src);
+        if (!srcok) return false;
+
+        // DSi region locking hack, see DSi::ARM9Read32()
+        if (ConsoleType == 1 && CPU == 0 && CurSrcAddr <= 0x02FE71B0 && (0x02FE71B0 - CurSrcAddr) < src.Len)
+            src.Len = 0x02FE71B0 - CurSrcAddr;
+    }
+
+    u32 num = IterCount;
+    if (num > (dst.Len >> unitshift)) num = dst.Len >> unitshift;
+    if (SrcAddrInc)
+    {
+        if (num > (src.Len >> unitshift)) num = src.Len >> unitshift;
+
+        // copying forward onto itself repeats what was just written, so
+        // only copy as far as the data can't have been overwritten yet
+        if (dst.Ptr > src.Ptr && dst.Ptr < src.Ptr + (num << unitshift))
+            num = (dst.Ptr - src.Ptr) >> unitshift;
+    }
+
+    // the unit that reaches the target still gets transferred
+    u64 unitcost = (CPU == 0) ? ((u64)unitcycles << NDS::ARM9ClockShift) : (u64)unitcycles;
+    u64 timestamp = (CPU == 0) ? NDS::ARM9Timestamp : NDS::ARM7Timestamp;
+    u64 target = (CPU == 0) ? NDS::ARM9Target : NDS::ARM7Target;
+    u64 fit = (target - timestamp + unitcost - 1) / unitcost;
+    if (num > fit) num = fit;
+
+    if (num == 0) return false;
+
+    u32 len = num << unitshift;
+
+    if (CPU == 0 && (dst.Type == DMAMem_VRAM || src.Type == DMAMem_VRAM))
+    {
+        if (GPU::Pending2D) GPU::Sync2D();
+    }
+
+#ifdef JIT_ENABLED
+    DMAInvalidateJIT(CPU, dst.Type, CurDstAddr, len);
+#endif
+
+    if (SrcAddrInc)
+        memmove(dst.Ptr, src.Ptr, len);
+    else
+    {
+        if (src.Ptr)
+            fillval = (unitshift == 1) ? *(u16*)src.Ptr : *(u32*)src.Ptr;
+
+        if (unitshift == 1)
+        {
+            for (u32 i = 0; i < num; i++) ((u16*)dst.Ptr)[i] = fillval;
+        }
+        else
+        {
+            for (u32 i = 0; i < num; i++) ((u32*)dst.Ptr)[i] = fillval;
+        }
+    }
+
+    if (dst.Type == DMAMem_VRAM)
+        GPU::MarkVRAMRange(dst.Ptr, len);
+
+    if (CPU == 0) NDS::ARM9Timestamp += num * unitcost;
+    else          NDS::ARM7Timestamp += num * unitcost;
+
+    CurSrcAddr += (SrcAddrInc * num) << unitshift;
+    CurDstAddr += len;
+    IterCount -= num;
+    RemCount -= num;
+
+    return true;
+}
+
 template <int ConsoleType>
 void DMA::Run9()
 {
@@ -190,6 +450,11 @@ void DMA::Run9()
 
     Executing = true;
 
+    // the SPU can't mix ahead of the ARM7
+    u64 timestamp = NDS::ARM9Timestamp >> NDS::ARM9ClockShift;
+    if (timestamp > NDS::ARM7Timestamp) timestamp = NDS::ARM7Timestamp;
+    SyncSPU(timestamp);
+
     // add NS penalty for first accesses in burst
     bool burststart = (Running == 2);
     Running = 1;
@@ -219,6 +484,12 @@ void DMA::Run9()
 
         while (IterCount > 0 && !Stall)
         {
+            if (RunDirect<ConsoleType>(1, unitcycles))
+            {
+                if (NDS::ARM9Timestamp >= NDS::ARM9Target) break;
+                continue;
+            }
+
             NDS::ARM9Timestamp += (unitcycles << NDS::ARM9ClockShift);
 
             if (ConsoleType == 1)
@@ -258,6 +529,12 @@ void DMA::Run9()
 
         while (IterCount > 0 && !Stall)
         {
+            if (RunDirect<ConsoleType>(2, unitcycles))
+            {
+                if (NDS::ARM9Timestamp >= NDS::ARM9Target) break;
+                continue;
+            }
+
             NDS::ARM9Timestamp += (unitcycles << NDS::ARM9ClockShift);
 
             if (ConsoleType == 1)
@@ -309,6 +586,8 @@ void DMA::Run7()
 
     Executing = true;
 
+    SyncSPU(NDS::ARM7Timestamp);
+
     // add NS penalty for first accesses in burst
     bool burststart = (Running == 2);
     Running = 1;
@@ -338,6 +617,12 @@ void DMA::Run7()
 
         while (IterCount > 0 && !Stall)
         {
+            if (RunDirect<ConsoleType>(1, unitcycles))
+            {
+                if (NDS::ARM7Timestamp >= NDS::ARM7Target) break;
+                continue;
+            }
+
             NDS::ARM7Timestamp += unitcycles;
 
             if (ConsoleType == 1)
@@ -377,6 +662,12 @@ void DMA::Run7()
 
         while (IterCount > 0 && !Stall)
         {
+            if (RunDirect<ConsoleType>(2, unitcycles))
+            {
+                if (NDS::ARM7Timestamp >= NDS::ARM7Target) break;
+                continue;
+            }
+
             NDS::ARM7Timestamp += unitcycles;
 
             if (ConsoleType == 1)
@@ -71,6 +71,10 @@ public:
     u32 Cnt;
 
 private:
+    template <int ConsoleType>
+    bool RunDirect(u32 unitshift, s32 unitcycles);
+    void SyncSPU(u64 timestamp);
+
     u32 CPU, Num;
 
     u32 StartMode;
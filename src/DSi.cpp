@@ -42,42 +42,42 @@
 namespace DSi
 {
 
-u32 BootAddr[2];
+INSTANCE_LOCAL u32 BootAddr[2];
 
-u16 SCFG_BIOS;
-u16 SCFG_Clock9;
-u16 SCFG_Clock7;
-u32 SCFG_EXT[2];
-u32 SCFG_MC;
+INSTANCE_LOCAL u16 SCFG_BIOS;
+INSTANCE_LOCAL u16 SCFG_Clock9;
+INSTANCE_LOCAL u16 SCFG_Clock7;
+INSTANCE_LOCAL u32 SCFG_EXT[2];
+INSTANCE_LOCAL u32 SCFG_MC;
 
-u8 ARM9iBIOS[0x10000];
-u8 ARM7iBIOS[0x10000];
+INSTANCE_LOCAL u8 ARM9iBIOS[0x10000];
+INSTANCE_LOCAL u8 ARM7iBIOS[0x10000];
 
-u32 MBK[2][9];
+INSTANCE_LOCAL u32 MBK[2][9];
 
-u8* NWRAM_A;
-u8* NWRAM_B;
-u8* NWRAM_C;
+INSTANCE_LOCAL u8* NWRAM_A;
+INSTANCE_LOCAL u8* NWRAM_B;
+INSTANCE_LOCAL u8* NWRAM_C;
 
-u8* NWRAMMap_A[2][4];
-u8* NWRAMMap_B[3][8];
-u8* NWRAMMap_C[3][8];
+INSTANCE_LOCAL u8* NWRAMMap_A[2][4];
+INSTANCE_LOCAL u8* NWRAMMap_B[3][8];
+INSTANCE_LOCAL u8* NWRAMMap_C[3][8];
 
-u32 NWRAMStart[2][3];
-u32 NWRAMEnd[2][3];
-u32 NWRAMMask[2][3];
+INSTANCE_LOCAL u32 NWRAMStart[2][3];
+INSTANCE_LOCAL u32 NWRAMEnd[2][3];
+INSTANCE_LOCAL u32 NWRAMMask[2][3];
 
-u32 NDMACnt[2];
-DSi_NDMA* NDMAs[8];
+INSTANCE_LOCAL u32 NDMACnt[2];
+INSTANCE_LOCAL DSi_NDMA* NDMAs[8];
 
-DSi_SDHost* SDMMC;
-DSi_SDHost* SDIO;
+INSTANCE_LOCAL DSi_SDHost* SDMMC;
+INSTANCE_LOCAL DSi_SDHost* SDIO;
 
-u64 ConsoleID;
-u8 eMMC_CID[16];
+INSTANCE_LOCAL u64 ConsoleID;
+INSTANCE_LOCAL u8 eMMC_CID[16];
 
-u8 ITCMInit[0x8000];
-u8 ARM7Init[0x3C00];
+INSTANCE_LOCAL u8 ITCMInit[0x8000];
+INSTANCE_LOCAL u8 ARM7Init[0x3C00];
 
 
 bool Init()
@@ -567,6 +567,9 @@ void MapNWRAM_A(u32 num, u8 val)
     {
         NWRAMMap_A[val & 0x01][(val >> 2) & 0x3] = ptr;
     }
+
+    NDS::UpdatePageMap(0, 0x03000000, 0x04000000);
+    NDS::UpdatePageMap(1, 0x03000000, 0x04000000);
 }
 
 void MapNWRAM_B(u32 num, u8 val)
@@ -606,6 +609,9 @@ void MapNWRAM_B(u32 num, u8 val)
 
         NWRAMMap_B[val & 0x03][(val >> 2) & 0x7] = ptr;
     }
+
+    NDS::UpdatePageMap(0, 0x03000000, 0x04000000);
+    NDS::UpdatePageMap(1, 0x03000000, 0x04000000);
 }
 
 void MapNWRAM_C(u32 num, u8 val)
@@ -645,6 +651,9 @@ void MapNWRAM_C(u32 num, u8 val)
 
         NWRAMMap_C[val & 0x03][(val >> 2) & 0x7] = ptr;
     }
+
+    NDS::UpdatePageMap(0, 0x03000000, 0x04000000);
+    NDS::UpdatePageMap(1, 0x03000000, 0x04000000);
 }
 
 void MapNWRAMRange(u32 cpu, u32 num, u32 val)
@@ -697,6 +706,8 @@ void MapNWRAMRange(u32 cpu, u32 num, u32 val)
         case 3: NWRAMMask[cpu][num] = 0x7; break;
         }
     }
+
+    NDS::UpdatePageMap(cpu, 0x03000000, 0x04000000);
 }
 
 void ApplyNewRAMSize(u32 size)
@@ -714,9 +725,21 @@ void ApplyNewRAMSize(u32 size)
         printf("RAM: 16MB\n");
         break;
     }
+
+    NDS::UpdatePageMap(0, 0x02000000, 0x03000000);
+    NDS::UpdatePageMap(1, 0x02000000, 0x03000000);
 }
 
 
+void Set_SCFG_BIOS(u16 val)
+{
+#ifdef JIT_ENABLED
+    // the JIT compiler looks at which BIOS is visible
+    ARMJIT::SyncCompileThread();
+#endif
+    SCFG_BIOS |= val;
+}
+
 void Set_SCFG_Clock9(u16 val)
 {
     NDS::ARM9Timestamp >>= NDS::ARM9ClockShift;
@@ -1068,6 +1091,40 @@ bool ARM9GetMemRegion(u32 addr, bool write, NDS::MemRegion* region)
     return false;
 }
 
+u8* ARM9GetPagePtr(u32 addr, bool write)
+{
+    switch (addr & 0xFF000000)
+    {
+    case 0x02000000:
+        // region locking hack, see ARM9Read32
+        if (!write && (addr & 0xFFFFF000) == 0x02FE7000) return NULL;
+        break;
+
+    case 0x03000000:
+        if (addr >= NWRAMStart[0][0] && addr < NWRAMEnd[0][0])
+        {
+            u8* ptr = NWRAMMap_A[0][(addr >> 16) & NWRAMMask[0][0]];
+            return ptr ? &ptr[addr & 0xFFFF] : NULL;
+        }
+        if (addr >= NWRAMStart[0][1] && addr < NWRAMEnd[0][1])
+        {
+            u8* ptr = NWRAMMap_B[0][(addr >> 15) & NWRAMMask[0][1]];
+            return ptr ? &ptr[addr & 0x7FFF] : NULL;
+        }
+        if (addr >= NWRAMStart[0][2] && addr < NWRAMEnd[0][2])
+        {
+            u8* ptr = NWRAMMap_C[0][(addr >> 15) & NWRAMMask[0][2]];
+            return ptr ? &ptr[addr & 0x7FFF] : NULL;
+        }
+        break;
+
+    case 0x04000000:
+        return NULL;
+    }
+
+    return NDS::ARM9GetPagePtr(addr, write);
+}
+
 
 
 u8 ARM7Read8(u32 addr)
@@ -1372,6 +1429,35 @@ bool ARM7GetMemRegion(u32 addr, bool write, NDS::MemRegion* region)
     return false;
 }
 
+u8* ARM7GetPagePtr(u32 addr, bool write)
+{
+    switch (addr & 0xFF800000)
+    {
+    case 0x03000000:
+        if (addr >= NWRAMStart[1][0] && addr < NWRAMEnd[1][0])
+        {
+            u8* ptr = NWRAMMap_A[1][(addr >> 16) & NWRAMMask[1][0]];
+            return ptr ? &ptr[addr & 0xFFFF] : NULL;
+        }
+        if (addr >= NWRAMStart[1][1] && addr < NWRAMEnd[1][1])
+        {
+            u8* ptr = NWRAMMap_B[1][(addr >> 15) & NWRAMMask[1][1]];
+            return ptr ? &ptr[addr & 0x7FFF] : NULL;
+        }
+        if (addr >= NWRAMStart[1][2] && addr < NWRAMEnd[1][2])
+        {
+            u8* ptr = NWRAMMap_C[1][(addr >> 15) & NWRAMMask[1][2]];
+            return ptr ? &ptr[addr & 0x7FFF] : NULL;
+        }
+        break;
+
+    case 0x04000000:
+        return NULL;
+    }
+
+    return NDS::ARM7GetPagePtr(addr, write);
+}
+
 
 
 
@@ -1835,10 +1921,10 @@ void ARM7IOWrite8(u32 addr, u8 val)
     switch (addr)
     {
     case 0x04004000:
-        SCFG_BIOS |= (val & 0x03);
+        Set_SCFG_BIOS(val & 0x03);
         return;
     case 0x04004001:
-        SCFG_BIOS |= ((val & 0x07) << 8);
+        Set_SCFG_BIOS((val & 0x07) << 8);
         return;
 
     case 0x04004500: DSi_I2C::WriteData(val); return;
@@ -1856,7 +1942,7 @@ void ARM7IOWrite16(u32 addr, u16 val)
     case 0x0400021C: NDS::IF2 &= ~(val & 0x7FF7); NDS::UpdateIRQ(1); return;
 
     case 0x04004000:
-        SCFG_BIOS |= (val & 0x0703);
+        Set_SCFG_BIOS(val & 0x0703);
         return;
     case 0x04004004:
         SCFG_Clock7 = val & 0x0187;
@@ -1888,7 +1974,7 @@ void ARM7IOWrite32(u32 addr, u32 val)
     case 0x0400021C: NDS::IF2 &= ~(val & 0x7FF7); NDS::UpdateIRQ(1); return;
 
     case 0x04004000:
-        SCFG_BIOS |= (val & 0x0703);
+        Set_SCFG_BIOS(val & 0x0703);
         return;
     case 0x04004008:
         SCFG_EXT[0] &= ~0x03000000;
@@ -25,30 +25,30 @@
 namespace DSi
 {
 
-extern u16 SCFG_BIOS;
+extern INSTANCE_LOCAL u16 SCFG_BIOS;
 
-extern u8 ARM9iBIOS[0x10000];
-extern u8 ARM7iBIOS[0x10000];
+extern INSTANCE_LOCAL u8 ARM9iBIOS[0x10000];
+extern INSTANCE_LOCAL u8 ARM7iBIOS[0x10000];
 
-extern u8 eMMC_CID[16];
-extern u64 ConsoleID;
+extern INSTANCE_LOCAL u8 eMMC_CID[16];
+extern INSTANCE_LOCAL u64 ConsoleID;
 
-extern DSi_SDHost* SDMMC;
-extern DSi_SDHost* SDIO;
+extern INSTANCE_LOCAL DSi_SDHost* SDMMC;
+extern INSTANCE_LOCAL DSi_SDHost* SDIO;
 
 const u32 NWRAMSize = 0x40000;
 
-extern u8* NWRAM_A;
-extern u8* NWRAM_B;
-extern u8* NWRAM_C;
+extern INSTANCE_LOCAL u8* NWRAM_A;
+extern INSTANCE_LOCAL u8* NWRAM_B;
+extern INSTANCE_LOCAL u8* NWRAM_C;
 
-extern u8* NWRAMMap_A[2][4];
-extern u8* NWRAMMap_B[3][8];
-extern u8* NWRAMMap_C[3][8];
+extern INSTANCE_LOCAL u8* NWRAMMap_A[2][4];
+extern INSTANCE_LOCAL u8* NWRAMMap_B[3][8];
+extern INSTANCE_LOCAL u8* NWRAMMap_C[3][8];
 
-extern u32 NWRAMStart[2][3];
-extern u32 NWRAMEnd[2][3];
-extern u32 NWRAMMask[2][3];
+extern INSTANCE_LOCAL u32 NWRAMStart[2][3];
+extern INSTANCE_LOCAL u32 NWRAMEnd[2][3];
+extern INSTANCE_LOCAL u32 NWRAMMask[2][3];
 
 bool Init();
 void DeInit();
@@ -79,6 +79,7 @@ void ARM9Write16(u32 addr, u16 val);
 void ARM9Write32(u32 addr, u32 val);
 
 bool ARM9GetMemRegion(u32 addr, bool write, NDS::MemRegion* region);
+u8* ARM9GetPagePtr(u32 addr, bool write);
 
 u8 ARM7Read8(u32 addr);
 u16 ARM7Read16(u32 addr);
@@ -88,6 +89,7 @@ void ARM7Write16(u32 addr, u16 val);
 void ARM7Write32(u32 addr, u32 val);
 
 bool ARM7GetMemRegion(u32 addr, bool write, NDS::MemRegion* region);
+u8* ARM7GetPagePtr(u32 addr, bool write);
 
 u8 ARM9IORead8(u32 addr);
 u16 ARM9IORead16(u32 addr);
@@ -24,39 +24,59 @@
 #include "tiny-AES-c/aes.hpp"
 #include "Platform.h"
 
+#if defined(__x86_64__)
+#define AESNI_ENGINE
+#include <immintrin.h>
+#include "dolphin/CPUDetect.h"
+#ifdef __GNUC__
+#define AESNI_FUNC __attribute__((target("aes,ssse3")))
+#else
+#define AESNI_FUNC
+#endif
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define ARMCE_ENGINE
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
 
 namespace DSi_AES
 {
 
-u32 Cnt;
+INSTANCE_LOCAL u32 Cnt;
 
-u32 BlkCnt;
-u32 RemBlocks;
+INSTANCE_LOCAL u32 BlkCnt;
+INSTANCE_LOCAL u32 RemBlocks;
 
-bool OutputFlush;
+INSTANCE_LOCAL bool OutputFlush;
 
-u32 InputDMASize, OutputDMASize;
-u32 AESMode;
+INSTANCE_LOCAL u32 InputDMASize, OutputDMASize;
+INSTANCE_LOCAL u32 AESMode;
 
-FIFO<u32>* InputFIFO;
-FIFO<u32>* OutputFIFO;
+INSTANCE_LOCAL FIFO<u32>* InputFIFO;
+INSTANCE_LOCAL FIFO<u32>* OutputFIFO;
 
-u8 IV[16];
+INSTANCE_LOCAL u8 IV[16];
 
-u8 MAC[16];
+INSTANCE_LOCAL u8 MAC[16];
 
-u8 KeyNormal[4][16];
-u8 KeyX[4][16];
-u8 KeyY[4][16];
+INSTANCE_LOCAL u8 KeyNormal[4][16];
+INSTANCE_LOCAL u8 KeyX[4][16];
+INSTANCE_LOCAL u8 KeyY[4][16];
 
-u8 CurKey[16];
-u8 CurMAC[16];
+INSTANCE_LOCAL u8 CurKey[16];
+INSTANCE_LOCAL u8 CurMAC[16];
 
 // output MAC for CCM encrypt
-u8 OutputMAC[16];
-bool OutputMACDue;
+INSTANCE_LOCAL u8 OutputMAC[16];
+INSTANCE_LOCAL bool OutputMACDue;
 
-AES_ctx Ctx;
+INSTANCE_LOCAL AES_ctx Ctx;
 
 
 void Swap16(u8* dst, u8* src)
@@ -82,6 +102,193 @@ void ROL16(u8* val, u32 n)
     }
 }
 
+// AES engines
+//
+// the key schedule is always built by tiny-AES, the engines only run the
+// block cipher over it. the expanded round keys are laid out the same way
+// AES-NI and the ARMv8 crypto extensions expect them.
+//
+// the AES unit takes its data in reverse byte order compared to the AES spec
+// (see all the Swap16 calls). for CTR, instead of swapping every block twice,
+// the keystream is reversed once before it's XORed into the data.
+
+struct AESEngine
+{
+    // encrypts blocks in place, in AES byte order
+    void (*Encrypt)(const AES_ctx* ctx, u8* blocks, u32 num);
+
+    // CTR-crypts blocks in place, in the AES unit's byte order
+    // the counter (ctx->Iv) is advanced by the number of blocks
+    void (*CryptCTR)(AES_ctx* ctx, u8* blocks, u32 num);
+};
+
+void IncrementCTR(u8* ctr)
+{
+    for (int i = 15; i >= 0; i--)
+    {
+        if (++ctr[i]) break;
+    }
+}
+
+void Portable_Encrypt(const AES_ctx* ctx, u8* blocks, u32 num)
+{
+    for (u32 i = 0; i < num; i++)
+        AES_ECB_encrypt(ctx, &blocks[i*16]);
+}
+
+void Portable_CTR(AES_ctx* ctx, u8* blocks, u32 num)
+{
+    for (u32 i = 0; i < num; i++)
+    {
+        u8 stream[16];
+        memcpy(stream, ctx->Iv, 16);
+        AES_ECB_encrypt(ctx, stream);
+        IncrementCTR(ctx->Iv);
+
+        u8* data = &blocks[i*16];
+        for (int j = 0; j < 16; j++)
+            data[j] ^= stream[15-j];
+    }
+}
+
+const AESEngine Engine_Portable = {Portable_Encrypt, Portable_CTR};
+
+#ifdef AESNI_ENGINE
+
+// the rounds of several blocks are interleaved, so that the AES unit
+// doesn't sit idle waiting for the previous round of the same block
+#define AESNI_ROUNDS(num) \
+    for (int b = 0; b < (num); b++) s[b] = _mm_xor_si128(s[b], rk[0]); \
+    for (int r = 1; r < 10; r++) \
+        for (int b = 0; b < (num); b++) s[b] = _mm_aesenc_si128(s[b], rk[r]); \
+    for (int b = 0; b < (num); b++) s[b] = _mm_aesenclast_si128(s[b], rk[10]);
+
+AESNI_FUNC void AESNI_Encrypt(const AES_ctx* ctx, u8* blocks, u32 num)
+{
+    __m128i rk[11];
+    for (int r = 0; r < 11; r++)
+        rk[r] = _mm_loadu_si128((const __m128i*)&ctx->RoundKey[r*16]);
+
+    for (u32 i = 0; i < num; i++)
+    {
+        __m128i s[1];
+        s[0] = _mm_loadu_si128((const __m128i*)&blocks[i*16]);
+        AESNI_ROUNDS(1)
+        _mm_storeu_si128((__m128i*)&blocks[i*16], s[0]);
+    }
+}
+
+AESNI_FUNC void AESNI_CTR(AES_ctx* ctx, u8* blocks, u32 num)
+{
+    __m128i rk[11];
+    for (int r = 0; r < 11; r++)
+        rk[r] = _mm_loadu_si128((const __m128i*)&ctx->RoundKey[r*16]);
+
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    u32 i = 0;
+    for (; i + 4 <= num; i += 4)
+    {
+        __m128i s[4];
+        for (int b = 0; b < 4; b++)
+        {
+            s[b] = _mm_loadu_si128((const __m128i*)ctx->Iv);
+            IncrementCTR(ctx->Iv);
+        }
+
+        AESNI_ROUNDS(4)
+
+        for (int b = 0; b < 4; b++)
+        {
+            __m128i* data = (__m128i*)&blocks[(i+b)*16];
+            _mm_storeu_si128(data, _mm_xor_si128(_mm_loadu_si128(data), _mm_shuffle_epi8(s[b], reverse)));
+        }
+    }
+    for (; i < num; i++)
+    {
+        __m128i s[1];
+        s[0] = _mm_loadu_si128((const __m128i*)ctx->Iv);
+        IncrementCTR(ctx->Iv);
+
+        AESNI_ROUNDS(1)
+
+        __m128i* data = (__m128i*)&blocks[i*16];
+        _mm_storeu_si128(data, _mm_xor_si128(_mm_loadu_si128(data), _mm_shuffle_epi8(s[0], reverse)));
+    }
+}
+
+#undef AESNI_ROUNDS
+
+const AESEngine Engine_AESNI = {AESNI_Encrypt, AESNI_CTR};
+
+#endif // AESNI_ENGINE
+
+#ifdef ARMCE_ENGINE
+
+inline uint8x16_t ARMCE_EncryptBlock(const uint8x16_t* rk, uint8x16_t s)
+{
+    for (int r = 0; r < 9; r++)
+        s = vaesmcq_u8(vaeseq_u8(s, rk[r]));
+    s = vaeseq_u8(s, rk[9]);
+    return veorq_u8(s, rk[10]);
+}
+
+void ARMCE_Encrypt(const AES_ctx* ctx, u8* blocks, u32 num)
+{
+    uint8x16_t rk[11];
+    for (int r = 0; r < 11; r++)
+        rk[r] = vld1q_u8(&ctx->RoundKey[r*16]);
+
+    for (u32 i = 0; i < num; i++)
+        vst1q_u8(&blocks[i*16], ARMCE_EncryptBlock(rk, vld1q_u8(&blocks[i*16])));
+}
+
+void ARMCE_CTR(AES_ctx* ctx, u8* blocks, u32 num)
+{
+    uint8x16_t rk[11];
+    for (int r = 0; r < 11; r++)
+        rk[r] = vld1q_u8(&ctx->RoundKey[r*16]);
+
+    for (u32 i = 0; i < num; i++)
+    {
+        uint8x16_t s = ARMCE_EncryptBlock(rk, vld1q_u8(ctx->Iv));
+        IncrementCTR(ctx->Iv);
+
+        // reverse the keystream bytes
+        s = vrev64q_u8(s);
+        s = vextq_u8(s, s, 8);
+
+        vst1q_u8(&blocks[i*16], veorq_u8(vld1q_u8(&blocks[i*16]), s));
+    }
+}
+
+const AESEngine Engine_ARMCE = {ARMCE_Encrypt, ARMCE_CTR};
+
+#endif // ARMCE_ENGINE
+
+const AESEngine* DetectEngine()
+{
+#ifdef AESNI_ENGINE
+    if (cpu_info.bAES && cpu_info.bSSSE3)
+        return &Engine_AESNI;
+#endif
+
+#ifdef ARMCE_ENGINE
+#if defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_AES)
+        return &Engine_ARMCE;
+#else
+    // the compiler was told the crypto extensions are there
+    return &Engine_ARMCE;
+#endif
+#endif
+
+    return &Engine_Portable;
+}
+
+INSTANCE_LOCAL const AESEngine* Engine;
+
+
 #define _printhex(str, size) { for (int z = 0; z < (size); z++) printf("%02X", (str)[z]); printf("\n"); }
 #define _printhex2(str, size) { for (int z = 0; z < (size); z++) printf("%02X", (str)[z]); }
 
@@ -94,6 +301,9 @@ bool Init()
     InputFIFO = new FIFO<u32>(16);
     OutputFIFO = new FIFO<u32>(16);
 
+    static const AESEngine* engine = DetectEngine();
+    Engine = engine;
+
     const u8 zero[16] = {0};
     AES_init_ctx_iv(&Ctx, zero, zero);
 
@@ -159,84 +369,46 @@ void Reset()
 }
 
 
-void ProcessBlock_CCM_Decrypt()
+void ProcessBlocks(u8* data, u32 num)
 {
-    u8 data[16];
-    u8 data_rev[16];
-
-    *(u32*)&data[0] = InputFIFO->Read();
-    *(u32*)&data[4] = InputFIFO->Read();
-    *(u32*)&data[8] = InputFIFO->Read();
-    *(u32*)&data[12] = InputFIFO->Read();
-
-    //printf("AES-CCM: "); _printhex2(data, 16);
-
-    Swap16(data_rev, data);
-
-    AES_CTR_xcrypt_buffer(&Ctx, data_rev, 16);
-    for (int i = 0; i < 16; i++) CurMAC[i] ^= data_rev[i];
-    AES_ECB_encrypt(&Ctx, CurMAC);
-
-    Swap16(data, data_rev);
-
-    //printf(" -> "); _printhex2(data, 16);
-
-    OutputFIFO->Write(*(u32*)&data[0]);
-    OutputFIFO->Write(*(u32*)&data[4]);
-    OutputFIFO->Write(*(u32*)&data[8]);
-    OutputFIFO->Write(*(u32*)&data[12]);
-}
-
-void ProcessBlock_CCM_Encrypt()
-{
-    u8 data[16];
-    u8 data_rev[16];
-
-    *(u32*)&data[0] = InputFIFO->Read();
-    *(u32*)&data[4] = InputFIFO->Read();
-    *(u32*)&data[8] = InputFIFO->Read();
-    *(u32*)&data[12] = InputFIFO->Read();
-
-    //printf("AES-CCM: "); _printhex2(data, 16);
-
-    Swap16(data_rev, data);
-
-    for (int i = 0; i < 16; i++) CurMAC[i] ^= data_rev[i];
-    AES_CTR_xcrypt_buffer(&Ctx, data_rev, 16);
-    AES_ECB_encrypt(&Ctx, CurMAC);
-
-    Swap16(data, data_rev);
+    switch (AESMode)
+    {
+    case 0: // CCM decrypt
+        Engine->CryptCTR(&Ctx, data, num);
+        for (u32 i = 0; i < num; i++)
+        {
+            for (int j = 0; j < 16; j++) CurMAC[j] ^= data[i*16 + 15-j];
+            Engine->Encrypt(&Ctx, CurMAC, 1);
+        }
+        break;
 
-    //printf(" -> "); _printhex2(data, 16);
+    case 1: // CCM encrypt
+        for (u32 i = 0; i < num; i++)
+        {
+            for (int j = 0; j < 16; j++) CurMAC[j] ^= data[i*16 + 15-j];
+            Engine->Encrypt(&Ctx, CurMAC, 1);
+        }
+        Engine->CryptCTR(&Ctx, data, num);
+        break;
 
-    OutputFIFO->Write(*(u32*)&data[0]);
-    OutputFIFO->Write(*(u32*)&data[4]);
-    OutputFIFO->Write(*(u32*)&data[8]);
-    OutputFIFO->Write(*(u32*)&data[12]);
+    case 2:
+    case 3: // CTR
+        Engine->CryptCTR(&Ctx, data, num);
+        break;
+    }
 }
 
-void ProcessBlock_CTR()
+void FinishMAC()
 {
-    u8 data[16];
-    u8 data_rev[16];
+    u8 stream[16];
 
-    *(u32*)&data[0] = InputFIFO->Read();
-    *(u32*)&data[4] = InputFIFO->Read();
-    *(u32*)&data[8] = InputFIFO->Read();
-    *(u32*)&data[12] = InputFIFO->Read();
+    Ctx.Iv[13] = 0x00;
+    Ctx.Iv[14] = 0x00;
+    Ctx.Iv[15] = 0x00;
+    memcpy(stream, Ctx.Iv, 16);
+    Engine->Encrypt(&Ctx, stream, 1);
 
-    //printf("AES-CTR: "); _printhex2(data, 16);
-
-    Swap16(data_rev, data);
-    AES_CTR_xcrypt_buffer(&Ctx, data_rev, 16);
-    Swap16(data, data_rev);
-
-    //printf(" -> "); _printhex(data, 16);
-
-    OutputFIFO->Write(*(u32*)&data[0]);
-    OutputFIFO->Write(*(u32*)&data[4]);
-    OutputFIFO->Write(*(u32*)&data[8]);
-    OutputFIFO->Write(*(u32*)&data[12]);
+    for (int i = 0; i < 16; i++) CurMAC[i] ^= stream[i];
 }
 
 
@@ -312,7 +484,7 @@ void WriteCnt(u32 val)
                 iv[15] = RemBlocks << 4;
 
                 memcpy(CurMAC, iv, 16);
-                AES_ECB_encrypt(&Ctx, CurMAC);
+                Engine->Encrypt(&Ctx, CurMAC, 1);
             }
             else
             {
@@ -407,17 +579,25 @@ void CheckOutputDMA()
 
 void Update()
 {
-    while (InputFIFO->Level() >= 4 && OutputFIFO->Level() <= 12 && RemBlocks > 0)
+    // process as many blocks as both FIFOs allow in one go
+    u32 num = InputFIFO->Level() >> 2;
+    u32 outroom = (16 - OutputFIFO->Level()) >> 2;
+    if (num > outroom) num = outroom;
+    if (num > RemBlocks) num = RemBlocks;
+
+    if (num > 0)
     {
-        switch (AESMode)
-        {
-        case 0: ProcessBlock_CCM_Decrypt(); break;
-        case 1: ProcessBlock_CCM_Encrypt(); break;
-        case 2:
-        case 3: ProcessBlock_CTR(); break;
-        }
+        u32 data[16];
 
-        RemBlocks--;
+        for (u32 i = 0; i < num*4; i++)
+            data[i] = InputFIFO->Read();
+
+        ProcessBlocks((u8*)data, num);
+
+        for (u32 i = 0; i < num*4; i++)
+            OutputFIFO->Write(data[i]);
+
+        RemBlocks -= num;
     }
 
     CheckOutputDMA();
@@ -426,10 +606,7 @@ void Update()
     {
         if (AESMode == 0)
         {
-            Ctx.Iv[13] = 0x00;
-            Ctx.Iv[14] = 0x00;
-            Ctx.Iv[15] = 0x00;
-            AES_CTR_xcrypt_buffer(&Ctx, CurMAC, 16);
+            FinishMAC();
 
             //printf("FINAL MAC: "); _printhexR(CurMAC, 16);
             //printf("INPUT MAC: "); _printhex(MAC, 16);
@@ -442,10 +619,7 @@ void Update()
         }
         else if (AESMode == 1)
         {
-            Ctx.Iv[13] = 0x00;
-            Ctx.Iv[14] = 0x00;
-            Ctx.Iv[15] = 0x00;
-            AES_CTR_xcrypt_buffer(&Ctx, CurMAC, 16);
+            FinishMAC();
 
             Swap16(OutputMAC, CurMAC);
             OutputMACDue = true;
@@ -586,25 +760,15 @@ void GetModcryptKey(u8* romheader, u8* key)
 
 void ApplyModcrypt(u8* data, u32 len, u8* key, u8* iv)
 {
+    // use a separate context, so this doesn't disturb the AES unit
+    AES_ctx ctx;
     u8 key_rev[16], iv_rev[16];
-    u8 data_rev[16];
-    u8 oldkeys[16*2];
-    memcpy(&oldkeys[16*0], Ctx.RoundKey, 16);
-    memcpy(&oldkeys[16*1], Ctx.Iv, 16);
 
     Swap16(key_rev, key);
     Swap16(iv_rev, iv);
-    AES_init_ctx_iv(&Ctx, key_rev, iv_rev);
-
-    for (u32 i = 0; i < len; i += 16)
-    {
-        Swap16(data_rev, &data[i]);
-        AES_CTR_xcrypt_buffer(&Ctx, data_rev, 16);
-        Swap16(&data[i], data_rev);
-    }
+    AES_init_ctx_iv(&ctx, key_rev, iv_rev);
 
-    memcpy(Ctx.RoundKey, &oldkeys[16*0], 16);
-    memcpy(Ctx.Iv, &oldkeys[16*1], 16);
+    Engine->CryptCTR(&ctx, data, len >> 4);
 }
 
 }
@@ -24,7 +24,7 @@
 namespace DSi_AES
 {
 
-extern u32 Cnt;
+extern INSTANCE_LOCAL u32 Cnt;
 
 bool Init();
 void DeInit();
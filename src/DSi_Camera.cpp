@@ -21,8 +21,8 @@
 #include "DSi_Camera.h"
 
 
-DSi_Camera* DSi_Camera0; // 78 / facing outside
-DSi_Camera* DSi_Camera1; // 7A / selfie cam
+INSTANCE_LOCAL DSi_Camera* DSi_Camera0; // 78 / facing outside
+INSTANCE_LOCAL DSi_Camera* DSi_Camera1; // 7A / selfie cam
 
 
 bool DSi_Camera::Init()
@@ -52,7 +52,7 @@ private:
 };
 
 
-extern DSi_Camera* DSi_Camera0;
-extern DSi_Camera* DSi_Camera1;
+extern INSTANCE_LOCAL DSi_Camera* DSi_Camera0;
+extern INSTANCE_LOCAL DSi_Camera* DSi_Camera1;
 
 #endif // DSI_CAMERA_H
@@ -27,8 +27,8 @@
 namespace DSi_BPTWL
 {
 
-u8 Registers[0x100];
-u32 CurPos;
+INSTANCE_LOCAL u8 Registers[0x100];
+INSTANCE_LOCAL u32 CurPos;
 
 bool Init()
 {
@@ -136,10 +136,10 @@ void Write(u8 val, bool last)
 namespace DSi_I2C
 {
 
-u8 Cnt;
-u8 Data;
+INSTANCE_LOCAL u8 Cnt;
+INSTANCE_LOCAL u8 Data;
 
-u32 Device;
+INSTANCE_LOCAL u32 Device;
 
 bool Init()
 {
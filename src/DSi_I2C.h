@@ -22,7 +22,7 @@
 namespace DSi_I2C
 {
 
-extern u8 Cnt;
+extern INSTANCE_LOCAL u8 Cnt;
 
 bool Init();
 void DeInit();
@@ -113,7 +113,7 @@ const u8 CIS1[256] =
 };
 
 
-DSi_NWifi* Ctx = nullptr;
+INSTANCE_LOCAL DSi_NWifi* Ctx = nullptr;
 
 
 DSi_NWifi::DSi_NWifi(DSi_SDHost* host) : DSi_SDDevice(host)
@@ -18,6 +18,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
+#include <deque>
 #include "DSi.h"
 #include "DSi_SD.h"
 #include "DSi_NWifi.h"
@@ -714,11 +716,148 @@ void DSi_SDHost::CheckSwapFIFO()
 
 #define MMC_DESC  (Internal?"NAND":"SDcard")
 
+
+// write-back of NAND/SD blocks
+// one thread serves every storage. a storage waits for it to be idle
+// before reading from its file, so reads never see stale data
+
+typedef struct
+{
+    FILE* File;
+    u64 Addr;
+    u32 Len;
+    u8* Data;
+
+} MMCWriteJob;
+
+INSTANCE_LOCAL std::deque<MMCWriteJob> MMCWriteQueue;
+INSTANCE_LOCAL Platform::Thread* MMCWriterThread = NULL;
+INSTANCE_LOCAL Platform::Semaphore* Sema_MMCWriterStart;
+INSTANCE_LOCAL Platform::Semaphore* Sema_MMCWriterIdle;
+INSTANCE_LOCAL Platform::Mutex* MMCWriterLock;
+INSTANCE_LOCAL bool MMCWriterBusy;
+INSTANCE_LOCAL bool MMCWriterWaiting;
+INSTANCE_LOCAL bool MMCWriterQuit;
+INSTANCE_LOCAL u32 MMCWriterUsers = 0;
+
+void MMCWriteJobRun(MMCWriteJob& job)
+{
+    fseek(job.File, job.Addr, SEEK_SET);
+    fwrite(job.Data, 1, job.Len, job.File);
+    fflush(job.File);
+    delete[] job.Data;
+}
+
+void MMCWriterThreadFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_MMCWriterStart);
+
+        for (;;)
+        {
+            Platform::Mutex_Lock(MMCWriterLock);
+            if (MMCWriteQueue.empty())
+            {
+                MMCWriterBusy = false;
+                if (MMCWriterWaiting)
+                {
+                    MMCWriterWaiting = false;
+                    Platform::Semaphore_Post(Sema_MMCWriterIdle);
+                }
+                Platform::Mutex_Unlock(MMCWriterLock);
+                break;
+            }
+
+            MMCWriteJob job = MMCWriteQueue.front();
+            MMCWriteQueue.pop_front();
+            MMCWriterBusy = true;
+            Platform::Mutex_Unlock(MMCWriterLock);
+
+            MMCWriteJobRun(job);
+        }
+
+        if (MMCWriterQuit) break;
+    }
+}
+
+void MMCWriterStart()
+{
+    if (MMCWriterUsers++) return;
+
+#ifndef MULTI_INSTANCE
+    // the writer thread wouldn't see this console's state
+    MMCWriterLock = Platform::Mutex_Create();
+    Sema_MMCWriterStart = Platform::Semaphore_Create();
+    Sema_MMCWriterIdle = Platform::Semaphore_Create();
+    MMCWriterBusy = false;
+    MMCWriterWaiting = false;
+    MMCWriterQuit = false;
+    MMCWriterThread = Platform::Thread_Create(MMCWriterThreadFunc);
+#endif
+}
+
+void MMCWriterWaitIdle()
+{
+    if (!MMCWriterThread) return;
+
+    Platform::Mutex_Lock(MMCWriterLock);
+    bool busy = MMCWriterBusy || !MMCWriteQueue.empty();
+    if (busy) MMCWriterWaiting = true;
+    Platform::Mutex_Unlock(MMCWriterLock);
+
+    if (busy) Platform::Semaphore_Wait(Sema_MMCWriterIdle);
+}
+
+void MMCWriterStop()
+{
+    if (--MMCWriterUsers) return;
+    if (!MMCWriterThread) return;
+
+    MMCWriterQuit = true;
+    Platform::Semaphore_Post(Sema_MMCWriterStart);
+    Platform::Thread_Wait(MMCWriterThread);
+    Platform::Thread_Free(MMCWriterThread);
+    MMCWriterThread = NULL;
+
+    Platform::Semaphore_Free(Sema_MMCWriterIdle);
+    Platform::Semaphore_Free(Sema_MMCWriterStart);
+    Platform::Mutex_Free(MMCWriterLock);
+}
+
+void MMCWriterQueue(MMCWriteJob& job)
+{
+    if (!MMCWriterThread)
+    {
+        MMCWriteJobRun(job);
+        return;
+    }
+
+    Platform::Mutex_Lock(MMCWriterLock);
+    MMCWriteQueue.push_back(job);
+    Platform::Mutex_Unlock(MMCWriterLock);
+
+    Platform::Semaphore_Post(Sema_MMCWriterStart);
+}
+
+
 DSi_MMCStorage::DSi_MMCStorage(DSi_SDHost* host, bool internal, const char* path) : DSi_SDDevice(host)
 {
     Internal = internal;
     strncpy(FilePath, path, 1023); FilePath[1023] = '\0';
 
+    for (u32 i = 0; i < CacheNumChunks; i++)
+    {
+        Cache[i].Addr = ~0ULL;
+        Cache[i].Dirty = 0;
+        Cache[i].LastUse = 0;
+        Cache[i].Data = NULL;
+    }
+    LastChunk = NULL;
+    CacheTick = 0;
+
+    MMCWriterStart();
+
     File = Platform::OpenLocalFile(path, "r+b");
     if (!File)
     {
@@ -736,6 +875,15 @@ DSi_MMCStorage::DSi_MMCStorage(DSi_SDHost* host, bool internal, const char* path
 
 DSi_MMCStorage::~DSi_MMCStorage()
 {
+    FlushCache();
+    MMCWriterWaitIdle();
+    MMCWriterStop();
+
+    for (u32 i = 0; i < CacheNumChunks; i++)
+    {
+        if (Cache[i].Data) delete[] Cache[i].Data;
+    }
+
     if (File) fclose(File);
 }
 
@@ -840,7 +988,7 @@ void DSi_MMCStorage::SendCMD(u8 cmd, u32 param)
 
     case 12: // stop operation
         SetState(0x04);
-        if (File) fflush(File);
+        FlushCache();
         RWCommand = 0;
         Host->SendResponse(CSR, true);
         return;
@@ -959,6 +1107,126 @@ void DSi_MMCStorage::ContinueTransfer()
     RWAddress += len;
 }
 
+DSi_MMCStorage::CacheChunk* DSi_MMCStorage::GetChunk(u64 addr)
+{
+    addr &= ~(u64)(CacheChunkSize-1);
+    CacheTick++;
+
+    if (LastChunk && LastChunk->Addr == addr)
+    {
+        LastChunk->LastUse = CacheTick;
+        return LastChunk;
+    }
+
+    // not cached: take an unused chunk, or the least recently used one
+    CacheChunk* victim = NULL;
+    for (u32 i = 0; i < CacheNumChunks; i++)
+    {
+        CacheChunk* chunk = &Cache[i];
+        if (chunk->Addr == addr)
+        {
+            chunk->LastUse = CacheTick;
+            LastChunk = chunk;
+            return chunk;
+        }
+
+        if (!victim || (victim->Addr != ~0ULL && (chunk->Addr == ~0ULL || chunk->LastUse < victim->LastUse)))
+            victim = chunk;
+    }
+
+    WriteBackChunk(victim);
+    if (!victim->Data) victim->Data = new u8[CacheChunkSize];
+
+    // pending writes may cover this chunk
+    MMCWriterWaitIdle();
+
+    fseek(File, addr, SEEK_SET);
+    u32 len = fread(victim->Data, 1, CacheChunkSize, File);
+    if (len < CacheChunkSize)
+        memset(&victim->Data[len], 0, CacheChunkSize - len);
+
+    victim->Addr = addr;
+    victim->Dirty = 0;
+    victim->LastUse = CacheTick;
+    LastChunk = victim;
+    return victim;
+}
+
+void DSi_MMCStorage::WriteBackChunk(CacheChunk* chunk)
+{
+    if (!chunk->Dirty) return;
+
+    // one job per run of dirty blocks
+    u64 dirty = chunk->Dirty;
+    u32 block = 0;
+    while (dirty)
+    {
+        if (!(dirty & 1))
+        {
+            dirty >>= 1;
+            block++;
+            continue;
+        }
+
+        u32 start = block;
+        while (dirty & 1)
+        {
+            dirty >>= 1;
+            block++;
+        }
+
+        MMCWriteJob job;
+        job.File = File;
+        job.Addr = chunk->Addr + (start << 9);
+        job.Len = (block - start) << 9;
+        job.Data = new u8[job.Len];
+        memcpy(job.Data, &chunk->Data[start << 9], job.Len);
+        MMCWriterQueue(job);
+    }
+
+    chunk->Dirty = 0;
+}
+
+void DSi_MMCStorage::FlushCache()
+{
+    for (u32 i = 0; i < CacheNumChunks; i++)
+        WriteBackChunk(&Cache[i]);
+}
+
+void DSi_MMCStorage::ReadData(u64 addr, u8* data, u32 len)
+{
+    while (len)
+    {
+        CacheChunk* chunk = GetChunk(addr);
+        u32 offset = addr & (CacheChunkSize-1);
+        u32 chunklen = std::min(len, CacheChunkSize - offset);
+
+        memcpy(data, &chunk->Data[offset], chunklen);
+
+        addr += chunklen;
+        data += chunklen;
+        len -= chunklen;
+    }
+}
+
+void DSi_MMCStorage::WriteData(u64 addr, u8* data, u32 len)
+{
+    while (len)
+    {
+        CacheChunk* chunk = GetChunk(addr);
+        u32 offset = addr & (CacheChunkSize-1);
+        u32 chunklen = std::min(len, CacheChunkSize - offset);
+
+        memcpy(&chunk->Data[offset], data, chunklen);
+        for (u32 b = (offset >> 9); b <= ((offset + chunklen - 1) >> 9); b++)
+            chunk->Dirty |= (1ULL << b);
+
+        addr += chunklen;
+        data += chunklen;
+        len -= chunklen;
+    }
+}
+
 u32 DSi_MMCStorage::ReadBlock(u64 addr)
 {
     u32 len = BlockSize;
@@ -967,8 +1235,7 @@ u32 DSi_MMCStorage::ReadBlock(u64 addr)
     u8 data[0x200];
     if (File)
     {
-        fseek(File, addr, SEEK_SET);
-        fread(data, 1, len, File);
+        ReadData(addr, data, len);
     }
 
     return Host->DataRX(data, len);
@@ -984,8 +1251,7 @@ u32 DSi_MMCStorage::WriteBlock(u64 addr)
     {
         if (File)
         {
-            fseek(File, addr, SEEK_SET);
-            fwrite(data, 1, len, File);
+            WriteData(addr, data, len);
         }
     }
 
@@ -152,6 +152,31 @@ private:
 
     void SetState(u32 state) { CSR &= ~(0xF << 9); CSR |= (state << 9); }
 
+    // the image is cached in chunks, which are read in one go
+    // this way, multi-block reads are mostly served from memory
+    // dirty blocks are handed to a writer thread
+    static const u32 CacheChunkSize = 0x8000; // 64 blocks
+    static const u32 CacheNumChunks = 64;
+
+    struct CacheChunk
+    {
+        u64 Addr;   // ~0 if unused
+        u64 Dirty;  // one bit per 512-byte block
+        u32 LastUse;
+        u8* Data;
+    };
+
+    CacheChunk Cache[CacheNumChunks];
+    CacheChunk* LastChunk;
+    u32 CacheTick;
+
+    CacheChunk* GetChunk(u64 addr);
+    void WriteBackChunk(CacheChunk* chunk);
+    void FlushCache();
+
+    void ReadData(u64 addr, u8* data, u32 len);
+    void WriteData(u64 addr, u8* data, u32 len);
+
     u32 ReadBlock(u64 addr);
     u32 WriteBlock(u64 addr);
 };
@@ -26,15 +26,15 @@
 namespace DSi_SPI_TSC
 {
 
-u32 DataPos;
-u8 Index;
-u8 Bank;
-u8 Data;
+INSTANCE_LOCAL u32 DataPos;
+INSTANCE_LOCAL u8 Index;
+INSTANCE_LOCAL u8 Bank;
+INSTANCE_LOCAL u8 Data;
 
-u8 Bank3Regs[0x80];
-u8 TSCMode;
+INSTANCE_LOCAL u8 Bank3Regs[0x80];
+INSTANCE_LOCAL u8 TSCMode;
 
-u16 TouchX, TouchY;
+INSTANCE_LOCAL u16 TouchX, TouchY;
 
 
 bool Init()
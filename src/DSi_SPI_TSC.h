@@ -22,7 +22,7 @@
 namespace DSi_SPI_TSC
 {
 
-extern u32 DataPos;
+extern INSTANCE_LOCAL u32 DataPos;
 
 bool Init();
 void DeInit();
@@ -45,15 +45,15 @@ struct FlashProperties
     u8 bank;
 };
 
-u8* SRAM;
-FILE* SRAMFile;
-u32 SRAMLength;
-SaveType SRAMType;
-FlashProperties SRAMFlashState;
+INSTANCE_LOCAL u8* SRAM;
+INSTANCE_LOCAL FILE* SRAMFile;
+INSTANCE_LOCAL u32 SRAMLength;
+INSTANCE_LOCAL SaveType SRAMType;
+INSTANCE_LOCAL FlashProperties SRAMFlashState;
 
-char SRAMPath[1024];
+INSTANCE_LOCAL char SRAMPath[1024];
 
-void (*WriteFunc)(u32 addr, u8 val);
+INSTANCE_LOCAL void (*WriteFunc)(u32 addr, u8 val);
 
 
 void Write_Null(u32 addr, u8 val);
@@ -501,13 +501,13 @@ const char SOLAR_SENSOR_GAMECODES[10][5] =
 };
 
 
-bool CartInserted;
-bool HasSolarSensor;
-u8* CartROM;
-u32 CartROMSize;
-u32 CartCRC;
-u32 CartID;
-GPIO CartGPIO; // overridden GPIO parameters
+INSTANCE_LOCAL bool CartInserted;
+INSTANCE_LOCAL bool HasSolarSensor;
+INSTANCE_LOCAL u8* CartROM;
+INSTANCE_LOCAL u32 CartROMSize;
+INSTANCE_LOCAL u32 CartCRC;
+INSTANCE_LOCAL u32 CartID;
+INSTANCE_LOCAL GPIO CartGPIO; // overridden GPIO parameters
 
 
 bool Init()
@@ -723,10 +723,10 @@ void WriteGPIO(u32 addr, u16 val)
 namespace GBACart_SolarSensor
 {
 
-bool LightEdge;
-u8 LightCounter;
-u8 LightSample;
-u8 LightLevel; // 0-10 range
+INSTANCE_LOCAL bool LightEdge;
+INSTANCE_LOCAL u8 LightCounter;
+INSTANCE_LOCAL u8 LightSample;
+INSTANCE_LOCAL u8 LightLevel; // 0-10 range
 
 // levels from mGBA
 const int GBA_LUX_LEVELS[11] = { 0, 5, 11, 18, 27, 42, 62, 84, 109, 139, 183 };
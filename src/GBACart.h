@@ -26,8 +26,8 @@
 namespace GBACart_SRAM
 {
 
-extern u8* SRAM;
-extern u32 SRAMLength;
+extern INSTANCE_LOCAL u8* SRAM;
+extern INSTANCE_LOCAL u32 SRAMLength;
 
 void Reset();
 void DoSavestate(Savestate* file);
@@ -53,11 +53,11 @@ struct GPIO
     u16 control;
 };
 
-extern bool CartInserted;
-extern bool HasSolarSensor;
-extern u8* CartROM;
-extern u32 CartROMSize;
-extern u32 CartCRC;
+extern INSTANCE_LOCAL bool CartInserted;
+extern INSTANCE_LOCAL bool HasSolarSensor;
+extern INSTANCE_LOCAL u8* CartROM;
+extern INSTANCE_LOCAL u32 CartROMSize;
+extern INSTANCE_LOCAL u32 CartCRC;
 
 bool Init();
 void DeInit();
@@ -76,7 +76,7 @@ void WriteGPIO(u32 addr, u16 val);
 namespace GBACart_SolarSensor
 {
 
-extern u8 LightLevel;
+extern INSTANCE_LOCAL u8 LightLevel;
 
 void Reset();
 void DoSavestate(Savestate* file);
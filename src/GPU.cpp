@@ -20,6 +20,8 @@
 #include <string.h>
 #include "NDS.h"
 #include "GPU.h"
+#include "Platform.h"
+#include "Profiler.h"
 
 
 namespace GPU
@@ -29,61 +31,108 @@ namespace GPU
 #define HBLANK_CYCLES (48+(256*6))
 #define FRAME_CYCLES  (LINE_CYCLES * 263)
 
-u16 VCount;
-u32 NextVCount;
-u16 TotalScanlines;
+INSTANCE_LOCAL u16 VCount;
+INSTANCE_LOCAL u32 NextVCount;
+INSTANCE_LOCAL u16 TotalScanlines;
 
-bool RunFIFO;
+INSTANCE_LOCAL bool RunFIFO;
 
-u16 DispStat[2], VMatch[2];
+INSTANCE_LOCAL u16 DispStat[2], VMatch[2];
 
-u8 Palette[2*1024];
-u8 OAM[2*1024];
+INSTANCE_LOCAL u8 Palette[2*1024];
+INSTANCE_LOCAL u8 OAM[2*1024];
 
-u8 VRAM_A[128*1024];
-u8 VRAM_B[128*1024];
-u8 VRAM_C[128*1024];
-u8 VRAM_D[128*1024];
-u8 VRAM_E[ 64*1024];
-u8 VRAM_F[ 16*1024];
-u8 VRAM_G[ 16*1024];
-u8 VRAM_H[ 32*1024];
-u8 VRAM_I[ 16*1024];
-u8* VRAM[9]     = {VRAM_A,  VRAM_B,  VRAM_C,  VRAM_D,  VRAM_E, VRAM_F, VRAM_G, VRAM_H, VRAM_I};
-u32 VRAMMask[9] = {0x1FFFF, 0x1FFFF, 0x1FFFF, 0x1FFFF, 0xFFFF, 0x3FFF, 0x3FFF, 0x7FFF, 0x3FFF};
+INSTANCE_LOCAL u8 VRAM_A[128*1024];
+INSTANCE_LOCAL u8 VRAM_B[128*1024];
+INSTANCE_LOCAL u8 VRAM_C[128*1024];
+INSTANCE_LOCAL u8 VRAM_D[128*1024];
+INSTANCE_LOCAL u8 VRAM_E[ 64*1024];
+INSTANCE_LOCAL u8 VRAM_F[ 16*1024];
+INSTANCE_LOCAL u8 VRAM_G[ 16*1024];
+INSTANCE_LOCAL u8 VRAM_H[ 32*1024];
+INSTANCE_LOCAL u8 VRAM_I[ 16*1024];
+INSTANCE_LOCAL u8* VRAM[9];
+const u32 VRAMMask[9] = {0x1FFFF, 0x1FFFF, 0x1FFFF, 0x1FFFF, 0xFFFF, 0x3FFF, 0x3FFF, 0x7FFF, 0x3FFF};
 
-u8 VRAMCNT[9];
-u8 VRAMSTAT;
+INSTANCE_LOCAL u32 VRAMGen;
+INSTANCE_LOCAL u32 VRAMMapGen;
+INSTANCE_LOCAL u32 VRAMPageGen[41];
 
-u32 VRAMMap_LCDC;
+INSTANCE_LOCAL u8 VRAMCNT[9];
+INSTANCE_LOCAL u8 VRAMSTAT;
 
-u32 VRAMMap_ABG[0x20];
-u32 VRAMMap_AOBJ[0x10];
-u32 VRAMMap_BBG[0x8];
-u32 VRAMMap_BOBJ[0x8];
+INSTANCE_LOCAL u32 VRAMMap_LCDC;
 
-u32 VRAMMap_ABGExtPal[4];
-u32 VRAMMap_AOBJExtPal;
-u32 VRAMMap_BBGExtPal[4];
-u32 VRAMMap_BOBJExtPal;
+INSTANCE_LOCAL u32 VRAMMap_ABG[0x20];
+INSTANCE_LOCAL u32 VRAMMap_AOBJ[0x10];
+INSTANCE_LOCAL u32 VRAMMap_BBG[0x8];
+INSTANCE_LOCAL u32 VRAMMap_BOBJ[0x8];
 
-u32 VRAMMap_Texture[4];
-u32 VRAMMap_TexPal[8];
+INSTANCE_LOCAL u32 VRAMMap_ABGExtPal[4];
+INSTANCE_LOCAL u32 VRAMMap_AOBJExtPal;
+INSTANCE_LOCAL u32 VRAMMap_BBGExtPal[4];
+INSTANCE_LOCAL u32 VRAMMap_BOBJExtPal;
 
-u32 VRAMMap_ARM7[2];
+INSTANCE_LOCAL u32 VRAMMap_Texture[4];
+INSTANCE_LOCAL u32 VRAMMap_TexPal[8];
 
-u8* VRAMPtr_ABG[0x20];
-u8* VRAMPtr_AOBJ[0x10];
-u8* VRAMPtr_BBG[0x8];
-u8* VRAMPtr_BOBJ[0x8];
+INSTANCE_LOCAL u32 VRAMMap_ARM7[2];
 
-int FrontBuffer;
-u32* Framebuffer[2][2];
-int Renderer;
-bool Accelerated;
+INSTANCE_LOCAL u8* VRAMPtr_ABG[0x20];
+INSTANCE_LOCAL u8* VRAMPtr_AOBJ[0x10];
+INSTANCE_LOCAL u8* VRAMPtr_BBG[0x8];
+INSTANCE_LOCAL u8* VRAMPtr_BOBJ[0x8];
 
-GPU2D* GPU2D_A;
-GPU2D* GPU2D_B;
+INSTANCE_LOCAL int FrontBuffer;
+INSTANCE_LOCAL u32* Framebuffer[2][2];
+INSTANCE_LOCAL int Renderer;
+INSTANCE_LOCAL bool Accelerated;
+
+INSTANCE_LOCAL GPU2D* GPU2D_A;
+INSTANCE_LOCAL GPU2D* GPU2D_B;
+
+// threaded 2D rendering
+//
+// when enabled, everything the 2D engines get to see during a frame
+// (register writes, scanline starts, drawing, VBlank) is queued and
+// replayed in the same order on the 2D thread, so the result is the
+// same as when running them synchronously.
+//
+// the emulation side has to wait for the 2D thread (Sync2D()) before
+// changing anything the engines read while drawing: palette, OAM, VRAM
+// and its mapping, framebuffers. register reads wait for all the queued
+// writes to be applied. frames that use the display FIFO and the OpenGL
+// renderer aren't supported and are drawn synchronously.
+
+typedef struct
+{
+    u8 Type;
+    u8 Num;
+    u32 Addr;
+    u32 Val;
+
+} Cmd2DEntry;
+
+const u32 Cmd2DQueueSize = 8192; // must be a power of two
+INSTANCE_LOCAL Cmd2DEntry Cmd2DQueue[Cmd2DQueueSize];
+INSTANCE_LOCAL u32 Cmd2DWritePos;  // emulation thread
+INSTANCE_LOCAL u32 Cmd2DDonePos;   // emulation thread, the queue is known to be processed up to there
+INSTANCE_LOCAL u32 Cmd2DSubmitPos; // shared, under Lock2D
+INSTANCE_LOCAL u32 Cmd2DReadPos;   // shared, under Lock2D
+INSTANCE_LOCAL bool Sync2DWaiting; // shared, under Lock2D
+
+INSTANCE_LOCAL bool Threaded2D;
+INSTANCE_LOCAL bool Run2DThreaded;
+INSTANCE_LOCAL bool Pending2D;
+
+INSTANCE_LOCAL Platform::Thread* Thread2D;
+INSTANCE_LOCAL bool Thread2DRunning;
+INSTANCE_LOCAL Platform::Semaphore* Sema_2DStart;
+INSTANCE_LOCAL Platform::Semaphore* Sema_2DDone;
+INSTANCE_LOCAL Platform::Mutex* Lock2D;
+
+void Thread2DFunc();
+void Stop2DThread();
 
 
 bool Init()
@@ -92,6 +141,24 @@ bool Init()
     GPU2D_B = new GPU2D(1);
     if (!GPU3D::Init()) return false;
 
+    VRAM[0] = VRAM_A; VRAM[1] = VRAM_B; VRAM[2] = VRAM_C;
+    VRAM[3] = VRAM_D; VRAM[4] = VRAM_E; VRAM[5] = VRAM_F;
+    VRAM[6] = VRAM_G; VRAM[7] = VRAM_H; VRAM[8] = VRAM_I;
+
+    Sema_2DStart = Platform::Semaphore_Create();
+    Sema_2DDone = Platform::Semaphore_Create();
+    Lock2D = Platform::Mutex_Create();
+
+    Threaded2D = false;
+    Run2DThreaded = false;
+    Pending2D = false;
+    Thread2DRunning = false;
+    Cmd2DWritePos = 0;
+    Cmd2DDonePos = 0;
+    Cmd2DSubmitPos = 0;
+    Cmd2DReadPos = 0;
+    Sync2DWaiting = false;
+
     FrontBuffer = 0;
     Framebuffer[0][0] = NULL; Framebuffer[0][1] = NULL;
     Framebuffer[1][0] = NULL; Framebuffer[1][1] = NULL;
@@ -103,6 +170,12 @@ bool Init()
 
 void DeInit()
 {
+    Stop2DThread();
+
+    Platform::Semaphore_Free(Sema_2DStart);
+    Platform::Semaphore_Free(Sema_2DDone);
+    Platform::Mutex_Free(Lock2D);
+
     delete GPU2D_A;
     delete GPU2D_B;
     GPU3D::DeInit();
@@ -115,6 +188,9 @@ void DeInit()
 
 void Reset()
 {
+    Sync2D();
+    Run2DThreaded = false;
+
     VCount = 0;
     NextVCount = -1;
     TotalScanlines = 0;
@@ -137,6 +213,12 @@ void Reset()
     memset(VRAM_H, 0,  32*1024);
     memset(VRAM_I, 0,  16*1024);
 
+    // the generation itself keeps counting, so that anything noted before
+    // the reset is seen as changed
+    for (int i = 0; i < 41; i++)
+        VRAMPageGen[i] = VRAMGen;
+    VRAMMapGen = VRAMGen;
+
     memset(VRAMCNT, 0, 9);
     VRAMSTAT = 0;
 
@@ -190,6 +272,9 @@ void Reset()
 
 void Stop()
 {
+    Sync2D();
+    Run2DThreaded = false;
+
     int fbsize;
     if (Accelerated) fbsize = (256*3 + 1) * 192;
     else             fbsize = 256 * 192;
@@ -201,6 +286,8 @@ void Stop()
 
 void DoSavestate(Savestate* file)
 {
+    Sync2D();
+
     file->Section("GPUG");
 
     file->Var16(&VCount);
@@ -256,6 +343,15 @@ void DoSavestate(Savestate* file)
             VRAMPtr_BBG[i] = GetUniqueBankPtr(VRAMMap_BBG[i], i << 14);
         for (int i = 0; i < 0x8; i++)
             VRAMPtr_BOBJ[i] = GetUniqueBankPtr(VRAMMap_BOBJ[i], i << 14);
+
+        for (int i = 0; i < 41; i++)
+            VRAMPageGen[i] = VRAMGen;
+        VRAMMapGen = VRAMGen;
+
+        for (int i = 0; i < 4; i++)
+            GPU3D::SoftRenderer::TexSlotDirty(i);
+        for (int i = 0; i < 8; i++)
+            GPU3D::SoftRenderer::TexPalSlotDirty(i);
     }
 
     GPU2D_A->DoSavestate(file);
@@ -265,6 +361,8 @@ void DoSavestate(Savestate* file)
 
 void AssignFramebuffers()
 {
+    Sync2D();
+
     int backbuf = FrontBuffer ? 0 : 1;
     if (NDS::PowerControl9 & (1<<15))
     {
@@ -280,6 +378,8 @@ void AssignFramebuffers()
 
 void InitRenderer(int renderer)
 {
+    Sync2D();
+
 #ifdef OGLRENDERER_ENABLED
     if (renderer == 1)
     {
@@ -305,6 +405,8 @@ void InitRenderer(int renderer)
 
 void DeInitRenderer()
 {
+    Sync2D();
+
     if (Renderer == 0)
     {
         GPU3D::SoftRenderer::DeInit();
@@ -335,6 +437,15 @@ void ResetRenderer()
 
 void SetRenderSettings(int renderer, RenderSettings& settings)
 {
+#ifdef MULTI_INSTANCE
+    // helper threads wouldn't see the state of this thread's console
+    settings.Threaded2D = false;
+    settings.Soft_Threaded = false;
+    settings.Soft_Workers = 0;
+#endif
+
+    Sync2D();
+
     if (renderer != Renderer)
     {
         DeInitRenderer();
@@ -376,6 +487,156 @@ void SetRenderSettings(int renderer, RenderSettings& settings)
         GPU3D::GLRenderer::SetRenderSettings(settings);
     }
 #endif
+
+    Threaded2D = settings.Threaded2D;
+    if (Threaded2D)
+    {
+        if (!Thread2DRunning)
+        {
+            Thread2DRunning = true;
+            Thread2D = Platform::Thread_Create(Thread2DFunc);
+        }
+    }
+    else
+    {
+        Run2DThreaded = false;
+        Stop2DThread();
+    }
+}
+
+
+void Run2DCommand(GPU2D* gpu, u8 type, u32 addr, u32 val)
+{
+    switch (type)
+    {
+    case Cmd2D_Write8: gpu->WriteReg8(addr, val); return;
+    case Cmd2D_Write16: gpu->WriteReg16(addr, val); return;
+    case Cmd2D_Write32: gpu->WriteReg32(addr, val); return;
+    case Cmd2D_StartScanline: gpu->StartScanline(val); return;
+    case Cmd2D_DrawScanline:
+        {
+            // timed here so it's counted on whichever thread draws the scanline
+#ifdef PROFILING_ENABLED
+            u64 profstart = Profiler::GetTicks();
+#endif
+            gpu->DrawScanline(val);
+#ifdef PROFILING_ENABLED
+            Profiler::Time[Profiler::Prof_GPU2D] += Profiler::GetTicks() - profstart;
+#endif
+        }
+        return;
+    case Cmd2D_DrawSprites: gpu->DrawSprites(val); return;
+    case Cmd2D_VBlank: gpu->VBlank(); return;
+    case Cmd2D_VBlankEnd: gpu->VBlankEnd(); return;
+    }
+}
+
+void Thread2DFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_2DStart);
+        if (!Thread2DRunning) return;
+
+        Platform::Mutex_Lock(Lock2D);
+        u32 pos = Cmd2DReadPos;
+        u32 end = Cmd2DSubmitPos;
+        Platform::Mutex_Unlock(Lock2D);
+
+        while (pos != end)
+        {
+            Cmd2DEntry* cmd = &Cmd2DQueue[pos];
+            Run2DCommand(cmd->Num ? GPU2D_B : GPU2D_A, cmd->Type, cmd->Addr, cmd->Val);
+            pos = (pos + 1) & (Cmd2DQueueSize-1);
+        }
+
+        Platform::Mutex_Lock(Lock2D);
+        Cmd2DReadPos = pos;
+        bool wake = Sync2DWaiting && (pos == Cmd2DSubmitPos);
+        if (wake) Sync2DWaiting = false;
+        Platform::Mutex_Unlock(Lock2D);
+
+        if (wake) Platform::Semaphore_Post(Sema_2DDone);
+    }
+}
+
+void Stop2DThread()
+{
+    if (Thread2DRunning)
+    {
+        Sync2D();
+
+        Thread2DRunning = false;
+        Platform::Semaphore_Post(Sema_2DStart);
+        Platform::Thread_Wait(Thread2D);
+        Platform::Thread_Free(Thread2D);
+    }
+}
+
+void Submit2D()
+{
+    Platform::Mutex_Lock(Lock2D);
+    Cmd2DSubmitPos = Cmd2DWritePos;
+    Cmd2DDonePos = Cmd2DReadPos;
+    Platform::Mutex_Unlock(Lock2D);
+
+    Platform::Semaphore_Post(Sema_2DStart);
+}
+
+void Queue2D(u8 type, u8 num, u32 addr, u32 val)
+{
+    u32 next = (Cmd2DWritePos + 1) & (Cmd2DQueueSize-1);
+    if (next == Cmd2DDonePos)
+        Sync2D();
+
+    Cmd2DEntry* cmd = &Cmd2DQueue[Cmd2DWritePos];
+    cmd->Type = type;
+    cmd->Num = num;
+    cmd->Addr = addr;
+    cmd->Val = val;
+    Cmd2DWritePos = next;
+}
+
+void Sync2D()
+{
+    if (Cmd2DWritePos != Cmd2DDonePos)
+    {
+        Platform::Mutex_Lock(Lock2D);
+        Cmd2DSubmitPos = Cmd2DWritePos;
+        bool done = (Cmd2DReadPos == Cmd2DSubmitPos);
+        if (!done) Sync2DWaiting = true;
+        Platform::Mutex_Unlock(Lock2D);
+
+        if (!done)
+        {
+            Platform::Semaphore_Post(Sema_2DStart);
+            Platform::Semaphore_Wait(Sema_2DDone);
+        }
+
+        Cmd2DDonePos = Cmd2DWritePos;
+    }
+
+    Pending2D = false;
+}
+
+void Run2D(u8 type, u32 line)
+{
+    if (Run2DThreaded)
+    {
+        Queue2D(type, 0, 0, line);
+        Queue2D(type, 1, 0, line);
+
+        if (type == Cmd2D_DrawScanline || type == Cmd2D_DrawSprites)
+        {
+            // those read palette/OAM/VRAM, writes to them will have to wait
+            Pending2D = true;
+            Submit2D();
+        }
+        return;
+    }
+
+    Run2DCommand(GPU2D_A, type, 0, line);
+    Run2DCommand(GPU2D_B, type, 0, line);
 }
 
 
@@ -426,6 +687,31 @@ u8* GetUniqueBankPtr(u32 mask, u32 offset)
     return &VRAM[num][offset & VRAMMask[num]];
 }
 
+void MarkVRAMRange(u32 bank, u32 offset, u32 len)
+{
+    if (!len) return;
+
+    u32 first = offset >> 14;
+    u32 last = (offset + len - 1) >> 14;
+    u32 pagemask = VRAMPageMask[bank];
+    if (last - first > pagemask) last = first + pagemask;
+
+    for (u32 p = first; p <= last; p++)
+        VRAMPageGen[VRAMPageBase[bank] + (p & pagemask)] = VRAMGen;
+}
+
+void MarkVRAMRange(u8* ptr, u32 len)
+{
+    for (int i = 0; i < 9; i++)
+    {
+        if (ptr >= VRAM[i] && ptr <= &VRAM[i][VRAMMask[i]])
+        {
+            MarkVRAMRange(i, ptr - VRAM[i], len);
+            return;
+        }
+    }
+}
+
 #define MAP_RANGE(map, base, n)    for (int i = 0; i < n; i++) VRAMMap_##map[(base)+i] |= bankmask;
 #define UNMAP_RANGE(map, base, n)  for (int i = 0; i < n; i++) VRAMMap_##map[(base)+i] &= ~bankmask;
 
@@ -436,11 +722,15 @@ u8* GetUniqueBankPtr(u32 mask, u32 offset)
 
 void MapVRAM_AB(u32 bank, u8 cnt)
 {
+    Sync2D();
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
     if (oldcnt == cnt) return;
 
+    VRAMMapGen = VRAMGen;
+
     u8 oldofs = (oldcnt >> 3) & 0x3;
     u8 ofs = (cnt >> 3) & 0x3;
     u32 bankmask = 1 << bank;
@@ -464,6 +754,7 @@ void MapVRAM_AB(u32 bank, u8 cnt)
 
         case 3: // texture
             VRAMMap_Texture[oldofs] &= ~bankmask;
+            GPU3D::SoftRenderer::TexSlotDirty(oldofs);
             break;
         }
     }
@@ -487,13 +778,18 @@ void MapVRAM_AB(u32 bank, u8 cnt)
 
         case 3: // texture
             VRAMMap_Texture[ofs] |= bankmask;
+            GPU3D::SoftRenderer::TexSlotDirty(ofs);
             break;
         }
     }
+
+    NDS::UpdatePageMap(0, 0x06000000, 0x06800000);
 }
 
 void MapVRAM_CD(u32 bank, u8 cnt)
 {
+    Sync2D();
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
@@ -501,6 +797,8 @@ void MapVRAM_CD(u32 bank, u8 cnt)
 
     if (oldcnt == cnt) return;
 
+    VRAMMapGen = VRAMGen;
+
     u8 oldofs = (oldcnt >> 3) & 0x7;
     u8 ofs = (cnt >> 3) & 0x7;
     u32 bankmask = 1 << bank;
@@ -524,6 +822,7 @@ void MapVRAM_CD(u32 bank, u8 cnt)
 
         case 3: // texture
             VRAMMap_Texture[oldofs] &= ~bankmask;
+            GPU3D::SoftRenderer::TexSlotDirty(oldofs);
             break;
 
         case 4: // BBG/BOBJ
@@ -559,6 +858,7 @@ void MapVRAM_CD(u32 bank, u8 cnt)
 
         case 3: // texture
             VRAMMap_Texture[ofs] |= bankmask;
+            GPU3D::SoftRenderer::TexSlotDirty(ofs);
             break;
 
         case 4: // BBG/BOBJ
@@ -573,15 +873,22 @@ void MapVRAM_CD(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdatePageMap(0, 0x06000000, 0x06800000);
+    NDS::UpdatePageMap(1, 0x06000000, 0x07000000);
 }
 
 void MapVRAM_E(u32 bank, u8 cnt)
 {
+    Sync2D();
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
     if (oldcnt == cnt) return;
 
+    VRAMMapGen = VRAMGen;
+
     u32 bankmask = 1 << bank;
 
     if (oldcnt & (1<<7))
@@ -602,6 +909,7 @@ void MapVRAM_E(u32 bank, u8 cnt)
 
         case 3: // texture palette
             UNMAP_RANGE(TexPal, 0, 4);
+            for (int i = 0; i < 4; i++) GPU3D::SoftRenderer::TexPalSlotDirty(i);
             break;
 
         case 4: // ABG ext palette
@@ -630,6 +938,7 @@ void MapVRAM_E(u32 bank, u8 cnt)
 
         case 3: // texture palette
             MAP_RANGE(TexPal, 0, 4);
+            for (int i = 0; i < 4; i++) GPU3D::SoftRenderer::TexPalSlotDirty(i);
             break;
 
         case 4: // ABG ext palette
@@ -639,15 +948,21 @@ void MapVRAM_E(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdatePageMap(0, 0x06000000, 0x06800000);
 }
 
 void MapVRAM_FG(u32 bank, u8 cnt)
 {
+    Sync2D();
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
     if (oldcnt == cnt) return;
 
+    VRAMMapGen = VRAMGen;
+
     u8 oldofs = (oldcnt >> 3) & 0x7;
     u8 ofs = (cnt >> 3) & 0x7;
     u32 bankmask = 1 << bank;
@@ -682,6 +997,7 @@ void MapVRAM_FG(u32 bank, u8 cnt)
 
         case 3: // texture palette
             VRAMMap_TexPal[(oldofs & 0x1) + ((oldofs & 0x2) << 1)] &= ~bankmask;
+            GPU3D::SoftRenderer::TexPalSlotDirty((oldofs & 0x1) + ((oldofs & 0x2) << 1));
             break;
 
         case 4: // ABG ext palette
@@ -727,6 +1043,7 @@ void MapVRAM_FG(u32 bank, u8 cnt)
 
         case 3: // texture palette
             VRAMMap_TexPal[(ofs & 0x1) + ((ofs & 0x2) << 1)] |= bankmask;
+            GPU3D::SoftRenderer::TexPalSlotDirty((ofs & 0x1) + ((ofs & 0x2) << 1));
             break;
 
         case 4: // ABG ext palette
@@ -741,15 +1058,21 @@ void MapVRAM_FG(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdatePageMap(0, 0x06000000, 0x06800000);
 }
 
 void MapVRAM_H(u32 bank, u8 cnt)
 {
+    Sync2D();
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
     if (oldcnt == cnt) return;
 
+    VRAMMapGen = VRAMGen;
+
     u32 bankmask = 1 << bank;
 
     if (oldcnt & (1<<7))
@@ -805,15 +1128,21 @@ void MapVRAM_H(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdatePageMap(0, 0x06000000, 0x06800000);
 }
 
 void MapVRAM_I(u32 bank, u8 cnt)
 {
+    Sync2D();
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
     if (oldcnt == cnt) return;
 
+    VRAMMapGen = VRAMGen;
+
     u32 bankmask = 1 << bank;
 
     if (oldcnt & (1<<7))
@@ -875,6 +1204,8 @@ void MapVRAM_I(u32 bank, u8 cnt)
             break;
         }
     }
+
+    NDS::UpdatePageMap(0, 0x06000000, 0x06800000);
 }
 
 
@@ -890,6 +1221,8 @@ void SetPowerCnt(u32 val)
 
     if (!(val & (1<<0))) printf("!!! CLEARING POWCNT BIT0. DANGER\n");
 
+    Sync2D();
+
     GPU2D_A->SetEnabled(val & (1<<1));
     GPU2D_B->SetEnabled(val & (1<<9));
     GPU3D::SetEnabled(val & (1<<3), val & (1<<2));
@@ -926,8 +1259,11 @@ void StartFrame()
     // only run the display FIFO if needed:
     // * if it is used for display or capture
     // * if we have display FIFO DMA
+    Sync2D();
     RunFIFO = GPU2D_A->UsesFIFO() || NDS::DMAsInMode(0, 0x04);
 
+    Run2DThreaded = Threaded2D && !Accelerated && !RunFIFO;
+
     TotalScanlines = 0;
     StartScanline(0);
 }
@@ -943,27 +1279,24 @@ void StartHBlank(u32 line)
         // note: this should start 48 cycles after the scanline start
         if (line < 192)
         {
-            GPU2D_A->DrawScanline(line);
-            GPU2D_B->DrawScanline(line);
+            Run2D(Cmd2D_DrawScanline, line);
         }
 
         // sprites are pre-rendered one scanline in advance
         if (line < 191)
-        {
-            GPU2D_A->DrawSprites(line+1);
-            GPU2D_B->DrawSprites(line+1);
-        }
+            Run2D(Cmd2D_DrawSprites, line+1);
 
         NDS::CheckDMAs(0, 0x02);
     }
     else if (VCount == 215)
     {
+        // the 3D renderer starts overwriting the scanlines the 2D engines read
+        Sync2D();
         GPU3D::VCount215();
     }
     else if (VCount == 262)
     {
-        GPU2D_A->DrawSprites(0);
-        GPU2D_B->DrawSprites(0);
+        Run2D(Cmd2D_DrawSprites, 0);
     }
 
     if (DispStat[0] & (1<<4)) NDS::SetIRQ(0, NDS::IRQ_HBlank);
@@ -1015,8 +1348,9 @@ void StartScanline(u32 line)
     else
         DispStat[1] &= ~(1<<2);
 
-    GPU2D_A->CheckWindows(VCount);
-    GPU2D_B->CheckWindows(VCount);
+    VRAMGen++;
+
+    Run2D(Cmd2D_StartScanline, VCount);
 
     if (VCount >= 2 && VCount < 194)
         NDS::CheckDMAs(0, 0x03);
@@ -1026,10 +1360,7 @@ void StartScanline(u32 line)
     if (line < 192)
     {
         if (line == 0)
-        {
-            GPU2D_A->VBlankEnd();
-            GPU2D_B->VBlankEnd();
-        }
+            Run2D(Cmd2D_VBlankEnd, 0);
 
         if (RunFIFO)
             NDS::ScheduleEvent(NDS::Event_DisplayFIFO, false, 32, DisplayFIFO, 0);
@@ -1058,8 +1389,7 @@ void StartScanline(u32 line)
             if (DispStat[0] & (1<<3)) NDS::SetIRQ(0, NDS::IRQ_VBlank);
             if (DispStat[1] & (1<<3)) NDS::SetIRQ(1, NDS::IRQ_VBlank);
 
-            GPU2D_A->VBlank();
-            GPU2D_B->VBlank();
+            Run2D(Cmd2D_VBlank, 0);
             GPU3D::VBlank();
 
 #ifdef OGLRENDERER_ENABLED
@@ -24,59 +24,62 @@
 namespace GPU
 {
 
-extern u16 VCount;
-extern u16 TotalScanlines;
+extern INSTANCE_LOCAL u16 VCount;
+extern INSTANCE_LOCAL u16 TotalScanlines;
 
-extern u16 DispStat[2];
+extern INSTANCE_LOCAL u16 DispStat[2];
 
-extern u8 VRAMCNT[9];
-extern u8 VRAMSTAT;
+extern INSTANCE_LOCAL u8 VRAMCNT[9];
+extern INSTANCE_LOCAL u8 VRAMSTAT;
 
-extern u8 Palette[2*1024];
-extern u8 OAM[2*1024];
+extern INSTANCE_LOCAL u8 Palette[2*1024];
+extern INSTANCE_LOCAL u8 OAM[2*1024];
 
-extern u8 VRAM_A[128*1024];
-extern u8 VRAM_B[128*1024];
-extern u8 VRAM_C[128*1024];
-extern u8 VRAM_D[128*1024];
-extern u8 VRAM_E[ 64*1024];
-extern u8 VRAM_F[ 16*1024];
-extern u8 VRAM_G[ 16*1024];
-extern u8 VRAM_H[ 32*1024];
-extern u8 VRAM_I[ 16*1024];
+extern INSTANCE_LOCAL u8 VRAM_A[128*1024];
+extern INSTANCE_LOCAL u8 VRAM_B[128*1024];
+extern INSTANCE_LOCAL u8 VRAM_C[128*1024];
+extern INSTANCE_LOCAL u8 VRAM_D[128*1024];
+extern INSTANCE_LOCAL u8 VRAM_E[ 64*1024];
+extern INSTANCE_LOCAL u8 VRAM_F[ 16*1024];
+extern INSTANCE_LOCAL u8 VRAM_G[ 16*1024];
+extern INSTANCE_LOCAL u8 VRAM_H[ 32*1024];
+extern INSTANCE_LOCAL u8 VRAM_I[ 16*1024];
 
-extern u8* VRAM[9];
+extern INSTANCE_LOCAL u8* VRAM[9];
 
-extern u32 VRAMMap_LCDC;
-extern u32 VRAMMap_ABG[0x20];
-extern u32 VRAMMap_AOBJ[0x10];
-extern u32 VRAMMap_BBG[0x8];
-extern u32 VRAMMap_BOBJ[0x8];
-extern u32 VRAMMap_ABGExtPal[4];
-extern u32 VRAMMap_AOBJExtPal;
-extern u32 VRAMMap_BBGExtPal[4];
-extern u32 VRAMMap_BOBJExtPal;
-extern u32 VRAMMap_Texture[4];
-extern u32 VRAMMap_TexPal[8];
-extern u32 VRAMMap_ARM7[2];
+extern INSTANCE_LOCAL u32 VRAMMap_LCDC;
+extern INSTANCE_LOCAL u32 VRAMMap_ABG[0x20];
+extern INSTANCE_LOCAL u32 VRAMMap_AOBJ[0x10];
+extern INSTANCE_LOCAL u32 VRAMMap_BBG[0x8];
+extern INSTANCE_LOCAL u32 VRAMMap_BOBJ[0x8];
+extern INSTANCE_LOCAL u32 VRAMMap_ABGExtPal[4];
+extern INSTANCE_LOCAL u32 VRAMMap_AOBJExtPal;
+extern INSTANCE_LOCAL u32 VRAMMap_BBGExtPal[4];
+extern INSTANCE_LOCAL u32 VRAMMap_BOBJExtPal;
+extern INSTANCE_LOCAL u32 VRAMMap_Texture[4];
+extern INSTANCE_LOCAL u32 VRAMMap_TexPal[8];
+extern INSTANCE_LOCAL u32 VRAMMap_ARM7[2];
 
-extern u8* VRAMPtr_ABG[0x20];
-extern u8* VRAMPtr_AOBJ[0x10];
-extern u8* VRAMPtr_BBG[0x8];
-extern u8* VRAMPtr_BOBJ[0x8];
+extern INSTANCE_LOCAL u8* VRAMPtr_ABG[0x20];
+extern INSTANCE_LOCAL u8* VRAMPtr_AOBJ[0x10];
+extern INSTANCE_LOCAL u8* VRAMPtr_BBG[0x8];
+extern INSTANCE_LOCAL u8* VRAMPtr_BOBJ[0x8];
 
-extern int FrontBuffer;
-extern u32* Framebuffer[2][2];
+extern INSTANCE_LOCAL int FrontBuffer;
+extern INSTANCE_LOCAL u32* Framebuffer[2][2];
 
-extern GPU2D* GPU2D_A;
-extern GPU2D* GPU2D_B;
+extern INSTANCE_LOCAL GPU2D* GPU2D_A;
+extern INSTANCE_LOCAL GPU2D* GPU2D_B;
 
-extern int Renderer;
+extern INSTANCE_LOCAL int Renderer;
 
 
 typedef struct
 {
+    bool Threaded2D; // draw the 2D engines on a separate thread
+
     bool Soft_Threaded;
+    int Soft_Workers; // extra threads for rasterizing scanline bands, 0 = off
 
     int GL_ScaleFactor;
     bool GL_BetterPolygons;
@@ -98,6 +101,27 @@ void ResetRenderer();
 void SetRenderSettings(int renderer, RenderSettings& settings);
 
 
+// threaded 2D rendering, see GPU.cpp
+
+enum
+{
+    Cmd2D_Write8 = 0,
+    Cmd2D_Write16,
+    Cmd2D_Write32,
+    Cmd2D_StartScanline,
+    Cmd2D_DrawScanline,
+    Cmd2D_DrawSprites,
+    Cmd2D_VBlank,
+    Cmd2D_VBlankEnd,
+};
+
+extern INSTANCE_LOCAL bool Run2DThreaded;
+extern INSTANCE_LOCAL bool Pending2D;
+
+void Queue2D(u8 type, u8 num, u32 addr, u32 val);
+void Sync2D();
+
+
 u8* GetUniqueBankPtr(u32 mask, u32 offset);
 
 void MapVRAM_AB(u32 bank, u8 cnt);
@@ -108,9 +132,67 @@ void MapVRAM_H(u32 bank, u8 cnt);
 void MapVRAM_I(u32 bank, u8 cnt);
 
 
+// VRAM write tracking
+//
+// VRAM is tracked in 16K pages, with the banks laid out one after another
+// (A at page 0, B at page 8, ..., I at page 40). every write stamps the page
+// with the current generation, VRAMGen, which advances once per scanline.
+// a consumer notes VRAMGen when it reads VRAM, and later asks whether the
+// range was changed since then. remapping any bank counts as a change to all
+// the mapped views, but not to the banks themselves.
+
+const u32 VRAMPageBase[9] = {0, 8, 16, 24, 32, 36, 37, 38, 40};
+const u32 VRAMPageMask[9] = {0x7, 0x7, 0x7, 0x7, 0x3, 0x0, 0x0, 0x1, 0x0};
+
+extern INSTANCE_LOCAL u32 VRAMGen;
+extern INSTANCE_LOCAL u32 VRAMMapGen;
+extern INSTANCE_LOCAL u32 VRAMPageGen[41];
+
+inline void MarkVRAMPage(u32 bank, u32 addr)
+{
+    VRAMPageGen[VRAMPageBase[bank] + ((addr >> 14) & VRAMPageMask[bank])] = VRAMGen;
+}
+
+// for writes that go straight to the bank memory (DMA, display capture)
+void MarkVRAMRange(u32 bank, u32 offset, u32 len);
+void MarkVRAMRange(u8* ptr, u32 len);
+
+// generations wrap around, so they are compared as a signed distance
+inline bool VRAMMapChanged(u32 gen)
+{
+    return (s32)(VRAMMapGen - gen) >= 0;
+}
+
+// whether any of the banks in mask were written within offset..offset+len
+// since gen. the range is wrapped to the size of each bank, like mirroring
+inline bool VRAMBanksChanged(u32 mask, u32 offset, u32 len, u32 gen)
+{
+    u32 first = offset >> 14;
+    u32 last = (offset + len - 1) >> 14;
+
+    for (u32 bank = 0; mask; bank++, mask >>= 1)
+    {
+        if (!(mask & 0x1)) continue;
+
+        u32 pagemask = VRAMPageMask[bank];
+        u32 end = (last - first > pagemask) ? (first + pagemask) : last;
+        for (u32 p = first; p <= end; p++)
+        {
+            if ((s32)(VRAMPageGen[VRAMPageBase[bank] + (p & pagemask)] - gen) >= 0)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+
 template<typename T>
 T ReadVRAM_LCDC(u32 addr)
 {
+    // display capture writes to LCDC VRAM
+    if (Pending2D) Sync2D();
+
     int bank;
 
     switch (addr & 0xFF8FC000)
@@ -176,6 +258,8 @@ T ReadVRAM_LCDC(u32 addr)
 template<typename T>
 void WriteVRAM_LCDC(u32 addr, T val)
 {
+    if (Pending2D) Sync2D();
+
     int bank;
 
     switch (addr & 0xFF8FC000)
@@ -233,7 +317,11 @@ void WriteVRAM_LCDC(u32 addr, T val)
     default: return;
     }
 
-    if (VRAMMap_LCDC & (1<<bank)) *(T*)&VRAM[bank][addr] = val;
+    if (VRAMMap_LCDC & (1<<bank))
+    {
+        *(T*)&VRAM[bank][addr] = val;
+        MarkVRAMPage(bank, addr);
+    }
 }
 
 
@@ -260,15 +348,17 @@ T ReadVRAM_ABG(u32 addr)
 template<typename T>
 void WriteVRAM_ABG(u32 addr, T val)
 {
+    if (Pending2D) Sync2D();
+
     u32 mask = VRAMMap_ABG[(addr >> 14) & 0x1F];
 
-    if (mask & (1<<0)) *(T*)&VRAM_A[addr & 0x1FFFF] = val;
-    if (mask & (1<<1)) *(T*)&VRAM_B[addr & 0x1FFFF] = val;
-    if (mask & (1<<2)) *(T*)&VRAM_C[addr & 0x1FFFF] = val;
-    if (mask & (1<<3)) *(T*)&VRAM_D[addr & 0x1FFFF] = val;
-    if (mask & (1<<4)) *(T*)&VRAM_E[addr & 0xFFFF] = val;
-    if (mask & (1<<5)) *(T*)&VRAM_F[addr & 0x3FFF] = val;
-    if (mask & (1<<6)) *(T*)&VRAM_G[addr & 0x3FFF] = val;
+    if (mask & (1<<0)) { *(T*)&VRAM_A[addr & 0x1FFFF] = val; MarkVRAMPage(0, addr); }
+    if (mask & (1<<1)) { *(T*)&VRAM_B[addr & 0x1FFFF] = val; MarkVRAMPage(1, addr); }
+    if (mask & (1<<2)) { *(T*)&VRAM_C[addr & 0x1FFFF] = val; MarkVRAMPage(2, addr); }
+    if (mask & (1<<3)) { *(T*)&VRAM_D[addr & 0x1FFFF] = val; MarkVRAMPage(3, addr); }
+    if (mask & (1<<4)) { *(T*)&VRAM_E[addr & 0xFFFF] = val; MarkVRAMPage(4, addr); }
+    if (mask & (1<<5)) { *(T*)&VRAM_F[addr & 0x3FFF] = val; MarkVRAMPage(5, addr); }
+    if (mask & (1<<6)) { *(T*)&VRAM_G[addr & 0x3FFF] = val; MarkVRAMPage(6, addr); }
 }
 
 
@@ -293,13 +383,15 @@ T ReadVRAM_AOBJ(u32 addr)
 template<typename T>
 void WriteVRAM_AOBJ(u32 addr, T val)
 {
+    if (Pending2D) Sync2D();
+
     u32 mask = VRAMMap_AOBJ[(addr >> 14) & 0xF];
 
-    if (mask & (1<<0)) *(T*)&VRAM_A[addr & 0x1FFFF] = val;
-    if (mask & (1<<1)) *(T*)&VRAM_B[addr & 0x1FFFF] = val;
-    if (mask & (1<<4)) *(T*)&VRAM_E[addr & 0xFFFF] = val;
-    if (mask & (1<<5)) *(T*)&VRAM_F[addr & 0x3FFF] = val;
-    if (mask & (1<<6)) *(T*)&VRAM_G[addr & 0x3FFF] = val;
+    if (mask & (1<<0)) { *(T*)&VRAM_A[addr & 0x1FFFF] = val; MarkVRAMPage(0, addr); }
+    if (mask & (1<<1)) { *(T*)&VRAM_B[addr & 0x1FFFF] = val; MarkVRAMPage(1, addr); }
+    if (mask & (1<<4)) { *(T*)&VRAM_E[addr & 0xFFFF] = val; MarkVRAMPage(4, addr); }
+    if (mask & (1<<5)) { *(T*)&VRAM_F[addr & 0x3FFF] = val; MarkVRAMPage(5, addr); }
+    if (mask & (1<<6)) { *(T*)&VRAM_G[addr & 0x3FFF] = val; MarkVRAMPage(6, addr); }
 }
 
 
@@ -322,11 +414,13 @@ T ReadVRAM_BBG(u32 addr)
 template<typename T>
 void WriteVRAM_BBG(u32 addr, T val)
 {
+    if (Pending2D) Sync2D();
+
     u32 mask = VRAMMap_BBG[(addr >> 14) & 0x7];
 
-    if (mask & (1<<2)) *(T*)&VRAM_C[addr & 0x1FFFF] = val;
-    if (mask & (1<<7)) *(T*)&VRAM_H[addr & 0x7FFF] = val;
-    if (mask & (1<<8)) *(T*)&VRAM_I[addr & 0x3FFF] = val;
+    if (mask & (1<<2)) { *(T*)&VRAM_C[addr & 0x1FFFF] = val; MarkVRAMPage(2, addr); }
+    if (mask & (1<<7)) { *(T*)&VRAM_H[addr & 0x7FFF] = val; MarkVRAMPage(7, addr); }
+    if (mask & (1<<8)) { *(T*)&VRAM_I[addr & 0x3FFF] = val; MarkVRAMPage(8, addr); }
 }
 
 
@@ -348,10 +442,12 @@ T ReadVRAM_BOBJ(u32 addr)
 template<typename T>
 void WriteVRAM_BOBJ(u32 addr, T val)
 {
+    if (Pending2D) Sync2D();
+
     u32 mask = VRAMMap_BOBJ[(addr >> 14) & 0x7];
 
-    if (mask & (1<<3)) *(T*)&VRAM_D[addr & 0x1FFFF] = val;
-    if (mask & (1<<8)) *(T*)&VRAM_I[addr & 0x3FFF] = val;
+    if (mask & (1<<3)) { *(T*)&VRAM_D[addr & 0x1FFFF] = val; MarkVRAMPage(3, addr); }
+    if (mask & (1<<8)) { *(T*)&VRAM_I[addr & 0x3FFF] = val; MarkVRAMPage(8, addr); }
 }
 
 
@@ -372,8 +468,8 @@ void WriteVRAM_ARM7(u32 addr, T val)
 {
     u32 mask = VRAMMap_ARM7[(addr >> 17) & 0x1];
 
-    if (mask & (1<<2)) *(T*)&VRAM_C[addr & 0x1FFFF] = val;
-    if (mask & (1<<3)) *(T*)&VRAM_D[addr & 0x1FFFF] = val;
+    if (mask & (1<<2)) { *(T*)&VRAM_C[addr & 0x1FFFF] = val; MarkVRAMPage(2, addr); }
+    if (mask & (1<<3)) { *(T*)&VRAM_D[addr & 0x1FFFF] = val; MarkVRAMPage(3, addr); }
 }
 
 
@@ -85,6 +85,8 @@ GPU2D::GPU2D(u32 num)
 {
     Num = num;
 
+    Kernels = GPU2D_Kernels::Detect();
+
     // initialize mosaic table
     for (int m = 0; m < 16; m++)
     {
@@ -103,6 +105,7 @@ GPU2D::~GPU2D()
 void GPU2D::Reset()
 {
     Enabled = false;
+    VCount = 0;
     DispCnt = 0;
     memset(BGCnt, 0, 4*2);
     memset(BGXPos, 0, 4*2);
@@ -154,6 +157,8 @@ void GPU2D::Reset()
     BGExtPalStatus[2] = 0;
     BGExtPalStatus[3] = 0;
     OBJExtPalStatus = 0;
+
+    InvalidateBGTileCache();
 }
 
 void GPU2D::DoSavestate(Savestate* file)
@@ -217,6 +222,8 @@ void GPU2D::DoSavestate(Savestate* file)
 
         CurBGXMosaicTable = MosaicTable[BGMosaicSize[0]];
         CurOBJXMosaicTable = MosaicTable[OBJMosaicSize[0]];
+
+        VCount = GPU::VCount;
     }
 }
 
@@ -233,6 +240,8 @@ void GPU2D::SetRenderSettings(bool accel)
 
 u8 GPU2D::Read8(u32 addr)
 {
+    GPU::Sync2D();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000: return DispCnt & 0xFF;
@@ -266,6 +275,8 @@ u8 GPU2D::Read8(u32 addr)
 
 u16 GPU2D::Read16(u32 addr)
 {
+    GPU::Sync2D();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000: return DispCnt & 0xFFFF;
@@ -295,6 +306,8 @@ u16 GPU2D::Read16(u32 addr)
 
 u32 GPU2D::Read32(u32 addr)
 {
+    GPU::Sync2D();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000: return DispCnt;
@@ -306,6 +319,30 @@ u32 GPU2D::Read32(u32 addr)
 }
 
 void GPU2D::Write8(u32 addr, u8 val)
+{
+    if (GPU::Run2DThreaded)
+        GPU::Queue2D(GPU::Cmd2D_Write8, Num, addr, val);
+    else
+        WriteReg8(addr, val);
+}
+
+void GPU2D::Write16(u32 addr, u16 val)
+{
+    if (GPU::Run2DThreaded)
+        GPU::Queue2D(GPU::Cmd2D_Write16, Num, addr, val);
+    else
+        WriteReg16(addr, val);
+}
+
+void GPU2D::Write32(u32 addr, u32 val)
+{
+    if (GPU::Run2DThreaded)
+        GPU::Queue2D(GPU::Cmd2D_Write32, Num, addr, val);
+    else
+        WriteReg32(addr, val);
+}
+
+void GPU2D::WriteReg8(u32 addr, u8 val)
 {
     switch (addr & 0x00000FFF)
     {
@@ -404,7 +441,7 @@ void GPU2D::Write8(u32 addr, u8 val)
     printf("unknown GPU write8 %08X %02X\n", addr, val);
 }
 
-void GPU2D::Write16(u32 addr, u16 val)
+void GPU2D::WriteReg16(u32 addr, u16 val)
 {
     switch (addr & 0x00000FFF)
     {
@@ -453,21 +490,21 @@ void GPU2D::Write16(u32 addr, u16 val)
     case 0x026: BGRotD[0] = val; return;
     case 0x028:
         BGXRef[0] = (BGXRef[0] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (VCount < 192) BGXRefInternal[0] = BGXRef[0];
         return;
     case 0x02A:
         if (val & 0x0800) val |= 0xF000;
         BGXRef[0] = (BGXRef[0] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (VCount < 192) BGXRefInternal[0] = BGXRef[0];
         return;
     case 0x02C:
         BGYRef[0] = (BGYRef[0] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (VCount < 192) BGYRefInternal[0] = BGYRef[0];
         return;
     case 0x02E:
         if (val & 0x0800) val |= 0xF000;
         BGYRef[0] = (BGYRef[0] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (VCount < 192) BGYRefInternal[0] = BGYRef[0];
         return;
 
     case 0x030: BGRotA[1] = val; return;
@@ -476,21 +513,21 @@ void GPU2D::Write16(u32 addr, u16 val)
     case 0x036: BGRotD[1] = val; return;
     case 0x038:
         BGXRef[1] = (BGXRef[1] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (VCount < 192) BGXRefInternal[1] = BGXRef[1];
         return;
     case 0x03A:
         if (val & 0x0800) val |= 0xF000;
         BGXRef[1] = (BGXRef[1] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (VCount < 192) BGXRefInternal[1] = BGXRef[1];
         return;
     case 0x03C:
         BGYRef[1] = (BGYRef[1] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (VCount < 192) BGYRefInternal[1] = BGYRef[1];
         return;
     case 0x03E:
         if (val & 0x0800) val |= 0xF000;
         BGYRef[1] = (BGYRef[1] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (VCount < 192) BGYRefInternal[1] = BGYRef[1];
         return;
 
     case 0x040:
@@ -546,7 +583,7 @@ void GPU2D::Write16(u32 addr, u16 val)
     //printf("unknown GPU write16 %08X %04X\n", addr, val);
 }
 
-void GPU2D::Write32(u32 addr, u32 val)
+void GPU2D::WriteReg32(u32 addr, u32 val)
 {
     switch (addr & 0x00000FFF)
     {
@@ -576,28 +613,28 @@ void GPU2D::Write32(u32 addr, u32 val)
     case 0x028:
         if (val & 0x08000000) val |= 0xF0000000;
         BGXRef[0] = val;
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (VCount < 192) BGXRefInternal[0] = BGXRef[0];
         return;
     case 0x02C:
         if (val & 0x08000000) val |= 0xF0000000;
         BGYRef[0] = val;
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (VCount < 192) BGYRefInternal[0] = BGYRef[0];
         return;
 
     case 0x038:
         if (val & 0x08000000) val |= 0xF0000000;
         BGXRef[1] = val;
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (VCount < 192) BGXRefInternal[1] = BGXRef[1];
         return;
     case 0x03C:
         if (val & 0x08000000) val |= 0xF0000000;
         BGYRef[1] = val;
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (VCount < 192) BGYRefInternal[1] = BGYRef[1];
         return;
     }
 
-    Write16(addr, val&0xFFFF);
-    Write16(addr+2, val>>16);
+    WriteReg16(addr, val&0xFFFF);
+    WriteReg16(addr+2, val>>16);
 }
 
 
@@ -756,7 +793,7 @@ void GPU2D::DrawScanline(u32 line)
     u32* dst = &Framebuffer[stride * line];
 
     int n3dline = line;
-    line = GPU::VCount;
+    line = VCount;
 
     bool forceblank = false;
 
@@ -823,6 +860,12 @@ void GPU2D::DrawScanline(u32 line)
                 u16* vram = (u16*)GPU::VRAM[vrambank];
                 vram = &vram[line * 256];
 
+                if (Kernels)
+                {
+                    Kernels->Expand555(dst, vram);
+                    break;
+                }
+
                 for (int i = 0; i < 256; i++)
                 {
                     u16 color = vram[i];
@@ -845,6 +888,12 @@ void GPU2D::DrawScanline(u32 line)
 
     case 3: // FIFO display
         {
+            if (Kernels)
+            {
+                Kernels->Expand555(dst, DispFIFOBuffer);
+                break;
+            }
+
             for (int i = 0; i < 256; i++)
             {
                 u16 color = DispFIFOBuffer[i];
@@ -889,9 +938,14 @@ void GPU2D::DrawScanline(u32 line)
             u32 factor = MasterBrightness & 0x1F;
             if (factor > 16) factor = 16;
 
-            for (int i = 0; i < 256; i++)
+            if (Kernels)
+                Kernels->BrightnessUp(dst, factor);
+            else
             {
-                dst[i] = ColorBrightnessUp(dst[i], factor);
+                for (int i = 0; i < 256; i++)
+                {
+                    dst[i] = ColorBrightnessUp(dst[i], factor);
+                }
             }
         }
         else if ((MasterBrightness >> 14) == 2)
@@ -900,9 +954,14 @@ void GPU2D::DrawScanline(u32 line)
             u32 factor = MasterBrightness & 0x1F;
             if (factor > 16) factor = 16;
 
-            for (int i = 0; i < 256; i++)
+            if (Kernels)
+                Kernels->BrightnessDown(dst, factor);
+            else
             {
-                dst[i] = ColorBrightnessDown(dst[i], factor);
+                for (int i = 0; i < 256; i++)
+                {
+                    dst[i] = ColorBrightnessDown(dst[i], factor);
+                }
             }
         }
     }
@@ -910,6 +969,12 @@ void GPU2D::DrawScanline(u32 line)
     // convert to 32-bit BGRA
     // note: 32-bit RGBA would be more straightforward, but
     // BGRA seems to be more compatible (Direct2D soft, cairo...)
+    if (Kernels)
+    {
+        Kernels->ConvertBGRA(dst);
+        return;
+    }
+
     for (int i = 0; i < 256; i+=2)
     {
         u64 c = *(u64*)&dst[i];
@@ -1062,6 +1127,8 @@ void GPU2D::DoCapture(u32 line, u32 width)
     dstaddr &= 0xFFFF;
     srcBaddr &= 0xFFFF;
 
+    GPU::MarkVRAMRange(dstvram, dstaddr << 1, width << 1);
+
     switch ((CaptureCnt >> 29) & 0x3)
     {
     case 0: // source A
@@ -1201,6 +1268,51 @@ void GPU2D::OBJExtPalDirty()
 }
 
 
+void GPU2D::InvalidateBGTileCache()
+{
+    memset(BGTileCache, 0, sizeof(BGTileCache));
+    BGTileCacheGen = GPU::VRAMGen;
+}
+
+GPU2D::BGTileRow* GPU2D::GetBGTileRow(u32 bgnum, u32 addr, bool hflip, bool bpp8)
+{
+    u32 tag = addr | (hflip ? 0x1 : 0) | (bpp8 ? 0x2 : 0);
+
+    // the rows of one scanline are all at the same Y within their tiles,
+    // so the slot is picked by hashing the tile number together with the row
+    u32 key = addr >> (bpp8 ? 3 : 2); // tile number << 3 | row
+    u32 slot = ((key * 0x9E3779B1) >> 16) & (BGTileCacheSize-1);
+    BGTileRow* row = &BGTileCache[bgnum][slot];
+
+    if (row->Tag == tag)
+        return row;
+
+    u8 pixels[8];
+    if (bpp8)
+    {
+        u64 data = GPU::ReadVRAM_BG<u64>(addr);
+        for (int i = 0; i < 8; i++)
+            pixels[i] = data >> (i << 3);
+    }
+    else
+    {
+        u32 data = GPU::ReadVRAM_BG<u32>(addr);
+        for (int i = 0; i < 8; i++)
+            pixels[i] = (data >> (i << 2)) & 0xF;
+    }
+
+    row->Tag = tag;
+    row->Opaque = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        u8 color = pixels[hflip ? (7-i) : i];
+        row->Pixels[i] = color;
+        if (color) row->Opaque |= (1 << i);
+    }
+
+    return row;
+}
+
 u16* GPU2D::GetBGExtPal(u32 slot, u32 pal)
 {
     u16* dst = &BGExtPalCache[slot][pal << 8];
@@ -1270,6 +1382,12 @@ u16* GPU2D::GetOBJExtPal()
 }
 
 
+void GPU2D::StartScanline(u32 line)
+{
+    VCount = line;
+    CheckWindows(line);
+}
+
 void GPU2D::CheckWindows(u32 line)
 {
     line &= 0xFF;
@@ -1279,10 +1397,44 @@ void GPU2D::CheckWindows(u32 line)
     else if (line == Win1Coords[2]) Win1Active |=  0x1;
 }
 
+// a window's horizontal flag turns on at x1 and off at x2, and carries over
+// from one line to the next. this fills the spans where the window is active
+// instead of stepping through every pixel.
+void FillWindowSpans(u8* mask, u8 x1, u8 x2, u32& active, u8 val)
+{
+    u32 events[2];
+    int numevents = 0;
+
+    // when both match, only the 'off' one happens
+    if (x1 < x2)
+    {
+        events[numevents++] = x1;
+        events[numevents++] = x2;
+    }
+    else
+    {
+        events[numevents++] = x2;
+        if (x1 != x2) events[numevents++] = x1;
+    }
+
+    u32 start = 0;
+    for (int e = 0; e <= numevents; e++)
+    {
+        u32 end = (e < numevents) ? events[e] : 256;
+        if (active == 0x3 && end > start)
+            memset(&mask[start], val, end - start);
+
+        if (e == numevents) break;
+
+        if (end == x2) active &= ~0x2;
+        else           active |=  0x2;
+        start = end;
+    }
+}
+
 void GPU2D::CalculateWindowMask(u32 line)
 {
-    for (u32 i = 0; i < 256; i++)
-        WindowMask[i] = WinCnt[2]; // window outside
+    memset(WindowMask, WinCnt[2], 256); // window outside
 
     if (DispCnt & (1<<15))
     {
@@ -1297,31 +1449,13 @@ void GPU2D::CalculateWindowMask(u32 line)
     if (DispCnt & (1<<14))
     {
         // window 1
-        u8 x1 = Win1Coords[0];
-        u8 x2 = Win1Coords[1];
-
-        for (int i = 0; i < 256; i++)
-        {
-            if (i == x2)      Win1Active &= ~0x2;
-            else if (i == x1) Win1Active |=  0x2;
-
-            if (Win1Active == 0x3) WindowMask[i] = WinCnt[1];
-        }
+        FillWindowSpans(WindowMask, Win1Coords[0], Win1Coords[1], Win1Active, WinCnt[1]);
     }
 
     if (DispCnt & (1<<13))
     {
         // window 0
-        u8 x1 = Win0Coords[0];
-        u8 x2 = Win0Coords[1];
-
-        for (int i = 0; i < 256; i++)
-        {
-            if (i == x2)      Win0Active &= ~0x2;
-            else if (i == x1) Win0Active |=  0x2;
-
-            if (Win0Active == 0x3) WindowMask[i] = WinCnt[0];
-        }
+        FillWindowSpans(WindowMask, Win0Coords[0], Win0Coords[1], Win0Active, WinCnt[0]);
     }
 }
 
@@ -1488,6 +1622,33 @@ void GPU2D::DrawScanline_BGOBJ(u32 line)
             *(u64*)&BGOBJLine[i] = backdrop;
     }
 
+    // drop the decoded tile rows whose VRAM was changed since the last line
+    if (GPU::VRAMMapChanged(BGTileCacheGen))
+        InvalidateBGTileCache();
+    else
+    {
+        u32* map = Num ? GPU::VRAMMap_BBG : GPU::VRAMMap_ABG;
+        u32 numpages = Num ? 0x8 : 0x20;
+        u32 changed = 0;
+
+        for (u32 i = 0; i < numpages; i++)
+        {
+            if (GPU::VRAMBanksChanged(map[i], i << 14, 0x4000, BGTileCacheGen))
+                changed |= (1 << i);
+        }
+
+        if (changed)
+        {
+            BGTileRow* row = &BGTileCache[0][0];
+            for (int i = 0; i < 4*BGTileCacheSize; i++, row++)
+            {
+                if (changed & (1 << ((row->Tag >> 14) & (numpages-1))))
+                    row->Tag = 0;
+            }
+        }
+    }
+    BGTileCacheGen = GPU::VRAMGen;
+
     if (DispCnt & 0xE000)
         CalculateWindowMask(line);
     else
@@ -1508,16 +1669,20 @@ void GPU2D::DrawScanline_BGOBJ(u32 line)
     }
 
     // color special effects
-    // can likely be optimized
 
     if (!Accelerated)
     {
-        for (int i = 0; i < 256; i++)
+        if (Kernels)
+            Kernels->Composite(BGOBJLine, WindowMask, BlendCnt, EVA, EVB, EVY);
+        else
         {
-            u32 val1 = BGOBJLine[i];
-            u32 val2 = BGOBJLine[256+i];
+            for (int i = 0; i < 256; i++)
+            {
+                u32 val1 = BGOBJLine[i];
+                u32 val2 = BGOBJLine[256+i];
 
-            BGOBJLine[i] = ColorComposite(i, val1, val2);
+                BGOBJLine[i] = ColorComposite(i, val1, val2);
+            }
         }
     }
     else
@@ -1751,6 +1916,53 @@ void GPU2D::DrawBG_Text(u32 line, u32 bgnum)
     u8 color;
     u32 lastxpos;
 
+    if (!mosaic)
+    {
+        // without mosaic, every tile row is drawn as a whole
+        bool bpp8 = bgcnt & 0x0080;
+        u32 i = 0;
+        while (i < 256)
+        {
+            curtile = GPU::ReadVRAM_BG<u16>(tilemapaddr + ((xoff & 0xF8) >> 2) + ((xoff & widexmask) << 3));
+
+            if (bpp8)
+            {
+                if (extpal) curpal = GetBGExtPal(extpalslot, curtile>>12);
+                else        curpal = pal;
+
+                pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 6)
+                                         + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 3);
+            }
+            else
+            {
+                curpal = pal + ((curtile & 0xF000) >> 8);
+                pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 5)
+                                         + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 2);
+            }
+
+            BGTileRow* row = GetBGTileRow(bgnum, pixelsaddr, curtile & 0x0400, bpp8);
+
+            u32 start = xoff & 0x7;
+            u32 num = 8 - start;
+            if (num > 256 - i) num = 256 - i;
+
+            u32 opaque = (row->Opaque >> start) & ((1 << num) - 1);
+            while (opaque)
+            {
+                u32 x = __builtin_ctz(opaque);
+                opaque &= ~(1 << x);
+
+                if (WindowMask[i+x] & (1<<bgnum))
+                    drawPixel(&BGOBJLine[i+x], curpal[row->Pixels[start+x]], 0x01000000<<bgnum);
+            }
+
+            i += num;
+            xoff += num;
+        }
+
+        return;
+    }
+
     if (bgcnt & 0x0080)
     {
         // 256-color
@@ -19,6 +19,8 @@
 #ifndef GPU2D_H
 #define GPU2D_H
 
+#include "GPU2D_Kernels.h"
+
 class GPU2D
 {
 public:
@@ -40,6 +42,11 @@ public:
     void Write16(u32 addr, u16 val);
     void Write32(u32 addr, u32 val);
 
+    // apply register writes directly, bypassing the 2D thread's queue
+    void WriteReg8(u32 addr, u8 val);
+    void WriteReg16(u32 addr, u16 val);
+    void WriteReg32(u32 addr, u32 val);
+
     bool UsesFIFO()
     {
         if (((DispCnt >> 16) & 0x3) == 3)
@@ -57,6 +64,7 @@ public:
     void VBlank();
     void VBlankEnd();
 
+    void StartScanline(u32 line);
     void CheckWindows(u32 line);
 
     void BGExtPalDirty(u32 base);
@@ -72,6 +80,10 @@ private:
 
     bool Accelerated;
 
+    const GPU2D_Kernels::KernelSet* Kernels;
+
+    u32 VCount; // latched at scanline start, the 2D thread may lag behind GPU::VCount
+
     u32 BGOBJLine[256*3] __attribute__((aligned (8)));
     u32* _3DLine;
 
@@ -132,6 +144,21 @@ private:
     u32 BGExtPalStatus[4];
     u32 OBJExtPalStatus;
 
+    // decoded text BG tile rows, palette indices already flipped
+    struct BGTileRow
+    {
+        u32 Tag; // row address | hflip | 8bpp<<1, 0 if unused
+        u8 Pixels[8];
+        u32 Opaque; // bit set for every non-transparent pixel
+    };
+
+    static const u32 BGTileCacheSize = 256; // rows per BG
+    BGTileRow BGTileCache[4][BGTileCacheSize];
+    u32 BGTileCacheGen; // VRAM generation the cache was last checked against
+
+    void InvalidateBGTileCache();
+    BGTileRow* GetBGTileRow(u32 bgnum, u32 addr, bool hflip, bool bpp8);
+
     u32 ColorBlend4(u32 val1, u32 val2, u32 eva, u32 evb);
     u32 ColorBlend5(u32 val1, u32 val2);
     u32 ColorBrightnessUp(u32 val, u32 factor);
@@ -0,0 +1,629 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include "GPU2D_Kernels.h"
+
+#if defined(__x86_64__)
+#define SSE2_KERNELS
+#define AVX2_KERNELS
+#include <immintrin.h>
+#include "dolphin/CPUDetect.h"
+#ifdef __GNUC__
+#define AVX2_FUNC __attribute__((target("avx2")))
+#else
+#define AVX2_FUNC
+#endif
+#endif
+
+#if defined(__aarch64__)
+#define NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+
+/*
+    all the kernels keep the 18-bit colors the way GPU2D stores them, one
+    6-bit channel per byte, and split them in two halves for the math:
+
+    * lo: red in the low 16 bits, blue in the high 16 bits (color & 0x3F003F)
+    * hi: green in the low 16 bits ((color >> 8) & 0x3F003F)
+
+    this way every channel gets its own 16-bit lane, and the blending and
+    brightness formulas work the same way as the scalar ones, without the
+    clamping tricks. the high half of 'hi' holds junk, it's dropped when the
+    halves are put back together.
+*/
+
+namespace GPU2D_Kernels
+{
+
+#ifdef SSE2_KERNELS
+
+inline __m128i SSE2_Select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// all ones in the lanes where (val & bits) != 0
+inline __m128i SSE2_Test(__m128i val, u32 bits)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i ret = _mm_cmpeq_epi32(_mm_and_si128(val, _mm_set1_epi32(bits)), zero);
+    return _mm_xor_si128(ret, _mm_cmpeq_epi32(zero, zero));
+}
+
+inline __m128i SSE2_Pack(__m128i lo, __m128i hi)
+{
+    hi = _mm_slli_epi32(_mm_and_si128(hi, _mm_set1_epi32(0xFFFF)), 8);
+    return _mm_or_si128(_mm_or_si128(lo, hi), _mm_set1_epi32(0xFF000000));
+}
+
+template <int shift>
+inline __m128i SSE2_Mix(__m128i c1, __m128i c2, __m128i eva, __m128i evb, __m128i bias)
+{
+    __m128i ret = _mm_add_epi16(_mm_mullo_epi16(c1, eva), _mm_mullo_epi16(c2, evb));
+    ret = _mm_add_epi16(_mm_srli_epi16(ret, shift), bias);
+    return _mm_min_epi16(ret, _mm_set1_epi16(0x3F));
+}
+
+inline __m128i SSE2_Up(__m128i c, __m128i factor)
+{
+    __m128i diff = _mm_sub_epi16(_mm_set1_epi16(0x3F), c);
+    return _mm_add_epi16(c, _mm_srli_epi16(_mm_mullo_epi16(diff, factor), 4));
+}
+
+inline __m128i SSE2_Down(__m128i c, __m128i factor)
+{
+    return _mm_sub_epi16(c, _mm_srli_epi16(_mm_mullo_epi16(c, factor), 4));
+}
+
+// per-pixel factor from the low 16 bits of each lane to both halves
+inline __m128i SSE2_Spread(__m128i val)
+{
+    return _mm_or_si128(val, _mm_slli_epi32(val, 16));
+}
+
+void SSE2_Composite(u32* line, const u8* windowmask, u32 blendcnt, u32 eva, u32 evb, u32 evy)
+{
+    const __m128i chanmask = _mm_set1_epi32(0x003F003F);
+    const __m128i target1 = _mm_set1_epi32(blendcnt & 0x3F);
+    const __m128i target2 = _mm_set1_epi32((blendcnt >> 8) & 0x3F);
+    const __m128i obj = _mm_set1_epi32(0x10);
+    const __m128i bg0 = _mm_set1_epi32(0x01);
+    const __m128i factor = _mm_set1_epi16(evy);
+    const u32 effect = (blendcnt >> 6) & 0x3;
+
+    for (int i = 0; i < 256; i += 4)
+    {
+        __m128i val1 = _mm_loadu_si128((__m128i*)&line[i]);
+        __m128i val2 = _mm_loadu_si128((__m128i*)&line[256+i]);
+        __m128i flag1 = _mm_srli_epi32(val1, 24);
+        __m128i flag2 = _mm_srli_epi32(val2, 24);
+
+        __m128i obj1 = SSE2_Test(flag1, 0x80);
+        __m128i _3d1 = SSE2_Test(flag1, 0x40);
+        __m128i layer1 = SSE2_Select(obj1, obj, SSE2_Select(_3d1, bg0, _mm_and_si128(flag1, _mm_set1_epi32(0x3F))));
+        __m128i layer2 = SSE2_Select(SSE2_Test(flag2, 0x80), obj,
+                         SSE2_Select(SSE2_Test(flag2, 0x40), bg0, _mm_and_si128(flag2, _mm_set1_epi32(0x3F))));
+
+        __m128i blend2 = SSE2_Test(_mm_and_si128(layer2, target2), 0x3F);
+
+        __m128i win = _mm_cvtsi32_si128(*(u32*)&windowmask[i]);
+        win = _mm_unpacklo_epi16(_mm_unpacklo_epi8(win, _mm_setzero_si128()), _mm_setzero_si128());
+
+        // sprite blending, 3D layer blending, then BLDCNT effects
+        __m128i objblend = _mm_and_si128(obj1, blend2);
+        __m128i _3dblend = _mm_andnot_si128(obj1, _mm_and_si128(_3d1, blend2));
+        __m128i fx = _mm_and_si128(SSE2_Test(_mm_and_si128(layer1, target1), 0x3F), SSE2_Test(win, 0x20));
+        fx = _mm_andnot_si128(_mm_or_si128(objblend, _3dblend), fx);
+
+        __m128i lo1 = _mm_and_si128(val1, chanmask);
+        __m128i hi1 = _mm_and_si128(_mm_srli_epi32(val1, 8), chanmask);
+        __m128i lo2 = _mm_and_si128(val2, chanmask);
+        __m128i hi2 = _mm_and_si128(_mm_srli_epi32(val2, 8), chanmask);
+
+        __m128i ret = val1;
+
+        // 3D layer: alpha blending with the 3D alpha
+        {
+            __m128i eva5 = _mm_add_epi32(_mm_and_si128(flag1, _mm_set1_epi32(0x1F)), _mm_set1_epi32(1));
+            __m128i evb5 = _mm_sub_epi32(_mm_set1_epi32(32), eva5);
+            __m128i bias = _mm_and_si128(_mm_cmplt_epi32(eva5, _mm_set1_epi32(17)), _mm_set1_epi32(0x00010001));
+            eva5 = SSE2_Spread(eva5);
+            evb5 = SSE2_Spread(evb5);
+
+            __m128i blend = SSE2_Pack(SSE2_Mix<5>(lo1, lo2, eva5, evb5, bias),
+                                      SSE2_Mix<5>(hi1, hi2, eva5, evb5, bias));
+
+            // full alpha leaves the pixel alone
+            __m128i mask = _mm_andnot_si128(_mm_cmpeq_epi32(evb5, _mm_setzero_si128()), _3dblend);
+            ret = SSE2_Select(mask, blend, ret);
+        }
+
+        // sprites and regular alpha blending
+        __m128i mask4 = objblend;
+        if (effect == 1) mask4 = _mm_or_si128(mask4, _mm_and_si128(fx, blend2));
+        {
+            __m128i bitmap = _mm_and_si128(objblend, _3d1);
+            __m128i eva4 = SSE2_Select(bitmap, _mm_and_si128(flag1, _mm_set1_epi32(0x1F)), _mm_set1_epi32(eva));
+            __m128i evb4 = SSE2_Select(bitmap, _mm_sub_epi32(_mm_set1_epi32(16), eva4), _mm_set1_epi32(evb));
+            eva4 = SSE2_Spread(eva4);
+            evb4 = SSE2_Spread(evb4);
+
+            __m128i zero = _mm_setzero_si128();
+            __m128i blend = SSE2_Pack(SSE2_Mix<4>(lo1, lo2, eva4, evb4, zero),
+                                      SSE2_Mix<4>(hi1, hi2, eva4, evb4, zero));
+            ret = SSE2_Select(mask4, blend, ret);
+        }
+
+        if (effect == 2)
+            ret = SSE2_Select(fx, SSE2_Pack(SSE2_Up(lo1, factor), SSE2_Up(hi1, factor)), ret);
+        else if (effect == 3)
+            ret = SSE2_Select(fx, SSE2_Pack(SSE2_Down(lo1, factor), SSE2_Down(hi1, factor)), ret);
+
+        _mm_storeu_si128((__m128i*)&line[i], ret);
+    }
+}
+
+void SSE2_BrightnessUp(u32* dst, u32 factor)
+{
+    const __m128i chanmask = _mm_set1_epi32(0x003F003F);
+    const __m128i f = _mm_set1_epi16(factor);
+
+    for (int i = 0; i < 256; i += 4)
+    {
+        __m128i c = _mm_loadu_si128((__m128i*)&dst[i]);
+        __m128i lo = _mm_and_si128(c, chanmask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(c, 8), chanmask);
+        _mm_storeu_si128((__m128i*)&dst[i], SSE2_Pack(SSE2_Up(lo, f), SSE2_Up(hi, f)));
+    }
+}
+
+void SSE2_BrightnessDown(u32* dst, u32 factor)
+{
+    const __m128i chanmask = _mm_set1_epi32(0x003F003F);
+    const __m128i f = _mm_set1_epi16(factor);
+
+    for (int i = 0; i < 256; i += 4)
+    {
+        __m128i c = _mm_loadu_si128((__m128i*)&dst[i]);
+        __m128i lo = _mm_and_si128(c, chanmask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(c, 8), chanmask);
+        _mm_storeu_si128((__m128i*)&dst[i], SSE2_Pack(SSE2_Down(lo, f), SSE2_Down(hi, f)));
+    }
+}
+
+inline __m128i SSE2_Expand(__m128i c)
+{
+    __m128i r = _mm_slli_epi32(_mm_and_si128(c, _mm_set1_epi32(0x001F)), 1);
+    __m128i g = _mm_slli_epi32(_mm_and_si128(c, _mm_set1_epi32(0x03E0)), 4);
+    __m128i b = _mm_slli_epi32(_mm_and_si128(c, _mm_set1_epi32(0x7C00)), 7);
+    return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+void SSE2_Expand555(u32* dst, const u16* src)
+{
+    for (int i = 0; i < 256; i += 8)
+    {
+        __m128i c = _mm_loadu_si128((__m128i*)&src[i]);
+        _mm_storeu_si128((__m128i*)&dst[i],   SSE2_Expand(_mm_unpacklo_epi16(c, _mm_setzero_si128())));
+        _mm_storeu_si128((__m128i*)&dst[i+4], SSE2_Expand(_mm_unpackhi_epi16(c, _mm_setzero_si128())));
+    }
+}
+
+void SSE2_ConvertBGRA(u32* dst)
+{
+    for (int i = 0; i < 256; i += 4)
+    {
+        __m128i c = _mm_loadu_si128((__m128i*)&dst[i]);
+
+        __m128i r = _mm_and_si128(_mm_slli_epi32(c, 18), _mm_set1_epi32(0xFC0000));
+        __m128i g = _mm_and_si128(_mm_slli_epi32(c, 2), _mm_set1_epi32(0xFC00));
+        __m128i b = _mm_and_si128(_mm_srli_epi32(c, 14), _mm_set1_epi32(0xFC));
+        c = _mm_or_si128(_mm_or_si128(r, g), b);
+
+        __m128i low = _mm_srli_epi32(_mm_and_si128(c, _mm_set1_epi32(0xC0C0C0)), 6);
+        c = _mm_or_si128(_mm_or_si128(c, low), _mm_set1_epi32(0xFF000000));
+
+        _mm_storeu_si128((__m128i*)&dst[i], c);
+    }
+}
+
+const KernelSet Kernels_SSE2 = {SSE2_Composite, SSE2_BrightnessUp, SSE2_BrightnessDown, SSE2_Expand555, SSE2_ConvertBGRA};
+
+#endif // SSE2_KERNELS
+
+#ifdef AVX2_KERNELS
+
+AVX2_FUNC inline __m256i AVX2_Select(__m256i mask, __m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+AVX2_FUNC inline __m256i AVX2_Test(__m256i val, u32 bits)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i ret = _mm256_cmpeq_epi32(_mm256_and_si256(val, _mm256_set1_epi32(bits)), zero);
+    return _mm256_xor_si256(ret, _mm256_cmpeq_epi32(zero, zero));
+}
+
+AVX2_FUNC inline __m256i AVX2_Pack(__m256i lo, __m256i hi)
+{
+    hi = _mm256_slli_epi32(_mm256_and_si256(hi, _mm256_set1_epi32(0xFFFF)), 8);
+    return _mm256_or_si256(_mm256_or_si256(lo, hi), _mm256_set1_epi32(0xFF000000));
+}
+
+template <int shift>
+AVX2_FUNC inline __m256i AVX2_Mix(__m256i c1, __m256i c2, __m256i eva, __m256i evb, __m256i bias)
+{
+    __m256i ret = _mm256_add_epi16(_mm256_mullo_epi16(c1, eva), _mm256_mullo_epi16(c2, evb));
+    ret = _mm256_add_epi16(_mm256_srli_epi16(ret, shift), bias);
+    return _mm256_min_epi16(ret, _mm256_set1_epi16(0x3F));
+}
+
+AVX2_FUNC inline __m256i AVX2_Up(__m256i c, __m256i factor)
+{
+    __m256i diff = _mm256_sub_epi16(_mm256_set1_epi16(0x3F), c);
+    return _mm256_add_epi16(c, _mm256_srli_epi16(_mm256_mullo_epi16(diff, factor), 4));
+}
+
+AVX2_FUNC inline __m256i AVX2_Down(__m256i c, __m256i factor)
+{
+    return _mm256_sub_epi16(c, _mm256_srli_epi16(_mm256_mullo_epi16(c, factor), 4));
+}
+
+AVX2_FUNC inline __m256i AVX2_Spread(__m256i val)
+{
+    return _mm256_or_si256(val, _mm256_slli_epi32(val, 16));
+}
+
+AVX2_FUNC void AVX2_Composite(u32* line, const u8* windowmask, u32 blendcnt, u32 eva, u32 evb, u32 evy)
+{
+    const __m256i chanmask = _mm256_set1_epi32(0x003F003F);
+    const __m256i target1 = _mm256_set1_epi32(blendcnt & 0x3F);
+    const __m256i target2 = _mm256_set1_epi32((blendcnt >> 8) & 0x3F);
+    const __m256i obj = _mm256_set1_epi32(0x10);
+    const __m256i bg0 = _mm256_set1_epi32(0x01);
+    const __m256i factor = _mm256_set1_epi16(evy);
+    const u32 effect = (blendcnt >> 6) & 0x3;
+
+    for (int i = 0; i < 256; i += 8)
+    {
+        __m256i val1 = _mm256_loadu_si256((__m256i*)&line[i]);
+        __m256i val2 = _mm256_loadu_si256((__m256i*)&line[256+i]);
+        __m256i flag1 = _mm256_srli_epi32(val1, 24);
+        __m256i flag2 = _mm256_srli_epi32(val2, 24);
+
+        __m256i obj1 = AVX2_Test(flag1, 0x80);
+        __m256i _3d1 = AVX2_Test(flag1, 0x40);
+        __m256i layer1 = AVX2_Select(obj1, obj, AVX2_Select(_3d1, bg0, _mm256_and_si256(flag1, _mm256_set1_epi32(0x3F))));
+        __m256i layer2 = AVX2_Select(AVX2_Test(flag2, 0x80), obj,
+                         AVX2_Select(AVX2_Test(flag2, 0x40), bg0, _mm256_and_si256(flag2, _mm256_set1_epi32(0x3F))));
+
+        __m256i blend2 = AVX2_Test(_mm256_and_si256(layer2, target2), 0x3F);
+
+        __m256i win = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)&windowmask[i]));
+
+        __m256i objblend = _mm256_and_si256(obj1, blend2);
+        __m256i _3dblend = _mm256_andnot_si256(obj1, _mm256_and_si256(_3d1, blend2));
+        __m256i fx = _mm256_and_si256(AVX2_Test(_mm256_and_si256(layer1, target1), 0x3F), AVX2_Test(win, 0x20));
+        fx = _mm256_andnot_si256(_mm256_or_si256(objblend, _3dblend), fx);
+
+        __m256i lo1 = _mm256_and_si256(val1, chanmask);
+        __m256i hi1 = _mm256_and_si256(_mm256_srli_epi32(val1, 8), chanmask);
+        __m256i lo2 = _mm256_and_si256(val2, chanmask);
+        __m256i hi2 = _mm256_and_si256(_mm256_srli_epi32(val2, 8), chanmask);
+
+        __m256i ret = val1;
+
+        {
+            __m256i eva5 = _mm256_add_epi32(_mm256_and_si256(flag1, _mm256_set1_epi32(0x1F)), _mm256_set1_epi32(1));
+            __m256i evb5 = _mm256_sub_epi32(_mm256_set1_epi32(32), eva5);
+            __m256i bias = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(17), eva5), _mm256_set1_epi32(0x00010001));
+            eva5 = AVX2_Spread(eva5);
+            evb5 = AVX2_Spread(evb5);
+
+            __m256i blend = AVX2_Pack(AVX2_Mix<5>(lo1, lo2, eva5, evb5, bias),
+                                      AVX2_Mix<5>(hi1, hi2, eva5, evb5, bias));
+
+            __m256i mask = _mm256_andnot_si256(_mm256_cmpeq_epi32(evb5, _mm256_setzero_si256()), _3dblend);
+            ret = AVX2_Select(mask, blend, ret);
+        }
+
+        __m256i mask4 = objblend;
+        if (effect == 1) mask4 = _mm256_or_si256(mask4, _mm256_and_si256(fx, blend2));
+        {
+            __m256i bitmap = _mm256_and_si256(objblend, _3d1);
+            __m256i eva4 = AVX2_Select(bitmap, _mm256_and_si256(flag1, _mm256_set1_epi32(0x1F)), _mm256_set1_epi32(eva));
+            __m256i evb4 = AVX2_Select(bitmap, _mm256_sub_epi32(_mm256_set1_epi32(16), eva4), _mm256_set1_epi32(evb));
+            eva4 = AVX2_Spread(eva4);
+            evb4 = AVX2_Spread(evb4);
+
+            __m256i zero = _mm256_setzero_si256();
+            __m256i blend = AVX2_Pack(AVX2_Mix<4>(lo1, lo2, eva4, evb4, zero),
+                                      AVX2_Mix<4>(hi1, hi2, eva4, evb4, zero));
+            ret = AVX2_Select(mask4, blend, ret);
+        }
+
+        if (effect == 2)
+            ret = AVX2_Select(fx, AVX2_Pack(AVX2_Up(lo1, factor), AVX2_Up(hi1, factor)), ret);
+        else if (effect == 3)
+            ret = AVX2_Select(fx, AVX2_Pack(AVX2_Down(lo1, factor), AVX2_Down(hi1, factor)), ret);
+
+        _mm256_storeu_si256((__m256i*)&line[i], ret);
+    }
+}
+
+AVX2_FUNC void AVX2_BrightnessUp(u32* dst, u32 factor)
+{
+    const __m256i chanmask = _mm256_set1_epi32(0x003F003F);
+    const __m256i f = _mm256_set1_epi16(factor);
+
+    for (int i = 0; i < 256; i += 8)
+    {
+        __m256i c = _mm256_loadu_si256((__m256i*)&dst[i]);
+        __m256i lo = _mm256_and_si256(c, chanmask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(c, 8), chanmask);
+        _mm256_storeu_si256((__m256i*)&dst[i], AVX2_Pack(AVX2_Up(lo, f), AVX2_Up(hi, f)));
+    }
+}
+
+AVX2_FUNC void AVX2_BrightnessDown(u32* dst, u32 factor)
+{
+    const __m256i chanmask = _mm256_set1_epi32(0x003F003F);
+    const __m256i f = _mm256_set1_epi16(factor);
+
+    for (int i = 0; i < 256; i += 8)
+    {
+        __m256i c = _mm256_loadu_si256((__m256i*)&dst[i]);
+        __m256i lo = _mm256_and_si256(c, chanmask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(c, 8), chanmask);
+        _mm256_storeu_si256((__m256i*)&dst[i], AVX2_Pack(AVX2_Down(lo, f), AVX2_Down(hi, f)));
+    }
+}
+
+AVX2_FUNC void AVX2_Expand555(u32* dst, const u16* src)
+{
+    for (int i = 0; i < 256; i += 8)
+    {
+        __m256i c = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)&src[i]));
+
+        __m256i r = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0x001F)), 1);
+        __m256i g = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0x03E0)), 4);
+        __m256i b = _mm256_slli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0x7C00)), 7);
+
+        _mm256_storeu_si256((__m256i*)&dst[i], _mm256_or_si256(_mm256_or_si256(r, g), b));
+    }
+}
+
+AVX2_FUNC void AVX2_ConvertBGRA(u32* dst)
+{
+    for (int i = 0; i < 256; i += 8)
+    {
+        __m256i c = _mm256_loadu_si256((__m256i*)&dst[i]);
+
+        __m256i r = _mm256_and_si256(_mm256_slli_epi32(c, 18), _mm256_set1_epi32(0xFC0000));
+        __m256i g = _mm256_and_si256(_mm256_slli_epi32(c, 2), _mm256_set1_epi32(0xFC00));
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(c, 14), _mm256_set1_epi32(0xFC));
+        c = _mm256_or_si256(_mm256_or_si256(r, g), b);
+
+        __m256i low = _mm256_srli_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0xC0C0C0)), 6);
+        c = _mm256_or_si256(_mm256_or_si256(c, low), _mm256_set1_epi32(0xFF000000));
+
+        _mm256_storeu_si256((__m256i*)&dst[i], c);
+    }
+}
+
+const KernelSet Kernels_AVX2 = {AVX2_Composite, AVX2_BrightnessUp, AVX2_BrightnessDown, AVX2_Expand555, AVX2_ConvertBGRA};
+
+#endif // AVX2_KERNELS
+
+#ifdef NEON_KERNELS
+
+inline uint32x4_t NEON_Pack(uint16x8_t lo, uint16x8_t hi)
+{
+    uint32x4_t g = vshlq_n_u32(vandq_u32(vreinterpretq_u32_u16(hi), vdupq_n_u32(0xFFFF)), 8);
+    return vorrq_u32(vorrq_u32(vreinterpretq_u32_u16(lo), g), vdupq_n_u32(0xFF000000));
+}
+
+template <int shift>
+inline uint16x8_t NEON_Mix(uint16x8_t c1, uint16x8_t c2, uint16x8_t eva, uint16x8_t evb, uint16x8_t bias)
+{
+    uint16x8_t ret = vmlaq_u16(vmulq_u16(c1, eva), c2, evb);
+    ret = vaddq_u16(vshrq_n_u16(ret, shift), bias);
+    return vminq_u16(ret, vdupq_n_u16(0x3F));
+}
+
+inline uint16x8_t NEON_Up(uint16x8_t c, uint16x8_t factor)
+{
+    uint16x8_t diff = vsubq_u16(vdupq_n_u16(0x3F), c);
+    return vaddq_u16(c, vshrq_n_u16(vmulq_u16(diff, factor), 4));
+}
+
+inline uint16x8_t NEON_Down(uint16x8_t c, uint16x8_t factor)
+{
+    return vsubq_u16(c, vshrq_n_u16(vmulq_u16(c, factor), 4));
+}
+
+inline uint16x8_t NEON_Spread(uint32x4_t val)
+{
+    return vreinterpretq_u16_u32(vorrq_u32(val, vshlq_n_u32(val, 16)));
+}
+
+inline uint16x8_t NEON_Lo(uint32x4_t c)
+{
+    return vreinterpretq_u16_u32(vandq_u32(c, vdupq_n_u32(0x003F003F)));
+}
+
+inline uint16x8_t NEON_Hi(uint32x4_t c)
+{
+    return vreinterpretq_u16_u32(vandq_u32(vshrq_n_u32(c, 8), vdupq_n_u32(0x003F003F)));
+}
+
+void NEON_Composite(u32* line, const u8* windowmask, u32 blendcnt, u32 eva, u32 evb, u32 evy)
+{
+    const uint32x4_t target1 = vdupq_n_u32(blendcnt & 0x3F);
+    const uint32x4_t target2 = vdupq_n_u32((blendcnt >> 8) & 0x3F);
+    const uint32x4_t obj = vdupq_n_u32(0x10);
+    const uint32x4_t bg0 = vdupq_n_u32(0x01);
+    const uint16x8_t factor = vdupq_n_u16(evy);
+    const u32 effect = (blendcnt >> 6) & 0x3;
+
+    for (int i = 0; i < 256; i += 4)
+    {
+        uint32x4_t val1 = vld1q_u32(&line[i]);
+        uint32x4_t val2 = vld1q_u32(&line[256+i]);
+        uint32x4_t flag1 = vshrq_n_u32(val1, 24);
+        uint32x4_t flag2 = vshrq_n_u32(val2, 24);
+
+        uint32x4_t obj1 = vtstq_u32(flag1, vdupq_n_u32(0x80));
+        uint32x4_t _3d1 = vtstq_u32(flag1, vdupq_n_u32(0x40));
+        uint32x4_t layer1 = vbslq_u32(obj1, obj, vbslq_u32(_3d1, bg0, vandq_u32(flag1, vdupq_n_u32(0x3F))));
+        uint32x4_t layer2 = vbslq_u32(vtstq_u32(flag2, vdupq_n_u32(0x80)), obj,
+                            vbslq_u32(vtstq_u32(flag2, vdupq_n_u32(0x40)), bg0, vandq_u32(flag2, vdupq_n_u32(0x3F))));
+
+        uint32x4_t blend2 = vtstq_u32(layer2, target2);
+
+        u32 win4;
+        memcpy(&win4, &windowmask[i], 4);
+        uint32x4_t win = vmovl_u16(vget_low_u16(vmovl_u8(vcreate_u8(win4))));
+
+        uint32x4_t objblend = vandq_u32(obj1, blend2);
+        uint32x4_t _3dblend = vbicq_u32(vandq_u32(_3d1, blend2), obj1);
+        uint32x4_t fx = vandq_u32(vtstq_u32(layer1, target1), vtstq_u32(win, vdupq_n_u32(0x20)));
+        fx = vbicq_u32(fx, vorrq_u32(objblend, _3dblend));
+
+        uint16x8_t lo1 = NEON_Lo(val1), hi1 = NEON_Hi(val1);
+        uint16x8_t lo2 = NEON_Lo(val2), hi2 = NEON_Hi(val2);
+
+        uint32x4_t ret = val1;
+
+        {
+            uint32x4_t eva5 = vaddq_u32(vandq_u32(flag1, vdupq_n_u32(0x1F)), vdupq_n_u32(1));
+            uint32x4_t evb5 = vsubq_u32(vdupq_n_u32(32), eva5);
+            uint32x4_t bias = vandq_u32(vcltq_u32(eva5, vdupq_n_u32(17)), vdupq_n_u32(0x00010001));
+
+            uint32x4_t blend = NEON_Pack(NEON_Mix<5>(lo1, lo2, NEON_Spread(eva5), NEON_Spread(evb5), vreinterpretq_u16_u32(bias)),
+                                         NEON_Mix<5>(hi1, hi2, NEON_Spread(eva5), NEON_Spread(evb5), vreinterpretq_u16_u32(bias)));
+
+            uint32x4_t mask = vbicq_u32(_3dblend, vceqq_u32(evb5, vdupq_n_u32(0)));
+            ret = vbslq_u32(mask, blend, ret);
+        }
+
+        uint32x4_t mask4 = objblend;
+        if (effect == 1) mask4 = vorrq_u32(mask4, vandq_u32(fx, blend2));
+        {
+            uint32x4_t bitmap = vandq_u32(objblend, _3d1);
+            uint32x4_t eva4 = vbslq_u32(bitmap, vandq_u32(flag1, vdupq_n_u32(0x1F)), vdupq_n_u32(eva));
+            uint32x4_t evb4 = vbslq_u32(bitmap, vsubq_u32(vdupq_n_u32(16), eva4), vdupq_n_u32(evb));
+
+            uint16x8_t zero = vdupq_n_u16(0);
+            uint32x4_t blend = NEON_Pack(NEON_Mix<4>(lo1, lo2, NEON_Spread(eva4), NEON_Spread(evb4), zero),
+                                         NEON_Mix<4>(hi1, hi2, NEON_Spread(eva4), NEON_Spread(evb4), zero));
+            ret = vbslq_u32(mask4, blend, ret);
+        }
+
+        if (effect == 2)
+            ret = vbslq_u32(fx, NEON_Pack(NEON_Up(lo1, factor), NEON_Up(hi1, factor)), ret);
+        else if (effect == 3)
+            ret = vbslq_u32(fx, NEON_Pack(NEON_Down(lo1, factor), NEON_Down(hi1, factor)), ret);
+
+        vst1q_u32(&line[i], ret);
+    }
+}
+
+void NEON_BrightnessUp(u32* dst, u32 factor)
+{
+    const uint16x8_t f = vdupq_n_u16(factor);
+
+    for (int i = 0; i < 256; i += 4)
+    {
+        uint32x4_t c = vld1q_u32(&dst[i]);
+        vst1q_u32(&dst[i], NEON_Pack(NEON_Up(NEON_Lo(c), f), NEON_Up(NEON_Hi(c), f)));
+    }
+}
+
+void NEON_BrightnessDown(u32* dst, u32 factor)
+{
+    const uint16x8_t f = vdupq_n_u16(factor);
+
+    for (int i = 0; i < 256; i += 4)
+    {
+        uint32x4_t c = vld1q_u32(&dst[i]);
+        vst1q_u32(&dst[i], NEON_Pack(NEON_Down(NEON_Lo(c), f), NEON_Down(NEON_Hi(c), f)));
+    }
+}
+
+inline uint32x4_t NEON_Expand(uint32x4_t c)
+{
+    uint32x4_t r = vshlq_n_u32(vandq_u32(c, vdupq_n_u32(0x001F)), 1);
+    uint32x4_t g = vshlq_n_u32(vandq_u32(c, vdupq_n_u32(0x03E0)), 4);
+    uint32x4_t b = vshlq_n_u32(vandq_u32(c, vdupq_n_u32(0x7C00)), 7);
+    return vorrq_u32(vorrq_u32(r, g), b);
+}
+
+void NEON_Expand555(u32* dst, const u16* src)
+{
+    for (int i = 0; i < 256; i += 8)
+    {
+        uint16x8_t c = vld1q_u16(&src[i]);
+        vst1q_u32(&dst[i],   NEON_Expand(vmovl_u16(vget_low_u16(c))));
+        vst1q_u32(&dst[i+4], NEON_Expand(vmovl_u16(vget_high_u16(c))));
+    }
+}
+
+void NEON_ConvertBGRA(u32* dst)
+{
+    for (int i = 0; i < 256; i += 4)
+    {
+        uint32x4_t c = vld1q_u32(&dst[i]);
+
+        uint32x4_t r = vandq_u32(vshlq_n_u32(c, 18), vdupq_n_u32(0xFC0000));
+        uint32x4_t g = vandq_u32(vshlq_n_u32(c, 2), vdupq_n_u32(0xFC00));
+        uint32x4_t b = vandq_u32(vshrq_n_u32(c, 14), vdupq_n_u32(0xFC));
+        c = vorrq_u32(vorrq_u32(r, g), b);
+
+        uint32x4_t low = vshrq_n_u32(vandq_u32(c, vdupq_n_u32(0xC0C0C0)), 6);
+        vst1q_u32(&dst[i], vorrq_u32(vorrq_u32(c, low), vdupq_n_u32(0xFF000000)));
+    }
+}
+
+const KernelSet Kernels_NEON = {NEON_Composite, NEON_BrightnessUp, NEON_BrightnessDown, NEON_Expand555, NEON_ConvertBGRA};
+
+#endif // NEON_KERNELS
+
+const KernelSet* Detect()
+{
+#ifdef AVX2_KERNELS
+    if (cpu_info.bAVX2)
+        return &Kernels_AVX2;
+#endif
+
+#ifdef SSE2_KERNELS
+    return &Kernels_SSE2;
+#endif
+
+#ifdef NEON_KERNELS
+    return &Kernels_NEON;
+#endif
+
+    return nullptr;
+}
+
+}
@@ -0,0 +1,52 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef GPU2D_KERNELS_H
+#define GPU2D_KERNELS_H
+
+#include "types.h"
+
+namespace GPU2D_Kernels
+{
+
+// vectorized versions of the per-scanline passes of GPU2D
+// they all work on full 256 pixel lines, and give the exact same results as
+// the scalar code in GPU2D.cpp
+
+struct KernelSet
+{
+    // color special effects: line[i] = ColorComposite(i, line[i], line[256+i])
+    void (*Composite)(u32* line, const u8* windowmask, u32 blendcnt, u32 eva, u32 evb, u32 evy);
+
+    // master brightness, factor is 0-16
+    void (*BrightnessUp)(u32* dst, u32 factor);
+    void (*BrightnessDown)(u32* dst, u32 factor);
+
+    // 15-bit VRAM/FIFO colors to 18-bit
+    void (*Expand555)(u32* dst, const u16* src);
+
+    // 18-bit to 32-bit BGRA, in place
+    void (*ConvertBGRA)(u32* dst);
+};
+
+// returns the best set for this CPU, or nullptr if there is none
+const KernelSet* Detect();
+
+}
+
+#endif // GPU2D_KERNELS_H
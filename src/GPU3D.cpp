@@ -147,127 +147,127 @@ typedef union
 
 } CmdFIFOEntry;
 
-FIFO<CmdFIFOEntry>* CmdFIFO;
-FIFO<CmdFIFOEntry>* CmdPIPE;
+INSTANCE_LOCAL FIFO<CmdFIFOEntry>* CmdFIFO;
+INSTANCE_LOCAL FIFO<CmdFIFOEntry>* CmdPIPE;
 
-FIFO<CmdFIFOEntry>* CmdStallQueue;
+INSTANCE_LOCAL FIFO<CmdFIFOEntry>* CmdStallQueue;
 
-u32 NumCommands, CurCommand, ParamCount, TotalParams;
+INSTANCE_LOCAL u32 NumCommands, CurCommand, ParamCount, TotalParams;
 
-bool GeometryEnabled;
-bool RenderingEnabled;
+INSTANCE_LOCAL bool GeometryEnabled;
+INSTANCE_LOCAL bool RenderingEnabled;
 
-u32 DispCnt;
-u8 AlphaRefVal, AlphaRef;
+INSTANCE_LOCAL u32 DispCnt;
+INSTANCE_LOCAL u8 AlphaRefVal, AlphaRef;
 
-u16 ToonTable[32];
-u16 EdgeTable[8];
+INSTANCE_LOCAL u16 ToonTable[32];
+INSTANCE_LOCAL u16 EdgeTable[8];
 
-u32 FogColor, FogOffset;
-u8 FogDensityTable[32];
+INSTANCE_LOCAL u32 FogColor, FogOffset;
+INSTANCE_LOCAL u8 FogDensityTable[32];
 
-u32 ClearAttr1, ClearAttr2;
+INSTANCE_LOCAL u32 ClearAttr1, ClearAttr2;
 
-u32 RenderDispCnt;
-u8 RenderAlphaRef;
+INSTANCE_LOCAL u32 RenderDispCnt;
+INSTANCE_LOCAL u8 RenderAlphaRef;
 
-u16 RenderToonTable[32];
-u16 RenderEdgeTable[8];
+INSTANCE_LOCAL u16 RenderToonTable[32];
+INSTANCE_LOCAL u16 RenderEdgeTable[8];
 
-u32 RenderFogColor, RenderFogOffset, RenderFogShift;
-u8 RenderFogDensityTable[34];
+INSTANCE_LOCAL u32 RenderFogColor, RenderFogOffset, RenderFogShift;
+INSTANCE_LOCAL u8 RenderFogDensityTable[34];
 
-u32 RenderClearAttr1, RenderClearAttr2;
+INSTANCE_LOCAL u32 RenderClearAttr1, RenderClearAttr2;
 
-u32 ZeroDotWLimit;
+INSTANCE_LOCAL u32 ZeroDotWLimit;
 
-u32 GXStat;
+INSTANCE_LOCAL u32 GXStat;
 
-u32 ExecParams[32];
-u32 ExecParamCount;
+INSTANCE_LOCAL u32 ExecParams[32];
+INSTANCE_LOCAL u32 ExecParamCount;
 
-u64 Timestamp;
-s32 CycleCount;
-s32 VertexPipeline;
-s32 NormalPipeline;
-s32 PolygonPipeline;
-s32 VertexSlotCounter;
-u32 VertexSlotsFree;
+INSTANCE_LOCAL u64 Timestamp;
+INSTANCE_LOCAL s32 CycleCount;
+INSTANCE_LOCAL s32 VertexPipeline;
+INSTANCE_LOCAL s32 NormalPipeline;
+INSTANCE_LOCAL s32 PolygonPipeline;
+INSTANCE_LOCAL s32 VertexSlotCounter;
+INSTANCE_LOCAL u32 VertexSlotsFree;
 
-u32 NumPushPopCommands;
-u32 NumTestCommands;
+INSTANCE_LOCAL u32 NumPushPopCommands;
+INSTANCE_LOCAL u32 NumTestCommands;
 
 
-u32 MatrixMode;
+INSTANCE_LOCAL u32 MatrixMode;
 
-s32 ProjMatrix[16];
-s32 PosMatrix[16];
-s32 VecMatrix[16];
-s32 TexMatrix[16];
+INSTANCE_LOCAL s32 ProjMatrix[16];
+INSTANCE_LOCAL s32 PosMatrix[16];
+INSTANCE_LOCAL s32 VecMatrix[16];
+INSTANCE_LOCAL s32 TexMatrix[16];
 
-s32 ClipMatrix[16];
-bool ClipMatrixDirty;
+INSTANCE_LOCAL s32 ClipMatrix[16];
+INSTANCE_LOCAL bool ClipMatrixDirty;
 
-u32 Viewport[6];
+INSTANCE_LOCAL u32 Viewport[6];
 
-s32 ProjMatrixStack[16];
-s32 PosMatrixStack[32][16];
-s32 VecMatrixStack[32][16];
-s32 TexMatrixStack[16];
-s32 ProjMatrixStackPointer;
-s32 PosMatrixStackPointer;
-s32 TexMatrixStackPointer;
+INSTANCE_LOCAL s32 ProjMatrixStack[16];
+INSTANCE_LOCAL s32 PosMatrixStack[32][16];
+INSTANCE_LOCAL s32 VecMatrixStack[32][16];
+INSTANCE_LOCAL s32 TexMatrixStack[16];
+INSTANCE_LOCAL s32 ProjMatrixStackPointer;
+INSTANCE_LOCAL s32 PosMatrixStackPointer;
+INSTANCE_LOCAL s32 TexMatrixStackPointer;
 
 void MatrixLoadIdentity(s32* m);
 void UpdateClipMatrix();
 
 
-u32 PolygonMode;
-s16 CurVertex[3];
-u8 VertexColor[3];
-s16 TexCoords[2];
-s16 RawTexCoords[2];
-s16 Normal[3];
+INSTANCE_LOCAL u32 PolygonMode;
+INSTANCE_LOCAL s16 CurVertex[3];
+INSTANCE_LOCAL u8 VertexColor[3];
+INSTANCE_LOCAL s16 TexCoords[2];
+INSTANCE_LOCAL s16 RawTexCoords[2];
+INSTANCE_LOCAL s16 Normal[3];
 
-s16 LightDirection[4][3];
-u8 LightColor[4][3];
-u8 MatDiffuse[3];
-u8 MatAmbient[3];
-u8 MatSpecular[3];
-u8 MatEmission[3];
+INSTANCE_LOCAL s16 LightDirection[4][3];
+INSTANCE_LOCAL u8 LightColor[4][3];
+INSTANCE_LOCAL u8 MatDiffuse[3];
+INSTANCE_LOCAL u8 MatAmbient[3];
+INSTANCE_LOCAL u8 MatSpecular[3];
+INSTANCE_LOCAL u8 MatEmission[3];
 
-bool UseShininessTable;
-u8 ShininessTable[128];
+INSTANCE_LOCAL bool UseShininessTable;
+INSTANCE_LOCAL u8 ShininessTable[128];
 
-u32 PolygonAttr;
-u32 CurPolygonAttr;
+INSTANCE_LOCAL u32 PolygonAttr;
+INSTANCE_LOCAL u32 CurPolygonAttr;
 
-u32 TexParam;
-u32 TexPalette;
+INSTANCE_LOCAL u32 TexParam;
+INSTANCE_LOCAL u32 TexPalette;
 
-s32 PosTestResult[4];
-s16 VecTestResult[3];
+INSTANCE_LOCAL s32 PosTestResult[4];
+INSTANCE_LOCAL s16 VecTestResult[3];
 
-Vertex TempVertexBuffer[4];
-u32 VertexNum;
-u32 VertexNumInPoly;
-u32 NumConsecutivePolygons;
-Polygon* LastStripPolygon;
-u32 NumOpaquePolygons;
+INSTANCE_LOCAL Vertex TempVertexBuffer[4];
+INSTANCE_LOCAL u32 VertexNum;
+INSTANCE_LOCAL u32 VertexNumInPoly;
+INSTANCE_LOCAL u32 NumConsecutivePolygons;
+INSTANCE_LOCAL Polygon* LastStripPolygon;
+INSTANCE_LOCAL u32 NumOpaquePolygons;
 
-Vertex VertexRAM[6144 * 2];
-Polygon PolygonRAM[2048 * 2];
+INSTANCE_LOCAL Vertex VertexRAM[6144 * 2];
+INSTANCE_LOCAL Polygon PolygonRAM[2048 * 2];
 
-Vertex* CurVertexRAM;
-Polygon* CurPolygonRAM;
-u32 NumVertices, NumPolygons;
-u32 CurRAMBank;
+INSTANCE_LOCAL Vertex* CurVertexRAM;
+INSTANCE_LOCAL Polygon* CurPolygonRAM;
+INSTANCE_LOCAL u32 NumVertices, NumPolygons;
+INSTANCE_LOCAL u32 CurRAMBank;
 
-std::array<Polygon*,2048> RenderPolygonRAM;
-u32 RenderNumPolygons;
+INSTANCE_LOCAL std::array<Polygon*,2048> RenderPolygonRAM;
+INSTANCE_LOCAL u32 RenderNumPolygons;
 
-u32 FlushRequest;
-u32 FlushAttributes;
+INSTANCE_LOCAL u32 FlushRequest;
+INSTANCE_LOCAL u32 FlushAttributes;
 
 
 
@@ -76,21 +76,21 @@ typedef struct
 
 } Polygon;
 
-extern u32 RenderDispCnt;
-extern u8 RenderAlphaRef;
+extern INSTANCE_LOCAL u32 RenderDispCnt;
+extern INSTANCE_LOCAL u8 RenderAlphaRef;
 
-extern u16 RenderToonTable[32];
-extern u16 RenderEdgeTable[8];
+extern INSTANCE_LOCAL u16 RenderToonTable[32];
+extern INSTANCE_LOCAL u16 RenderEdgeTable[8];
 
-extern u32 RenderFogColor, RenderFogOffset, RenderFogShift;
-extern u8 RenderFogDensityTable[34];
+extern INSTANCE_LOCAL u32 RenderFogColor, RenderFogOffset, RenderFogShift;
+extern INSTANCE_LOCAL u8 RenderFogDensityTable[34];
 
-extern u32 RenderClearAttr1, RenderClearAttr2;
+extern INSTANCE_LOCAL u32 RenderClearAttr1, RenderClearAttr2;
 
-extern std::array<Polygon*,2048> RenderPolygonRAM;
-extern u32 RenderNumPolygons;
+extern INSTANCE_LOCAL std::array<Polygon*,2048> RenderPolygonRAM;
+extern INSTANCE_LOCAL u32 RenderNumPolygons;
 
-extern u64 Timestamp;
+extern INSTANCE_LOCAL u64 Timestamp;
 
 extern int Renderer;
 
@@ -137,6 +137,9 @@ void VCount144();
 void RenderFrame();
 u32* GetLine(int line);
 
+void TexSlotDirty(u32 slot);
+void TexPalSlotDirty(u32 slot);
+
 }
 
 #ifdef OGLRENDERER_ENABLED
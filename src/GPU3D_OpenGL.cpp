@@ -115,6 +115,8 @@ const u32 EdgeIndicesOffset = 2048 * 30;
 
 GLuint TexMemID;
 GLuint TexPalMemID;
+bool TexMemDirty;
+u32 TexMemGen; // VRAM generation of the last texture upload
 
 int ScaleFactor;
 bool BetterPolygons;
@@ -376,6 +378,8 @@ bool Init()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, 1024, 48, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, NULL);
 
+    TexMemDirty = true;
+
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     return true;
@@ -405,6 +409,7 @@ void DeInit()
 
 void Reset()
 {
+    TexMemDirty = true;
 }
 
 void SetRenderSettings(GPU::RenderSettings& settings)
@@ -1227,8 +1232,10 @@ void RenderFrame()
     if (unibuf) memcpy(unibuf, &ShaderConfig, sizeof(ShaderConfig));
     glUnmapBuffer(GL_UNIFORM_BUFFER);
 
-    // SUCKY!!!!!!!!!!!!!!!!!!
-    // TODO: detect when VRAM blocks are modified!
+    // only upload the texture slots that were written to since the last frame
+    if (GPU::VRAMMapChanged(TexMemGen))
+        TexMemDirty = true;
+
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, TexMemID);
     for (int i = 0; i < 4; i++)
@@ -1236,6 +1243,7 @@ void RenderFrame()
         u32 mask = GPU::VRAMMap_Texture[i];
         u8* vram;
         if (!mask) continue;
+        if (!TexMemDirty && !GPU::VRAMBanksChanged(mask, i << 17, 0x20000, TexMemGen)) continue;
         else if (mask & (1<<0)) vram = GPU::VRAM_A;
         else if (mask & (1<<1)) vram = GPU::VRAM_B;
         else if (mask & (1<<2)) vram = GPU::VRAM_C;
@@ -1252,6 +1260,7 @@ void RenderFrame()
         u32 mask = GPU::VRAMMap_TexPal[i];
         u8* vram;
         if (!mask) continue;
+        if (!TexMemDirty && !GPU::VRAMBanksChanged(mask, i << 14, 0x4000, TexMemGen)) continue;
         else if (mask & (1<<4)) vram = &GPU::VRAM_E[(i&3)*0x4000];
         else if (mask & (1<<5)) vram = GPU::VRAM_F;
         else if (mask & (1<<6)) vram = GPU::VRAM_G;
@@ -1259,6 +1268,9 @@ void RenderFrame()
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, i*8, 1024, 8, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, vram);
     }
 
+    TexMemDirty = false;
+    TexMemGen = GPU::VRAMGen;
+
     glDisable(GL_SCISSOR_TEST);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_STENCIL_TEST);
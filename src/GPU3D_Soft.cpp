@@ -18,10 +18,21 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include "NDS.h"
 #include "GPU.h"
 #include "Config.h"
 #include "Platform.h"
+#include "Profiler.h"
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 
 namespace GPU3D
@@ -40,9 +51,9 @@ const int NumScanlines = 194;
 const int BufferSize = ScanlineWidth * NumScanlines;
 const int FirstPixelOffset = ScanlineWidth + 1;
 
-u32 ColorBuffer[BufferSize * 2];
-u32 DepthBuffer[BufferSize * 2];
-u32 AttrBuffer[BufferSize * 2];
+INSTANCE_LOCAL u32 ColorBuffer[BufferSize * 2];
+INSTANCE_LOCAL u32 DepthBuffer[BufferSize * 2];
+INSTANCE_LOCAL u32 AttrBuffer[BufferSize * 2];
 
 // attribute buffer:
 // bit0-3: edge flags (left/right/top/bottom)
@@ -53,23 +64,61 @@ u32 AttrBuffer[BufferSize * 2];
 // bit22: translucent flag
 // bit24-29: polygon ID for opaque pixels
 
-u8 StencilBuffer[256*2];
-bool PrevIsShadowMask;
+// stencil buffer for shadows
+// the buffer holds two scanlines, and its contents as well as the shadow
+// mask state can carry over from one scanline to the next of the same parity
+
+typedef struct
+{
+    u8 StencilBuffer[256*2];
+    bool PrevIsShadowMask;
+
+} StencilState;
+
+INSTANCE_LOCAL StencilState Stencil;
 
-bool Enabled;
+INSTANCE_LOCAL bool Enabled;
 
 // threading
 
-bool Threaded;
-Platform::Thread* RenderThread;
-bool RenderThreadRunning;
-bool RenderThreadRendering;
-Platform::Semaphore* Sema_RenderStart;
-Platform::Semaphore* Sema_RenderDone;
-Platform::Semaphore* Sema_ScanlineCount;
+INSTANCE_LOCAL bool Threaded;
+INSTANCE_LOCAL Platform::Thread* RenderThread;
+INSTANCE_LOCAL bool RenderThreadRunning;
+INSTANCE_LOCAL bool RenderThreadRendering;
+INSTANCE_LOCAL Platform::Semaphore* Sema_RenderStart;
+INSTANCE_LOCAL Platform::Semaphore* Sema_RenderDone;
+INSTANCE_LOCAL Platform::Semaphore* Sema_ScanlineCount;
 
 void RenderThreadFunc();
 
+bool InitBands();
+void DeInitBands();
+
+// worker threads for banded rendering, see RenderPolygonsBanded()
+
+const int MaxWorkers = 16;
+
+INSTANCE_LOCAL int NumWorkers;
+INSTANCE_LOCAL int NumWorkersRunning;
+INSTANCE_LOCAL bool WorkersRunning;
+INSTANCE_LOCAL Platform::Semaphore* Sema_WorkerStart;
+INSTANCE_LOCAL Platform::Semaphore* Sema_WorkerDone;
+INSTANCE_LOCAL Platform::Mutex* BandLock;
+
+void SetupWorkerThreads();
+void StopWorkerThreads();
+
+// texture cache, see GetTexture()
+// remapped VRAM slots are collected here and handed to the render thread
+// when it is idle
+
+const u32 TexCacheMemSize = 2*1024*1024; // in texels
+INSTANCE_LOCAL u32* TexCacheMem;
+INSTANCE_LOCAL u32 TexSlotsRemapped;
+INSTANCE_LOCAL u32 TexCacheInvalid;
+
+void ResetTexCache();
+
 
 void StopRenderThread()
 {
@@ -95,6 +144,11 @@ void SetupRenderThread()
         if (RenderThreadRendering)
             Platform::Semaphore_Wait(Sema_RenderDone);
 
+        SetupWorkerThreads();
+
+        TexCacheInvalid |= TexSlotsRemapped;
+        TexSlotsRemapped = 0;
+
         Platform::Semaphore_Reset(Sema_RenderStart);
         Platform::Semaphore_Reset(Sema_ScanlineCount);
 
@@ -103,6 +157,7 @@ void SetupRenderThread()
     else
     {
         StopRenderThread();
+        SetupWorkerThreads();
     }
 }
 
@@ -117,12 +172,20 @@ bool Init()
     RenderThreadRunning = false;
     RenderThreadRendering = false;
 
+    if (!InitBands()) return false;
+
+    TexCacheMem = new u32[TexCacheMemSize];
+    ResetTexCache();
+
     return true;
 }
 
 void DeInit()
 {
     StopRenderThread();
+    DeInitBands();
+
+    delete[] TexCacheMem;
 
     Platform::Semaphore_Free(Sema_RenderStart);
     Platform::Semaphore_Free(Sema_RenderDone);
@@ -135,7 +198,9 @@ void Reset()
     memset(DepthBuffer, 0, BufferSize * 2 * 4);
     memset(AttrBuffer, 0, BufferSize * 2 * 4);
 
-    PrevIsShadowMask = false;
+    Stencil.PrevIsShadowMask = false;
+
+    TexSlotsRemapped = 0xFF0F;
 
     SetupRenderThread();
 }
@@ -143,11 +208,100 @@ void Reset()
 void SetRenderSettings(GPU::RenderSettings& settings)
 {
     Threaded = settings.Soft_Threaded;
+
+    NumWorkers = settings.Soft_Workers;
+    if (NumWorkers < 0) NumWorkers = 0;
+    else if (NumWorkers > MaxWorkers) NumWorkers = MaxWorkers;
+
     SetupRenderThread();
 }
 
 
 
+// span kernels used by the interpolator to process a whole span at once
+// they compute out[x] = base + ((k * m[x]) >> s) for xstart <= x < xend,
+// either with a 32-bit product (wrapping like the u32 math in Interpolate())
+// or with a 64-bit product and a rounding bias (like the s64 math elsewhere)
+
+void MulShiftSpan32(s32 xstart, s32 xend, s32 base, u32 k, int s, const u32* m, s32* out)
+{
+    s32 x = xstart;
+
+#if defined(__x86_64__)
+    const __m128i vbase = _mm_set1_epi32(base);
+    const __m128i vk = _mm_set1_epi32(k);
+    const __m128i vs = _mm_cvtsi32_si128(s);
+
+    for (; x+4 <= xend; x += 4)
+    {
+        __m128i vm = _mm_loadu_si128((const __m128i*)&m[x]);
+
+        // SSE2 has no 32-bit mullo, do the even and odd lanes separately
+        __m128i even = _mm_mul_epu32(vm, vk);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(vm, 32), vk);
+        __m128i prod = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, 0x08), _mm_shuffle_epi32(odd, 0x08));
+
+        _mm_storeu_si128((__m128i*)&out[x], _mm_add_epi32(vbase, _mm_srl_epi32(prod, vs)));
+    }
+#elif defined(__aarch64__)
+    const uint32x4_t vbase = vdupq_n_u32(base);
+    const uint32x4_t vk = vdupq_n_u32(k);
+    const int32x4_t vs = vdupq_n_s32(-s);
+
+    for (; x+4 <= xend; x += 4)
+    {
+        uint32x4_t prod = vmulq_u32(vld1q_u32(&m[x]), vk);
+        vst1q_s32(&out[x], vreinterpretq_s32_u32(vaddq_u32(vbase, vshlq_u32(prod, vs))));
+    }
+#endif
+
+    for (; x < xend; x++)
+        out[x] = base + ((k * m[x]) >> s);
+}
+
+void MulShiftSpan64(s32 xstart, s32 xend, s32 base, u32 k, u32 bias, int s, const u32* m, s32* out)
+{
+    s32 x = xstart;
+
+#if defined(__x86_64__)
+    const __m128i vbase = _mm_set1_epi32(base);
+    const __m128i vk = _mm_set1_epi32(k);
+    const __m128i vbias = _mm_set1_epi64x(bias);
+    const __m128i vs = _mm_cvtsi32_si128(s);
+    const __m128i lomask = _mm_set1_epi64x(0xFFFFFFFF);
+
+    for (; x+4 <= xend; x += 4)
+    {
+        __m128i vm = _mm_loadu_si128((const __m128i*)&m[x]);
+
+        __m128i even = _mm_srl_epi64(_mm_add_epi64(_mm_mul_epu32(vm, vk), vbias), vs);
+        __m128i odd = _mm_srl_epi64(_mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(vm, 32), vk), vbias), vs);
+        __m128i res = _mm_or_si128(_mm_and_si128(even, lomask), _mm_slli_epi64(odd, 32));
+
+        _mm_storeu_si128((__m128i*)&out[x], _mm_add_epi32(vbase, res));
+    }
+#elif defined(__aarch64__)
+    const uint32x4_t vbase = vdupq_n_u32(base);
+    const uint32x2_t vk = vdup_n_u32(k);
+    const uint64x2_t vbias = vdupq_n_u64(bias);
+    const int64x2_t vs = vdupq_n_s64(-s);
+
+    for (; x+4 <= xend; x += 4)
+    {
+        uint32x4_t vm = vld1q_u32(&m[x]);
+
+        uint64x2_t lo = vshlq_u64(vaddq_u64(vmull_u32(vget_low_u32(vm), vk), vbias), vs);
+        uint64x2_t hi = vshlq_u64(vaddq_u64(vmull_u32(vget_high_u32(vm), vk), vbias), vs);
+        uint32x4_t res = vcombine_u32(vmovn_u64(lo), vmovn_u64(hi));
+
+        vst1q_s32(&out[x], vreinterpretq_s32_u32(vaddq_u32(vbase, res)));
+    }
+#endif
+
+    for (; x < xend; x++)
+        out[x] = base + (s32)((((u64)k * m[x]) + bias) >> s);
+}
+
 // Notes on the interpolator:
 //
 // This is a theory on how the DS hardware interpolates values. It matches hardware output
@@ -245,6 +399,104 @@ public:
         }
     }
 
+    void SetX(s32 x, const u32* factors)
+    {
+        // same as SetX(x), with the factor taken from CalcFactors()
+        this->x = x - x0;
+        if (xdiff != 0 && !linear)
+            yfactor = factors[x];
+    }
+
+    void CalcFactors(s32 xstart, s32 xend, u32* factors)
+    {
+        // calculate the perspective correction factors for a whole span
+        // the divisions are done on several pixels at once where possible
+        // doubles are exact there: num is below 2^34 and den below 2^26,
+        // so truncating the quotient gives the same result as the integer division
+        if (xdiff == 0 || linear) return;
+
+        s32 x = xstart;
+
+#if defined(__x86_64__) && defined(__AVX__)
+        const __m256d vnum = _mm256_set1_pd((double)w0n * (1<<shift));
+        const __m256d vw0d = _mm256_set1_pd((double)w0d);
+        const __m256d vw1d = _mm256_set1_pd((double)w1d);
+        const __m256d vxdiff = _mm256_set1_pd((double)xdiff);
+        const __m256d vzero = _mm256_setzero_pd();
+        const __m256d vone = _mm256_set1_pd(1.0);
+        __m256d vx = _mm256_set_pd(x+3-x0, x+2-x0, x+1-x0, x-x0);
+
+        for (; x+4 <= xend; x += 4)
+        {
+            __m256d num = _mm256_mul_pd(vx, vnum);
+            __m256d den = _mm256_add_pd(_mm256_mul_pd(vx, vw0d), _mm256_mul_pd(_mm256_sub_pd(vxdiff, vx), vw1d));
+
+            // den == 0 gives a factor of 0
+            __m256d iszero = _mm256_cmp_pd(den, vzero, _CMP_EQ_OQ);
+            num = _mm256_andnot_pd(iszero, num);
+            den = _mm256_or_pd(den, _mm256_and_pd(iszero, vone));
+
+            _mm_storeu_si128((__m128i*)&factors[x], _mm256_cvttpd_epi32(_mm256_div_pd(num, den)));
+            vx = _mm256_add_pd(vx, _mm256_set1_pd(4.0));
+        }
+#elif defined(__x86_64__)
+        const __m128d vnum = _mm_set1_pd((double)w0n * (1<<shift));
+        const __m128d vw0d = _mm_set1_pd((double)w0d);
+        const __m128d vw1d = _mm_set1_pd((double)w1d);
+        const __m128d vxdiff = _mm_set1_pd((double)xdiff);
+        const __m128d vzero = _mm_setzero_pd();
+        const __m128d vone = _mm_set1_pd(1.0);
+        __m128d vx = _mm_set_pd(x+1-x0, x-x0);
+
+        for (; x+2 <= xend; x += 2)
+        {
+            __m128d num = _mm_mul_pd(vx, vnum);
+            __m128d den = _mm_add_pd(_mm_mul_pd(vx, vw0d), _mm_mul_pd(_mm_sub_pd(vxdiff, vx), vw1d));
+
+            // den == 0 gives a factor of 0
+            __m128d iszero = _mm_cmpeq_pd(den, vzero);
+            num = _mm_andnot_pd(iszero, num);
+            den = _mm_or_pd(den, _mm_and_pd(iszero, vone));
+
+            _mm_storel_epi64((__m128i*)&factors[x], _mm_cvttpd_epi32(_mm_div_pd(num, den)));
+            vx = _mm_add_pd(vx, _mm_set1_pd(2.0));
+        }
+#elif defined(__aarch64__)
+        const float64x2_t vnum = vdupq_n_f64((double)w0n * (1<<shift));
+        const float64x2_t vw0d = vdupq_n_f64((double)w0d);
+        const float64x2_t vw1d = vdupq_n_f64((double)w1d);
+        const float64x2_t vxdiff = vdupq_n_f64((double)xdiff);
+        const float64x2_t vzero = vdupq_n_f64(0.0);
+        const float64x2_t vone = vdupq_n_f64(1.0);
+        const double xinit[2] = {(double)(x-x0), (double)(x+1-x0)};
+        float64x2_t vx = vld1q_f64(xinit);
+
+        for (; x+2 <= xend; x += 2)
+        {
+            float64x2_t num = vmulq_f64(vx, vnum);
+            float64x2_t den = vaddq_f64(vmulq_f64(vx, vw0d), vmulq_f64(vsubq_f64(vxdiff, vx), vw1d));
+
+            // den == 0 gives a factor of 0
+            uint64x2_t iszero = vceqq_f64(den, vzero);
+            num = vbslq_f64(iszero, vzero, num);
+            den = vbslq_f64(iszero, vone, den);
+
+            vst1_s32((s32*)&factors[x], vmovn_s64(vcvtq_s64_f64(vdivq_f64(num, den))));
+            vx = vaddq_f64(vx, vdupq_n_f64(2.0));
+        }
+#endif
+
+        for (; x < xend; x++)
+        {
+            s32 xx = x - x0;
+            s64 num = ((s64)xx * w0n) << shift;
+            s32 den = (xx * w0d) + ((xdiff-xx) * w1d);
+
+            if (den == 0) factors[x] = 0;
+            else          factors[x] = (s32)(num / den);
+        }
+    }
+
     s32 Interpolate(s32 y0, s32 y1)
     {
         if (xdiff == 0 || y0 == y1) return y0;
@@ -318,6 +570,97 @@ public:
         }
     }
 
+    void InterpolateSpan(s32 xstart, s32 xend, s32 y0, s32 y1, const u32* factors, s32* out)
+    {
+        // same as SetX(x, factors) followed by Interpolate(y0, y1), for every pixel in the span
+        if (xdiff == 0 || y0 == y1)
+        {
+            for (s32 x = xstart; x < xend; x++)
+                out[x] = y0;
+            return;
+        }
+
+        u32 m[256];
+
+        if (!linear)
+        {
+            if (y0 < y1)
+                MulShiftSpan32(xstart, xend, y0, y1-y0, shift, factors, out);
+            else
+            {
+                for (s32 x = xstart; x < xend; x++)
+                    m[x] = (1<<shift) - factors[x];
+                MulShiftSpan32(xstart, xend, y1, y0-y1, shift, m, out);
+            }
+        }
+        else
+        {
+            // the products fit in 32 bits: attributes are 16-bit at most
+            if (y0 < y1)
+            {
+                for (s32 x = xstart; x < xend; x++)
+                    m[x] = (y1-y0) * (x-x0);
+                MulShiftSpan64(xstart, xend, y0, xrecip, 3<<24, 30, m, out);
+            }
+            else
+            {
+                for (s32 x = xstart; x < xend; x++)
+                    m[x] = (y0-y1) * (xdiff-(x-x0));
+                MulShiftSpan64(xstart, xend, y1, xrecip, 3<<24, 30, m, out);
+            }
+        }
+    }
+
+    void InterpolateZSpan(s32 xstart, s32 xend, s32 z0, s32 z1, bool wbuffer, const u32* factors, s32* out)
+    {
+        // same as SetX(x, factors) followed by InterpolateZ(z0, z1, wbuffer), for every pixel in the span
+        if (xdiff == 0 || z0 == z1)
+        {
+            for (s32 x = xstart; x < xend; x++)
+                out[x] = z0;
+            return;
+        }
+
+        u32 m[256];
+
+        if (wbuffer && !linear)
+        {
+            if (z0 < z1)
+                MulShiftSpan64(xstart, xend, z0, z1-z0, 0, shift, factors, out);
+            else
+            {
+                for (s32 x = xstart; x < xend; x++)
+                    m[x] = (1<<shift) - factors[x];
+                MulShiftSpan64(xstart, xend, z1, z0-z1, 0, shift, m, out);
+            }
+        }
+        else if (!wbuffer && !dir)
+        {
+            if (z0 < z1)
+            {
+                s32 disp = (z1 - z0) >> 9;
+                for (s32 x = xstart; x < xend; x++)
+                    m[x] = disp * (x-x0);
+                MulShiftSpan64(xstart, xend, z0, xrecip_z, 0, 13, m, out);
+            }
+            else
+            {
+                s32 disp = (z0 - z1) >> 9;
+                for (s32 x = xstart; x < xend; x++)
+                    m[x] = disp * (xdiff-(x-x0));
+                MulShiftSpan64(xstart, xend, z1, xrecip_z, 0, 13, m, out);
+            }
+        }
+        else
+        {
+            for (s32 x = xstart; x < xend; x++)
+            {
+                SetX(x, factors);
+                out[x] = InterpolateZ(z0, z1, wbuffer);
+            }
+        }
+    }
+
 private:
     s32 x0, x1, xdiff, x;
 
@@ -546,56 +889,18 @@ typedef struct
     u32 CurVL, CurVR;
     u32 NextVL, NextVR;
 
+    u32* Texels; // decoded texture, NULL if not cached
+
 } RendererPolygon;
 
-RendererPolygon PolygonList[2048];
+INSTANCE_LOCAL RendererPolygon PolygonList[2048];
 
 
-void TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* color, u8* alpha)
+void DecodeTexel(u32 texparam, u32 texpal, s32 s, s32 t, u16* color, u8* alpha)
 {
     u32 vramaddr = (texparam & 0xFFFF) << 3;
 
     s32 width = 8 << ((texparam >> 20) & 0x7);
-    s32 height = 8 << ((texparam >> 23) & 0x7);
-
-    s >>= 4;
-    t >>= 4;
-
-    // texture wrapping
-    // TODO: optimize this somehow
-    // testing shows that it's hardly worth optimizing, actually
-
-    if (texparam & (1<<16))
-    {
-        if (texparam & (1<<18))
-        {
-            if (s & width) s = (width-1) - (s & (width-1));
-            else           s = (s & (width-1));
-        }
-        else
-            s &= width-1;
-    }
-    else
-    {
-        if (s < 0) s = 0;
-        else if (s >= width) s = width-1;
-    }
-
-    if (texparam & (1<<17))
-    {
-        if (texparam & (1<<19))
-        {
-            if (t & height) t = (height-1) - (t & (height-1));
-            else            t = (t & (height-1));
-        }
-        else
-            t &= height-1;
-    }
-    else
-    {
-        if (t < 0) t = 0;
-        else if (t >= height) t = height-1;
-    }
 
     u8 alpha0;
     if (texparam & (1<<29)) alpha0 = 0;
@@ -777,6 +1082,340 @@ void TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* color, u8* alpha
     }
 }
 
+void TextureLookup(u32 texparam, u32 texpal, u32* texels, s16 s, s16 t, u16* color, u8* alpha)
+{
+    s32 width = 8 << ((texparam >> 20) & 0x7);
+    s32 height = 8 << ((texparam >> 23) & 0x7);
+
+    s >>= 4;
+    t >>= 4;
+
+    // texture wrapping
+    // TODO: optimize this somehow
+    // testing shows that it's hardly worth optimizing, actually
+
+    if (texparam & (1<<16))
+    {
+        if (texparam & (1<<18))
+        {
+            if (s & width) s = (width-1) - (s & (width-1));
+            else           s = (s & (width-1));
+        }
+        else
+            s &= width-1;
+    }
+    else
+    {
+        if (s < 0) s = 0;
+        else if (s >= width) s = width-1;
+    }
+
+    if (texparam & (1<<17))
+    {
+        if (texparam & (1<<19))
+        {
+            if (t & height) t = (height-1) - (t & (height-1));
+            else            t = (t & (height-1));
+        }
+        else
+            t &= height-1;
+    }
+    else
+    {
+        if (t < 0) t = 0;
+        else if (t >= height) t = height-1;
+    }
+
+    if (texels)
+    {
+        u32 texel = texels[(t * width) + s];
+        *color = texel & 0xFFFF;
+        *alpha = texel >> 16;
+    }
+    else
+        DecodeTexel(texparam, texpal, s, t, color, alpha);
+}
+
+
+// texture cache
+//
+// textures are decoded once and kept around, instead of being decoded
+// on every texel fetch. texture VRAM can only be written to while it is
+// mapped to LCDC, so the cached textures stay valid until the VRAM slots
+// they were decoded from are remapped.
+//
+// the cache is only modified by the render thread, before rasterizing
+// begins. the band workers only read from it.
+
+typedef struct
+{
+    u32 TexParam;
+    u32 TexPal;
+    u32 SlotMask; // texture slots in bits 0-3, palette slots in bits 8-15
+    u32* Texels; // color in bits 0-15, alpha in bits 16-20
+    u32 LastUsed; // frame number
+    s32 Next;
+
+} TexCacheEntry;
+
+const int TexCacheHashSize = 256;
+const int MaxTexCacheEntries = 1024;
+INSTANCE_LOCAL TexCacheEntry TexCache[MaxTexCacheEntries];
+INSTANCE_LOCAL int NumTexCacheEntries;
+INSTANCE_LOCAL s32 TexCacheHash[TexCacheHashSize];
+INSTANCE_LOCAL u32 TexCacheMemUsed;
+INSTANCE_LOCAL u32 TexCacheFrame;
+
+// textures that didn't fit during the last frame
+typedef struct
+{
+    u32 TexParam;
+    u32 TexPal;
+    s32 Next;
+
+} TexCacheMiss;
+
+INSTANCE_LOCAL TexCacheMiss TexCacheMisses[MaxTexCacheEntries];
+INSTANCE_LOCAL s32 TexCacheMissHash[TexCacheHashSize];
+INSTANCE_LOCAL u32 TexCacheMissEntries;
+INSTANCE_LOCAL u32 TexCacheMissSize;
+
+INSTANCE_LOCAL u32* PolygonTexels[2048];
+
+void TexSlotDirty(u32 slot)
+{
+    TexSlotsRemapped |= (1 << (slot & 0x3));
+}
+
+void TexPalSlotDirty(u32 slot)
+{
+    TexSlotsRemapped |= (1 << (8 + (slot & 0x7)));
+}
+
+u32 TexCacheKeyHash(u32 texparam, u32 texpal)
+{
+    u32 hash = texparam ^ (texparam >> 13) ^ (texpal * 0x9E3779B1);
+    return (hash ^ (hash >> 16)) & (TexCacheHashSize-1);
+}
+
+u32 TexSlotMask(u32 texparam, u32 texpal)
+{
+    u32 fmt = (texparam >> 26) & 0x7;
+    u32 addr = (texparam & 0xFFFF) << 3;
+    u32 size = (8 << ((texparam >> 20) & 0x7)) * (8 << ((texparam >> 23) & 0x7));
+    u32 palsize = 0;
+
+    switch (fmt)
+    {
+    case 1: palsize = 32*2; break;
+    case 2: size >>= 2; palsize = 4*2; break;
+    case 3: size >>= 1; palsize = 16*2; break;
+    case 4: palsize = 256*2; break;
+    case 5: size >>= 2; palsize = 0x10000; break; // palette offset comes from slot 1
+    case 6: palsize = 8*2; break;
+    case 7: size <<= 1; break;
+    }
+
+    u32 mask = 0;
+    for (u32 a = addr & ~0x1FFFF; a < addr+size; a += 0x20000)
+        mask |= (1 << ((a >> 17) & 0x3));
+    if (fmt == 5)
+        mask |= (1 << 1);
+
+    if (palsize)
+    {
+        u32 paladdr = (fmt == 2) ? (texpal << 3) : (texpal << 4);
+        for (u32 a = paladdr & ~0x3FFF; a < paladdr+palsize; a += 0x4000)
+            mask |= (1 << (8 + ((a >> 14) & 0x7)));
+    }
+
+    return mask;
+}
+
+void RebuildTexCacheHash()
+{
+    for (int i = 0; i < TexCacheHashSize; i++)
+    {
+        TexCacheHash[i] = -1;
+        TexCacheMissHash[i] = -1;
+    }
+
+    for (int i = 0; i < NumTexCacheEntries; i++)
+    {
+        TexCacheEntry* entry = &TexCache[i];
+        u32 hash = TexCacheKeyHash(entry->TexParam, entry->TexPal);
+        entry->Next = TexCacheHash[hash];
+        TexCacheHash[hash] = i;
+    }
+}
+
+void ResetTexCache()
+{
+    NumTexCacheEntries = 0;
+    TexCacheMemUsed = 0;
+    TexCacheFrame = 0;
+    TexCacheMissEntries = 0;
+    TexCacheMissSize = 0;
+    RebuildTexCacheHash();
+}
+
+void UpdateTexCache()
+{
+    // drop the textures from remapped VRAM, and move the remaining ones
+    // down so their memory stays contiguous
+
+    bool drop[MaxTexCacheEntries];
+    bool compact = false;
+    u32 freeentries = MaxTexCacheEntries - NumTexCacheEntries;
+    u32 freesize = TexCacheMemSize - TexCacheMemUsed;
+
+    for (int i = 0; i < NumTexCacheEntries; i++)
+    {
+        drop[i] = (TexCache[i].SlotMask & TexCacheInvalid) != 0;
+        if (drop[i])
+        {
+            compact = true;
+            freeentries++;
+            freesize += (8 << ((TexCache[i].TexParam >> 20) & 0x7)) * (8 << ((TexCache[i].TexParam >> 23) & 0x7));
+        }
+    }
+
+    if (TexCacheMissEntries)
+    {
+        // not all of the last frame's textures fit. make room for the missing
+        // ones by evicting the least recently used textures, so a working set
+        // slightly bigger than the cache doesn't get decoded all over again
+        u32 needentries = std::min(TexCacheMissEntries, (u32)MaxTexCacheEntries);
+        u32 needsize = std::min(TexCacheMissSize, TexCacheMemSize);
+
+        int order[MaxTexCacheEntries];
+        int numorder = 0;
+        for (int i = 0; i < NumTexCacheEntries; i++)
+        {
+            if (!drop[i]) order[numorder++] = i;
+        }
+        std::stable_sort(order, order+numorder, [](int a, int b)
+        {
+            return TexCache[a].LastUsed < TexCache[b].LastUsed;
+        });
+
+        for (int i = 0; i < numorder && (freeentries < needentries || freesize < needsize); i++)
+        {
+            TexCacheEntry* entry = &TexCache[order[i]];
+            drop[order[i]] = true;
+            compact = true;
+            freeentries++;
+            freesize += (8 << ((entry->TexParam >> 20) & 0x7)) * (8 << ((entry->TexParam >> 23) & 0x7));
+        }
+
+        TexCacheMissEntries = 0;
+        TexCacheMissSize = 0;
+        for (int i = 0; i < TexCacheHashSize; i++)
+            TexCacheMissHash[i] = -1;
+    }
+
+    TexCacheInvalid = 0;
+    TexCacheFrame++;
+    if (!compact) return;
+
+    int numentries = 0;
+    u32 memused = 0;
+    for (int i = 0; i < NumTexCacheEntries; i++)
+    {
+        TexCacheEntry* entry = &TexCache[i];
+        if (drop[i]) continue;
+
+        u32 size = (8 << ((entry->TexParam >> 20) & 0x7)) * (8 << ((entry->TexParam >> 23) & 0x7));
+        if (entry->Texels != &TexCacheMem[memused])
+            memmove(&TexCacheMem[memused], entry->Texels, size*4);
+
+        TexCache[numentries] = *entry;
+        TexCache[numentries].Texels = &TexCacheMem[memused];
+        numentries++;
+        memused += size;
+    }
+
+    NumTexCacheEntries = numentries;
+    TexCacheMemUsed = memused;
+    RebuildTexCacheHash();
+}
+
+u32* GetTexture(Polygon* polygon)
+{
+    if (!(RenderDispCnt & (1<<0))) return NULL;
+
+    u32 texparam = polygon->TexParam;
+    u32 fmt = (texparam >> 26) & 0x7;
+    if (fmt == 0) return NULL;
+
+    // wrapping and texcoord transform bits don't affect decoding
+    texparam &= 0x3FF0FFFF;
+    u32 texpal = (fmt == 7) ? 0 : polygon->TexPalette;
+
+    u32 hash = TexCacheKeyHash(texparam, texpal);
+    for (s32 i = TexCacheHash[hash]; i != -1; i = TexCache[i].Next)
+    {
+        TexCacheEntry* entry = &TexCache[i];
+        if (entry->TexParam == texparam && entry->TexPal == texpal)
+        {
+            entry->LastUsed = TexCacheFrame;
+            return entry->Texels;
+        }
+    }
+
+    s32 width = 8 << ((texparam >> 20) & 0x7);
+    s32 height = 8 << ((texparam >> 23) & 0x7);
+    u32 size = width * height;
+
+    if (NumTexCacheEntries >= MaxTexCacheEntries || (TexCacheMemUsed + size) > TexCacheMemSize)
+    {
+        // no room left, this texture is decoded per texel for this frame
+        // room is made for it before the next one, see UpdateTexCache()
+        for (s32 i = TexCacheMissHash[hash]; i != -1; i = TexCacheMisses[i].Next)
+        {
+            if (TexCacheMisses[i].TexParam == texparam && TexCacheMisses[i].TexPal == texpal)
+                return NULL;
+        }
+
+        if (TexCacheMissEntries < MaxTexCacheEntries)
+        {
+            TexCacheMiss* miss = &TexCacheMisses[TexCacheMissEntries];
+            miss->TexParam = texparam;
+            miss->TexPal = texpal;
+            miss->Next = TexCacheMissHash[hash];
+            TexCacheMissHash[hash] = TexCacheMissEntries;
+        }
+        TexCacheMissEntries++;
+        TexCacheMissSize += size;
+        return NULL;
+    }
+
+    TexCacheEntry* entry = &TexCache[NumTexCacheEntries];
+    entry->TexParam = texparam;
+    entry->TexPal = texpal;
+    entry->SlotMask = TexSlotMask(texparam, texpal);
+    entry->Texels = &TexCacheMem[TexCacheMemUsed];
+    entry->LastUsed = TexCacheFrame;
+
+    u32* texel = entry->Texels;
+    for (s32 t = 0; t < height; t++)
+    {
+        for (s32 s = 0; s < width; s++)
+        {
+            u16 color; u8 alpha;
+            DecodeTexel(texparam, texpal, s, t, &color, &alpha);
+            *texel++ = color | (alpha << 16);
+        }
+    }
+
+    entry->Next = TexCacheHash[hash];
+    TexCacheHash[hash] = NumTexCacheEntries;
+    NumTexCacheEntries++;
+    TexCacheMemUsed += size;
+
+    return entry->Texels;
+}
+
 // depth test is 'less or equal' instead of 'less than' under the following conditions:
 // * when drawing a front-facing pixel over an opaque back-facing pixel
 // * when drawing wireframe edges, under certain conditions (TODO)
@@ -857,8 +1496,10 @@ u32 AlphaBlend(u32 srccolor, u32 dstcolor, u32 alpha)
     return srcR | (srcG << 8) | (srcB << 16) | (dstalpha << 24);
 }
 
-u32 RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16 t)
+u32 RenderPixel(RendererPolygon* rp, u8 vr, u8 vg, u8 vb, s16 s, s16 t)
 {
+    Polygon* polygon = rp->PolyData;
+
     u8 r, g, b, a;
 
     u32 blendmode = (polygon->Attr >> 4) & 0x3;
@@ -894,7 +1535,7 @@ u32 RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16 t)
         u8 tr, tg, tb;
 
         u16 tcolor; u8 talpha;
-        TextureLookup(polygon->TexParam, polygon->TexPalette, s, t, &tcolor, &talpha);
+        TextureLookup(polygon->TexParam, polygon->TexPalette, rp->Texels, s, t, &tcolor, &talpha);
 
         tr = (tcolor << 1) & 0x3E; if (tr) tr++;
         tg = (tcolor >> 4) & 0x3E; if (tg) tg++;
@@ -1111,7 +1752,7 @@ void SetupPolygon(RendererPolygon* rp, Polygon* polygon)
     }
 }
 
-void RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
+void RenderShadowMaskScanline(RendererPolygon* rp, s32 y, StencilState* st)
 {
     Polygon* polygon = rp->PolyData;
 
@@ -1129,10 +1770,10 @@ void RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
     else
         fnDepthTest = DepthTest_LessThan;
 
-    if (!PrevIsShadowMask)
-        memset(&StencilBuffer[256 * (y&0x1)], 0, 256);
+    if (!st->PrevIsShadowMask)
+        memset(&st->StencilBuffer[256 * (y&0x1)], 0, 256);
 
-    PrevIsShadowMask = true;
+    st->PrevIsShadowMask = true;
 
     if (polygon->YTop != polygon->YBottom)
     {
@@ -1231,6 +1872,8 @@ void RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
 
     if (x < 0) x = 0;
     s32 xlimit;
+    u32 factors[256];
+    s32 zspan[256];
 
     // for shadow masks: set stencil bits where the depth test fails.
     // draw nothing.
@@ -1255,13 +1898,13 @@ void RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
             continue;
 
         if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
-            StencilBuffer[256*(y&0x1) + x] |= 0x1;
+            st->StencilBuffer[256*(y&0x1) + x] |= 0x1;
 
         if (dstattr & 0x3)
         {
             pixeladdr += BufferSize;
             if (!fnDepthTest(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
-                StencilBuffer[256*(y&0x1) + x] |= 0x2;
+                st->StencilBuffer[256*(y&0x1) + x] |= 0x2;
         }
     }
 
@@ -1271,23 +1914,26 @@ void RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
     if (xlimit > xend+1) xlimit = xend+1;
     if (xlimit > 256) xlimit = 256;
     if (wireframe && !edge) x = xlimit;
-    else for (; x < xlimit; x++)
+    else
+    {
+        interpX.CalcFactors(x, xlimit, factors);
+        interpX.InterpolateZSpan(x, xlimit, zl, zr, polygon->WBuffer, factors, zspan);
+    }
+    for (; x < xlimit; x++)
     {
         u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
 
-        interpX.SetX(x);
-
-        s32 z = interpX.InterpolateZ(zl, zr, polygon->WBuffer);
+        s32 z = zspan[x];
         u32 dstattr = AttrBuffer[pixeladdr];
 
         if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
-            StencilBuffer[256*(y&0x1) + x] = 1;
+            st->StencilBuffer[256*(y&0x1) + x] = 1;
 
         if (dstattr & 0x3)
         {
             pixeladdr += BufferSize;
             if (!fnDepthTest(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
-                StencilBuffer[256*(y&0x1) + x] |= 0x2;
+                st->StencilBuffer[256*(y&0x1) + x] |= 0x2;
         }
     }
 
@@ -1310,13 +1956,13 @@ void RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
             continue;
 
         if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
-            StencilBuffer[256*(y&0x1) + x] = 1;
+            st->StencilBuffer[256*(y&0x1) + x] = 1;
 
         if (dstattr & 0x3)
         {
             pixeladdr += BufferSize;
             if (!fnDepthTest(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
-                StencilBuffer[256*(y&0x1) + x] |= 0x2;
+                st->StencilBuffer[256*(y&0x1) + x] |= 0x2;
         }
     }
 
@@ -1324,7 +1970,7 @@ void RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
     rp->XR = rp->SlopeR.Step();
 }
 
-void RenderPolygonScanline(RendererPolygon* rp, s32 y)
+void RenderPolygonScanline(RendererPolygon* rp, s32 y, StencilState* st)
 {
     Polygon* polygon = rp->PolyData;
 
@@ -1342,7 +1988,7 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
     else
         fnDepthTest = DepthTest_LessThan;
 
-    PrevIsShadowMask = false;
+    st->PrevIsShadowMask = false;
 
     if (polygon->YTop != polygon->YBottom)
     {
@@ -1460,6 +2106,8 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
 
     if (x < 0) x = 0;
     s32 xlimit;
+    u32 factors[256];
+    s32 zspan[256], rspan[256], gspan[256], bspan[256], sspan[256], tspan[256];
 
     s32 xcov = 0;
 
@@ -1484,7 +2132,7 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
         // check stencil buffer for shadows
         if (polygon->IsShadow)
         {
-            u8 stencil = StencilBuffer[256*(y&0x1) + x];
+            u8 stencil = st->StencilBuffer[256*(y&0x1) + x];
             if (!stencil)
                 continue;
             if (!(stencil & 0x1))
@@ -1516,7 +2164,7 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
         s16 s = interpX.Interpolate(sl, sr);
         s16 t = interpX.Interpolate(tl, tr);
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel(rp, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1570,8 +2218,28 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
     if (xlimit > xend+1) xlimit = xend+1;
     if (xlimit > 256) xlimit = 256;
 
+    // interpolate the attributes for the whole span up front, several pixels at a time
+    // texcoords are only needed when texturing is on
     if (wireframe && !edge) x = xlimit;
     else
+    {
+        interpX.CalcFactors(x, xlimit, factors);
+        interpX.InterpolateZSpan(x, xlimit, zl, zr, polygon->WBuffer, factors, zspan);
+        interpX.InterpolateSpan(x, xlimit, rl, rr, factors, rspan);
+        interpX.InterpolateSpan(x, xlimit, gl, gr, factors, gspan);
+        interpX.InterpolateSpan(x, xlimit, bl, br, factors, bspan);
+
+        if ((RenderDispCnt & (1<<0)) && (((polygon->TexParam >> 26) & 0x7) != 0))
+        {
+            interpX.InterpolateSpan(x, xlimit, sl, sr, factors, sspan);
+            interpX.InterpolateSpan(x, xlimit, tl, tr, factors, tspan);
+        }
+        else
+        {
+            for (s32 xx = x; xx < xlimit; xx++)
+                sspan[xx] = tspan[xx] = 0;
+        }
+    }
     for (; x < xlimit; x++)
     {
         u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
@@ -1580,7 +2248,7 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
         // check stencil buffer for shadows
         if (polygon->IsShadow)
         {
-            u8 stencil = StencilBuffer[256*(y&0x1) + x];
+            u8 stencil = st->StencilBuffer[256*(y&0x1) + x];
             if (!stencil)
                 continue;
             if (!(stencil & 0x1))
@@ -1589,9 +2257,7 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
                 dstattr &= ~0x3; // quick way to prevent drawing the shadow under antialiased edges
         }
 
-        interpX.SetX(x);
-
-        s32 z = interpX.InterpolateZ(zl, zr, polygon->WBuffer);
+        s32 z = zspan[x];
 
         // if depth test against the topmost pixel fails, test
         // against the pixel underneath
@@ -1605,14 +2271,14 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
                 continue;
         }
 
-        u32 vr = interpX.Interpolate(rl, rr);
-        u32 vg = interpX.Interpolate(gl, gr);
-        u32 vb = interpX.Interpolate(bl, br);
+        u32 vr = rspan[x];
+        u32 vg = gspan[x];
+        u32 vb = bspan[x];
 
-        s16 s = interpX.Interpolate(sl, sr);
-        s16 t = interpX.Interpolate(tl, tr);
+        s16 s = sspan[x];
+        s16 t = tspan[x];
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel(rp, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1655,7 +2321,7 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
         // check stencil buffer for shadows
         if (polygon->IsShadow)
         {
-            u8 stencil = StencilBuffer[256*(y&0x1) + x];
+            u8 stencil = st->StencilBuffer[256*(y&0x1) + x];
             if (!stencil)
                 continue;
             if (!(stencil & 0x1))
@@ -1687,7 +2353,7 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
         s16 s = interpX.Interpolate(sl, sr);
         s16 t = interpX.Interpolate(tl, tr);
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel(rp, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1739,19 +2405,19 @@ void RenderPolygonScanline(RendererPolygon* rp, s32 y)
     rp->XR = rp->SlopeR.Step();
 }
 
-void RenderScanline(s32 y, int npolys)
+void RenderScanline(s32 y, RendererPolygon* polylist, int npolys, StencilState* st)
 {
     for (int i = 0; i < npolys; i++)
     {
-        RendererPolygon* rp = &PolygonList[i];
+        RendererPolygon* rp = &polylist[i];
         Polygon* polygon = rp->PolyData;
 
         if (y >= polygon->YTop && (y < polygon->YBottom || (y == polygon->YTop && polygon->YBottom == polygon->YTop)))
         {
             if (polygon->IsShadowMask)
-                RenderShadowMaskScanline(rp, y);
+                RenderShadowMaskScanline(rp, y, st);
             else
-                RenderPolygonScanline(rp, y);
+                RenderPolygonScanline(rp, y, st);
         }
     }
 }
@@ -2054,20 +2720,363 @@ void ClearBuffers()
     }
 }
 
-void RenderPolygons(bool threaded, Polygon** polygons, int npolys)
+// banded rendering
+//
+// the frame is split into bands of scanlines, which are rasterized in
+// parallel by the worker threads and the thread calling RenderPolygons().
+// each band sets up its own edge state for the polygons it covers. as far
+// as rasterization goes, scanlines only touch their own row of the buffers,
+// so the only state shared between scanlines is the stencil state, which
+// is dealt with in SetupBands().
+// the final pass needs the neighboring scanlines, so it is done once the
+// bands are complete, in order, by the calling thread.
+
+const int BandHeight = 8;
+const int MaxBands = 192 / BandHeight;
+
+typedef struct
+{
+    s32 YStart, YEnd;
+
+    StencilState* Stencil;
+    StencilState LocalStencil;
+    bool StencilUsed[2];
+
+    Platform::Semaphore* Sema_Done;
+
+} RenderBand;
+
+INSTANCE_LOCAL RenderBand Bands[MaxBands];
+INSTANCE_LOCAL int NumBands;
+INSTANCE_LOCAL int NextBand;
+
+INSTANCE_LOCAL Polygon** BandPolygons;
+INSTANCE_LOCAL int NumBandPolygons;
+INSTANCE_LOCAL bool FinalPrevIsShadowMask;
+
+INSTANCE_LOCAL Platform::Thread* WorkerThreads[MaxWorkers];
+INSTANCE_LOCAL RendererPolygon* WorkerPolygonList[MaxWorkers];
+INSTANCE_LOCAL int NumWorkersStarted;
+
+void WorkerThreadFunc();
+
+
+bool InitBands()
+{
+    for (int i = 0; i < MaxBands; i++)
+        Bands[i].Sema_Done = Platform::Semaphore_Create();
+
+    Sema_WorkerStart = Platform::Semaphore_Create();
+    Sema_WorkerDone = Platform::Semaphore_Create();
+    BandLock = Platform::Mutex_Create();
+
+    NumWorkers = 0;
+    NumWorkersRunning = 0;
+    WorkersRunning = false;
+    memset(WorkerPolygonList, 0, sizeof(WorkerPolygonList));
+
+    return true;
+}
+
+void DeInitBands()
+{
+    StopWorkerThreads();
+
+    for (int i = 0; i < MaxWorkers; i++)
+    {
+        if (WorkerPolygonList[i]) delete[] WorkerPolygonList[i];
+        WorkerPolygonList[i] = nullptr;
+    }
+
+    for (int i = 0; i < MaxBands; i++)
+        Platform::Semaphore_Free(Bands[i].Sema_Done);
+
+    Platform::Semaphore_Free(Sema_WorkerStart);
+    Platform::Semaphore_Free(Sema_WorkerDone);
+    Platform::Mutex_Free(BandLock);
+}
+
+void StopWorkerThreads()
+{
+    if (!WorkersRunning) return;
+
+    WorkersRunning = false;
+    for (int i = 0; i < NumWorkersRunning; i++)
+        Platform::Semaphore_Post(Sema_WorkerStart);
+
+    for (int i = 0; i < NumWorkersRunning; i++)
+    {
+        Platform::Thread_Wait(WorkerThreads[i]);
+        Platform::Thread_Free(WorkerThreads[i]);
+    }
+
+    NumWorkersRunning = 0;
+}
+
+void SetupWorkerThreads()
+{
+    // note: this must not be called while a frame is being rendered
+    if (NumWorkersRunning == NumWorkers) return;
+
+    StopWorkerThreads();
+    if (NumWorkers == 0) return;
+
+    for (int i = 0; i < NumWorkers; i++)
+    {
+        if (!WorkerPolygonList[i])
+            WorkerPolygonList[i] = new RendererPolygon[2048];
+    }
+
+    Platform::Semaphore_Reset(Sema_WorkerStart);
+    Platform::Semaphore_Reset(Sema_WorkerDone);
+
+    WorkersRunning = true;
+    NumWorkersStarted = 0;
+    for (int i = 0; i < NumWorkers; i++)
+        WorkerThreads[i] = Platform::Thread_Create(WorkerThreadFunc);
+
+    NumWorkersRunning = NumWorkers;
+}
+
+void SetupBands(Polygon** polygons, int npolys)
+{
+    // the stencil buffer contents carry over from one scanline to the next
+    // scanline of the same parity, unless they get cleared by a shadow mask
+    // that doesn't directly follow another shadow mask. the shadow mask
+    // state itself carries over from one scanline to the next.
+    //
+    // a band can only start at a scanline where, for both parities, the
+    // first polygon to use the stencil buffer is a shadow mask that clears
+    // it. otherwise, the band is merged with the previous one.
+    // the shadow mask state only depends on which polygons are rendered on
+    // which scanline, so it can be worked out beforehand.
+
+    int firststencil[192];
+    int prevpoly[192];
+    int lastpoly[192];
+    bool startprev[192];
+    bool depends[192+2];
+
+    for (int y = 0; y < 192; y++)
+    {
+        firststencil[y] = -1;
+        prevpoly[y] = -1;
+        lastpoly[y] = -1;
+    }
+
+    for (int i = 0; i < npolys; i++)
+    {
+        Polygon* polygon = polygons[i];
+        if (polygon->Degenerate) continue;
+
+        s32 ytop = polygon->YTop;
+        s32 ybot = (polygon->YBottom == ytop) ? (ytop+1) : polygon->YBottom;
+        if (ybot > 192) ybot = 192;
+
+        bool usestencil = polygon->IsShadowMask || polygon->IsShadow;
+
+        for (s32 y = ytop; y < ybot; y++)
+        {
+            if (usestencil && firststencil[y] == -1)
+            {
+                firststencil[y] = i;
+                prevpoly[y] = lastpoly[y];
+            }
+
+            lastpoly[y] = i;
+        }
+    }
+
+    bool prev = Stencil.PrevIsShadowMask;
+    for (int y = 0; y < 192; y++)
+    {
+        startprev[y] = prev;
+
+        if (firststencil[y] != -1)
+        {
+            Polygon* polygon = polygons[firststencil[y]];
+
+            if (polygon->IsShadow)
+                depends[y] = true;
+            else if (prevpoly[y] != -1)
+                depends[y] = polygons[prevpoly[y]]->IsShadowMask;
+            else
+                depends[y] = prev;
+        }
+
+        if (lastpoly[y] != -1)
+            prev = polygons[lastpoly[y]]->IsShadowMask;
+    }
+
+    FinalPrevIsShadowMask = prev;
+
+    // scanlines with no stencil operations depend on whatever comes next
+    depends[192] = false;
+    depends[193] = false;
+    for (int y = 191; y >= 0; y--)
+    {
+        if (firststencil[y] == -1)
+            depends[y] = depends[y+2];
+    }
+
+    NumBands = 0;
+    for (int y = 0; y < 192; y += BandHeight)
+    {
+        if (y > 0 && (depends[y] || depends[y+1]))
+        {
+            Bands[NumBands-1].YEnd = y + BandHeight;
+            continue;
+        }
+
+        RenderBand* band = &Bands[NumBands++];
+        band->YStart = y;
+        band->YEnd = y + BandHeight;
+
+        if (y == 0)
+            band->Stencil = &Stencil;
+        else
+        {
+            band->Stencil = &band->LocalStencil;
+            band->LocalStencil.PrevIsShadowMask = startprev[y];
+        }
+    }
+
+    for (int b = 0; b < NumBands; b++)
+    {
+        RenderBand* band = &Bands[b];
+
+        band->StencilUsed[0] = false;
+        band->StencilUsed[1] = false;
+        for (int y = band->YStart; y < band->YEnd; y++)
+        {
+            if (firststencil[y] != -1)
+                band->StencilUsed[y & 0x1] = true;
+        }
+    }
+}
+
+void RenderBands(RendererPolygon* polylist)
+{
+    for (;;)
+    {
+        Platform::Mutex_Lock(BandLock);
+        int b = NextBand++;
+        Platform::Mutex_Unlock(BandLock);
+
+        if (b >= NumBands) return;
+
+        RenderBand* band = &Bands[b];
+        s32 ystart = band->YStart;
+
+        // set up the polygons covering this band, as they would be
+        // after rendering all the scanlines before it
+        int j = 0;
+        for (int i = 0; i < NumBandPolygons; i++)
+        {
+            Polygon* polygon = BandPolygons[i];
+            if (polygon->Degenerate) continue;
+
+            s32 ybot = (polygon->YBottom == polygon->YTop) ? (polygon->YTop+1) : polygon->YBottom;
+            if (polygon->YTop >= band->YEnd || ybot <= ystart) continue;
+
+            RendererPolygon* rp = &polylist[j++];
+            SetupPolygon(rp, polygon);
+            rp->Texels = PolygonTexels[i];
+
+            if (polygon->YTop < ystart)
+            {
+                SetupPolygonLeftEdge(rp, ystart);
+                SetupPolygonRightEdge(rp, ystart);
+            }
+        }
+
+        for (s32 y = ystart; y < band->YEnd; y++)
+            RenderScanline(y, polylist, j, band->Stencil);
+
+        Platform::Semaphore_Post(band->Sema_Done);
+    }
+}
+
+void RenderPolygonsBanded(bool threaded, Polygon** polygons, int npolys)
+{
+    SetupBands(polygons, npolys);
+
+    BandPolygons = polygons;
+    NumBandPolygons = npolys;
+    NextBand = 0;
+
+    for (int i = 0; i < NumWorkersRunning; i++)
+        Platform::Semaphore_Post(Sema_WorkerStart);
+
+    RenderBands(PolygonList);
+
+    // the final pass for a scanline needs the scanlines above and below it
+    s32 y = 0;
+    for (int b = 0; b < NumBands; b++)
+    {
+        Platform::Semaphore_Wait(Bands[b].Sema_Done);
+
+        s32 yend = (b == NumBands-1) ? 192 : (Bands[b].YEnd - 1);
+        for (; y < yend; y++)
+        {
+            ScanlineFinalPass(y);
+
+            if (threaded)
+                Platform::Semaphore_Post(Sema_ScanlineCount);
+        }
+    }
+
+    for (int i = 0; i < NumWorkersRunning; i++)
+        Platform::Semaphore_Wait(Sema_WorkerDone);
+
+    // carry the stencil state over to the next frame, like the
+    // serial renderer does
+    for (int p = 0; p < 2; p++)
+    {
+        for (int b = NumBands-1; b > 0; b--)
+        {
+            if (!Bands[b].StencilUsed[p]) continue;
+
+            memcpy(&Stencil.StencilBuffer[256*p], &Bands[b].LocalStencil.StencilBuffer[256*p], 256);
+            break;
+        }
+    }
+
+    Stencil.PrevIsShadowMask = FinalPrevIsShadowMask;
+}
+
+void WorkerThreadFunc()
+{
+    Platform::Mutex_Lock(BandLock);
+    int id = NumWorkersStarted++;
+    Platform::Mutex_Unlock(BandLock);
+
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_WorkerStart);
+        if (!WorkersRunning) return;
+
+        RenderBands(WorkerPolygonList[id]);
+
+        Platform::Semaphore_Post(Sema_WorkerDone);
+    }
+}
+
+void RenderPolygonsSerial(bool threaded, Polygon** polygons, int npolys)
 {
     int j = 0;
     for (int i = 0; i < npolys; i++)
     {
         if (polygons[i]->Degenerate) continue;
-        SetupPolygon(&PolygonList[j++], polygons[i]);
+        SetupPolygon(&PolygonList[j], polygons[i]);
+        PolygonList[j++].Texels = PolygonTexels[i];
     }
 
-    RenderScanline(0, j);
+    RenderScanline(0, PolygonList, j, &Stencil);
 
     for (s32 y = 1; y < 192; y++)
     {
-        RenderScanline(y, j);
+        RenderScanline(y, PolygonList, j, &Stencil);
         ScanlineFinalPass(y-1);
 
         if (threaded)
@@ -2080,6 +3089,30 @@ void RenderPolygons(bool threaded, Polygon** polygons, int npolys)
         Platform::Semaphore_Post(Sema_ScanlineCount);
 }
 
+void RenderPolygons(bool threaded, Polygon** polygons, int npolys)
+{
+#ifdef PROFILING_ENABLED
+    u64 profstart = Profiler::GetTicks();
+#endif
+
+    // decode the textures up front, rasterizing only reads from the cache
+    UpdateTexCache();
+    for (int i = 0; i < npolys; i++)
+    {
+        if (polygons[i]->Degenerate) PolygonTexels[i] = NULL;
+        else                         PolygonTexels[i] = GetTexture(polygons[i]);
+    }
+
+    if (NumWorkersRunning > 0)
+        RenderPolygonsBanded(threaded, polygons, npolys);
+    else
+        RenderPolygonsSerial(threaded, polygons, npolys);
+
+#ifdef PROFILING_ENABLED
+    Profiler::Time[Profiler::Prof_GPU3DRender] += Profiler::GetTicks() - profstart;
+#endif
+}
+
 void VCount144()
 {
     if (RenderThreadRunning)
@@ -2088,6 +3121,10 @@ void VCount144()
 
 void RenderFrame()
 {
+    // the render thread is idle at this point
+    TexCacheInvalid |= TexSlotsRemapped;
+    TexSlotsRemapped = 0;
+
     if (RenderThreadRunning)
     {
         Platform::Semaphore_Post(Sema_RenderStart);
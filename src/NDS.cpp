@@ -32,6 +32,7 @@
 #include "Wifi.h"
 #include "AREngine.h"
 #include "Platform.h"
+#include "Profiler.h"
 
 #ifdef JIT_ENABLED
 #include "ARMJIT.h"
@@ -67,98 +68,106 @@ namespace NDS
 //
 // timings for GBA slot and wifi are set up at runtime
 
-int ConsoleType;
+INSTANCE_LOCAL int ConsoleType;
 
-u8 ARM9MemTimings[0x40000][4];
-u8 ARM7MemTimings[0x20000][4];
+INSTANCE_LOCAL u8 ARM9MemTimings[0x40000][4];
+INSTANCE_LOCAL u8 ARM7MemTimings[0x20000][4];
 
-ARMv5* ARM9;
-ARMv4* ARM7;
+INSTANCE_LOCAL ARMv5* ARM9;
+INSTANCE_LOCAL ARMv4* ARM7;
 
-u32 NumFrames;
-u64 LastSysClockCycles;
-u64 FrameStartTimestamp;
+INSTANCE_LOCAL u32 NumFrames;
+INSTANCE_LOCAL u64 LastSysClockCycles;
+INSTANCE_LOCAL u64 FrameStartTimestamp;
 
-int CurCPU;
+INSTANCE_LOCAL int CurCPU;
 
 const s32 kMaxIterationCycles = 64;
 
-u32 ARM9ClockShift;
+INSTANCE_LOCAL u32 ARM9ClockShift;
 
 // no need to worry about those overflowing, they can keep going for atleast 4350 years
-u64 ARM9Timestamp, ARM9Target;
-u64 ARM7Timestamp, ARM7Target;
-u64 SysTimestamp;
+INSTANCE_LOCAL u64 ARM9Timestamp, ARM9Target;
+INSTANCE_LOCAL u64 ARM7Timestamp, ARM7Target;
+INSTANCE_LOCAL u64 SysTimestamp;
 
-SchedEvent SchedList[Event_MAX];
-u32 SchedListMask;
+INSTANCE_LOCAL SchedEvent SchedList[Event_MAX];
+INSTANCE_LOCAL u32 SchedListMask;
 
-u32 CPUStop;
+// scheduled events are also kept in a binary min-heap ordered by timestamp
+// (ties broken by event ID), so the next one is always at SchedHeap[0]
+INSTANCE_LOCAL u8 SchedHeap[Event_MAX];
+INSTANCE_LOCAL u8 SchedHeapPos[Event_MAX];
+INSTANCE_LOCAL u32 SchedHeapLen;
 
-u8 ARM9BIOS[0x1000];
-u8 ARM7BIOS[0x4000];
+void RebuildSchedHeap();
 
-u8* MainRAM;
-u32 MainRAMMask;
+INSTANCE_LOCAL u32 CPUStop;
 
-u8* SharedWRAM;
-u8 WRAMCnt;
+INSTANCE_LOCAL u8 ARM9BIOS[0x1000];
+INSTANCE_LOCAL u8 ARM7BIOS[0x4000];
+
+INSTANCE_LOCAL u8* MainRAM;
+INSTANCE_LOCAL u32 MainRAMMask;
+
+INSTANCE_LOCAL u8* SharedWRAM;
+INSTANCE_LOCAL u8 WRAMCnt;
 
 // putting them together so they're always next to each other
-MemRegion SWRAM_ARM9;
-MemRegion SWRAM_ARM7;
+INSTANCE_LOCAL MemRegion SWRAM_ARM9;
+INSTANCE_LOCAL MemRegion SWRAM_ARM7;
 
-u8* ARM7WRAM;
+INSTANCE_LOCAL u8* ARM7WRAM;
 
-u16 ExMemCnt[2];
+INSTANCE_LOCAL u16 ExMemCnt[2];
 
 // TODO: these belong in NDSCart!
-u8 ROMSeed0[2*8];
-u8 ROMSeed1[2*8];
+INSTANCE_LOCAL u8 ROMSeed0[2*8];
+INSTANCE_LOCAL u8 ROMSeed1[2*8];
 
 // IO shit
-u32 IME[2];
-u32 IE[2], IF[2];
-u32 IE2, IF2;
+INSTANCE_LOCAL u32 IME[2];
+INSTANCE_LOCAL u32 IE[2], IF[2];
+INSTANCE_LOCAL u32 IE2, IF2;
 
-u8 PostFlag9;
-u8 PostFlag7;
-u16 PowerControl9;
-u16 PowerControl7;
+INSTANCE_LOCAL u8 PostFlag9;
+INSTANCE_LOCAL u8 PostFlag7;
+INSTANCE_LOCAL u16 PowerControl9;
+INSTANCE_LOCAL u16 PowerControl7;
 
-u16 WifiWaitCnt;
+INSTANCE_LOCAL u16 WifiWaitCnt;
 
-u16 ARM7BIOSProt;
+INSTANCE_LOCAL u16 ARM7BIOSProt;
 
-Timer Timers[8];
-u8 TimerCheckMask[2];
-u64 TimerTimestamp[2];
+INSTANCE_LOCAL Timer Timers[8];
+INSTANCE_LOCAL u8 TimerCheckMask[2];
+INSTANCE_LOCAL u64 TimerTimestamp[2];
 
-DMA* DMAs[8];
-u32 DMA9Fill[4];
+INSTANCE_LOCAL DMA* DMAs[8];
+INSTANCE_LOCAL u32 DMA9Fill[4];
 
-u16 IPCSync9, IPCSync7;
-u16 IPCFIFOCnt9, IPCFIFOCnt7;
-FIFO<u32>* IPCFIFO9; // FIFO in which the ARM9 writes
-FIFO<u32>* IPCFIFO7;
+INSTANCE_LOCAL u16 IPCSync9, IPCSync7;
+INSTANCE_LOCAL u16 IPCFIFOCnt9, IPCFIFOCnt7;
+INSTANCE_LOCAL FIFO<u32>* IPCFIFO9; // FIFO in which the ARM9 writes
+INSTANCE_LOCAL FIFO<u32>* IPCFIFO7;
 
-u16 DivCnt;
-u32 DivNumerator[2];
-u32 DivDenominator[2];
-u32 DivQuotient[2];
-u32 DivRemainder[2];
+INSTANCE_LOCAL u16 DivCnt;
+INSTANCE_LOCAL u32 DivNumerator[2];
+INSTANCE_LOCAL u32 DivDenominator[2];
+INSTANCE_LOCAL u32 DivQuotient[2];
+INSTANCE_LOCAL u32 DivRemainder[2];
 
-u16 SqrtCnt;
-u32 SqrtVal[2];
-u32 SqrtRes;
+INSTANCE_LOCAL u16 SqrtCnt;
+INSTANCE_LOCAL u32 SqrtVal[2];
+INSTANCE_LOCAL u32 SqrtRes;
 
-u32 KeyInput;
-u16 KeyCnt;
-u16 RCnt;
+INSTANCE_LOCAL u32 KeyInput;
+INSTANCE_LOCAL u16 KeyCnt;
+INSTANCE_LOCAL u16 RCnt;
 
-bool Running;
+INSTANCE_LOCAL bool Running;
 
-bool RunningGame;
+INSTANCE_LOCAL bool RunningGame;
 
 
 void DivDone(u32 param);
@@ -239,6 +248,10 @@ void DeInit()
 
 void SetARM9RegionTimings(u32 addrstart, u32 addrend, int buswidth, int nonseq, int seq)
 {
+#ifdef JIT_ENABLED
+    ARMJIT::SyncCompileThread();
+#endif
+
     addrstart >>= 14;
     addrend   >>= 14;
 
@@ -273,6 +286,10 @@ void SetARM9RegionTimings(u32 addrstart, u32 addrend, int buswidth, int nonseq,
 
 void SetARM7RegionTimings(u32 addrstart, u32 addrend, int buswidth, int nonseq, int seq)
 {
+#ifdef JIT_ENABLED
+    ARMJIT::SyncCompileThread();
+#endif
+
     addrstart >>= 15;
     addrend   >>= 15;
 
@@ -579,6 +596,7 @@ void Reset()
 
     memset(SchedList, 0, sizeof(SchedList));
     SchedListMask = 0;
+    RebuildSchedHeap();
 
     KeyInput = 0x007F03FF;
     KeyCnt = 0;
@@ -598,6 +616,9 @@ void Reset()
         KeyInput &= ~(1 << (16+6));
     }
 
+    UpdatePageMap(0, 0x00000000, 0x10000000);
+    UpdatePageMap(1, 0x00000000, 0x10000000);
+
     AREngine::Reset();
 }
 
@@ -760,6 +781,7 @@ bool DoSavestate(Savestate* file)
 
     if (!DoSavestate_Scheduler(file)) return false;
     file->Var32(&SchedListMask);
+    if (!file->Saving) RebuildSchedHeap();
     file->Var64(&ARM9Timestamp);
     file->Var64(&ARM9Target);
     file->Var64(&ARM7Timestamp);
@@ -808,6 +830,9 @@ bool DoSavestate(Savestate* file)
     if (!file->Saving)
     {
         GPU::SetPowerCnt(PowerControl9);
+
+        UpdatePageMap(0, 0x00000000, 0x10000000);
+        UpdatePageMap(1, 0x00000000, 0x10000000);
     }
 
 #ifdef JIT_ENABLED
@@ -830,6 +855,10 @@ bool LoadROM(const char* path, const char* sram, bool direct)
 {
     if (NDSCart::LoadROM(path, sram, direct))
     {
+#ifdef JIT_ENABLED
+        ARMJIT::LoadPersistentCache();
+#endif
+
         Running = true;
         return true;
     }
@@ -867,44 +896,162 @@ void RelocateSave(const char* path, bool write)
 
 
 
-u64 NextTarget()
+bool SchedBefore(u32 a, u32 b)
 {
-    u64 ret = SysTimestamp + kMaxIterationCycles;
+    if (SchedList[a].Timestamp != SchedList[b].Timestamp)
+        return SchedList[a].Timestamp < SchedList[b].Timestamp;
 
-    u32 mask = SchedListMask;
+    return a < b;
+}
+
+void SchedHeapSet(u32 pos, u32 id)
+{
+    SchedHeap[pos] = id;
+    SchedHeapPos[id] = pos;
+}
+
+void SchedHeapSiftUp(u32 pos)
+{
+    u32 id = SchedHeap[pos];
+    while (pos > 0)
+    {
+        u32 parent = (pos - 1) >> 1;
+        if (!SchedBefore(id, SchedHeap[parent])) break;
+
+        SchedHeapSet(pos, SchedHeap[parent]);
+        pos = parent;
+    }
+
+    SchedHeapSet(pos, id);
+}
+
+void SchedHeapSiftDown(u32 pos)
+{
+    u32 id = SchedHeap[pos];
+    for (;;)
+    {
+        u32 child = (pos << 1) + 1;
+        if (child >= SchedHeapLen) break;
+        if ((child+1) < SchedHeapLen && SchedBefore(SchedHeap[child+1], SchedHeap[child]))
+            child++;
+        if (!SchedBefore(SchedHeap[child], id)) break;
+
+        SchedHeapSet(pos, SchedHeap[child]);
+        pos = child;
+    }
+
+    SchedHeapSet(pos, id);
+}
+
+void SchedHeapInsert(u32 id)
+{
+    u32 pos = SchedHeapLen++;
+    SchedHeapSet(pos, id);
+    SchedHeapSiftUp(pos);
+}
+
+void SchedHeapRemove(u32 id)
+{
+    u32 pos = SchedHeapPos[id];
+    if (pos >= SchedHeapLen || SchedHeap[pos] != id)
+        return; // not in the heap
+
+    SchedHeapLen--;
+    if (pos == SchedHeapLen) return;
+
+    SchedHeapSet(pos, SchedHeap[SchedHeapLen]);
+    if (pos > 0 && SchedBefore(SchedHeap[pos], SchedHeap[(pos - 1) >> 1]))
+        SchedHeapSiftUp(pos);
+    else
+        SchedHeapSiftDown(pos);
+}
+
+void RebuildSchedHeap()
+{
+    SchedHeapLen = 0;
     for (int i = 0; i < Event_MAX; i++)
     {
-        if (!mask) break;
-        if (mask & 0x1)
-        {
-            if (SchedList[i].Timestamp < ret)
-                ret = SchedList[i].Timestamp;
-        }
+        if (SchedListMask & (1<<i))
+            SchedHeapInsert(i);
+    }
+}
 
-        mask >>= 1;
+u64 NextTarget()
+{
+    u64 ret = SysTimestamp + kMaxIterationCycles;
+
+    if (SchedHeapLen)
+    {
+        u64 next = SchedList[SchedHeap[0]].Timestamp;
+        if (next < ret)
+            ret = next;
     }
 
     return ret;
 }
 
+bool SchedHeapContains(u32 id)
+{
+    u32 pos = SchedHeapPos[id];
+    return pos < SchedHeapLen && SchedHeap[pos] == id;
+}
+
 void RunSystem(u64 timestamp)
 {
     SysTimestamp = timestamp;
 
-    u32 mask = SchedListMask;
+    // run the due events in ID order, the same way as scanning all the
+    // events that were scheduled when the pass started: when a callback makes
+    // such an event due, it still runs in this pass if its ID is higher than
+    // the current one. otherwise it waits for the next pass.
+    // the events taken off the heap stay marked as scheduled until they are run
+    u32 scheduled = SchedListMask;
+    u32 mask = 0;
+    u32 deferred = 0;
+    s32 cur = -1;
+
+    auto takedue = [&]()
+    {
+        while (SchedHeapLen)
+        {
+            u32 id = SchedHeap[0];
+            if (SchedList[id].Timestamp > SysTimestamp) break;
+
+            SchedHeapRemove(id);
+            if ((s32)id > cur && (scheduled & (1<<id)))
+                mask |= (1<<id);
+            else
+                deferred |= (1<<id);
+        }
+    };
+
+    takedue();
+
     for (int i = 0; i < Event_MAX; i++)
     {
-        if (!mask) break;
-        if (mask & 0x1)
+        if (!(mask >> i)) break;
+        if (mask & (1<<i))
         {
             if (SchedList[i].Timestamp <= SysTimestamp)
             {
+                // an earlier event might have rescheduled this one
+                SchedHeapRemove(i);
+
                 SchedListMask &= ~(1<<i);
+                cur = i;
                 SchedList[i].Func(SchedList[i].Param);
+
+                takedue();
             }
         }
+    }
 
-        mask >>= 1;
+    // the events that wait for the next pass go back on the heap
+    for (int i = 0; i < Event_MAX; i++)
+    {
+        if (!(deferred >> i)) break;
+        if ((deferred & (1<<i)) && (SchedListMask & (1<<i)) && !SchedHeapContains(i))
+            SchedHeapInsert(i);
     }
 }
 
@@ -925,6 +1072,10 @@ u32 RunFrame()
         ARM9Target = target << ARM9ClockShift;
         CurCPU = 0;
 
+#ifdef PROFILING_ENABLED
+        u64 profstart = Profiler::GetTicks();
+#endif
+
         if (CPUStop & 0x80000000)
         {
             // GXFIFO stall
@@ -950,9 +1101,21 @@ u32 RunFrame()
                 ARM9->Execute();
         }
 
+#ifdef PROFILING_ENABLED
+        u64 proftime = Profiler::GetTicks();
+        Profiler::Time[Profiler::Prof_ARM9] += proftime - profstart;
+        profstart = proftime;
+#endif
+
         RunTimers(0);
         GPU3D::Run();
 
+#ifdef PROFILING_ENABLED
+        proftime = Profiler::GetTicks();
+        Profiler::Time[Profiler::Prof_GPU3D] += proftime - profstart;
+        profstart = proftime;
+#endif
+
         target = ARM9Timestamp >> ARM9ClockShift;
         CurCPU = 1;
 
@@ -981,6 +1144,10 @@ u32 RunFrame()
             RunTimers(1);
         }
 
+#ifdef PROFILING_ENABLED
+        Profiler::Time[Profiler::Prof_ARM7] += Profiler::GetTicks() - profstart;
+#endif
+
         RunSystem(target);
 
         if (CPUStop & 0x40000000)
@@ -1060,6 +1227,7 @@ void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 para
     evt->Param = param;
 
     SchedListMask |= (1<<id);
+    SchedHeapInsert(id);
 
     Reschedule(evt->Timestamp);
 }
@@ -1067,6 +1235,7 @@ void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 para
 void CancelEvent(u32 id)
 {
     SchedListMask &= ~(1<<id);
+    SchedHeapRemove(id);
 }
 
 
@@ -1185,6 +1354,48 @@ void MapSharedWRAM(u8 val)
         SWRAM_ARM7.Mask = 0x7FFF;
         break;
     }
+
+    UpdatePageMap(0, 0x03000000, 0x04000000);
+    UpdatePageMap(1, 0x03000000, 0x04000000);
+}
+
+
+void UpdatePageMap(u32 cpu, u32 start, u32 end)
+{
+    u8** readmap = cpu ? ARM7->PageReadMap : ARM9->PageReadMap;
+    u8** writemap = cpu ? ARM7->PageWriteMap : ARM9->PageWriteMap;
+
+    // with the JIT, writes have to go through the handlers to invalidate blocks
+    bool fastwrite = true;
+#ifdef JIT_ENABLED
+    if (Config::JIT_Enable) fastwrite = false;
+#endif
+
+    for (u32 addr = start & ~0xFFF; addr < end; addr += 0x1000)
+    {
+        u8* rptr;
+        u8* wptr;
+
+        if (ConsoleType == 1)
+        {
+            rptr = cpu ? DSi::ARM7GetPagePtr(addr, false) : DSi::ARM9GetPagePtr(addr, false);
+            wptr = cpu ? DSi::ARM7GetPagePtr(addr, true) : DSi::ARM9GetPagePtr(addr, true);
+        }
+        else
+        {
+            rptr = cpu ? ARM7GetPagePtr(addr, false) : ARM9GetPagePtr(addr, false);
+            wptr = cpu ? ARM7GetPagePtr(addr, true) : ARM9GetPagePtr(addr, true);
+        }
+
+        // stores to sample data that's being played have to flush the SPU
+        // first, they go through the handlers (see SPU::UpdateSampleWatch())
+        if (wptr && ((addr >> 24) == 0x02 || (cpu && (addr >> 24) == 0x03))
+            && SPU::PlaysFrom(addr, 0x1000))
+            wptr = NULL;
+
+        readmap[addr >> 12] = rptr;
+        writemap[addr >> 12] = fastwrite ? wptr : NULL;
+    }
 }
 
 
@@ -1849,6 +2060,27 @@ void debug(u32 param)
 
 
 
+// CPU stores to sample data that a sound channel plays flush the SPU first
+inline void SyncSPUMainRAM(u32 addr, u32 len, u64 timestamp)
+{
+    u32 offset = addr & MainRAMMask;
+    if (offset < SPU::WatchMainRAMEnd && SPU::WatchMainRAMStart < offset + len)
+        SPU::SyncMemoryWrite(addr, len, timestamp);
+}
+
+inline void SyncSPUWRAM(u32 addr, u32 len)
+{
+    if (SPU::WatchWRAM)
+        SPU::SyncMemoryWrite(addr, len, ARM7Timestamp);
+}
+
+// the SPU can't mix ahead of the ARM7
+inline u64 ARM9SPUTimestamp()
+{
+    u64 timestamp = ARM9Timestamp >> ARM9ClockShift;
+    return (timestamp < ARM7Timestamp) ? timestamp : ARM7Timestamp;
+}
+
 u8 ARM9Read8(u32 addr)
 {
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
@@ -2052,6 +2284,7 @@ void ARM9Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        SyncSPUMainRAM(addr, 1, ARM9SPUTimestamp());
         *(u8*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2108,6 +2341,7 @@ void ARM9Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        SyncSPUMainRAM(addr, 2, ARM9SPUTimestamp());
         *(u16*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2127,6 +2361,7 @@ void ARM9Write16(u32 addr, u16 val)
 
     case 0x05000000:
         if (!(PowerControl9 & ((addr & 0x400) ? (1<<9) : (1<<1)))) return;
+        if (GPU::Pending2D) GPU::Sync2D();
         *(u16*)&GPU::Palette[addr & 0x7FF] = val;
         return;
 
@@ -2145,6 +2380,7 @@ void ARM9Write16(u32 addr, u16 val)
 
     case 0x07000000:
         if (!(PowerControl9 & ((addr & 0x400) ? (1<<9) : (1<<1)))) return;
+        if (GPU::Pending2D) GPU::Sync2D();
         *(u16*)&GPU::OAM[addr & 0x7FF] = val;
         return;
 
@@ -2183,6 +2419,7 @@ void ARM9Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        SyncSPUMainRAM(addr, 4, ARM9SPUTimestamp());
         *(u32*)&MainRAM[addr & MainRAMMask] = val;
         return ;
 
@@ -2202,6 +2439,7 @@ void ARM9Write32(u32 addr, u32 val)
 
     case 0x05000000:
         if (!(PowerControl9 & ((addr & 0x400) ? (1<<9) : (1<<1)))) return;
+        if (GPU::Pending2D) GPU::Sync2D();
         *(u32*)&GPU::Palette[addr & 0x7FF] = val;
         return;
 
@@ -2220,6 +2458,7 @@ void ARM9Write32(u32 addr, u32 val)
 
     case 0x07000000:
         if (!(PowerControl9 & ((addr & 0x400) ? (1<<9) : (1<<1)))) return;
+        if (GPU::Pending2D) GPU::Sync2D();
         *(u32*)&GPU::OAM[addr & 0x7FF] = val;
         return;
 
@@ -2281,6 +2520,39 @@ bool ARM9GetMemRegion(u32 addr, bool write, MemRegion* region)
     return false;
 }
 
+u8* ARM9GetPagePtr(u32 addr, bool write)
+{
+    switch (addr & 0xFF000000)
+    {
+    case 0x02000000:
+        return &MainRAM[addr & MainRAMMask];
+
+    case 0x03000000:
+        if (SWRAM_ARM9.Mem)
+            return &SWRAM_ARM9.Mem[addr & SWRAM_ARM9.Mask];
+        return NULL;
+
+    case 0x06000000:
+        // VRAM writes have to be tracked, and LCDC reads synced with capture
+        if (!write)
+        {
+            u8* ptr;
+            switch (addr & 0x00E00000)
+            {
+            case 0x00000000: ptr = GPU::VRAMPtr_ABG[(addr >> 14) & 0x1F]; break;
+            case 0x00200000: ptr = GPU::VRAMPtr_BBG[(addr >> 14) & 0x7]; break;
+            case 0x00400000: ptr = GPU::VRAMPtr_AOBJ[(addr >> 14) & 0xF]; break;
+            case 0x00600000: ptr = GPU::VRAMPtr_BOBJ[(addr >> 14) & 0x7]; break;
+            default: return NULL;
+            }
+            return ptr ? &ptr[addr & 0x3FFF] : NULL;
+        }
+        return NULL;
+    }
+
+    return NULL;
+}
+
 
 
 u8 ARM7Read8(u32 addr)
@@ -2487,6 +2759,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        SyncSPUMainRAM(addr, 1, ARM7Timestamp);
         *(u8*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2496,6 +2769,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            SyncSPUWRAM(addr, 1);
             *(u8*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
             return;
         }
@@ -2504,6 +2778,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+            SyncSPUWRAM(addr, 1);
             *(u8*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
             return;
         }
@@ -2512,6 +2787,7 @@ void ARM7Write8(u32 addr, u8 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+        SyncSPUWRAM(addr, 1);
         *(u8*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
         return;
 
@@ -2562,6 +2838,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        SyncSPUMainRAM(addr, 2, ARM7Timestamp);
         *(u16*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2571,6 +2848,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            SyncSPUWRAM(addr, 2);
             *(u16*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
             return;
         }
@@ -2579,6 +2857,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+            SyncSPUWRAM(addr, 2);
             *(u16*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
             return;
         }
@@ -2587,6 +2866,7 @@ void ARM7Write16(u32 addr, u16 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+        SyncSPUWRAM(addr, 2);
         *(u16*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
         return;
 
@@ -2646,6 +2926,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(addr);
 #endif
+        SyncSPUMainRAM(addr, 4, ARM7Timestamp);
         *(u32*)&MainRAM[addr & MainRAMMask] = val;
         return;
 
@@ -2655,6 +2936,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_SharedWRAM>(addr);
 #endif
+            SyncSPUWRAM(addr, 4);
             *(u32*)&SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask] = val;
             return;
         }
@@ -2663,6 +2945,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
             ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+            SyncSPUWRAM(addr, 4);
             *(u32*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
             return;
         }
@@ -2671,6 +2954,7 @@ void ARM7Write32(u32 addr, u32 val)
 #ifdef JIT_ENABLED
         ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_WRAM7>(addr);
 #endif
+        SyncSPUWRAM(addr, 4);
         *(u32*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)] = val;
         return;
 
@@ -2768,6 +3052,37 @@ bool ARM7GetMemRegion(u32 addr, bool write, MemRegion* region)
     return false;
 }
 
+u8* ARM7GetPagePtr(u32 addr, bool write)
+{
+    switch (addr & 0xFF800000)
+    {
+    case 0x02000000:
+    case 0x02800000:
+        return &MainRAM[addr & MainRAMMask];
+
+    case 0x03000000:
+        if (SWRAM_ARM7.Mem)
+            return &SWRAM_ARM7.Mem[addr & SWRAM_ARM7.Mask];
+        return &ARM7WRAM[addr & (ARM7WRAMSize - 1)];
+
+    case 0x03800000:
+        return &ARM7WRAM[addr & (ARM7WRAMSize - 1)];
+
+    case 0x06000000:
+    case 0x06800000:
+        // only when a single bank is mapped there, overlapping banks are ORed
+        if (!write)
+        {
+            u32 mask = GPU::VRAMMap_ARM7[(addr >> 17) & 0x1];
+            if (mask == (1<<2)) return &GPU::VRAM_C[addr & 0x1FFFF];
+            if (mask == (1<<3)) return &GPU::VRAM_D[addr & 0x1FFFF];
+        }
+        return NULL;
+    }
+
+    return NULL;
+}
+
 
 
 
@@ -3275,6 +3590,10 @@ void ARM9IOWrite16(u32 addr, u16 val)
     case 0x040001BA: ROMSeed1[4] = val & 0x7F; return;
 
     case 0x04000204:
+#ifdef JIT_ENABLED
+        // the JIT compiler looks at who has access to the cart
+        ARMJIT::SyncCompileThread();
+#endif
         ExMemCnt[0] = val;
         ExMemCnt[1] = (ExMemCnt[1] & 0x007F) | (val & 0xFF80);
         SetGBASlotTimings();
@@ -135,50 +135,51 @@ typedef struct
 
 } MemRegion;
 
-extern int ConsoleType;
-extern int CurCPU;
+extern INSTANCE_LOCAL int ConsoleType;
+extern INSTANCE_LOCAL int CurCPU;
 
-extern u8 ARM9MemTimings[0x40000][4];
-extern u8 ARM7MemTimings[0x20000][4];
+extern INSTANCE_LOCAL u8 ARM9MemTimings[0x40000][4];
+extern INSTANCE_LOCAL u8 ARM7MemTimings[0x20000][4];
 
-extern u64 ARM9Timestamp, ARM9Target;
-extern u64 ARM7Timestamp, ARM7Target;
-extern u32 ARM9ClockShift;
+extern INSTANCE_LOCAL u64 ARM9Timestamp, ARM9Target;
+extern INSTANCE_LOCAL u64 ARM7Timestamp, ARM7Target;
+extern INSTANCE_LOCAL u64 SysTimestamp;
+extern INSTANCE_LOCAL u32 ARM9ClockShift;
 
-extern u32 IME[2];
-extern u32 IE[2];
-extern u32 IF[2];
-extern u32 IE2;
-extern u32 IF2;
-extern Timer Timers[8];
+extern INSTANCE_LOCAL u32 IME[2];
+extern INSTANCE_LOCAL u32 IE[2];
+extern INSTANCE_LOCAL u32 IF[2];
+extern INSTANCE_LOCAL u32 IE2;
+extern INSTANCE_LOCAL u32 IF2;
+extern INSTANCE_LOCAL Timer Timers[8];
 
-extern u32 CPUStop;
+extern INSTANCE_LOCAL u32 CPUStop;
 
-extern u16 PowerControl9;
+extern INSTANCE_LOCAL u16 PowerControl9;
 
-extern u16 ExMemCnt[2];
-extern u8 ROMSeed0[2*8];
-extern u8 ROMSeed1[2*8];
+extern INSTANCE_LOCAL u16 ExMemCnt[2];
+extern INSTANCE_LOCAL u8 ROMSeed0[2*8];
+extern INSTANCE_LOCAL u8 ROMSeed1[2*8];
 
-extern u8 ARM9BIOS[0x1000];
-extern u8 ARM7BIOS[0x4000];
-extern u16 ARM7BIOSProt;
+extern INSTANCE_LOCAL u8 ARM9BIOS[0x1000];
+extern INSTANCE_LOCAL u8 ARM7BIOS[0x4000];
+extern INSTANCE_LOCAL u16 ARM7BIOSProt;
 
-extern u8* MainRAM;
-extern u32 MainRAMMask;
+extern INSTANCE_LOCAL u8* MainRAM;
+extern INSTANCE_LOCAL u32 MainRAMMask;
 
 const u32 MainRAMMaxSize = 0x1000000;
 
 const u32 SharedWRAMSize = 0x8000;
-extern u8* SharedWRAM;
+extern INSTANCE_LOCAL u8* SharedWRAM;
 
-extern MemRegion SWRAM_ARM9;
-extern MemRegion SWRAM_ARM7;
+extern INSTANCE_LOCAL MemRegion SWRAM_ARM9;
+extern INSTANCE_LOCAL MemRegion SWRAM_ARM7;
 
-extern u32 KeyInput;
+extern INSTANCE_LOCAL u32 KeyInput;
 
 const u32 ARM7WRAMSize = 0x10000;
-extern u8* ARM7WRAM;
+extern INSTANCE_LOCAL u8* ARM7WRAM;
 
 bool Init();
 void DeInit();
@@ -222,6 +223,10 @@ void Halt();
 
 void MapSharedWRAM(u8 val);
 
+// rebuilds the interpreter page maps of one CPU over the given address range
+// has to be called whenever the memory behind it is remapped
+void UpdatePageMap(u32 cpu, u32 start, u32 end);
+
 void UpdateIRQ(u32 cpu);
 void SetIRQ(u32 cpu, u32 irq);
 void ClearIRQ(u32 cpu, u32 irq);
@@ -254,6 +259,7 @@ void ARM9Write16(u32 addr, u16 val);
 void ARM9Write32(u32 addr, u32 val);
 
 bool ARM9GetMemRegion(u32 addr, bool write, MemRegion* region);
+u8* ARM9GetPagePtr(u32 addr, bool write);
 
 u8 ARM7Read8(u32 addr);
 u16 ARM7Read16(u32 addr);
@@ -263,6 +269,7 @@ void ARM7Write16(u32 addr, u16 val);
 void ARM7Write32(u32 addr, u32 val);
 
 bool ARM7GetMemRegion(u32 addr, bool write, MemRegion* region);
+u8* ARM7GetPagePtr(u32 addr, bool write);
 
 u8 ARM9IORead8(u32 addr);
 u16 ARM9IORead16(u32 addr);
@@ -18,6 +18,15 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <vector>
+#ifdef __WIN32__
+#define NOMINMAX // keep std::min usable
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 #include "NDS.h"
 #include "DSi.h"
 #include "NDSCart.h"
@@ -33,21 +42,55 @@
 namespace NDSCart_SRAM
 {
 
-u8* SRAM;
-u32 SRAMLength;
-
-char SRAMPath[1024];
-bool SRAMFileDirty;
-
-void (*WriteFunc)(u8 val, bool islast);
-
-u32 Hold;
-u8 CurCmd;
-u32 DataPos;
-u8 Data;
-
-u8 StatusReg;
-u32 Addr;
+INSTANCE_LOCAL u8* SRAM;
+INSTANCE_LOCAL u32 SRAMLength;
+
+INSTANCE_LOCAL char SRAMPath[1024];
+INSTANCE_LOCAL bool SRAMFileDirty;
+
+INSTANCE_LOCAL void (*WriteFunc)(u8 val, bool islast);
+
+INSTANCE_LOCAL u32 Hold;
+INSTANCE_LOCAL u8 CurCmd;
+INSTANCE_LOCAL u32 DataPos;
+INSTANCE_LOCAL u8 Data;
+
+INSTANCE_LOCAL u8 StatusReg;
+INSTANCE_LOCAL u32 Addr;
+
+// save file write-back
+// SRAM writes are tracked per page. once per frame, the dirty pages are
+// copied to a shadow buffer, from which a writer thread puts them in the
+// save file. they go to a journal next to the save file first, so a crash
+// in the middle of a write can't leave a half-updated save behind: the
+// journal gets replayed on the next load.
+//
+// journal format:
+// 00 - magic
+// 04 - save length
+// 08 - page size
+// 0C - number of pages
+// 10 - pages: offset, followed by the page data
+// last 4 bytes: CRC32 of everything before
+
+const u32 SRAMPageSize = 0x1000;
+const u32 JournalMagic = 0x4C4E524A; // JRNL
+
+INSTANCE_LOCAL u8* SRAMDirty;
+INSTANCE_LOCAL u32 SRAMNumPages;
+
+INSTANCE_LOCAL Platform::Thread* WriterThread;
+INSTANCE_LOCAL Platform::Semaphore* Sema_WriterStart;
+INSTANCE_LOCAL Platform::Mutex* WriterLock;   // shadow buffer and pending pages
+INSTANCE_LOCAL Platform::Mutex* WriterIOLock; // held while writing files
+INSTANCE_LOCAL bool WriterQuit;
+
+INSTANCE_LOCAL u8* WriterShadow;
+INSTANCE_LOCAL u8* WriterPending;
+INSTANCE_LOCAL u32 WriterLength;
+INSTANCE_LOCAL u32 WriterNumPages;
+INSTANCE_LOCAL char WriterPath[1024];
+INSTANCE_LOCAL bool WriterFileValid;
 
 
 void Write_Null(u8 val, bool islast);
@@ -55,24 +98,324 @@ void Write_EEPROMTiny(u8 val, bool islast);
 void Write_EEPROM(u8 val, bool islast);
 void Write_Flash(u8 val, bool islast);
 
+void WriterThreadFunc();
+void SyncSRAMFile();
+
 
 bool Init()
 {
     SRAM = NULL;
+    SRAMLength = 0;
+    SRAMPath[0] = '\0';
+    SRAMFileDirty = false;
+
+    SRAMDirty = NULL;
+    SRAMNumPages = 0;
+
+    WriterShadow = NULL;
+    WriterPending = NULL;
+    WriterLength = 0;
+    WriterNumPages = 0;
+    WriterPath[0] = '\0';
+    WriterFileValid = false;
+
+    WriterLock = Platform::Mutex_Create();
+    WriterIOLock = Platform::Mutex_Create();
+    Sema_WriterStart = Platform::Semaphore_Create();
+
+    WriterQuit = false;
+#ifdef MULTI_INSTANCE
+    // the writer thread wouldn't see this console's state, write from the emu thread
+    WriterThread = NULL;
+#else
+    WriterThread = Platform::Thread_Create(WriterThreadFunc);
+#endif
+
     return true;
 }
 
 void DeInit()
 {
+    SyncSRAMFile();
+
+    if (WriterThread)
+    {
+        WriterQuit = true;
+        Platform::Semaphore_Post(Sema_WriterStart);
+        Platform::Thread_Wait(WriterThread);
+        Platform::Thread_Free(WriterThread);
+        WriterThread = NULL;
+    }
+
+    Platform::Semaphore_Free(Sema_WriterStart);
+    Platform::Mutex_Free(WriterIOLock);
+    Platform::Mutex_Free(WriterLock);
+
     if (SRAM) delete[] SRAM;
+    if (SRAMDirty) delete[] SRAMDirty;
+    if (WriterShadow) delete[] WriterShadow;
+    if (WriterPending) delete[] WriterPending;
 }
 
 void Reset()
 {
+    SyncSRAMFile();
+
     if (SRAM) delete[] SRAM;
     SRAM = NULL;
 }
 
+inline void SetDirty(u32 addr)
+{
+    SRAMDirty[addr / SRAMPageSize] = 1;
+}
+
+void AllocDirty()
+{
+    if (SRAMDirty) delete[] SRAMDirty;
+
+    SRAMNumPages = (SRAMLength + SRAMPageSize - 1) / SRAMPageSize;
+    SRAMDirty = SRAMNumPages ? new u8[SRAMNumPages] : NULL;
+    if (SRAMDirty) memset(SRAMDirty, 0, SRAMNumPages);
+}
+
+// point the writer to the current save
+// nothing must be pending when calling this
+void ResetWriter(bool filevalid)
+{
+    Platform::Mutex_Lock(WriterLock);
+
+    // the shadow buffer only gets allocated once something is written
+    if (WriterShadow) delete[] WriterShadow;
+    if (WriterPending) delete[] WriterPending;
+    WriterShadow = NULL;
+
+    WriterLength = SRAMLength;
+    WriterNumPages = SRAMNumPages;
+    WriterPending = WriterNumPages ? new u8[WriterNumPages] : NULL;
+    if (WriterPending) memset(WriterPending, 0, WriterNumPages);
+
+    strncpy(WriterPath, SRAMPath, 1023);
+    WriterPath[1023] = '\0';
+    WriterFileValid = filevalid;
+
+    Platform::Mutex_Unlock(WriterLock);
+}
+
+void GetJournalPath(char* out, const char* path)
+{
+    snprintf(out, 1040, "%s.journal", path);
+}
+
+void SyncFileToDisk(FILE* f)
+{
+    fflush(f);
+#ifdef __WIN32__
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+}
+
+void DeleteJournal(const char* jpath)
+{
+    // an empty journal is ignored, in case it can't be removed
+    FILE* f = Platform::OpenFile(jpath, "wb");
+    if (f)
+    {
+        SyncFileToDisk(f);
+        fclose(f);
+    }
+    remove(jpath);
+}
+
+// write pages to the save file, as laid out in a journal
+bool ApplyJournal(u8* journal, u32 len, const char* path, bool create)
+{
+    u32 savelen = *(u32*)&journal[4];
+    u32 pagesize = *(u32*)&journal[8];
+    u32 numpages = *(u32*)&journal[12];
+
+    FILE* f = Platform::OpenFile(path, create ? "wb" : "r+b", !create);
+    if (!f) return false;
+
+    u32 pos = 16;
+    for (u32 i = 0; i < numpages; i++)
+    {
+        u32 offset = *(u32*)&journal[pos];
+        u32 pagelen = std::min(pagesize, savelen - offset);
+        pos += 4;
+
+        fseek(f, offset, SEEK_SET);
+        fwrite(&journal[pos], pagelen, 1, f);
+        pos += pagelen;
+    }
+
+    SyncFileToDisk(f);
+    fclose(f);
+    return true;
+}
+
+// finish a write-back that was interrupted
+void ReplayJournal(const char* path)
+{
+    if (path[0] == '\0') return;
+
+    char jpath[1040];
+    GetJournalPath(jpath, path);
+
+    FILE* f = Platform::OpenFile(jpath, "rb", true);
+    if (!f) return;
+
+    fseek(f, 0, SEEK_END);
+    u32 len = (u32)ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (len < 20)
+    {
+        fclose(f);
+        return;
+    }
+
+    u8* journal = new u8[len];
+    fread(journal, len, 1, f);
+    fclose(f);
+
+    u32 savelen = *(u32*)&journal[4];
+    u32 pagesize = *(u32*)&journal[8];
+    u32 numpages = *(u32*)&journal[12];
+    bool valid = *(u32*)&journal[0] == JournalMagic
+        && CRC32(journal, len-4) == *(u32*)&journal[len-4]
+        && pagesize > 0;
+
+    // check that the pages actually fit
+    u32 pos = 16;
+    for (u32 i = 0; valid && i < numpages; i++)
+    {
+        if (pos + 4 > len-4) { valid = false; break; }
+        u32 offset = *(u32*)&journal[pos];
+        if (offset >= savelen) { valid = false; break; }
+        pos += 4 + std::min(pagesize, savelen - offset);
+    }
+    if (pos != len-4) valid = false;
+
+    if (valid)
+    {
+        // a journal covering the whole save can recreate it
+        bool create = false;
+        FILE* save = Platform::OpenFile(path, "rb", true);
+        if (save)
+        {
+            fseek(save, 0, SEEK_END);
+            if ((u32)ftell(save) != savelen) create = true;
+            fclose(save);
+        }
+        else
+            create = true;
+
+        if (create && numpages != (savelen + pagesize - 1) / pagesize)
+            valid = false;
+
+        if (valid && ApplyJournal(journal, len, path, create))
+            printf("NDSCart_SRAM: recovered %d pages of %s from the journal\n", numpages, path);
+        else
+            valid = false;
+    }
+
+    if (!valid)
+        printf("NDSCart_SRAM: ignoring unusable journal for %s\n", path);
+
+    delete[] journal;
+    DeleteJournal(jpath);
+}
+
+// write the pending pages to the save file
+void WriteBack()
+{
+    Platform::Mutex_Lock(WriterIOLock);
+    Platform::Mutex_Lock(WriterLock);
+
+    u32 numpages = 0;
+    u32 len = 16 + 4;
+    for (u32 i = 0; i < WriterNumPages; i++)
+    {
+        if (!WriterPending[i]) continue;
+
+        numpages++;
+        len += 4 + std::min(SRAMPageSize, WriterLength - i*SRAMPageSize);
+    }
+
+    if (!numpages)
+    {
+        Platform::Mutex_Unlock(WriterLock);
+        Platform::Mutex_Unlock(WriterIOLock);
+        return;
+    }
+
+    u8* journal = new u8[len];
+    *(u32*)&journal[0] = JournalMagic;
+    *(u32*)&journal[4] = WriterLength;
+    *(u32*)&journal[8] = SRAMPageSize;
+    *(u32*)&journal[12] = numpages;
+
+    u32 pos = 16;
+    for (u32 i = 0; i < WriterNumPages; i++)
+    {
+        if (!WriterPending[i]) continue;
+        WriterPending[i] = 0;
+
+        u32 offset = i*SRAMPageSize;
+        u32 pagelen = std::min(SRAMPageSize, WriterLength - offset);
+        *(u32*)&journal[pos] = offset;
+        memcpy(&journal[pos+4], &WriterShadow[offset], pagelen);
+        pos += 4 + pagelen;
+    }
+
+    bool create = !WriterFileValid;
+
+    Platform::Mutex_Unlock(WriterLock);
+
+    *(u32*)&journal[pos] = CRC32(journal, pos);
+
+    char jpath[1040];
+    GetJournalPath(jpath, WriterPath);
+
+    FILE* f = Platform::OpenFile(jpath, "wb");
+    if (f)
+    {
+        fwrite(journal, len, 1, f);
+        SyncFileToDisk(f);
+        fclose(f);
+    }
+
+    bool ok = ApplyJournal(journal, len, WriterPath, create);
+    if (!ok)
+    {
+        // write everything again next time
+        printf("NDSCart_SRAM: could not write to %s\n", WriterPath);
+    }
+
+    if (f) DeleteJournal(jpath);
+
+    Platform::Mutex_Lock(WriterLock);
+    WriterFileValid = ok;
+    Platform::Mutex_Unlock(WriterLock);
+
+    delete[] journal;
+    Platform::Mutex_Unlock(WriterIOLock);
+}
+
+void WriterThreadFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_WriterStart);
+        if (WriterQuit) break;
+
+        WriteBack();
+    }
+}
+
 void DoSavestate(Savestate* file)
 {
     file->Section("NDCS");
@@ -92,8 +435,16 @@ void DoSavestate(Savestate* file)
         printf("savestate: VERY BAD!!!! SRAM LENGTH DIFFERENT. %d -> %d\n", oldlen, SRAMLength);
         printf("oh well. loading it anyway. adsfgdsf\n");
 
+        // this doesn't match the save file anymore
+        u32 newlen = SRAMLength;
+        SRAMLength = oldlen;
+        SyncSRAMFile();
+        SRAMLength = newlen;
+
         if (oldlen) delete[] SRAM;
-        if (SRAMLength) SRAM = new u8[SRAMLength];
+        SRAM = SRAMLength ? new u8[SRAMLength] : NULL;
+        AllocDirty();
+        ResetWriter(false);
     }
     if (SRAMLength)
     {
@@ -101,6 +452,11 @@ void DoSavestate(Savestate* file)
         //    SRAM = new u8[SRAMLength];
 
         file->VarArray(SRAM, SRAMLength);
+
+        // the contents changed behind our back, write the whole save
+        // file with the next save
+        if (!file->Saving && SRAMDirty)
+            memset(SRAMDirty, 1, SRAMNumPages);
     }
 
     // SPI status shito
@@ -116,12 +472,17 @@ void DoSavestate(Savestate* file)
 
 void LoadSave(const char* path, u32 type)
 {
+    SyncSRAMFile();
     if (SRAM) delete[] SRAM;
+    SRAM = NULL;
 
     strncpy(SRAMPath, path, 1023);
     SRAMPath[1023] = '\0';
 
+    ReplayJournal(path);
+
     FILE* f = Platform::OpenFile(path, "rb");
+    bool exists = (f != NULL);
     if (f)
     {
         fseek(f, 0, SEEK_END);
@@ -146,6 +507,10 @@ void LoadSave(const char* path, u32 type)
         }
     }
 
+    SRAMFileDirty = false;
+    AllocDirty();
+    ResetWriter(exists);
+
     switch (SRAMLength)
     {
     case 512: WriteFunc = Write_EEPROMTiny; break;
@@ -178,6 +543,8 @@ void RelocateSave(const char* path, bool write)
         return;
     }
 
+    SyncSRAMFile();
+
     strncpy(SRAMPath, path, 1023);
     SRAMPath[1023] = '\0';
 
@@ -185,11 +552,14 @@ void RelocateSave(const char* path, bool write)
     if (!f)
     {
         printf("NDSCart_SRAM::RelocateSave: failed to create new file. fuck\n");
+        ResetWriter(false);
         return;
     }
 
     fwrite(SRAM, SRAMLength, 1, f);
     fclose(f);
+
+    ResetWriter(true);
 }
 
 u8 Read()
@@ -212,7 +582,9 @@ void Write_EEPROMTiny(u8 val, bool islast)
         }
         else
         {
-            SRAM[(Addr + ((CurCmd==0x0A)?0x100:0)) & 0x1FF] = val;
+            u32 addr = (Addr + ((CurCmd==0x0A)?0x100:0)) & 0x1FF;
+            SRAM[addr] = val;
+            SetDirty(addr);
             Addr++;
         }
         break;
@@ -258,7 +630,9 @@ void Write_EEPROM(u8 val, bool islast)
         }
         else
         {
-            SRAM[Addr & (SRAMLength-1)] = val;
+            u32 addr = Addr & (SRAMLength-1);
+            SRAM[addr] = val;
+            SetDirty(addr);
             Addr++;
         }
         break;
@@ -301,7 +675,9 @@ void Write_Flash(u8 val, bool islast)
         }
         else
         {
-            SRAM[Addr & (SRAMLength-1)] = 0;
+            u32 addr = Addr & (SRAMLength-1);
+            SRAM[addr] = 0;
+            SetDirty(addr);
             Addr++;
         }
         break;
@@ -329,7 +705,9 @@ void Write_Flash(u8 val, bool islast)
         }
         else
         {
-            SRAM[Addr & (SRAMLength-1)] = val;
+            u32 addr = Addr & (SRAMLength-1);
+            SRAM[addr] = val;
+            SetDirty(addr);
             Addr++;
         }
         break;
@@ -349,7 +727,9 @@ void Write_Flash(u8 val, bool islast)
         {
             for (u32 i = 0; i < 0x10000; i++)
             {
-                SRAM[Addr & (SRAMLength-1)] = 0;
+                u32 addr = Addr & (SRAMLength-1);
+                SRAM[addr] = 0;
+                SetDirty(addr);
                 Addr++;
             }
         }
@@ -366,7 +746,9 @@ void Write_Flash(u8 val, bool islast)
         {
             for (u32 i = 0; i < 0x100; i++)
             {
-                SRAM[Addr & (SRAMLength-1)] = 0;
+                u32 addr = Addr & (SRAMLength-1);
+                SRAM[addr] = 0;
+                SetDirty(addr);
                 Addr++;
             }
         }
@@ -446,7 +828,7 @@ void Write(u8 val, u32 hold)
         break;
     }
 
-    SRAMFileDirty |= islast && (CurCmd == 0x02 || CurCmd == 0x0A) && (SRAMLength > 0);
+    SRAMFileDirty |= islast && (CurCmd == 0x02 || CurCmd == 0x0A || CurCmd == 0xD8 || CurCmd == 0xDB) && (SRAMLength > 0);
 }
 
 void FlushSRAMFile()
@@ -456,12 +838,44 @@ void FlushSRAMFile()
 
     SRAMFileDirty = false;
 
-    FILE* f = Platform::OpenFile(SRAMPath, "wb");
-    if (f)
+    if (SRAMPath[0] == '\0')
     {
-        fwrite(SRAM, SRAMLength, 1, f);
-        fclose(f);
+        memset(SRAMDirty, 0, SRAMNumPages);
+        return;
+    }
+
+    // hand the dirty pages over to the writer, which may still be busy with
+    // older ones: pages written again in the meantime only get written once
+    Platform::Mutex_Lock(WriterLock);
+
+    if (!WriterShadow) WriterShadow = new u8[WriterLength];
+
+    // the save file doesn't exist yet, or didn't get written properly
+    if (!WriterFileValid) memset(SRAMDirty, 1, SRAMNumPages);
+
+    for (u32 i = 0; i < SRAMNumPages; i++)
+    {
+        if (!SRAMDirty[i]) continue;
+        SRAMDirty[i] = 0;
+
+        u32 offset = i*SRAMPageSize;
+        memcpy(&WriterShadow[offset], &SRAM[offset], std::min(SRAMPageSize, SRAMLength - offset));
+        WriterPending[i] = 1;
     }
+
+    Platform::Mutex_Unlock(WriterLock);
+
+    if (WriterThread)
+        Platform::Semaphore_Post(Sema_WriterStart);
+    else
+        WriteBack();
+}
+
+// make sure everything is in the save file
+void SyncSRAMFile()
+{
+    if (SRAM) FlushSRAMFile();
+    WriteBack();
 }
 
 }
@@ -470,42 +884,191 @@ void FlushSRAMFile()
 namespace NDSCart
 {
 
-u16 SPICnt;
-u32 ROMCnt;
+INSTANCE_LOCAL u16 SPICnt;
+INSTANCE_LOCAL u32 ROMCnt;
 
-u8 ROMCommand[8];
-u32 ROMData;
+INSTANCE_LOCAL u8 ROMCommand[8];
+INSTANCE_LOCAL u32 ROMData;
 
-u8 TransferData[0x4000];
-u32 TransferPos;
-u32 TransferLen;
-u32 TransferDir;
-u8 TransferCmd[8];
+INSTANCE_LOCAL u8 TransferData[0x4000];
+INSTANCE_LOCAL u32 TransferPos;
+INSTANCE_LOCAL u32 TransferLen;
+INSTANCE_LOCAL u32 TransferDir;
+INSTANCE_LOCAL u8 TransferCmd[8];
 
-bool CartInserted;
-u8* CartROM;
-u32 CartROMSize;
-u32 CartCRC;
-u32 CartID;
-bool CartIsHomebrew;
-bool CartIsDSi;
+INSTANCE_LOCAL bool CartInserted;
+INSTANCE_LOCAL u8* CartROM;
+INSTANCE_LOCAL u32 CartROMSize;
+INSTANCE_LOCAL u32 CartCRC;
+INSTANCE_LOCAL bool CartCRCValid;
+INSTANCE_LOCAL u32 CartROMMapped;
+INSTANCE_LOCAL u32 CartID;
+INSTANCE_LOCAL bool CartIsHomebrew;
+INSTANCE_LOCAL bool CartIsDSi;
 
-FILE* CartSD;
+INSTANCE_LOCAL FILE* CartSD;
 
-u32 CmdEncMode;
-u32 DataEncMode;
+INSTANCE_LOCAL u32 CmdEncMode;
+INSTANCE_LOCAL u32 DataEncMode;
 
-u32 Key1_KeyBuf[0x412];
+INSTANCE_LOCAL u32 Key1_KeyBuf[0x412];
 
-u64 Key2_X;
-u64 Key2_Y;
+INSTANCE_LOCAL u64 Key2_X;
+INSTANCE_LOCAL u64 Key2_Y;
 
 
 void ROMCommand_Retail(u8* cmd);
 void ROMCommand_RetailNAND(u8* cmd);
 void ROMCommand_Homebrew(u8* cmd);
 
-void (*ROMCommandHandler)(u8* cmd);
+INSTANCE_LOCAL void (*ROMCommandHandler)(u8* cmd);
+
+
+#ifdef MULTI_INSTANCE
+
+// consoles running the same ROM share its image
+// only LoadROM() writes to it, before it gets shared
+
+typedef struct
+{
+    char Path[1024];
+    u8* ROM;
+    u32 CRC;
+    u32 RefCount;
+
+} SharedROM;
+
+std::vector<SharedROM> SharedROMs;
+
+Platform::Mutex* SharedROMLock()
+{
+    static Platform::Mutex* lock = Platform::Mutex_Create();
+    return lock;
+}
+
+bool AcquireSharedROM(const char* path)
+{
+    bool ret = false;
+    Platform::Mutex_Lock(SharedROMLock());
+
+    for (SharedROM& rom : SharedROMs)
+    {
+        if (strcmp(rom.Path, path)) continue;
+
+        rom.RefCount++;
+        CartROM = rom.ROM;
+        CartCRC = rom.CRC;
+        ret = true;
+        break;
+    }
+
+    Platform::Mutex_Unlock(SharedROMLock());
+    return ret;
+}
+
+void PublishSharedROM(const char* path)
+{
+    Platform::Mutex_Lock(SharedROMLock());
+
+    bool found = false;
+    for (SharedROM& rom : SharedROMs)
+    {
+        if (strcmp(rom.Path, path)) continue;
+
+        // another console loaded the same ROM meanwhile
+        rom.RefCount++;
+        delete[] CartROM;
+        CartROM = rom.ROM;
+        found = true;
+        break;
+    }
+
+    if (!found)
+    {
+        SharedROM rom;
+        strncpy(rom.Path, path, 1023);
+        rom.Path[1023] = '\0';
+        rom.ROM = CartROM;
+        rom.CRC = CartCRC;
+        rom.RefCount = 1;
+        SharedROMs.push_back(rom);
+    }
+
+    Platform::Mutex_Unlock(SharedROMLock());
+}
+
+#endif
+
+// map the ROM file copy-on-write: pages only get read from the file when
+// they're accessed, and the few ones LoadROM() patches become private copies
+// everything past the end of the file reads as zero
+u8* MapROM(FILE* f, u32 len, u32 size)
+{
+#ifdef __WIN32__
+    // a view can't extend past the end of a file that is opened read-only
+    if (len != size) return NULL;
+
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(f));
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (!mapping) return NULL;
+
+    // the view keeps the mapping alive
+    u8* mem = (u8*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, size);
+    CloseHandle(mapping);
+    return mem;
+#else
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+
+    if (mmap(mem, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(f), 0) == MAP_FAILED)
+    {
+        munmap(mem, size);
+        return NULL;
+    }
+
+    return (u8*)mem;
+#endif
+}
+
+void ReleaseROM()
+{
+    if (!CartROM) return;
+
+    if (CartROMMapped)
+    {
+#ifdef __WIN32__
+        UnmapViewOfFile(CartROM);
+#else
+        munmap(CartROM, CartROMMapped);
+#endif
+        CartROMMapped = 0;
+        CartROM = NULL;
+        return;
+    }
+
+#ifdef MULTI_INSTANCE
+    Platform::Mutex_Lock(SharedROMLock());
+
+    for (auto it = SharedROMs.begin(); it != SharedROMs.end(); it++)
+    {
+        if (it->ROM != CartROM) continue;
+
+        if (--it->RefCount == 0)
+        {
+            delete[] it->ROM;
+            SharedROMs.erase(it);
+        }
+        CartROM = NULL;
+        break;
+    }
+
+    Platform::Mutex_Unlock(SharedROMLock());
+    if (!CartROM) return;
+#endif
+
+    delete[] CartROM;
+    CartROM = NULL;
+}
 
 
 u32 ByteSwap(u32 val)
@@ -629,6 +1192,7 @@ bool Init()
     if (!NDSCart_SRAM::Init()) return false;
 
     CartROM = NULL;
+    CartROMMapped = 0;
 
     CartSD = NULL;
 
@@ -637,7 +1201,7 @@ bool Init()
 
 void DeInit()
 {
-    if (CartROM) delete[] CartROM;
+    ReleaseROM();
 
     if (CartSD) fclose(CartSD);
 
@@ -647,8 +1211,7 @@ void DeInit()
 void Reset()
 {
     CartInserted = false;
-    if (CartROM) delete[] CartROM;
-    CartROM = NULL;
+    ReleaseROM();
     CartROMSize = 0;
     CartID = 0;
     CartIsHomebrew = false;
@@ -895,9 +1458,8 @@ void DecryptSecureArea(u8* out)
 
 bool LoadROM(const char* path, const char* sram, bool direct)
 {
-    // TODO: streaming mode? for really big ROMs or systems with limited RAM
-    // for now we're lazy
-    // also TODO: validate what we're loading!!
+    // big ROMs can be mapped instead of read, see MapROM()
+    // TODO: validate what we're loading!!
 
     FILE* f = Platform::OpenFile(path, "rb");
     if (!f)
@@ -924,16 +1486,48 @@ bool LoadROM(const char* path, const char* sram, bool direct)
     fread(&unitcode, 1, 1, f);
     CartIsDSi = (unitcode & 0x02) != 0;
 
-    CartROM = new u8[CartROMSize];
-    memset(CartROM, 0, CartROMSize);
-    fseek(f, 0, SEEK_SET);
-    fread(CartROM, 1, len, f);
+    // mapped ROMs are shared through the page cache
+    bool mapped = false;
+    if (Config::MapCartROM)
+    {
+        CartROM = MapROM(f, len, CartROMSize);
+        if (CartROM)
+        {
+            CartROMMapped = CartROMSize;
+            mapped = true;
+        }
+        else
+            printf("could not map the ROM, loading it\n");
+    }
+
+#ifdef MULTI_INSTANCE
+    bool shared = !mapped && AcquireSharedROM(path);
+#else
+    bool shared = false;
+#endif
+
+    if (mapped)
+    {
+        // computing the CRC would read the whole ROM
+        CartCRCValid = false;
+    }
+    else if (!shared)
+    {
+        CartROM = new u8[CartROMSize];
+        memset(CartROM, 0, CartROMSize);
+        fseek(f, 0, SEEK_SET);
+        fread(CartROM, 1, len, f);
+
+        CartCRC = CRC32(CartROM, CartROMSize);
+        CartCRCValid = true;
+    }
+    else
+        CartCRCValid = true;
 
     fclose(f);
-    //CartROM = f;
 
-    CartCRC = CRC32(CartROM, CartROMSize);
-    printf("ROM CRC32: %08X\n", CartCRC);
+    if (CartCRCValid)
+        printf("ROM CRC32: %08X\n", CartCRC);
 
     ROMListEntry romparams;
     if (!ReadROMParams(gamecode, &romparams))
@@ -973,7 +1567,7 @@ bool LoadROM(const char* path, const char* sram, bool direct)
 
     u32 arm9base = *(u32*)&CartROM[0x20];
 
-    if (arm9base < 0x8000)
+    if (arm9base < 0x8000 && !shared)
     {
         if (arm9base >= 0x4000)
         {
@@ -997,10 +1591,15 @@ bool LoadROM(const char* path, const char* sram, bool direct)
     if ((arm9base < 0x4000) || (gamecode == 0x23232323))
     {
         CartIsHomebrew = true;
-        if (Config::DLDIEnable)
+        if (Config::DLDIEnable && !shared)
             ApplyDLDIPatch(melonDLDI, sizeof(melonDLDI));
     }
 
+#ifdef MULTI_INSTANCE
+    if (!shared && !mapped)
+        PublishSharedROM(path);
+#endif
+
     if (direct)
     {
         // TODO: in the case of an already-encrypted secure area, direct boot
@@ -1036,6 +1635,17 @@ bool LoadROM(const char* path, const char* sram, bool direct)
     return true;
 }
 
+u32 GetCartCRC()
+{
+    if (!CartCRCValid && CartROM)
+    {
+        CartCRC = CRC32(CartROM, CartROMSize);
+        CartCRCValid = true;
+    }
+
+    return CartCRC;
+}
+
 void RelocateSave(const char* path, bool write)
 {
     // herp derp
@@ -1049,6 +1659,8 @@ void FlushSRAMFile()
 
 int ImportSRAM(const u8* data, u32 length)
 {
+    NDSCart_SRAM::SyncSRAMFile();
+
     memcpy(NDSCart_SRAM::SRAM, data, std::min(length, NDSCart_SRAM::SRAMLength));
     FILE* f = Platform::OpenFile(NDSCart_SRAM::SRAMPath, "wb");
     if (f)
@@ -24,19 +24,20 @@
 namespace NDSCart
 {
 
-extern u16 SPICnt;
-extern u32 ROMCnt;
+extern INSTANCE_LOCAL u16 SPICnt;
+extern INSTANCE_LOCAL u32 ROMCnt;
 
-extern u8 ROMCommand[8];
+extern INSTANCE_LOCAL u8 ROMCommand[8];
 extern u32 ROMDataOut;
 
 extern u8 EncSeed0[5];
 extern u8 EncSeed1[5];
 
-extern u8* CartROM;
-extern u32 CartROMSize;
+extern INSTANCE_LOCAL u8* CartROM;
+extern INSTANCE_LOCAL u32 CartROMSize;
+extern INSTANCE_LOCAL u32 CartCRC;
 
-extern u32 CartID;
+extern INSTANCE_LOCAL u32 CartID;
 
 bool Init();
 void DeInit();
@@ -47,6 +48,9 @@ void DoSavestate(Savestate* file);
 void DecryptSecureArea(u8* out);
 bool LoadROM(const char* path, const char* sram, bool direct);
 
+// CRC32 of the ROM image, computed on first use for mapped ROMs
+u32 GetCartCRC();
+
 void FlushSRAMFile();
 
 void RelocateSave(const char* path, bool write);
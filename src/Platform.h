@@ -77,6 +77,8 @@ Semaphore* Semaphore_Create();
 void Semaphore_Free(Semaphore* sema);
 void Semaphore_Reset(Semaphore* sema);
 void Semaphore_Wait(Semaphore* sema);
+// returns false if the timeout (in milliseconds) ran out
+bool Semaphore_TryWait(Semaphore* sema, int timeout);
 void Semaphore_Post(Semaphore* sema);
 
 struct Mutex;
@@ -90,10 +92,12 @@ void* GL_GetProcAddress(const char* proc);
 
 // local multiplayer comm interface
 // packet type: DS-style TX header (12 bytes) + original 802.11 frame
+// timestamp: emulated time since the console was started, in microseconds
+// a blocking receive waits for a packet, up to a short timeout
 bool MP_Init();
 void MP_DeInit();
-int MP_SendPacket(u8* data, int len);
-int MP_RecvPacket(u8* data, bool block);
+int MP_SendPacket(u8* data, int len, u64 timestamp);
+int MP_RecvPacket(u8* data, bool block, u64 timestamp);
 
 // LAN comm interface
 // packet type: Ethernet (802.3)
@@ -0,0 +1,50 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include "Profiler.h"
+
+
+namespace Profiler
+{
+
+INSTANCE_LOCAL u64 Time[Prof_MAX];
+
+const char* Names[Prof_MAX] =
+{
+    "ARM9",
+    "ARM7",
+    "GPU3D",
+    "GPU3D render",
+    "GPU2D",
+    "SPU",
+};
+
+
+void Reset()
+{
+    memset(Time, 0, sizeof(Time));
+}
+
+const char* GetName(u32 id)
+{
+    if (id >= Prof_MAX) return "???";
+    return Names[id];
+}
+
+}
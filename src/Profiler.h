@@ -0,0 +1,59 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+
+#include "types.h"
+
+// wall-clock time spent in the main subsystems
+// the counters are only updated when building with PROFILING_ENABLED,
+// as taking timestamps around every CPU slice isn't free
+
+namespace Profiler
+{
+
+enum
+{
+    Prof_ARM9 = 0,
+    Prof_ARM7,
+    Prof_GPU3D,       // geometry engine (GPU3D::Run)
+    Prof_GPU3DRender, // software rasterizer, on whichever thread it runs
+    Prof_GPU2D,       // 2D engine scanline rendering, on whichever thread it runs
+    Prof_SPU,         // sound mixing
+
+    Prof_MAX
+};
+
+extern INSTANCE_LOCAL u64 Time[Prof_MAX];
+
+void Reset();
+const char* GetName(u32 id);
+
+inline u64 GetTicks()
+{
+    // nanoseconds
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+#endif // PROFILER_H
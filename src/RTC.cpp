@@ -28,24 +28,24 @@
 namespace RTC
 {
 
-u16 IO;
+INSTANCE_LOCAL u16 IO;
 
-u8 Input;
-u32 InputBit;
-u32 InputPos;
+INSTANCE_LOCAL u8 Input;
+INSTANCE_LOCAL u32 InputBit;
+INSTANCE_LOCAL u32 InputPos;
 
-u8 Output[8];
-u32 OutputBit;
-u32 OutputPos;
+INSTANCE_LOCAL u8 Output[8];
+INSTANCE_LOCAL u32 OutputBit;
+INSTANCE_LOCAL u32 OutputPos;
 
-u8 CurCmd;
+INSTANCE_LOCAL u8 CurCmd;
 
-u8 StatusReg1;
-u8 StatusReg2;
-u8 Alarm1[3];
-u8 Alarm2[3];
-u8 ClockAdjust;
-u8 FreeReg;
+INSTANCE_LOCAL u8 StatusReg1;
+INSTANCE_LOCAL u8 StatusReg2;
+INSTANCE_LOCAL u8 Alarm1[3];
+INSTANCE_LOCAL u8 Alarm2[3];
+INSTANCE_LOCAL u8 ClockAdjust;
+INSTANCE_LOCAL u8 FreeReg;
 
 
 bool Init()
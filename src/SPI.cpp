@@ -29,20 +29,20 @@
 namespace SPI_Firmware
 {
 
-char FirmwarePath[1024];
-u8* Firmware;
-u32 FirmwareLength;
-u32 FirmwareMask;
+INSTANCE_LOCAL char FirmwarePath[1024];
+INSTANCE_LOCAL u8* Firmware;
+INSTANCE_LOCAL u32 FirmwareLength;
+INSTANCE_LOCAL u32 FirmwareMask;
 
-u32 UserSettings;
+INSTANCE_LOCAL u32 UserSettings;
 
-u32 Hold;
-u8 CurCmd;
-u32 DataPos;
-u8 Data;
+INSTANCE_LOCAL u32 Hold;
+INSTANCE_LOCAL u8 CurCmd;
+INSTANCE_LOCAL u32 DataPos;
+INSTANCE_LOCAL u8 Data;
 
-u8 StatusReg;
-u32 Addr;
+INSTANCE_LOCAL u8 StatusReg;
+INSTANCE_LOCAL u32 Addr;
 
 
 u16 CRC16(u8* data, u32 len, u32 start)
@@ -361,13 +361,13 @@ void Write(u8 val, u32 hold)
 namespace SPI_Powerman
 {
 
-u32 Hold;
-u32 DataPos;
-u8 Index;
-u8 Data;
+INSTANCE_LOCAL u32 Hold;
+INSTANCE_LOCAL u32 DataPos;
+INSTANCE_LOCAL u8 Index;
+INSTANCE_LOCAL u8 Data;
 
-u8 Registers[8];
-u8 RegMasks[8];
+INSTANCE_LOCAL u8 Registers[8];
+INSTANCE_LOCAL u8 RegMasks[8];
 
 
 bool Init()
@@ -465,16 +465,16 @@ void Write(u8 val, u32 hold)
 namespace SPI_TSC
 {
 
-u32 DataPos;
-u8 ControlByte;
-u8 Data;
+INSTANCE_LOCAL u32 DataPos;
+INSTANCE_LOCAL u8 ControlByte;
+INSTANCE_LOCAL u8 Data;
 
-u16 ConvResult;
+INSTANCE_LOCAL u16 ConvResult;
 
-u16 TouchX, TouchY;
+INSTANCE_LOCAL u16 TouchX, TouchY;
 
-s16 MicBuffer[1024];
-int MicBufferLen;
+INSTANCE_LOCAL s16 MicBuffer[1024];
+INSTANCE_LOCAL int MicBufferLen;
 
 
 bool Init()
@@ -599,9 +599,9 @@ void Write(u8 val, u32 hold)
 namespace SPI
 {
 
-u16 Cnt;
+INSTANCE_LOCAL u16 Cnt;
 
-u32 CurDevice; // remove me
+INSTANCE_LOCAL u32 CurDevice; // remove me
 
 
 bool Init()
@@ -48,7 +48,7 @@ void Write(u8 val, u32 hold);
 namespace SPI
 {
 
-extern u16 Cnt;
+extern INSTANCE_LOCAL u16 Cnt;
 
 bool Init();
 void DeInit();
@@ -18,10 +18,12 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 #include "Platform.h"
 #include "NDS.h"
 #include "DSi.h"
 #include "SPU.h"
+#include "Profiler.h"
 
 
 // SPU TODO
@@ -62,22 +64,52 @@ const s16 PSGTable[8][8] =
     {-0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF, -0x7FFF}
 };
 
-const u32 OutputBufferSize = 2*2048;
-s16 OutputBackbuffer[2 * OutputBufferSize];
-u32 OutputBackbufferWritePosition;
-
-s16 OutputFrontBuffer[2 * OutputBufferSize];
-u32 OutputFrontBufferWritePosition;
-u32 OutputFrontBufferReadPosition;
-
-Platform::Mutex* AudioLock;
-
-u16 Cnt;
-u8 MasterVolume;
-u16 Bias;
+// samples are mixed lazily, in batches: the mixer catches up whenever an SPU
+// register is accessed, before a DMA or a CPU store writes to memory a channel
+// plays from, and at least every MixBatchSize samples
+// one sample is 1024 ARM7 cycles
+// the mixer can't run ahead of the ARM7, so ARM9 stores and DMAs may still be
+// seen by the samples between the ARM7's position and theirs, up to one batch
+// early. stores from JIT code that go through fastmem aren't seen at all, and
+// only sample data in main RAM and WRAM is watched
+const u32 MixBatchSize = 32;
+INSTANCE_LOCAL u64 NextSampleTimestamp;
 
-Channel* Channels[16];
-CaptureUnit* Capture[2];
+const u32 OutputBufferSize = 2*2048;
+INSTANCE_LOCAL s16 OutputBackbuffer[2 * OutputBufferSize];
+INSTANCE_LOCAL u32 OutputBackbufferWritePosition;
+INSTANCE_LOCAL u32 OutputFrameSamples;
+
+// the front buffer is a single-producer/single-consumer ring: the emulator
+// thread writes to it, the audio callback reads from it, and neither of them
+// ever locks. the positions count stereo samples and are never wrapped, only
+// masked when indexing the buffer.
+// the producer never moves the read position itself: to drop what is queued
+// (trim/drain) it posts a position for the consumer to skip to.
+INSTANCE_LOCAL s16 OutputFrontBuffer[2 * OutputBufferSize];
+INSTANCE_LOCAL std::atomic<u32> OutputFrontBufferWritePosition;
+INSTANCE_LOCAL std::atomic<u32> OutputFrontBufferReadPosition;
+INSTANCE_LOCAL std::atomic<u32> OutputFrontBufferSkipPosition;
+INSTANCE_LOCAL std::atomic<bool> OutputFrontBufferSkip;
+
+// posted by the consumer when OutputWaiting is set, for WaitOutput()
+INSTANCE_LOCAL Platform::Semaphore* OutputReadSema;
+INSTANCE_LOCAL std::atomic<bool> OutputWaiting;
+
+INSTANCE_LOCAL u16 Cnt;
+INSTANCE_LOCAL u8 MasterVolume;
+INSTANCE_LOCAL u16 Bias;
+
+INSTANCE_LOCAL Channel* Channels[16];
+INSTANCE_LOCAL CaptureUnit* Capture[2];
+
+// the memory each sample channel plays from, see SampleAddr()
+// empty if the channel is off or doesn't play from main RAM or WRAM
+INSTANCE_LOCAL u32 WatchStart[16];
+INSTANCE_LOCAL u32 WatchEnd[16];
+
+INSTANCE_LOCAL u32 WatchMainRAMStart, WatchMainRAMEnd;
+INSTANCE_LOCAL bool WatchWRAM;
 
 
 bool Init()
@@ -88,7 +120,7 @@ bool Init()
     Capture[0] = new CaptureUnit(0);
     Capture[1] = new CaptureUnit(1);
 
-    AudioLock = Platform::Mutex_Create();
+    OutputReadSema = Platform::Semaphore_Create();
 
     return true;
 }
@@ -101,7 +133,7 @@ void DeInit()
     delete Capture[0];
     delete Capture[1];
 
-    Platform::Mutex_Free(AudioLock);
+    Platform::Semaphore_Free(OutputReadSema);
 }
 
 void Reset()
@@ -118,18 +150,15 @@ void Reset()
     Capture[0]->Reset();
     Capture[1]->Reset();
 
-    NDS::ScheduleEvent(NDS::Event_SPU, true, 1024, Mix, 0);
+    NextSampleTimestamp = 1024;
+    NDS::ScheduleEvent(NDS::Event_SPU, true, MixBatchSize*1024, Mix, 0);
 }
 
 void Stop()
 {
-    Platform::Mutex_Lock(AudioLock);
-    memset(OutputFrontBuffer, 0, 2*OutputBufferSize*2);
-
     OutputBackbufferWritePosition = 0;
-    OutputFrontBufferReadPosition = 0;
-    OutputFrontBufferWritePosition = 0;
-    Platform::Mutex_Unlock(AudioLock);
+    OutputFrameSamples = 0;
+    DrainOutput();
 }
 
 void DoSavestate(Savestate* file)
@@ -145,6 +174,17 @@ void DoSavestate(Savestate* file)
 
     Capture[0]->DoSavestate(file);
     Capture[1]->DoSavestate(file);
+
+    if (!file->Saving)
+        UpdateSampleWatch();
+
+    if (file->IsAtleastVersion(6, 1))
+        file->Var64(&NextSampleTimestamp);
+    else if (!file->Saving)
+    {
+        // samples used to be mixed one by one, up to the system timestamp
+        NextSampleTimestamp = ((NDS::SysTimestamp >> 10) + 1) << 10;
+    }
 }
 
 
@@ -460,12 +500,45 @@ s32 Channel::Run()
     return val;
 }
 
+template<u32 type>
+void Channel::Run(s32* buf, u32 samples)
+{
+    for (u32 i = 0; i < samples; i++)
+    {
+        if (!(Cnt & (1<<31)))
+        {
+            // one-shot sound ended during the batch
+            memset(&buf[i], 0, (samples-i)*sizeof(s32));
+            return;
+        }
+
+        buf[i] = Run<type>();
+    }
+}
+
 void Channel::PanOutput(s32 in, s32& left, s32& right)
 {
     left += ((s64)in * (128-Pan)) >> 10;
     right += ((s64)in * Pan) >> 10;
 }
 
+void Channel::PanOutput(s32* in, s32* left, s32* right, u32 samples)
+{
+    // same as (in * pan) >> 10 done with 64-bit math, split so that it
+    // stays within 32 bits and can be vectorized
+    s32 lpan = 128 - Pan;
+    s32 rpan = Pan;
+
+    for (u32 i = 0; i < samples; i++)
+    {
+        s32 hi = in[i] >> 10;
+        s32 lo = in[i] & 0x3FF;
+
+        left[i] += (hi * lpan) + ((lo * lpan) >> 10);
+        right[i] += (hi * rpan) + ((lo * rpan) >> 10);
+    }
+}
+
 
 CaptureUnit::CaptureUnit(u32 num)
 {
@@ -599,111 +672,60 @@ void CaptureUnit::Run(s32 sample)
 }
 
 
-void Mix(u32 dummy)
+void OutputSample(s32 left, s32 right, s32 ch1, s32 ch3)
 {
-    s32 left = 0, right = 0;
-    s32 leftoutput = 0, rightoutput = 0;
+    s32 leftoutput, rightoutput;
 
-    if (Cnt & (1<<15))
+    switch (Cnt & 0x0300)
     {
-        s32 ch0 = Channels[0]->DoRun();
-        s32 ch1 = Channels[1]->DoRun();
-        s32 ch2 = Channels[2]->DoRun();
-        s32 ch3 = Channels[3]->DoRun();
-
-        // TODO: addition from capture registers
-        Channels[0]->PanOutput(ch0, left, right);
-        Channels[2]->PanOutput(ch2, left, right);
-
-        if (!(Cnt & (1<<12))) Channels[1]->PanOutput(ch1, left, right);
-        if (!(Cnt & (1<<13))) Channels[3]->PanOutput(ch3, left, right);
-
-        for (int i = 4; i < 16; i++)
+    case 0x0000: // left mixer
+        leftoutput = left;
+        break;
+    case 0x0100: // channel 1
         {
-            Channel* chan = Channels[i];
-
-            s32 channel = chan->DoRun();
-            chan->PanOutput(channel, left, right);
+            s32 pan = 128 - Channels[1]->Pan;
+            leftoutput = ((s64)ch1 * pan) >> 10;
         }
-
-        // sound capture
-        // TODO: other sound capture sources, along with their bugs
-
-        if (Capture[0]->Cnt & (1<<7))
+        break;
+    case 0x0200: // channel 3
         {
-            s32 val = left;
-
-            val >>= 8;
-            if      (val < -0x8000) val = -0x8000;
-            else if (val > 0x7FFF)  val = 0x7FFF;
-
-            Capture[0]->Run(val);
+            s32 pan = 128 - Channels[3]->Pan;
+            leftoutput = ((s64)ch3 * pan) >> 10;
         }
-
-        if (Capture[1]->Cnt & (1<<7))
+        break;
+    default: // channel 1+3
         {
-            s32 val = right;
-
-            val >>= 8;
-            if      (val < -0x8000) val = -0x8000;
-            else if (val > 0x7FFF)  val = 0x7FFF;
-
-            Capture[1]->Run(val);
+            s32 pan1 = 128 - Channels[1]->Pan;
+            s32 pan3 = 128 - Channels[3]->Pan;
+            leftoutput = (((s64)ch1 * pan1) >> 10) + (((s64)ch3 * pan3) >> 10);
         }
+        break;
+    }
 
-        // final output
-
-        switch (Cnt & 0x0300)
+    switch (Cnt & 0x0C00)
+    {
+    case 0x0000: // right mixer
+        rightoutput = right;
+        break;
+    case 0x0400: // channel 1
         {
-        case 0x0000: // left mixer
-            leftoutput = left;
-            break;
-        case 0x0100: // channel 1
-            {
-                s32 pan = 128 - Channels[1]->Pan;
-                leftoutput = ((s64)ch1 * pan) >> 10;
-            }
-            break;
-        case 0x0200: // channel 3
-            {
-                s32 pan = 128 - Channels[3]->Pan;
-                leftoutput = ((s64)ch3 * pan) >> 10;
-            }
-            break;
-        case 0x0300: // channel 1+3
-            {
-                s32 pan1 = 128 - Channels[1]->Pan;
-                s32 pan3 = 128 - Channels[3]->Pan;
-                leftoutput = (((s64)ch1 * pan1) >> 10) + (((s64)ch3 * pan3) >> 10);
-            }
-            break;
+            s32 pan = Channels[1]->Pan;
+            rightoutput = ((s64)ch1 * pan) >> 10;
         }
-
-        switch (Cnt & 0x0C00)
+        break;
+    case 0x0800: // channel 3
         {
-        case 0x0000: // right mixer
-            rightoutput = right;
-            break;
-        case 0x0400: // channel 1
-            {
-                s32 pan = Channels[1]->Pan;
-                rightoutput = ((s64)ch1 * pan) >> 10;
-            }
-            break;
-        case 0x0800: // channel 3
-            {
-                s32 pan = Channels[3]->Pan;
-                rightoutput = ((s64)ch3 * pan) >> 10;
-            }
-            break;
-        case 0x0C00: // channel 1+3
-            {
-                s32 pan1 = Channels[1]->Pan;
-                s32 pan3 = Channels[3]->Pan;
-                rightoutput = (((s64)ch1 * pan1) >> 10) + (((s64)ch3 * pan3) >> 10);
-            }
-            break;
+            s32 pan = Channels[3]->Pan;
+            rightoutput = ((s64)ch3 * pan) >> 10;
+        }
+        break;
+    default: // channel 1+3
+        {
+            s32 pan1 = Channels[1]->Pan;
+            s32 pan3 = Channels[3]->Pan;
+            rightoutput = (((s64)ch1 * pan1) >> 10) + (((s64)ch3 * pan3) >> 10);
         }
+        break;
     }
 
     leftoutput = ((s64)leftoutput * MasterVolume) >> 7;
@@ -721,83 +743,371 @@ void Mix(u32 dummy)
     OutputBackbuffer[OutputBackbufferWritePosition    ] = leftoutput >> 1;
     OutputBackbuffer[OutputBackbufferWritePosition + 1] = rightoutput >> 1;
     OutputBackbufferWritePosition += 2;
+}
+
+void RunCapture(s32 left, s32 right)
+{
+    // TODO: other sound capture sources, along with their bugs
 
-    NDS::ScheduleEvent(NDS::Event_SPU, true, 1024, Mix, 0);
+    if (Capture[0]->Cnt & (1<<7))
+    {
+        s32 val = left;
+
+        val >>= 8;
+        if      (val < -0x8000) val = -0x8000;
+        else if (val > 0x7FFF)  val = 0x7FFF;
+
+        Capture[0]->Run(val);
+    }
+
+    if (Capture[1]->Cnt & (1<<7))
+    {
+        s32 val = right;
+
+        val >>= 8;
+        if      (val < -0x8000) val = -0x8000;
+        else if (val > 0x7FFF)  val = 0x7FFF;
+
+        Capture[1]->Run(val);
+    }
 }
 
-void TransferOutput()
+// mixes one sample, going through every channel in turn
+// used when capture is on: capture writes to memory that channels may be
+// reading from, so the order of memory accesses has to be kept
+void MixSample()
+{
+    if (!(Cnt & (1<<15)))
+    {
+        OutputSample(0, 0, 0, 0);
+        return;
+    }
+
+    s32 left = 0, right = 0;
+
+    s32 ch0 = Channels[0]->DoRun();
+    s32 ch1 = Channels[1]->DoRun();
+    s32 ch2 = Channels[2]->DoRun();
+    s32 ch3 = Channels[3]->DoRun();
+
+    // TODO: addition from capture registers
+    Channels[0]->PanOutput(ch0, left, right);
+    Channels[2]->PanOutput(ch2, left, right);
+
+    if (!(Cnt & (1<<12))) Channels[1]->PanOutput(ch1, left, right);
+    if (!(Cnt & (1<<13))) Channels[3]->PanOutput(ch3, left, right);
+
+    for (int i = 4; i < 16; i++)
+    {
+        Channel* chan = Channels[i];
+
+        s32 channel = chan->DoRun();
+        chan->PanOutput(channel, left, right);
+    }
+
+    RunCapture(left, right);
+    OutputSample(left, right, ch1, ch3);
+}
+
+// mixes several samples at once, one channel after the other
+// register writes always flush the mixer first (see Run()), so the channel
+// settings are constant over the whole batch
+void MixBatch(u32 num)
+{
+    if (!(Cnt & (1<<15)))
+    {
+        for (u32 i = 0; i < num; i++)
+            OutputSample(0, 0, 0, 0);
+        return;
+    }
+
+    s32 left[MixBatchSize] = {0};
+    s32 right[MixBatchSize] = {0};
+    s32 ch1[MixBatchSize];
+    s32 ch3[MixBatchSize];
+    s32 buf[MixBatchSize];
+
+    for (int i = 0; i < 16; i++)
+    {
+        Channel* chan = Channels[i];
+        s32* out = (i == 1) ? ch1 : ((i == 3) ? ch3 : buf);
+
+        if (!chan->DoRun(out, num))
+        {
+            if (i == 1 || i == 3) memset(out, 0, num*sizeof(s32));
+            continue;
+        }
+
+        if (i == 1 && (Cnt & (1<<12))) continue;
+        if (i == 3 && (Cnt & (1<<13))) continue;
+
+        chan->PanOutput(out, left, right, num);
+    }
+
+    for (u32 i = 0; i < num; i++)
+        OutputSample(left[i], right[i], ch1[i], ch3[i]);
+}
+
+void Run(u64 timestamp)
+{
+    if (timestamp < NextSampleTimestamp) return;
+
+#ifdef PROFILING_ENABLED
+    u64 profstart = Profiler::GetTicks();
+#endif
+
+    u32 num = ((timestamp - NextSampleTimestamp) >> 10) + 1;
+    NextSampleTimestamp += (u64)num << 10;
+
+    while (num > 0)
+    {
+        u32 batch = (num > MixBatchSize) ? MixBatchSize : num;
+
+        if ((Capture[0]->Cnt | Capture[1]->Cnt) & (1<<7))
+        {
+            for (u32 i = 0; i < batch; i++)
+                MixSample();
+        }
+        else
+            MixBatch(batch);
+
+        num -= batch;
+    }
+
+    // one-shot channels may have stopped
+    UpdateSampleWatch();
+
+#ifdef PROFILING_ENABLED
+    Profiler::Time[Profiler::Prof_SPU] += Profiler::GetTicks() - profstart;
+#endif
+}
+
+void SyncMemoryWrite(u32 addr, u32 len, u64 timestamp)
+{
+    if (timestamp < NextSampleTimestamp) return;
+
+    if (PlaysFrom(addr, len))
+        Run(timestamp);
+}
+
+// turns an ARM7 address into one that's the same for all the mirrors
+u32 SampleAddr(u32 addr)
+{
+    switch (addr & 0xFF800000)
+    {
+    case 0x02000000:
+    case 0x02800000:
+        return 0x02000000 | (addr & NDS::MainRAMMask);
+
+    case 0x03000000:
+        if (NDS::SWRAM_ARM7.Mem)
+            return 0x03000000 | (addr & NDS::SWRAM_ARM7.Mask);
+        return 0x03800000 | (addr & (NDS::ARM7WRAMSize - 1));
+
+    case 0x03800000:
+        return 0x03800000 | (addr & (NDS::ARM7WRAMSize - 1));
+    }
+
+    return addr;
+}
+
+// stores to sample data that's being played have to go through the bus
+// handlers, which flush the mixer first. the page maps are updated whenever
+// that data changes
+void RemapSampleMemory(u32 start, u32 end)
+{
+    if ((start >> 24) == 0x02)
+    {
+        u32 size = NDS::MainRAMMask + 1;
+        start &= NDS::MainRAMMask;
+        end -= 0x02000000;
+        if (end > size) end = size;
+
+        for (u32 mirror = 0x02000000; mirror < 0x03000000; mirror += size)
+        {
+            NDS::UpdatePageMap(0, mirror + start, mirror + end);
+            NDS::UpdatePageMap(1, mirror + start, mirror + end);
+        }
+    }
+    else
+        NDS::UpdatePageMap(1, 0x03000000, 0x04000000);
+}
+
+void UpdateSampleWatch()
 {
-    Platform::Mutex_Lock(AudioLock);
-    for (u32 i = 0; i < OutputBackbufferWritePosition; i += 2)
+    u32 mainstart = 0xFFFFFFFF, mainend = 0;
+    bool wram = false;
+
+    for (int i = 0; i < 16; i++)
     {
-        OutputFrontBuffer[OutputFrontBufferWritePosition    ] = OutputBackbuffer[i   ];
-        OutputFrontBuffer[OutputFrontBufferWritePosition + 1] = OutputBackbuffer[i + 1];
+        Channel* chan = Channels[i];
+        u32 start = 0, end = 0;
 
-        OutputFrontBufferWritePosition += 2;
-        OutputFrontBufferWritePosition &= OutputBufferSize*2-1;
-        if (OutputFrontBufferWritePosition == OutputFrontBufferReadPosition)
+        if ((chan->Cnt & (1<<31)) && ((chan->Cnt >> 29) & 0x3) != 3)
         {
-            // advance the read position too, to avoid losing the entire FIFO
-            OutputFrontBufferReadPosition += 2;
-            OutputFrontBufferReadPosition &= OutputBufferSize*2-1;
+            start = SampleAddr(chan->SrcAddr);
+            if ((start >> 24) == 0x02 || (start >> 24) == 0x03)
+                end = start + chan->LoopPos + chan->Length;
+            else
+                start = 0;
         }
+
+        if (start != WatchStart[i] || end != WatchEnd[i])
+        {
+            u32 oldstart = WatchStart[i];
+            u32 oldend = WatchEnd[i];
+            WatchStart[i] = start;
+            WatchEnd[i] = end;
+
+            if (oldend > oldstart) RemapSampleMemory(oldstart, oldend);
+            if (end > start) RemapSampleMemory(start, end);
+        }
+
+        if (end <= start) continue;
+        if ((start >> 24) == 0x02)
+        {
+            if ((start & 0xFFFFFF) < mainstart) mainstart = start & 0xFFFFFF;
+            if ((end - 0x02000000) > mainend) mainend = end - 0x02000000;
+        }
+        else
+            wram = true;
+    }
+
+    WatchMainRAMStart = mainstart;
+    WatchMainRAMEnd = mainend;
+    WatchWRAM = wram;
+}
+
+bool PlaysFrom(u32 addr, u32 len)
+{
+    addr = SampleAddr(addr);
+
+    for (int i = 0; i < 16; i++)
+    {
+        if (addr < WatchEnd[i] && WatchStart[i] < addr + len)
+            return true;
+    }
+
+    return false;
+}
+
+void Mix(u32 dummy)
+{
+    Run(NDS::SysTimestamp);
+
+    NDS::ScheduleEvent(NDS::Event_SPU, true, MixBatchSize*1024, Mix, 0);
+}
+
+// producer side
+
+void SkipOutput(u32 pos)
+{
+    OutputFrontBufferSkipPosition.store(pos, std::memory_order_relaxed);
+    OutputFrontBufferSkip.store(true, std::memory_order_release);
+}
+
+void TransferOutput()
+{
+    Run(NDS::SysTimestamp);
+
+    u32 writepos = OutputFrontBufferWritePosition.load(std::memory_order_relaxed);
+    u32 readpos = OutputFrontBufferReadPosition.load(std::memory_order_acquire);
+    u32 num = OutputBackbufferWritePosition >> 1;
+
+    // if the consumer can't keep up, the samples that don't fit are dropped
+    // the slots it hasn't read yet are never overwritten
+    u32 room = OutputBufferSize - (writepos - readpos);
+    if (num > room) num = room;
+
+    for (u32 i = 0; i < num; i++)
+    {
+        u32 pos = ((writepos + i) & (OutputBufferSize-1)) << 1;
+        OutputFrontBuffer[pos    ] = OutputBackbuffer[(i << 1)    ];
+        OutputFrontBuffer[pos + 1] = OutputBackbuffer[(i << 1) + 1];
     }
+
+    OutputFrontBufferWritePosition.store(writepos + num, std::memory_order_release);
+    OutputFrameSamples = OutputBackbufferWritePosition >> 1;
     OutputBackbufferWritePosition = 0;
-    Platform::Mutex_Unlock(AudioLock);
+}
+
+int GetFrameOutput(s16* data, int samples)
+{
+    // the back buffer is only written to again once the next frame runs
+    if ((u32)samples > OutputFrameSamples) samples = OutputFrameSamples;
+
+    memcpy(data, OutputBackbuffer, samples*2*sizeof(s16));
+    return samples;
 }
 
 void TrimOutput()
 {
-    Platform::Mutex_Lock(AudioLock);
     const int halflimit = (OutputBufferSize / 2);
 
-    int readpos = OutputFrontBufferWritePosition - (halflimit*2);
-    if (readpos < 0) readpos += (OutputBufferSize*2);
-
-    OutputFrontBufferReadPosition = readpos;
-    Platform::Mutex_Unlock(AudioLock);
+    SkipOutput(OutputFrontBufferWritePosition.load(std::memory_order_relaxed) - halflimit);
 }
 
 void DrainOutput()
 {
-    Platform::Mutex_Lock(AudioLock);
-    OutputFrontBufferWritePosition = 0;
-    OutputFrontBufferReadPosition = 0;
-    Platform::Mutex_Unlock(AudioLock);
+    SkipOutput(OutputFrontBufferWritePosition.load(std::memory_order_relaxed));
 }
 
 void InitOutput()
 {
-    Platform::Mutex_Lock(AudioLock);
     memset(OutputBackbuffer, 0, 2*OutputBufferSize*2);
-    memset(OutputFrontBuffer, 0, 2*OutputBufferSize*2);
-    OutputFrontBufferReadPosition = 0;
-    OutputFrontBufferWritePosition = 0;
-    Platform::Mutex_Unlock(AudioLock);
+    OutputBackbufferWritePosition = 0;
+    OutputFrameSamples = 0;
+
+    DrainOutput();
+    Platform::Semaphore_Reset(OutputReadSema);
 }
 
 int GetOutputSize()
 {
-    Platform::Mutex_Lock(AudioLock);
+    u32 writepos = OutputFrontBufferWritePosition.load(std::memory_order_relaxed);
+    u32 readpos = OutputFrontBufferReadPosition.load(std::memory_order_acquire);
 
-    int ret;
-    if (OutputFrontBufferWritePosition >= OutputFrontBufferReadPosition)
-        ret = OutputFrontBufferWritePosition - OutputFrontBufferReadPosition;
-    else
-        ret = (OutputBufferSize*2) - OutputFrontBufferReadPosition + OutputFrontBufferWritePosition;
+    // account for samples the consumer was told to skip but hasn't yet
+    if (OutputFrontBufferSkip.load(std::memory_order_acquire))
+    {
+        u32 skippos = OutputFrontBufferSkipPosition.load(std::memory_order_relaxed);
+        if ((s32)(skippos - readpos) > 0)
+            readpos = skippos;
+    }
 
-    ret >>= 1;
+    s32 ret = (s32)(writepos - readpos);
+    return (ret > 0) ? ret : 0;
+}
 
-    Platform::Mutex_Unlock(AudioLock);
-    return ret;
+int GetOutputCapacity()
+{
+    return OutputBufferSize;
 }
 
-void Sync(bool wait)
+bool WaitOutput(int samples, int timeout)
 {
-    // this function is currently not used anywhere
-    // depending on the usage context the thread safety measures could be made
-    // a lot faster
+    while (GetOutputSize() > samples)
+    {
+        // the consumer checks the flag after moving its read position, and
+        // we check the position again after raising the flag, so a read
+        // can't slip in between without waking us up
+        OutputWaiting.store(true);
+        if (GetOutputSize() <= samples)
+        {
+            OutputWaiting.store(false);
+            break;
+        }
+
+        bool woken = Platform::Semaphore_TryWait(OutputReadSema, timeout);
+        OutputWaiting.store(false);
+        if (!woken) return false;
+    }
 
+    return true;
+}
+
+void Sync(bool wait)
+{
     // sync to audio output in case the core is running too fast
     // * wait=true: wait until enough audio data has been played
     // * wait=false: merely skip some audio data to avoid a FIFO overflow
@@ -806,53 +1116,58 @@ void Sync(bool wait)
 
     if (wait)
     {
-        // TODO: less CPU-intensive wait?
-        while (GetOutputSize() > halflimit);
+        while (!WaitOutput(halflimit, 1000));
     }
     else if (GetOutputSize() > halflimit)
     {
-        Platform::Mutex_Lock(AudioLock);
-
-        int readpos = OutputFrontBufferWritePosition - (halflimit*2);
-        if (readpos < 0) readpos += (OutputBufferSize*2);
-
-        OutputFrontBufferReadPosition = readpos;
-
-        Platform::Mutex_Unlock(AudioLock);
+        TrimOutput();
     }
 }
 
+
+// consumer side
+
 int ReadOutput(s16* data, int samples)
 {
-    Platform::Mutex_Lock(AudioLock);
-    if (OutputFrontBufferReadPosition == OutputFrontBufferWritePosition)
+    u32 readpos = OutputFrontBufferReadPosition.load(std::memory_order_relaxed);
+
+    if (OutputFrontBufferSkip.exchange(false, std::memory_order_acquire))
     {
-        Platform::Mutex_Unlock(AudioLock);
+        u32 skippos = OutputFrontBufferSkipPosition.load(std::memory_order_relaxed);
+        if ((s32)(skippos - readpos) > 0)
+            readpos = skippos;
+    }
+
+    u32 writepos = OutputFrontBufferWritePosition.load(std::memory_order_acquire);
+    u32 avail = writepos - readpos;
+    if (avail == 0)
+    {
+        OutputFrontBufferReadPosition.store(readpos, std::memory_order_release);
         return 0;
     }
 
+    if ((u32)samples > avail) samples = avail;
+
     for (int i = 0; i < samples; i++)
     {
-        *data++ = OutputFrontBuffer[OutputFrontBufferReadPosition];
-        *data++ = OutputFrontBuffer[OutputFrontBufferReadPosition + 1];
+        u32 pos = ((readpos + i) & (OutputBufferSize-1)) << 1;
+        *data++ = OutputFrontBuffer[pos    ];
+        *data++ = OutputFrontBuffer[pos + 1];
+    }
 
-        OutputFrontBufferReadPosition += 2;
-        OutputFrontBufferReadPosition &= ((2*OutputBufferSize)-1);
+    OutputFrontBufferReadPosition.store(readpos + samples);
 
-        if (OutputFrontBufferWritePosition == OutputFrontBufferReadPosition)
-        {
-            Platform::Mutex_Unlock(AudioLock);
-            return i+1;
-        }
-    }
+    if (OutputWaiting.load() && OutputWaiting.exchange(false))
+        Platform::Semaphore_Post(OutputReadSema);
 
-    Platform::Mutex_Unlock(AudioLock);
     return samples;
 }
 
 
 u8 Read8(u32 addr)
 {
+    Run(NDS::ARM7Timestamp);
+
     if (addr < 0x04000500)
     {
         Channel* chan = Channels[(addr >> 4) & 0xF];
@@ -883,6 +1198,8 @@ u8 Read8(u32 addr)
 
 u16 Read16(u32 addr)
 {
+    Run(NDS::ARM7Timestamp);
+
     if (addr < 0x04000500)
     {
         Channel* chan = Channels[(addr >> 4) & 0xF];
@@ -910,6 +1227,8 @@ u16 Read16(u32 addr)
 
 u32 Read32(u32 addr)
 {
+    Run(NDS::ARM7Timestamp);
+
     if (addr < 0x04000500)
     {
         Channel* chan = Channels[(addr >> 4) & 0xF];
@@ -939,6 +1258,8 @@ u32 Read32(u32 addr)
 
 void Write8(u32 addr, u8 val)
 {
+    Run(NDS::ARM7Timestamp);
+
     if (addr < 0x04000500)
     {
         Channel* chan = Channels[(addr >> 4) & 0xF];
@@ -980,6 +1301,8 @@ void Write8(u32 addr, u8 val)
 
 void Write16(u32 addr, u16 val)
 {
+    Run(NDS::ARM7Timestamp);
+
     if (addr < 0x04000500)
     {
         Channel* chan = Channels[(addr >> 4) & 0xF];
@@ -1029,6 +1352,8 @@ void Write16(u32 addr, u16 val)
 
 void Write32(u32 addr, u32 val)
 {
+    Run(NDS::ARM7Timestamp);
+
     if (addr < 0x04000500)
     {
         Channel* chan = Channels[(addr >> 4) & 0xF];
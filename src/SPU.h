@@ -33,15 +33,36 @@ void DoSavestate(Savestate* file);
 
 void SetBias(u16 bias);
 
+// mixes every sample due by the given ARM7 timestamp
+void Run(u64 timestamp);
 void Mix(u32 dummy);
+// mixes up to the given timestamp if a playing channel reads from the range
+// about to be written (ARM7 addresses)
+void SyncMemoryWrite(u32 addr, u32 len, u64 timestamp);
+// whether a playing channel reads from the given range (ARM7 addresses)
+bool PlaysFrom(u32 addr, u32 len);
+
+// main RAM (offsets) and WRAM the playing channels read from, so the CPU store
+// handlers can quickly tell whether they need to call SyncMemoryWrite()
+extern INSTANCE_LOCAL u32 WatchMainRAMStart, WatchMainRAMEnd;
+extern INSTANCE_LOCAL bool WatchWRAM;
+// called whenever a channel's source, length or state changes
+void UpdateSampleWatch();
 
 void TrimOutput();
 void DrainOutput();
 void InitOutput();
 int GetOutputSize();
+int GetOutputCapacity();
+// waits until at most the given number of samples are left to be played
+// returns false if nothing got read for the given time (in milliseconds)
+bool WaitOutput(int samples, int timeout);
 void Sync(bool wait);
 int ReadOutput(s16* data, int samples);
 void TransferOutput();
+// copies what was mixed over the last frame, before anything got dropped
+// from the output buffer (interleaved stereo)
+int GetFrameOutput(s16* data, int samples);
 
 u8 Read8(u32 addr);
 u16 Read16(u32 addr);
@@ -109,12 +130,14 @@ public:
         {
             KeyOn = true;
         }
+
+        UpdateSampleWatch();
     }
 
-    void SetSrcAddr(u32 val) { SrcAddr = val & 0x07FFFFFC; }
+    void SetSrcAddr(u32 val) { SrcAddr = val & 0x07FFFFFC; UpdateSampleWatch(); }
     void SetTimerReload(u32 val) { TimerReload = val & 0xFFFF; }
-    void SetLoopPos(u32 val) { LoopPos = (val & 0xFFFF) << 2; }
-    void SetLength(u32 val) { Length = (val & 0x001FFFFF) << 2; }
+    void SetLoopPos(u32 val) { LoopPos = (val & 0xFFFF) << 2; UpdateSampleWatch(); }
+    void SetLength(u32 val) { Length = (val & 0x001FFFFF) << 2; UpdateSampleWatch(); }
 
     void Start();
 
@@ -125,6 +148,7 @@ public:
     void NextSample_Noise();
 
     template<u32 type> s32 Run();
+    template<u32 type> void Run(s32* buf, u32 samples);
 
     s32 DoRun()
     {
@@ -141,7 +165,28 @@ public:
         }
     }
 
+    // runs the channel for several samples
+    // returns false if it's off, in which case the buffer is left untouched
+    bool DoRun(s32* buf, u32 samples)
+    {
+        if (!(Cnt & (1<<31))) return false;
+
+        switch ((Cnt >> 29) & 0x3)
+        {
+        case 0: Run<0>(buf, samples); return true;
+        case 1: Run<1>(buf, samples); return true;
+        case 2: Run<2>(buf, samples); return true;
+        case 3:
+            if      (Num >= 14) { Run<4>(buf, samples); return true; }
+            else if (Num >= 8)  { Run<3>(buf, samples); return true; }
+            return false;
+        default:
+            return false;
+        }
+    }
+
     void PanOutput(s32 in, s32& left, s32& right);
+    void PanOutput(s32* in, s32* left, s32* right, u32 samples);
 
 private:
     u32 (*BusRead32)(u32 addr);
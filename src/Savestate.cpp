@@ -17,6 +17,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "Savestate.h"
 #include "Platform.h"
 
@@ -45,48 +46,63 @@
 
 Savestate::Savestate(const char* filename, bool save)
 {
-    const char* magic = "MELN";
+    Error = false;
+    buffer = NULL;
+
+    file = Platform::OpenFile(filename, save ? "wb" : "rb");
+    if (!file)
+    {
+        printf("savestate: file %s doesn't exist\n", filename);
+        Error = true;
+        return;
+    }
+
+    u32 len = 0;
+    if (!save)
+    {
+        fseek(file, 0, SEEK_END);
+        len = (u32)ftell(file);
+        fseek(file, 0, SEEK_SET);
+    }
+
+    Start(save, len);
+}
 
+Savestate::Savestate(u8* buffer, u32 size, bool save)
+{
     Error = false;
+    file = NULL;
+
+    this->buffer = buffer;
+    bufferSize = size;
+    bufferPos = 0;
+
+    Start(save, size);
+}
+
+void Savestate::Start(bool save, u32 len)
+{
+    const char* magic = "MELN";
 
     if (save)
     {
         Saving = true;
-        file = Platform::OpenFile(filename, "wb");
-        if (!file)
-        {
-            printf("savestate: file %s doesn't exist\n", filename);
-            Error = true;
-            return;
-        }
 
         VersionMajor = SAVESTATE_MAJOR;
         VersionMinor = SAVESTATE_MINOR;
 
-        fwrite(magic, 4, 1, file);
-        fwrite(&VersionMajor, 2, 1, file);
-        fwrite(&VersionMinor, 2, 1, file);
-        fseek(file, 8, SEEK_CUR); // length to be fixed later
+        Write(magic, 4);
+        Write(&VersionMajor, 2);
+        Write(&VersionMinor, 2);
+        Skip(8); // length to be fixed later
     }
     else
     {
         Saving = false;
-        file = Platform::OpenFile(filename, "rb");
-        if (!file)
-        {
-            printf("savestate: file %s doesn't exist\n", filename);
-            Error = true;
-            return;
-        }
-
-        u32 len;
-        fseek(file, 0, SEEK_END);
-        len = (u32)ftell(file);
-        fseek(file, 0, SEEK_SET);
 
         u32 buf = 0;
 
-        fread(&buf, 4, 1, file);
+        Read(&buf, 4);
         if (buf != ((u32*)magic)[0])
         {
             printf("savestate: invalid magic %08X\n", buf);
@@ -97,7 +113,7 @@ Savestate::Savestate(const char* filename, bool save)
         VersionMajor = 0;
         VersionMinor = 0;
 
-        fread(&VersionMajor, 2, 1, file);
+        Read(&VersionMajor, 2);
         if (VersionMajor != SAVESTATE_MAJOR)
         {
             printf("savestate: bad version major %d, expecting %d\n", VersionMajor, SAVESTATE_MAJOR);
@@ -105,7 +121,7 @@ Savestate::Savestate(const char* filename, bool save)
             return;
         }
 
-        fread(&VersionMinor, 2, 1, file);
+        Read(&VersionMinor, 2);
         if (VersionMinor > SAVESTATE_MINOR)
         {
             printf("savestate: state from the future, %d > %d\n", VersionMinor, SAVESTATE_MINOR);
@@ -114,7 +130,7 @@ Savestate::Savestate(const char* filename, bool save)
         }
 
         buf = 0;
-        fread(&buf, 4, 1, file);
+        Read(&buf, 4);
         if (buf != len)
         {
             printf("savestate: bad length %d\n", buf);
@@ -122,7 +138,7 @@ Savestate::Savestate(const char* filename, bool save)
             return;
         }
 
-        fseek(file, 4, SEEK_CUR);
+        Skip(4);
     }
 
     CurSection = -1;
@@ -130,30 +146,104 @@ Savestate::Savestate(const char* filename, bool save)
 
 Savestate::~Savestate()
 {
-    if (Error) return;
-
-    if (Saving)
+    if (!Error && Saving)
     {
         if (CurSection != -1)
         {
-            u32 pos = (u32)ftell(file);
-            fseek(file, CurSection+4, SEEK_SET);
+            u32 pos = Tell();
+            Seek(CurSection+4);
 
             u32 len = pos - CurSection;
-            fwrite(&len, 4, 1, file);
+            Write(&len, 4);
 
-            fseek(file, pos, SEEK_SET);
+            Seek(pos);
         }
 
-        fseek(file, 0, SEEK_END);
-        u32 len = (u32)ftell(file);
-        fseek(file, 8, SEEK_SET);
-        fwrite(&len, 4, 1, file);
+        // the data always ends where the last section ends
+        u32 len = Tell();
+        Seek(8);
+        Write(&len, 4);
     }
 
     if (file) fclose(file);
 }
 
+void Savestate::Write(const void* data, u32 len)
+{
+    if (file)
+    {
+        fwrite(data, len, 1, file);
+        return;
+    }
+
+    if (len > bufferSize - bufferPos)
+    {
+        Error = true;
+        return;
+    }
+    memcpy(&buffer[bufferPos], data, len);
+    bufferPos += len;
+}
+
+void Savestate::Read(void* data, u32 len)
+{
+    if (file)
+    {
+        fread(data, len, 1, file);
+        return;
+    }
+
+    // a truncated buffer is a broken state, don't leave garbage behind
+    if (len > bufferSize - bufferPos)
+    {
+        memset(data, 0, len);
+        bufferPos = bufferSize;
+        Error = true;
+        return;
+    }
+    memcpy(data, &buffer[bufferPos], len);
+    bufferPos += len;
+}
+
+void Savestate::Seek(u32 pos)
+{
+    if (file)
+        fseek(file, pos, SEEK_SET);
+    else
+        bufferPos = pos < bufferSize ? pos : bufferSize;
+}
+
+void Savestate::Skip(u32 len)
+{
+    if (file)
+    {
+        fseek(file, len, SEEK_CUR);
+    }
+    else if (Saving)
+    {
+        // the gaps are zero filled like they'd be in a file
+        if (len > bufferSize - bufferPos)
+        {
+            Error = true;
+            return;
+        }
+        memset(&buffer[bufferPos], 0, len);
+        bufferPos += len;
+    }
+    else
+    {
+        bufferPos = len < bufferSize - bufferPos ? bufferPos + len : bufferSize;
+    }
+}
+
+u32 Savestate::Tell()
+{
+    if (file)
+        return (u32)ftell(file);
+    else
+        return bufferPos;
+}
+
 void Savestate::Section(const char* magic)
 {
     if (Error) return;
@@ -162,29 +252,31 @@ void Savestate::Section(const char* magic)
     {
         if (CurSection != -1)
         {
-            u32 pos = (u32)ftell(file);
-            fseek(file, CurSection+4, SEEK_SET);
+            u32 pos = Tell();
+            Seek(CurSection+4);
 
             u32 len = pos - CurSection;
-            fwrite(&len, 4, 1, file);
+            Write(&len, 4);
 
-            fseek(file, pos, SEEK_SET);
+            Seek(pos);
         }
 
-        CurSection = (u32)ftell(file);
+        CurSection = Tell();
 
-        fwrite(magic, 4, 1, file);
-        fseek(file, 12, SEEK_CUR);
+        Write(magic, 4);
+        Skip(12);
     }
     else
     {
-        fseek(file, 0x10, SEEK_SET);
+        Seek(0x10);
 
         for (;;)
         {
             u32 buf = 0;
 
-            fread(&buf, 4, 1, file);
+            // running off the end just means the section isn't there
+            if (file || (bufferSize - bufferPos) >= 4)
+                Read(&buf, 4);
             if (buf != ((u32*)magic)[0])
             {
                 if (buf == 0)
@@ -194,12 +286,12 @@ void Savestate::Section(const char* magic)
                 }
 
                 buf = 0;
-                fread(&buf, 4, 1, file);
-                fseek(file, buf-8, SEEK_CUR);
+                Read(&buf, 4);
+                Skip(buf-8);
                 continue;
             }
 
-            fseek(file, 12, SEEK_CUR);
+            Skip(12);
             break;
         }
     }
@@ -211,11 +303,11 @@ void Savestate::Var8(u8* var)
 
     if (Saving)
     {
-        fwrite(var, 1, 1, file);
+        Write(var, 1);
     }
     else
     {
-        fread(var, 1, 1, file);
+        Read(var, 1);
     }
 }
 
@@ -225,11 +317,11 @@ void Savestate::Var16(u16* var)
 
     if (Saving)
     {
-        fwrite(var, 2, 1, file);
+        Write(var, 2);
     }
     else
     {
-        fread(var, 2, 1, file);
+        Read(var, 2);
     }
 }
 
@@ -239,11 +331,11 @@ void Savestate::Var32(u32* var)
 
     if (Saving)
     {
-        fwrite(var, 4, 1, file);
+        Write(var, 4);
     }
     else
     {
-        fread(var, 4, 1, file);
+        Read(var, 4);
     }
 }
 
@@ -253,11 +345,11 @@ void Savestate::Var64(u64* var)
 
     if (Saving)
     {
-        fwrite(var, 8, 1, file);
+        Write(var, 8);
     }
     else
     {
-        fread(var, 8, 1, file);
+        Read(var, 8);
     }
 }
 
@@ -271,7 +363,7 @@ void Savestate::Bool32(bool* var)
     }
     else
     {
-        u32 val;
+        u32 val = 0;
         Var32(&val);
         *var = val != 0;
     }
@@ -283,10 +375,10 @@ void Savestate::VarArray(void* data, u32 len)
 
     if (Saving)
     {
-        fwrite(data, len, 1, file);
+        Write(data, len);
     }
     else
     {
-        fread(data, len, 1, file);
+        Read(data, len);
     }
 }
\ No newline at end of file
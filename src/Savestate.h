@@ -23,12 +23,15 @@
 #include "types.h"
 
 #define SAVESTATE_MAJOR 6
-#define SAVESTATE_MINOR 0
+#define SAVESTATE_MINOR 1
 
 class Savestate
 {
 public:
     Savestate(const char* filename, bool save);
+    // keeps the savestate in the given memory instead of a file
+    // when saving, running out of space is treated as an error
+    Savestate(u8* buffer, u32 size, bool save);
     ~Savestate();
 
     bool Error;
@@ -59,6 +62,18 @@ public:
 
 private:
     FILE* file;
+
+    u8* buffer;
+    u32 bufferSize;
+    u32 bufferPos;
+
+    void Start(bool save, u32 len);
+
+    void Write(const void* data, u32 len);
+    void Read(void* data, u32 len);
+    void Seek(u32 pos);
+    void Skip(u32 len);
+    u32 Tell();
 };
 
 #endif // SAVESTATE_H
@@ -31,29 +31,29 @@ namespace Wifi
 //#define WIFI_LOG printf
 #define WIFI_LOG(...) {}
 
-u8 RAM[0x2000];
-u16 IO[0x1000>>1];
+INSTANCE_LOCAL u8 RAM[0x2000];
+INSTANCE_LOCAL u16 IO[0x1000>>1];
 
 #define IOPORT(x) IO[(x)>>1]
 
-u16 Random;
+INSTANCE_LOCAL u16 Random;
 
-u64 USCounter;
-u64 USCompare;
-bool BlockBeaconIRQ14;
+INSTANCE_LOCAL u64 USCounter;
+INSTANCE_LOCAL u64 USCompare;
+INSTANCE_LOCAL bool BlockBeaconIRQ14;
 
-u32 CmdCounter;
+INSTANCE_LOCAL u32 CmdCounter;
 
-u16 BBCnt;
-u8 BBWrite;
-u8 BBRegs[0x100];
-u8 BBRegsRO[0x100];
+INSTANCE_LOCAL u16 BBCnt;
+INSTANCE_LOCAL u8 BBWrite;
+INSTANCE_LOCAL u8 BBRegs[0x100];
+INSTANCE_LOCAL u8 BBRegsRO[0x100];
 
-u8 RFVersion;
-u16 RFCnt;
-u16 RFData1;
-u16 RFData2;
-u32 RFRegs[0x40];
+INSTANCE_LOCAL u8 RFVersion;
+INSTANCE_LOCAL u16 RFCnt;
+INSTANCE_LOCAL u16 RFData1;
+INSTANCE_LOCAL u16 RFData2;
+INSTANCE_LOCAL u32 RFRegs[0x40];
 
 typedef struct
 {
@@ -66,23 +66,23 @@ typedef struct
 
 } TXSlot;
 
-TXSlot TXSlots[6];
+INSTANCE_LOCAL TXSlot TXSlots[6];
 
-u8 RXBuffer[2048];
-u32 RXBufferPtr;
-u32 RXTime;
-u32 RXHalfwordTimeMask;
-u16 RXEndAddr;
+INSTANCE_LOCAL u8 RXBuffer[2048];
+INSTANCE_LOCAL u32 RXBufferPtr;
+INSTANCE_LOCAL u32 RXTime;
+INSTANCE_LOCAL u32 RXHalfwordTimeMask;
+INSTANCE_LOCAL u16 RXEndAddr;
 
-u32 ComStatus; // 0=waiting for packets  1=receiving  2=sending
-u32 TXCurSlot;
-u32 RXCounter;
+INSTANCE_LOCAL u32 ComStatus; // 0=waiting for packets  1=receiving  2=sending
+INSTANCE_LOCAL u32 TXCurSlot;
+INSTANCE_LOCAL u32 RXCounter;
 
-int MPReplyTimer;
-int MPNumReplies;
+INSTANCE_LOCAL int MPReplyTimer;
+INSTANCE_LOCAL int MPNumReplies;
 
-bool MPInited;
-bool LANInited;
+INSTANCE_LOCAL bool MPInited;
+INSTANCE_LOCAL bool LANInited;
 
 
 
@@ -329,6 +329,13 @@ bool MACEqual(u8* a, u8* b)
     return (*(u32*)&a[0] == *(u32*)&b[0]) && (*(u16*)&a[4] == *(u16*)&b[4]);
 }
 
+u64 MPTimestamp()
+{
+    // microseconds since the console was started
+    // unlike USCOUNT, this can't be changed by software
+    return NDS::ARM7Timestamp / 33;
+}
+
 
 // TODO: set RFSTATUS/RFPINS
 
@@ -501,7 +508,7 @@ void SendMPDefaultReply()
 	*(u16*)&reply[0xC + 0x16] = IOPORT(W_TXSeqNo) << 4;
 	*(u32*)&reply[0xC + 0x18] = 0;
 
-	int txlen = Platform::MP_SendPacket(reply, 12+28);
+	int txlen = Platform::MP_SendPacket(reply, 12+28, MPTimestamp());
 	WIFI_LOG("wifi: sent %d/40 bytes of MP default reply\n", txlen);
 }
 
@@ -531,7 +538,7 @@ void SendMPAck()
 	*(u16*)&ack[0xC + 0x1A] = 0;
 	*(u32*)&ack[0xC + 0x1C] = 0;
 
-	int txlen = Platform::MP_SendPacket(ack, 12+32);
+	int txlen = Platform::MP_SendPacket(ack, 12+32, MPTimestamp());
 	WIFI_LOG("wifi: sent %d/44 bytes of MP ack, %d %d\n", txlen, ComStatus, RXTime);
 }
 
@@ -656,7 +663,7 @@ bool ProcessTX(TXSlot* slot, int num)
             IOPORT(W_RXTXAddr) = slot->Addr >> 1;
 
             // send
-            int txlen = Platform::MP_SendPacket(&RAM[slot->Addr], 12 + slot->Length);
+            int txlen = Platform::MP_SendPacket(&RAM[slot->Addr], 12 + slot->Length, MPTimestamp());
             WIFI_LOG("wifi: sent %d/%d bytes of slot%d packet, addr=%04X, framectl=%04X, %04X %04X\n",
                      txlen, slot->Length+12, num, slot->Addr, *(u16*)&RAM[slot->Addr + 0xC],
                      *(u16*)&RAM[slot->Addr + 0x24], *(u16*)&RAM[slot->Addr + 0x26]);
@@ -827,7 +834,7 @@ bool CheckRX(bool block)
 
     for (;;)
     {
-        int rxlen = Platform::MP_RecvPacket(RXBuffer, block);
+        int rxlen = Platform::MP_RecvPacket(RXBuffer, block, MPTimestamp());
         if (rxlen == 0) rxlen = WifiAP::RecvPacket(RXBuffer);
         if (rxlen == 0) return false;
         if (rxlen < 12+24) continue;
@@ -142,7 +142,7 @@ enum
 };
 
 
-extern bool MPInited;
+extern INSTANCE_LOCAL bool MPInited;
 
 
 bool Init();
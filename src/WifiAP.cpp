@@ -62,21 +62,21 @@ const u8 APMac[6] = {AP_MAC};
 #define PALIGN_4(p, base)  while (PLEN(p,base) & 0x3) *p++ = 0xFF;
 
 
-u64 USCounter;
+INSTANCE_LOCAL u64 USCounter;
 
-u16 SeqNo;
+INSTANCE_LOCAL u16 SeqNo;
 
-bool BeaconDue;
+INSTANCE_LOCAL bool BeaconDue;
 
-u8 PacketBuffer[2048];
-int PacketLen;
-int RXNum;
+INSTANCE_LOCAL u8 PacketBuffer[2048];
+INSTANCE_LOCAL int PacketLen;
+INSTANCE_LOCAL int RXNum;
 
-u8 LANBuffer[2048];
+INSTANCE_LOCAL u8 LANBuffer[2048];
 
 // this is a lazy AP, we only keep track of one client
 // 0=disconnected 1=authenticated 2=associated
-int ClientStatus;
+INSTANCE_LOCAL int ClientStatus;
 
 
 bool Init()
@@ -107,6 +107,42 @@ int ImportSRAM(const char* filename);
 void EnableCheats(bool enable);
 
 
+// drop all rewind states
+// called whenever the emulated system is reset or a state is loaded
+void Rewind_Reset();
+
+// to be called once after every emulated frame
+// takes a rewind state every RewindInterval frames, if rewinding is enabled
+void Rewind_Frame();
+
+// rewind emulation by at least the given amount of frames, as far as
+// the stored states allow. returns false if there is no state to go back to
+bool Rewind_StepBack(u32 frames);
+
+
+enum
+{
+    Capture_Y4M = 0,
+    Capture_PNG,
+};
+
+// start recording the video and audio output to files starting with path
+// (see Util_Capture.cpp for the formats)
+// with block set, the emulator waits for the encoder instead of dropping
+// frames and samples when it falls behind
+bool Capture_Start(const char* path, int format, bool block);
+void Capture_Stop();
+bool Capture_IsActive();
+
+// to be called once after every emulated frame, on the emulator thread
+// this records the frame's audio too
+void Capture_Frame();
+
+// how much got dropped since the capture was started
+u32 Capture_FramesDropped();
+u32 Capture_SamplesDropped();
+
+
 // setup the display layout based on the provided display size and parameters
 // * screenWidth/screenHeight: size of the host display
 // * screenLayout: how the DS screens are laid out
@@ -134,17 +170,26 @@ void GetScreenTransforms(float* top, float* bot);
 void GetTouchCoords(int& x, int& y);
 
 
+enum
+{
+    AudioOut_Cheap = 0,
+    AudioOut_Sinc,
+};
+
 // initialize the audio utility
 void Init_Audio(int outputfreq);
 
 // get how many samples to read from the core audio output
 // based on how many are needed by the frontend (outlen in samples)
-int AudioOut_GetNumSamples(int outlen);
+// with ratecontrol, the ratio is adjusted slightly to keep the core output
+// buffer half full, for when the emulator isn't synced to the audio output
+int AudioOut_GetNumSamples(int outlen, bool ratecontrol);
 
 // resample audio from the core audio output to match the frontend's
 // output frequency, and apply specified volume
+// quality is one of AudioOut_Cheap or AudioOut_Sinc
 // note: this assumes the output buffer is interleaved stereo
-void AudioOut_Resample(s16* inbuf, int inlen, s16* outbuf, int outlen, int volume);
+void AudioOut_Resample(s16* inbuf, int inlen, s16* outbuf, int outlen, int volume, int quality);
 
 // feed silence to the microphone input
 void Mic_FeedSilence();
@@ -0,0 +1,534 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef __WIN32__
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "LocalMP.h"
+
+
+/*
+    Shared memory layout
+
+    every instance owns a slot, and a ring buffer where it writes the packets
+    it sends. there is only one writer per ring, and every other instance
+    reads it with its own read position, so nothing needs to be locked.
+    the writer never waits for readers: a reader that falls too far behind
+    loses the packets that were overwritten, like it would with UDP.
+
+    ring record:
+    00 - packet length (PadRecord: skip to the start of the ring)
+    04 - unused
+    08 - time when the packet was sent, on the shared time base
+    10 - packet data, padded to 8 bytes
+
+    every console counts its emulated time from its own boot, so those can't
+    be compared between instances. each instance instead maps its time onto
+    a shared time base when it first sends or receives something, starting
+    where the furthest active instance is. it does so again when its own
+    time goes back (console reset), so the shared time never goes back.
+    this is only used to deliver packets from several instances in the
+    order they were sent.
+
+    instances that live in the same process (multi-instance builds) are told
+    apart by their slot, the owner PID is only used to reclaim the slots of
+    processes that died without releasing them.
+
+    an instance blocked in RecvPacket sets Waiting in its slot and sleeps on
+    its Signal counter (a futex on Linux, a named event on Windows). others
+    bump that counter and wake it when they send a packet, leave, or catch up
+    with its time.
+*/
+
+namespace LocalMP
+{
+
+const u32 Magic = 0x324D504C; // LPM2
+const int MaxInstances = 16;
+const u32 RingSize = 0x10000;
+const u32 MaxPacketSize = 2048;
+const u32 MaxRecordSize = 16 + MaxPacketSize;
+const u32 PadRecord = 0xFFFFFFFF;
+
+// how long a blocking receive waits at most, same as the UDP path
+const int BlockTimeout = 5000;
+
+struct SlotInfo
+{
+    std::atomic<u32> Owner;
+    std::atomic<u32> Active;
+    std::atomic<u64> Time;
+    std::atomic<u64> WritePos;
+    // these used to be padding, so older builds leave them at zero and
+    // simply never wake anyone up, which only costs the timeout
+    std::atomic<u32> Signal;
+    std::atomic<u32> Waiting;
+    u8 Pad[32];
+};
+
+struct SharedHeader
+{
+    std::atomic<u32> Magic;
+    u8 Pad[60];
+    SlotInfo Slots[MaxInstances];
+    u8 Rings[MaxInstances][RingSize];
+};
+
+#ifdef __WIN32__
+INSTANCE_LOCAL HANDLE MapHandle = NULL;
+INSTANCE_LOCAL HANDLE SignalEvent[MaxInstances];
+#endif
+INSTANCE_LOCAL SharedHeader* Shared = nullptr;
+
+INSTANCE_LOCAL int SlotID;
+INSTANCE_LOCAL u64 ReadPos[MaxInstances];
+
+INSTANCE_LOCAL bool TimeBaseSet;
+INSTANCE_LOCAL u64 TimeOffset;
+INSTANCE_LOCAL u64 LastTimestamp;
+
+
+u32 GetPID()
+{
+#ifdef __WIN32__
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif
+}
+
+bool ProcessAlive(u32 pid)
+{
+    if (pid == GetPID()) return true;
+
+#ifdef __WIN32__
+    HANDLE proc = OpenProcess(SYNCHRONIZE, FALSE, pid);
+    if (!proc) return false;
+    bool alive = WaitForSingleObject(proc, 0) == WAIT_TIMEOUT;
+    CloseHandle(proc);
+    return alive;
+#else
+    return kill(pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+bool MapShared()
+{
+#ifdef __WIN32__
+    MapHandle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                   0, sizeof(SharedHeader), "melonDS_LocalMP");
+    if (!MapHandle) return false;
+
+    Shared = (SharedHeader*)MapViewOfFile(MapHandle, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedHeader));
+    if (!Shared)
+    {
+        CloseHandle(MapHandle);
+        MapHandle = NULL;
+        return false;
+    }
+
+    for (int i = 0; i < MaxInstances; i++)
+    {
+        char name[64];
+        sprintf(name, "melonDS_LocalMP_Signal%d", i);
+        SignalEvent[i] = CreateEventA(NULL, FALSE, FALSE, name);
+    }
+#else
+    int fd = shm_open("/melonDS_LocalMP", O_RDWR | O_CREAT, 0600);
+    if (fd < 0) return false;
+
+    // new shared memory is zero-filled, which is a valid empty state
+    if (ftruncate(fd, sizeof(SharedHeader)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mem = mmap(NULL, sizeof(SharedHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return false;
+
+    Shared = (SharedHeader*)mem;
+#endif
+
+    return true;
+}
+
+void UnmapShared()
+{
+    if (!Shared) return;
+
+#ifdef __WIN32__
+    for (int i = 0; i < MaxInstances; i++)
+    {
+        if (SignalEvent[i]) CloseHandle(SignalEvent[i]);
+        SignalEvent[i] = NULL;
+    }
+
+    UnmapViewOfFile(Shared);
+    CloseHandle(MapHandle);
+    MapHandle = NULL;
+#else
+    munmap(Shared, sizeof(SharedHeader));
+#endif
+    Shared = nullptr;
+}
+
+
+// wakes up an instance blocked in RecvPacket
+void WakeSlot(int id)
+{
+    SlotInfo& slot = Shared->Slots[id];
+    slot.Signal.fetch_add(1, std::memory_order_release);
+
+#ifdef __WIN32__
+    if (SignalEvent[id]) SetEvent(SignalEvent[id]);
+#elif defined(__linux__)
+    syscall(SYS_futex, (u32*)&slot.Signal, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+// wakes up the waiting instances whose time isn't past 'time'
+// pass ~0 to wake up all of them
+void WakePeers(u64 time)
+{
+    // pairs with the fence in RecvPacket: either we see it waiting, or it
+    // sees what we did before calling this
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for (int i = 0; i < MaxInstances; i++)
+    {
+        if (i == SlotID) continue;
+
+        SlotInfo& slot = Shared->Slots[i];
+        if (!slot.Waiting.load(std::memory_order_relaxed)) continue;
+        if (slot.Time.load(std::memory_order_relaxed) > time) continue;
+
+        WakeSlot(i);
+    }
+}
+
+// sleeps until our slot is signalled past 'signal', or at most 'us' microseconds
+void WaitForWake(u32 signal, s64 us)
+{
+#ifdef __WIN32__
+    if (SignalEvent[SlotID])
+    {
+        WaitForSingleObject(SignalEvent[SlotID], (DWORD)((us + 999) / 1000));
+        return;
+    }
+#elif defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    syscall(SYS_futex, (u32*)&Shared->Slots[SlotID].Signal, FUTEX_WAIT, signal, &ts, NULL, 0);
+    return;
+#endif
+
+    std::this_thread::yield();
+}
+
+
+bool Init()
+{
+    SlotID = -1;
+
+    if (!MapShared())
+    {
+        printf("LocalMP: could not map the shared memory\n");
+        return false;
+    }
+
+    u32 magic = 0;
+    if (!Shared->Magic.compare_exchange_strong(magic, Magic) && magic != Magic)
+    {
+        printf("LocalMP: shared memory belongs to an incompatible version\n");
+        UnmapShared();
+        return false;
+    }
+
+    u32 pid = GetPID();
+    for (int i = 0; i < MaxInstances; i++)
+    {
+        SlotInfo& slot = Shared->Slots[i];
+
+        u32 owner = slot.Owner.load();
+        if (owner != 0 && ProcessAlive(owner))
+            continue;
+
+        if (slot.Owner.compare_exchange_strong(owner, pid))
+        {
+            SlotID = i;
+            break;
+        }
+    }
+
+    if (SlotID == -1)
+    {
+        printf("LocalMP: too many instances running\n");
+        UnmapShared();
+        return false;
+    }
+
+    SlotInfo& slot = Shared->Slots[SlotID];
+    slot.Time.store(0);
+    slot.Waiting.store(0);
+    slot.Active.store(1);
+    TimeBaseSet = false;
+
+    // only receive what gets sent from now on
+    for (int i = 0; i < MaxInstances; i++)
+        ReadPos[i] = Shared->Slots[i].WritePos.load(std::memory_order_acquire);
+
+    printf("LocalMP: joined as instance %d\n", SlotID);
+    return true;
+}
+
+void DeInit()
+{
+    if (!Shared) return;
+
+    if (SlotID != -1)
+    {
+        SlotInfo& slot = Shared->Slots[SlotID];
+        slot.Waiting.store(0);
+        slot.Active.store(0);
+        slot.Owner.store(0);
+
+        // nobody has to wait for us anymore
+        WakePeers(~0ULL);
+        SlotID = -1;
+    }
+
+    UnmapShared();
+}
+
+
+// converts our emulated time to the shared time base
+u64 SharedTime(u64 timestamp)
+{
+    if (!TimeBaseSet || timestamp < LastTimestamp)
+    {
+        u64 base = TimeBaseSet ? (LastTimestamp + TimeOffset) : 0;
+        for (int i = 0; i < MaxInstances; i++)
+        {
+            if (i == SlotID) continue;
+
+            SlotInfo& slot = Shared->Slots[i];
+            if (!slot.Active.load(std::memory_order_relaxed)) continue;
+
+            u64 time = slot.Time.load(std::memory_order_relaxed);
+            if (time > base) base = time;
+        }
+
+        TimeOffset = (base > timestamp) ? (base - timestamp) : 0;
+        TimeBaseSet = true;
+    }
+
+    LastTimestamp = timestamp;
+    return timestamp + TimeOffset;
+}
+
+int SendPacket(u8* data, int len, u64 timestamp)
+{
+    if (!Shared) return 0;
+
+    if (len > (int)MaxPacketSize)
+    {
+        printf("LocalMP: error: packet too long (%d)\n", len);
+        return 0;
+    }
+
+    SlotInfo& slot = Shared->Slots[SlotID];
+    u8* ring = Shared->Rings[SlotID];
+
+    timestamp = SharedTime(timestamp);
+    slot.Time.store(timestamp, std::memory_order_relaxed);
+
+    // we're the only writer, nobody else moves this
+    u64 pos = slot.WritePos.load(std::memory_order_relaxed);
+    u32 reclen = (16 + len + 7) & ~7;
+    u32 offset = pos & (RingSize-1);
+
+    if (offset + reclen > RingSize)
+    {
+        *(u32*)&ring[offset] = PadRecord;
+        pos += RingSize - offset;
+        offset = 0;
+    }
+
+    *(u32*)&ring[offset + 0] = len;
+    *(u32*)&ring[offset + 4] = 0;
+    *(u64*)&ring[offset + 8] = timestamp;
+    memcpy(&ring[offset + 16], data, len);
+
+    slot.WritePos.store(pos + reclen, std::memory_order_release);
+    WakePeers(~0ULL);
+    return len;
+}
+
+// reads the next packet from another instance's ring
+// returns 0 if there is none, -1 if the reader fell behind or the packet got
+// overwritten while it was being read
+int ReadRecord(int id, u8* data, u64* stamp, bool peek)
+{
+    SlotInfo& slot = Shared->Slots[id];
+    u8* ring = Shared->Rings[id];
+
+    for (;;)
+    {
+        u64 writepos = slot.WritePos.load(std::memory_order_acquire);
+        u64 pos = ReadPos[id];
+        if (pos == writepos) return 0;
+
+        // leave room for the record the writer may be busy with
+        if ((writepos - pos) > (RingSize - 2*MaxRecordSize))
+        {
+            ReadPos[id] = writepos;
+            return -1;
+        }
+
+        u32 offset = pos & (RingSize-1);
+        u32 len = *(u32*)&ring[offset];
+        if (len == PadRecord)
+        {
+            ReadPos[id] = pos + (RingSize - offset);
+            continue;
+        }
+        if (len > MaxPacketSize)
+        {
+            ReadPos[id] = writepos;
+            return -1;
+        }
+
+        *stamp = *(u64*)&ring[offset + 8];
+        if (!peek) memcpy(data, &ring[offset + 16], len);
+
+        // make sure the writer didn't lap us while we were copying
+        std::atomic_thread_fence(std::memory_order_acquire);
+        writepos = slot.WritePos.load(std::memory_order_relaxed);
+        if ((writepos - pos) > (RingSize - 2*MaxRecordSize))
+        {
+            ReadPos[id] = writepos;
+            return -1;
+        }
+
+        if (!peek) ReadPos[id] = pos + ((16 + len + 7) & ~7);
+        return len;
+    }
+}
+
+int RecvPacket(u8* data, bool block, u64 timestamp)
+{
+    if (!Shared) return 0;
+
+    SlotInfo& self = Shared->Slots[SlotID];
+
+    timestamp = SharedTime(timestamp);
+    self.Time.store(timestamp, std::memory_order_relaxed);
+
+    // instances that were waiting for us to get this far can give up now
+    WakePeers(timestamp);
+
+    if (block)
+    {
+        self.Waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(BlockTimeout);
+    int ret = 0;
+
+    for (;;)
+    {
+        u32 signal = self.Signal.load(std::memory_order_acquire);
+
+        // pick the oldest pending packet, so packets from different
+        // instances come in the order they were sent
+        int best = -1;
+        u64 beststamp = 0;
+        bool peerbehind = false;
+
+        for (int i = 0; i < MaxInstances; i++)
+        {
+            if (i == SlotID) continue;
+
+            SlotInfo& slot = Shared->Slots[i];
+            if (!slot.Active.load(std::memory_order_relaxed))
+            {
+                ReadPos[i] = slot.WritePos.load(std::memory_order_acquire);
+                continue;
+            }
+
+            if (slot.Time.load(std::memory_order_relaxed) < timestamp)
+                peerbehind = true;
+
+            u64 stamp;
+            int len;
+            while ((len = ReadRecord(i, nullptr, &stamp, true)) < 0);
+            if (len > 0 && (best == -1 || stamp < beststamp))
+            {
+                best = i;
+                beststamp = stamp;
+            }
+        }
+
+        if (best != -1)
+        {
+            u64 stamp;
+            ret = ReadRecord(best, data, &stamp, false);
+            if (ret > 0) break;
+            ret = 0;
+            continue;
+        }
+
+        // only an instance that is behind us in time can still send
+        // something that should arrive before now
+        if (!block || !peerbehind) break;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) break;
+
+        s64 left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+        WaitForWake(signal, left);
+    }
+
+    if (block) self.Waiting.store(0, std::memory_order_relaxed);
+    return ret;
+}
+
+}
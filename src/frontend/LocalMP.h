@@ -0,0 +1,43 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef LOCALMP_H
+#define LOCALMP_H
+
+#include "types.h"
+
+// local multiplayer between instances running on the same computer, through
+// shared memory instead of UDP broadcasts
+
+namespace LocalMP
+{
+
+bool Init();
+void DeInit();
+
+// timestamps are the caller's emulated time, in microseconds
+// they are used to deliver packets from several instances in order
+int SendPacket(u8* data, int len, u64 timestamp);
+
+// when blocking, waits until a packet comes in, no other instance is behind
+// in time anymore, or a short timeout passes
+int RecvPacket(u8* data, bool block, u64 timestamp);
+
+}
+
+#endif // LOCALMP_H
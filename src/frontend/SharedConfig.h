@@ -8,6 +8,10 @@ extern int ConsoleType;
 extern int DirectBoot;
 extern int SavestateRelocSRAM;
 
+extern int RewindEnable;
+extern int RewindInterval;
+extern int RewindLength;
+
 }
 
 #endif
\ No newline at end of file
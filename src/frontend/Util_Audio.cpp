@@ -24,25 +24,136 @@
 #include "FrontendUtil.h"
 
 #include "NDS.h"
+#include "SPU.h"
 
 #include "mic_blow.h"
 
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 
 namespace Frontend
 {
 
+/*
+    Resampler
+
+    the SPU output runs at 32823.6328125 Hz. it is converted to the output
+    frequency by a polyphase windowed-sinc filter: 16 taps, with the filter
+    bank precomputed for 256 positions between two input samples.
+
+    input samples are kept in a planar history buffer between calls, so the
+    filter always has the samples it needs on both sides of the output
+    position. the position is 32.32 fixed point, relative to the start of
+    the history buffer.
+
+    the cheap mode does linear interpolation on the two middle samples of
+    the same window, so both modes consume input the same way and can be
+    switched at any time.
+
+    rate control: the ratio is nudged by at most 0.5% depending on how full
+    the core output buffer is, which keeps it around the middle instead of
+    running dry or dropping samples when the emulator isn't paced by audio.
+*/
+
+const double AudioOut_InFreq = 32823.6328125;
+
+const int ResTaps = 16;
+const int ResPhaseBits = 8;
+const int ResPhases = 1 << ResPhaseBits;
+const int ResCoefShift = 14;
+const int ResHistSize = 4096;
+
+const double RateMaxDeviation = 0.005;
+
 int AudioOut_Freq;
-float AudioOut_SampleFrac;
+
+alignas(16) s16 ResBank[ResPhases][ResTaps];
+alignas(16) s16 ResHistL[ResHistSize];
+alignas(16) s16 ResHistR[ResHistSize];
+int ResHistLen;
+u64 ResPos;
+u64 ResBaseStep;
+u64 ResStep;
+float ResFillAvg;
 
 s16* MicBuffer;
 u32 MicBufferLength;
 u32 MicBufferReadPos;
 
 
+double BesselI0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x / (2*k)) * (x / (2*k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+void AudioOut_BuildFilter()
+{
+    // cutoff a bit below the input nyquist, or the output one when downsampling
+    double cutoff = 0.9;
+    if (AudioOut_Freq < AudioOut_InFreq)
+        cutoff *= AudioOut_Freq / AudioOut_InFreq;
+
+    const double beta = 6.0;
+    const double halftaps = ResTaps / 2;
+    double norm = BesselI0(beta);
+
+    for (int p = 0; p < ResPhases; p++)
+    {
+        double frac = p / (double)ResPhases;
+        double coef[ResTaps];
+        double sum = 0;
+
+        for (int k = 0; k < ResTaps; k++)
+        {
+            // distance between the output position and this tap's sample
+            double t = (k - (halftaps - 1)) - frac;
+
+            double x = M_PI * cutoff * t;
+            double sinc = (fabs(x) < 1e-9) ? 1.0 : (sin(x) / x);
+
+            double w = t / halftaps;
+            w = (w*w < 1) ? (BesselI0(beta * sqrt(1 - w*w)) / norm) : 0;
+
+            coef[k] = sinc * w;
+            sum += coef[k];
+        }
+
+        // normalize to unity gain, and put the rounding error on the center tap
+        int isum = 0;
+        for (int k = 0; k < ResTaps; k++)
+        {
+            int c = (int)lround((coef[k] / sum) * (1 << ResCoefShift));
+            ResBank[p][k] = c;
+            isum += c;
+        }
+        ResBank[p][(ResTaps/2) - 1 + (p >= ResPhases/2)] += (1 << ResCoefShift) - isum;
+    }
+}
+
 void Init_Audio(int outputfreq)
 {
     AudioOut_Freq = outputfreq;
-    AudioOut_SampleFrac = 0;
+
+    AudioOut_BuildFilter();
+
+    memset(ResHistL, 0, sizeof(ResHistL));
+    memset(ResHistR, 0, sizeof(ResHistR));
+    ResHistLen = ResTaps - 1;
+    ResPos = 0;
+    ResBaseStep = (u64)((AudioOut_InFreq / outputfreq) * 4294967296.0);
+    ResStep = ResBaseStep;
+    ResFillAvg = -1;
 
     MicBuffer = nullptr;
     MicBufferLength = 0;
@@ -50,34 +161,164 @@ void Init_Audio(int outputfreq)
 }
 
 
-int AudioOut_GetNumSamples(int outlen)
+int AudioOut_GetNumSamples(int outlen, bool ratecontrol)
 {
-    float f_len_in = (outlen * 32823.6328125) / (float)AudioOut_Freq;
-    f_len_in += AudioOut_SampleFrac;
-    int len_in = (int)floor(f_len_in);
-    AudioOut_SampleFrac = f_len_in - len_in;
+    ResStep = ResBaseStep;
+    if (ratecontrol)
+    {
+        float fill = SPU::GetOutputSize();
+        if (ResFillAvg < 0) ResFillAvg = fill;
+        else                ResFillAvg += (fill - ResFillAvg) * 0.125f;
+
+        // consume faster when above the middle, slower when below
+        float target = SPU::GetOutputCapacity() / 2;
+        float delta = (ResFillAvg - target) / target;
+        if      (delta < -1) delta = -1;
+        else if (delta >  1) delta =  1;
 
-    return len_in;
+        ResStep = (u64)(ResBaseStep * (1.0 + delta * RateMaxDeviation));
+    }
+    else
+        ResFillAvg = -1;
+
+    if (outlen < 1) return 0;
+
+    // the window for the last output sample needs to be in the history
+    u64 last = ResPos + (u64)(outlen - 1) * ResStep;
+    int needed = (int)(last >> 32) + ResTaps - ResHistLen;
+    if (needed < 0) needed = 0;
+    if (needed > ResHistSize - ResHistLen) needed = ResHistSize - ResHistLen;
+
+    return needed;
+}
+
+void AudioOut_Filter(const s16* inl, const s16* inr, const s16* coef, s32& outl, s32& outr)
+{
+#if defined(__x86_64__)
+    __m128i c0 = _mm_load_si128((const __m128i*)&coef[0]);
+    __m128i c1 = _mm_load_si128((const __m128i*)&coef[8]);
+
+    __m128i l = _mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)&inl[0]), c0),
+                              _mm_madd_epi16(_mm_loadu_si128((const __m128i*)&inl[8]), c1));
+    __m128i r = _mm_add_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i*)&inr[0]), c0),
+                              _mm_madd_epi16(_mm_loadu_si128((const __m128i*)&inr[8]), c1));
+
+    // l0+l2, r0+r2, l1+l3, r1+r3
+    __m128i t = _mm_add_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r));
+    t = _mm_add_epi32(t, _mm_srli_si128(t, 8));
+
+    outl = _mm_cvtsi128_si32(t);
+    outr = _mm_cvtsi128_si32(_mm_srli_si128(t, 4));
+#elif defined(__aarch64__)
+    int16x8_t c0 = vld1q_s16(&coef[0]);
+    int16x8_t c1 = vld1q_s16(&coef[8]);
+
+    int16x8_t l0 = vld1q_s16(&inl[0]), l1 = vld1q_s16(&inl[8]);
+    int16x8_t r0 = vld1q_s16(&inr[0]), r1 = vld1q_s16(&inr[8]);
+
+    int32x4_t l = vmull_s16(vget_low_s16(l0), vget_low_s16(c0));
+    l = vmlal_high_s16(l, l0, c0);
+    l = vmlal_s16(l, vget_low_s16(l1), vget_low_s16(c1));
+    l = vmlal_high_s16(l, l1, c1);
+
+    int32x4_t r = vmull_s16(vget_low_s16(r0), vget_low_s16(c0));
+    r = vmlal_high_s16(r, r0, c0);
+    r = vmlal_s16(r, vget_low_s16(r1), vget_low_s16(c1));
+    r = vmlal_high_s16(r, r1, c1);
+
+    outl = vaddvq_s32(l);
+    outr = vaddvq_s32(r);
+#else
+    s32 l = 0, r = 0;
+    for (int k = 0; k < ResTaps; k++)
+    {
+        l += inl[k] * coef[k];
+        r += inr[k] * coef[k];
+    }
+    outl = l;
+    outr = r;
+#endif
 }
 
-void AudioOut_Resample(s16* inbuf, int inlen, s16* outbuf, int outlen, int volume)
+s16 AudioOut_Clamp(s32 val)
 {
-    float res_incr = inlen / (float)outlen;
-    float res_timer = 0;
-    int res_pos = 0;
+    if (val < -0x8000) return -0x8000;
+    if (val >  0x7FFF) return  0x7FFF;
+    return val;
+}
+
+void AudioOut_Resample(s16* inbuf, int inlen, s16* outbuf, int outlen, int volume, int quality)
+{
+    if (ResHistLen + inlen < ResTaps)
+    {
+        memset(outbuf, 0, outlen*sizeof(s16)*2);
+        return;
+    }
+
+    if (inlen > ResHistSize - ResHistLen) inlen = ResHistSize - ResHistLen;
+
+    for (int i = 0; i < inlen; i++)
+    {
+        ResHistL[ResHistLen + i] = inbuf[i*2  ];
+        ResHistR[ResHistLen + i] = inbuf[i*2+1];
+    }
+    ResHistLen += inlen;
+
+    // if we were given less than asked for, stall on the last full window
+    const u64 maxpos = ((u64)(ResHistLen - ResTaps + 1) << 32) - 1;
+    u64 pos = ResPos;
 
-    for (int i = 0; i < outlen; i++)
+    if (quality == AudioOut_Cheap)
     {
-        outbuf[i*2  ] = (inbuf[res_pos*2  ] * volume) >> 8;
-        outbuf[i*2+1] = (inbuf[res_pos*2+1] * volume) >> 8;
+        for (int i = 0; i < outlen; i++)
+        {
+            if (pos > maxpos) pos = maxpos;
+
+            int idx = (pos >> 32) + (ResTaps/2) - 1;
+            s32 frac = (pos >> 16) & 0xFFFF;
+
+            s32 l = ResHistL[idx] + (((ResHistL[idx+1] - ResHistL[idx]) * frac) >> 16);
+            s32 r = ResHistR[idx] + (((ResHistR[idx+1] - ResHistR[idx]) * frac) >> 16);
 
-        res_timer += res_incr;
-        while (res_timer >= 1.0)
+            outbuf[i*2  ] = (l * volume) >> 8;
+            outbuf[i*2+1] = (r * volume) >> 8;
+
+            pos += ResStep;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < outlen; i++)
         {
-            res_timer -= 1.0;
-            res_pos++;
+            if (pos > maxpos) pos = maxpos;
+
+            int idx = pos >> 32;
+            const s16* coef = ResBank[(pos >> (32 - ResPhaseBits)) & (ResPhases-1)];
+
+            s32 l, r;
+            AudioOut_Filter(&ResHistL[idx], &ResHistR[idx], coef, l, r);
+
+            l = (l + (1 << (ResCoefShift-1))) >> ResCoefShift;
+            r = (r + (1 << (ResCoefShift-1))) >> ResCoefShift;
+
+            // the filter can overshoot a little on full-scale input
+            outbuf[i*2  ] = AudioOut_Clamp((l * volume) >> 8);
+            outbuf[i*2+1] = AudioOut_Clamp((r * volume) >> 8);
+
+            pos += ResStep;
         }
     }
+
+    // drop the input that no window will need anymore
+    int consumed = pos >> 32;
+    if (consumed > 0)
+    {
+        ResHistLen -= consumed;
+        memmove(&ResHistL[0], &ResHistL[consumed], ResHistLen*sizeof(s16));
+        memmove(&ResHistR[0], &ResHistR[consumed], ResHistLen*sizeof(s16));
+        pos -= (u64)consumed << 32;
+    }
+    ResPos = pos;
 }
 
 
@@ -0,0 +1,643 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "FrontendUtil.h"
+
+#include "NDS.h"
+#include "GPU.h"
+#include "SPU.h"
+#include "CRC32.h"
+#include "Platform.h"
+
+
+/*
+    A/V capture
+
+    right after NDS::RunFrame(), both screens are copied into one of two
+    frame slots, and the capture thread encodes and writes them from there.
+    the copy is all the emulator thread does: if both slots are still busy,
+    the frame is either dropped or waited for, depending on how the capture
+    was started. a dropped frame is counted, and the next frame that gets
+    through carries how many were dropped before it. the capture thread then
+    repeats the previous frame that many times, so the video keeps its
+    length and stays in sync with the audio.
+
+    the audio of each frame is taken from the SPU at the same point, before
+    the audio output gets to drop or trim anything, so both files always
+    cover the same emulated time whatever the frontend does with its audio.
+    it goes through its own ring. samples that don't fit are dropped and
+    counted, and replaced with as much silence once there is room again.
+
+    output:
+    * Capture_Y4M: <path>.y4m, 4:4:4 BT.601
+    * Capture_PNG: <path>_000000.png, <path>_000001.png, ...
+    and the audio in <path>.wav, 16-bit stereo.
+
+    the PNGs are compressed with a small deflate encoder (fixed Huffman codes,
+    greedy matching), which does well enough on DS graphics and keeps the
+    capture free of external dependencies.
+*/
+
+namespace Frontend
+{
+
+const int CaptureNumSlots = 2;
+const u32 CaptureWidth = 256;
+const u32 CaptureHeight = 384;
+const u32 CaptureFrameSize = CaptureWidth * CaptureHeight;
+
+// the SPU output rate is 32823.6 Hz, a WAV file needs a whole number
+const u32 CaptureAudioFreq = 32824;
+const u32 CaptureAudioRingSize = 32768;
+
+// 33513982 Hz / (355 dots * 263 lines * 6 cycles)
+const char* CaptureFrameRate = "33513982:560190";
+
+struct CaptureSlot
+{
+    u32 Pixels[CaptureFrameSize];
+    u32 Repeat;
+};
+
+bool CaptureActive = false;
+int CaptureFormat;
+bool CaptureBlock;
+std::string CapturePath;
+
+CaptureSlot* CaptureSlots = nullptr;
+std::atomic<u32> CaptureSlotWrite;
+std::atomic<u32> CaptureSlotRead;
+u32 CaptureRepeatPending;
+
+s16* CaptureAudioRing = nullptr;
+std::atomic<u32> CaptureAudioWrite;
+std::atomic<u32> CaptureAudioRead;
+u32 CaptureSilencePending;
+
+std::atomic<u32> CaptureFramesDropped;
+std::atomic<u32> CaptureSamplesDropped;
+
+Platform::Thread* CaptureThread = nullptr;
+Platform::Semaphore* CaptureWorkSema;
+Platform::Semaphore* CaptureFreeSema;
+std::atomic<bool> CaptureQuit;
+u32 CaptureRepeatTail;
+u32 CaptureSilenceTail;
+
+FILE* CaptureVideoFile = nullptr;
+FILE* CaptureAudioFile = nullptr;
+u32 CaptureFrameCount;
+u32 CaptureAudioBytes;
+
+// the last frame as it was written, for repeating dropped frames
+std::vector<u8> CaptureLastFrame;
+
+
+void Capture_PutU32(u8* dst, u32 val, bool bigendian)
+{
+    for (int i = 0; i < 4; i++)
+        dst[i] = bigendian ? (val >> (24 - i*8)) : (val >> (i*8));
+}
+
+void Capture_WriteWAVHeader()
+{
+    u8 header[44];
+
+    memcpy(&header[0], "RIFF", 4);
+    Capture_PutU32(&header[4], 36 + CaptureAudioBytes, false);
+    memcpy(&header[8], "WAVEfmt ", 8);
+    Capture_PutU32(&header[16], 16, false);
+    Capture_PutU32(&header[20], 1 | (2 << 16), false); // PCM, stereo
+    Capture_PutU32(&header[24], CaptureAudioFreq, false);
+    Capture_PutU32(&header[28], CaptureAudioFreq * 4, false);
+    Capture_PutU32(&header[32], 4 | (16 << 16), false); // block align, bits per sample
+    memcpy(&header[36], "data", 4);
+    Capture_PutU32(&header[40], CaptureAudioBytes, false);
+
+    fseek(CaptureAudioFile, 0, SEEK_SET);
+    fwrite(header, 44, 1, CaptureAudioFile);
+    fseek(CaptureAudioFile, 0, SEEK_END);
+}
+
+
+struct DeflateWriter
+{
+    std::vector<u8>& Out;
+    u32 BitBuf = 0;
+    int BitCount = 0;
+
+    DeflateWriter(std::vector<u8>& out) : Out(out) {}
+
+    void Bits(u32 val, int num)
+    {
+        BitBuf |= val << BitCount;
+        BitCount += num;
+        while (BitCount >= 8)
+        {
+            Out.push_back(BitBuf & 0xFF);
+            BitBuf >>= 8;
+            BitCount -= 8;
+        }
+    }
+
+    // Huffman codes are stored starting from their most significant bit
+    void Code(u32 code, int num)
+    {
+        u32 rev = 0;
+        for (int i = 0; i < num; i++)
+            rev |= ((code >> i) & 1) << (num - 1 - i);
+        Bits(rev, num);
+    }
+
+    void Flush()
+    {
+        if (BitCount > 0) Out.push_back(BitBuf & 0xFF);
+        BitBuf = 0;
+        BitCount = 0;
+    }
+};
+
+const u16 DeflateLenBase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+const u8 DeflateLenExtra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+const u16 DeflateDistBase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+const u8 DeflateDistExtra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+void Deflate_Symbol(DeflateWriter& w, u32 sym)
+{
+    // fixed Huffman codes
+    if      (sym < 144) w.Code(0x30 + sym, 8);
+    else if (sym < 256) w.Code(0x190 + (sym - 144), 9);
+    else if (sym < 280) w.Code(sym - 256, 7);
+    else                w.Code(0xC0 + (sym - 280), 8);
+}
+
+void Deflate_Match(DeflateWriter& w, u32 len, u32 dist)
+{
+    int lc = 28;
+    while (DeflateLenBase[lc] > len) lc--;
+    Deflate_Symbol(w, 257 + lc);
+    if (DeflateLenExtra[lc]) w.Bits(len - DeflateLenBase[lc], DeflateLenExtra[lc]);
+
+    int dc = 29;
+    while (DeflateDistBase[dc] > dist) dc--;
+    w.Code(dc, 5);
+    if (DeflateDistExtra[dc]) w.Bits(dist - DeflateDistBase[dc], DeflateDistExtra[dc]);
+}
+
+// zlib stream, a single block with fixed Huffman codes
+void Deflate(const u8* data, u32 len, std::vector<u8>& out)
+{
+    const u32 window = 32768;
+    const u32 hashbits = 15;
+    std::vector<s32> head(1 << hashbits, -1);
+
+    out.push_back(0x78);
+    out.push_back(0x01);
+
+    DeflateWriter w(out);
+    w.Bits(1, 1); // last block
+    w.Bits(1, 2); // fixed codes
+
+    u32 i = 0;
+    while (i < len)
+    {
+        u32 bestlen = 0, bestdist = 0;
+
+        if (i + 3 <= len)
+        {
+            u32 h = ((data[i] << 16) | (data[i+1] << 8) | data[i+2]) * 2654435761u >> (32 - hashbits);
+            s32 cand = head[h];
+            head[h] = i;
+
+            if (cand >= 0 && (i - cand) <= window)
+            {
+                u32 max = len - i;
+                if (max > 258) max = 258;
+
+                u32 l = 0;
+                while (l < max && data[cand + l] == data[i + l]) l++;
+                if (l >= 3)
+                {
+                    bestlen = l;
+                    bestdist = i - cand;
+                }
+            }
+        }
+
+        if (bestlen)
+        {
+            Deflate_Match(w, bestlen, bestdist);
+
+            // only index the end of the match, enough for runs and repeated rows
+            u32 end = i + bestlen;
+            for (u32 j = (end > i+4 ? end-3 : i+1); j < end && j + 3 <= len; j++)
+            {
+                u32 h = ((data[j] << 16) | (data[j+1] << 8) | data[j+2]) * 2654435761u >> (32 - hashbits);
+                head[h] = j;
+            }
+            i = end;
+        }
+        else
+        {
+            Deflate_Symbol(w, data[i]);
+            i++;
+        }
+    }
+
+    Deflate_Symbol(w, 256);
+    w.Flush();
+
+    u32 a = 1, b = 0;
+    for (u32 j = 0; j < len; j++)
+    {
+        a = (a + data[j]) % 65521;
+        b = (b + a) % 65521;
+    }
+    u8 adler[4];
+    Capture_PutU32(adler, (b << 16) | a, true);
+    out.insert(out.end(), adler, adler+4);
+}
+
+void PNG_Chunk(std::vector<u8>& out, const char* type, const u8* data, u32 len)
+{
+    u8 tmp[4];
+    Capture_PutU32(tmp, len, true);
+    out.insert(out.end(), tmp, tmp+4);
+
+    u32 start = out.size();
+    out.insert(out.end(), type, type+4);
+    if (len) out.insert(out.end(), data, data+len);
+
+    Capture_PutU32(tmp, CRC32(&out[start], len + 4), true);
+    out.insert(out.end(), tmp, tmp+4);
+}
+
+void Capture_EncodePNG(const u32* pixels, std::vector<u8>& out)
+{
+    // filter type 0 on every row, the flat areas compress fine as matches
+    std::vector<u8> raw(CaptureHeight * (1 + CaptureWidth*3));
+    u8* dst = &raw[0];
+    for (u32 y = 0; y < CaptureHeight; y++)
+    {
+        *dst++ = 0;
+        for (u32 x = 0; x < CaptureWidth; x++)
+        {
+            u32 col = *pixels++;
+            *dst++ = (col >> 16) & 0xFF;
+            *dst++ = (col >> 8) & 0xFF;
+            *dst++ = col & 0xFF;
+        }
+    }
+
+    std::vector<u8> idat;
+    Deflate(&raw[0], raw.size(), idat);
+
+    static const u8 sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.clear();
+    out.insert(out.end(), sig, sig+8);
+
+    u8 ihdr[13];
+    Capture_PutU32(&ihdr[0], CaptureWidth, true);
+    Capture_PutU32(&ihdr[4], CaptureHeight, true);
+    ihdr[8] = 8;  // bit depth
+    ihdr[9] = 2;  // RGB
+    ihdr[10] = 0; // compression, filter, interlace
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+
+    PNG_Chunk(out, "IHDR", ihdr, 13);
+    PNG_Chunk(out, "IDAT", &idat[0], idat.size());
+    PNG_Chunk(out, "IEND", nullptr, 0);
+}
+
+void Capture_EncodeY4M(const u32* pixels, std::vector<u8>& out)
+{
+    const char* tag = "FRAME\n";
+    out.resize(6 + CaptureFrameSize*3);
+    memcpy(&out[0], tag, 6);
+
+    u8* py = &out[6];
+    u8* pu = py + CaptureFrameSize;
+    u8* pv = pu + CaptureFrameSize;
+
+    // BT.601, limited range
+    for (u32 i = 0; i < CaptureFrameSize; i++)
+    {
+        u32 col = pixels[i];
+        s32 r = (col >> 16) & 0xFF;
+        s32 g = (col >> 8) & 0xFF;
+        s32 b = col & 0xFF;
+
+        py[i] = (( 66*r + 129*g +  25*b + 128) >> 8) + 16;
+        pu[i] = ((-38*r -  74*g + 112*b + 128) >> 8) + 128;
+        pv[i] = ((112*r -  94*g -  18*b + 128) >> 8) + 128;
+    }
+}
+
+void Capture_WriteFrame(const u8* data, u32 len)
+{
+    if (CaptureFormat == Capture_PNG)
+    {
+        char num[16];
+        sprintf(num, "_%06u.png", CaptureFrameCount);
+
+        FILE* f = Platform::OpenFile((CapturePath + num).c_str(), "wb");
+        if (f)
+        {
+            fwrite(data, len, 1, f);
+            fclose(f);
+        }
+    }
+    else
+        fwrite(data, len, 1, CaptureVideoFile);
+
+    CaptureFrameCount++;
+}
+
+void Capture_DrainAudio()
+{
+    u32 rdpos = CaptureAudioRead.load(std::memory_order_relaxed);
+    u32 wrpos = CaptureAudioWrite.load(std::memory_order_acquire);
+
+    while (rdpos != wrpos)
+    {
+        u32 offset = rdpos & (CaptureAudioRingSize-1);
+        u32 num = wrpos - rdpos;
+        if (num > CaptureAudioRingSize - offset) num = CaptureAudioRingSize - offset;
+
+        fwrite(&CaptureAudioRing[offset*2], num*4, 1, CaptureAudioFile);
+        CaptureAudioBytes += num*4;
+        rdpos += num;
+    }
+
+    CaptureAudioRead.store(rdpos, std::memory_order_release);
+}
+
+void CaptureThreadFunc()
+{
+    std::vector<u8> frame;
+
+    for (;;)
+    {
+        Platform::Semaphore_Wait(CaptureWorkSema);
+        bool quit = CaptureQuit.load(std::memory_order_acquire);
+
+        Capture_DrainAudio();
+
+        u32 rdpos = CaptureSlotRead.load(std::memory_order_relaxed);
+        while (rdpos != CaptureSlotWrite.load(std::memory_order_acquire))
+        {
+            CaptureSlot& slot = CaptureSlots[rdpos % CaptureNumSlots];
+
+            if (!CaptureLastFrame.empty())
+            {
+                for (u32 i = 0; i < slot.Repeat; i++)
+                    Capture_WriteFrame(&CaptureLastFrame[0], CaptureLastFrame.size());
+            }
+
+            if (CaptureFormat == Capture_PNG)
+                Capture_EncodePNG(slot.Pixels, frame);
+            else
+                Capture_EncodeY4M(slot.Pixels, frame);
+
+            // the slot can be reused as soon as it's encoded
+            rdpos++;
+            CaptureSlotRead.store(rdpos, std::memory_order_release);
+            Platform::Semaphore_Post(CaptureFreeSema);
+
+            Capture_WriteFrame(&frame[0], frame.size());
+            CaptureLastFrame.swap(frame);
+        }
+
+        Platform::Semaphore_Post(CaptureFreeSema);
+
+        if (quit)
+        {
+            // frames and samples dropped after the last ones that got through
+            if (!CaptureLastFrame.empty())
+            {
+                for (u32 i = 0; i < CaptureRepeatTail; i++)
+                    Capture_WriteFrame(&CaptureLastFrame[0], CaptureLastFrame.size());
+            }
+
+            s16 silence[256*2] = {0};
+            while (CaptureSilenceTail > 0)
+            {
+                u32 num = CaptureSilenceTail;
+                if (num > 256) num = 256;
+
+                fwrite(silence, num*4, 1, CaptureAudioFile);
+                CaptureAudioBytes += num*4;
+                CaptureSilenceTail -= num;
+            }
+            break;
+        }
+    }
+}
+
+
+bool Capture_Start(const char* path, int format, bool block)
+{
+    if (CaptureActive) Capture_Stop();
+
+    CapturePath = path;
+    CaptureFormat = format;
+    CaptureBlock = block;
+
+    CaptureAudioFile = Platform::OpenFile((CapturePath + ".wav").c_str(), "wb");
+    if (!CaptureAudioFile)
+        return false;
+
+    if (format == Capture_Y4M)
+    {
+        CaptureVideoFile = Platform::OpenFile((CapturePath + ".y4m").c_str(), "wb");
+        if (!CaptureVideoFile)
+        {
+            fclose(CaptureAudioFile);
+            CaptureAudioFile = nullptr;
+            return false;
+        }
+
+        fprintf(CaptureVideoFile, "YUV4MPEG2 W%u H%u F%s Ip A1:1 C444\n",
+                CaptureWidth, CaptureHeight, CaptureFrameRate);
+    }
+
+    CaptureFrameCount = 0;
+    CaptureAudioBytes = 0;
+    Capture_WriteWAVHeader();
+
+    CaptureSlots = new CaptureSlot[CaptureNumSlots];
+    CaptureSlotWrite = 0;
+    CaptureSlotRead = 0;
+    CaptureRepeatPending = 0;
+
+    CaptureAudioRing = new s16[CaptureAudioRingSize * 2];
+    CaptureAudioWrite = 0;
+    CaptureAudioRead = 0;
+    CaptureSilencePending = 0;
+
+    CaptureFramesDropped = 0;
+    CaptureSamplesDropped = 0;
+    CaptureLastFrame.clear();
+
+    CaptureWorkSema = Platform::Semaphore_Create();
+    CaptureFreeSema = Platform::Semaphore_Create();
+    CaptureQuit = false;
+    CaptureThread = Platform::Thread_Create(CaptureThreadFunc);
+
+    CaptureActive = true;
+    return true;
+}
+
+void Capture_Stop()
+{
+    if (!CaptureActive) return;
+    CaptureActive = false;
+
+    CaptureRepeatTail = CaptureRepeatPending;
+    CaptureSilenceTail = CaptureSilencePending;
+    CaptureQuit.store(true, std::memory_order_release);
+    Platform::Semaphore_Post(CaptureWorkSema);
+    Platform::Thread_Wait(CaptureThread);
+    Platform::Thread_Free(CaptureThread);
+    CaptureThread = nullptr;
+
+    Platform::Semaphore_Free(CaptureFreeSema);
+    Platform::Semaphore_Free(CaptureWorkSema);
+
+    Capture_WriteWAVHeader();
+    fclose(CaptureAudioFile);
+    CaptureAudioFile = nullptr;
+
+    if (CaptureVideoFile)
+    {
+        fclose(CaptureVideoFile);
+        CaptureVideoFile = nullptr;
+    }
+
+    delete[] CaptureSlots;
+    CaptureSlots = nullptr;
+    delete[] CaptureAudioRing;
+    CaptureAudioRing = nullptr;
+    CaptureLastFrame.clear();
+    CaptureLastFrame.shrink_to_fit();
+}
+
+bool Capture_IsActive()
+{
+    return CaptureActive;
+}
+
+void Capture_Audio()
+{
+    s16 data[2048*2];
+    u32 framesamples = SPU::GetFrameOutput(data, 2048);
+    u32 samples = framesamples;
+
+    // silence owed for earlier drops goes in first
+    u32 silence = CaptureSilencePending;
+
+    u32 wrpos = CaptureAudioWrite.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        u32 room = CaptureAudioRingSize - (wrpos - CaptureAudioRead.load(std::memory_order_acquire));
+        if ((silence + samples) <= room) break;
+
+        if (!CaptureBlock)
+        {
+            if (silence > room) silence = room;
+            u32 dropped = samples - (room - silence);
+            CaptureSamplesDropped += dropped;
+            samples -= dropped;
+            break;
+        }
+
+        Platform::Semaphore_Post(CaptureWorkSema);
+        Platform::Semaphore_Wait(CaptureFreeSema);
+    }
+
+    // whatever didn't fit is owed as silence
+    CaptureSilencePending = CaptureSilencePending - silence + (framesamples - samples);
+
+    for (u32 i = 0; i < silence; i++)
+    {
+        u32 pos = ((wrpos + i) & (CaptureAudioRingSize-1)) << 1;
+        CaptureAudioRing[pos    ] = 0;
+        CaptureAudioRing[pos + 1] = 0;
+    }
+    wrpos += silence;
+
+    for (u32 i = 0; i < samples; i++)
+    {
+        u32 pos = ((wrpos + i) & (CaptureAudioRingSize-1)) << 1;
+        CaptureAudioRing[pos    ] = data[i*2  ];
+        CaptureAudioRing[pos + 1] = data[i*2+1];
+    }
+    wrpos += samples;
+
+    CaptureAudioWrite.store(wrpos, std::memory_order_release);
+}
+
+void Capture_Frame()
+{
+    if (!CaptureActive) return;
+
+    Capture_Audio();
+
+    u32 wrpos = CaptureSlotWrite.load(std::memory_order_relaxed);
+    while ((wrpos - CaptureSlotRead.load(std::memory_order_acquire)) >= CaptureNumSlots)
+    {
+        if (!CaptureBlock)
+        {
+            CaptureFramesDropped++;
+            CaptureRepeatPending++;
+            return;
+        }
+
+        Platform::Semaphore_Wait(CaptureFreeSema);
+    }
+
+    CaptureSlot& slot = CaptureSlots[wrpos % CaptureNumSlots];
+
+    int frontbuf = GPU::FrontBuffer;
+    memcpy(&slot.Pixels[0], GPU::Framebuffer[frontbuf][0], 256*192*4);
+    memcpy(&slot.Pixels[256*192], GPU::Framebuffer[frontbuf][1], 256*192*4);
+    slot.Repeat = CaptureRepeatPending;
+    CaptureRepeatPending = 0;
+
+    CaptureSlotWrite.store(wrpos + 1, std::memory_order_release);
+    Platform::Semaphore_Post(CaptureWorkSema);
+}
+
+u32 Capture_FramesDropped()
+{
+    return CaptureFramesDropped;
+}
+
+u32 Capture_SamplesDropped()
+{
+    return CaptureSamplesDropped;
+}
+
+}
@@ -60,6 +60,8 @@ void Init_ROM()
 
 void DeInit_ROM()
 {
+    Rewind_Reset();
+
     if (CheatFile)
     {
         delete CheatFile;
@@ -277,6 +279,7 @@ int LoadBIOS()
     NDS::LoadBIOS();
 
     SavestateLoaded = false;
+    Rewind_Reset();
 
     LoadCheats();
 
@@ -339,6 +342,7 @@ int LoadROM(const char* file, int slot)
     if (slot == ROMSlot_NDS && NDS::LoadROM(ROMPath[slot], SRAMPath[slot], directboot))
     {
         SavestateLoaded = false;
+        Rewind_Reset();
 
         LoadCheats();
 
@@ -413,6 +417,7 @@ int Reset()
     }
 
     SavestateLoaded = false;
+    Rewind_Reset();
 
     NDS::SetConsoleType(Config::ConsoleType);
 
@@ -502,6 +507,8 @@ bool LoadState(const char* filename)
     NDS::DoSavestate(state);
     delete state;
 
+    Rewind_Reset();
+
     if (!failed)
     {
         if (Config::SavestateRelocSRAM && ROMPath[ROMSlot_NDS][0]!='\0')
@@ -581,6 +588,8 @@ void UndoStateLoad()
     NDS::DoSavestate(backup);
     delete backup;
 
+    Rewind_Reset();
+
     if (ROMPath[ROMSlot_NDS][0]!='\0')
     {
         strncpy(SRAMPath[ROMSlot_NDS], PrevSRAMPath[ROMSlot_NDS], 1024);
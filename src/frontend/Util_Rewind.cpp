@@ -0,0 +1,327 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+
+#include "FrontendUtil.h"
+#include "Config.h"
+#include "SharedConfig.h"
+
+#include "NDS.h"
+#include "Savestate.h"
+
+
+/*
+    Rewind buffer
+
+    every RewindInterval frames, a savestate is taken into memory. only the
+    newest state is kept in full; for each older one we keep a reverse delta,
+    which turns the state following it back into it.
+
+    a delta is the XOR of both states, stored as a list of runs:
+    00 - offset of the first word
+    04 - number of words
+    08 - XORed words
+
+    most of a savestate is RAM that barely changes from one capture to the
+    next, so identical 4K pages are skipped with a memcmp and runs only span
+    the words that actually differ. stepping back applies the deltas from the
+    newest one backwards and loads the resulting state.
+
+    the words of a delta are then packed: XORed words are often mostly zero
+    bytes (counters, flags, small values), and so are the run headers. each
+    word is stored as its nonzero bytes only, and a 4-bit mask saying which
+    bytes those are. the masks of two consecutive words share one byte, placed
+    before the bytes of both words.
+*/
+
+namespace Frontend
+{
+
+const u32 RewindPageSize = 4096;
+const u32 RewindMinBufferSize = 8*1024*1024;
+
+struct RewindDelta
+{
+    u32 Frame;
+    u32 NumWords;
+    std::vector<u8> Data;
+};
+
+std::deque<RewindDelta> RewindDeltas;
+std::vector<u32> RewindWords; // unpacked delta being built or applied
+
+u8* RewindState = nullptr;
+u8* RewindScratch = nullptr;
+u32 RewindBufferSize = 0;
+
+u32 RewindStateLen = 0;
+u32 RewindStateFrame = 0;
+u32 RewindFrame = 0;
+
+
+void Rewind_Reset()
+{
+    RewindDeltas.clear();
+    RewindWords.clear();
+    RewindWords.shrink_to_fit();
+
+    if (RewindState) delete[] RewindState;
+    if (RewindScratch) delete[] RewindScratch;
+    RewindState = nullptr;
+    RewindScratch = nullptr;
+    RewindBufferSize = 0;
+
+    RewindStateLen = 0;
+    RewindStateFrame = 0;
+    RewindFrame = 0;
+}
+
+void Rewind_GrowBuffers()
+{
+    u32 newsize = RewindBufferSize ? (RewindBufferSize << 1) : RewindMinBufferSize;
+
+    u8* newstate = new u8[newsize];
+    if (RewindState)
+    {
+        memcpy(newstate, RewindState, RewindStateLen);
+        delete[] RewindState;
+    }
+    if (RewindScratch) delete[] RewindScratch;
+
+    RewindState = newstate;
+    RewindScratch = new u8[newsize];
+    RewindBufferSize = newsize;
+}
+
+void Rewind_PackDelta(RewindDelta& delta)
+{
+    u32 numwords = RewindWords.size();
+    u32 size = (numwords + 1) >> 1;
+    for (u32 i = 0; i < numwords; i++)
+    {
+        u32 val = RewindWords[i];
+        size += !!(val & 0xFF) + !!(val & 0xFF00) + !!(val & 0xFF0000) + !!(val & 0xFF000000);
+    }
+
+    delta.NumWords = numwords;
+    delta.Data.resize(size);
+
+    u8* out = delta.Data.data();
+    u8* mask = nullptr;
+    for (u32 i = 0; i < numwords; i++)
+    {
+        if (!(i & 1))
+        {
+            mask = out++;
+            *mask = 0;
+        }
+
+        u32 val = RewindWords[i];
+        for (int b = 0; b < 4; b++)
+        {
+            u8 byte = val >> (b << 3);
+            if (!byte) continue;
+
+            *mask |= 1 << (((i & 1) << 2) + b);
+            *out++ = byte;
+        }
+    }
+}
+
+void Rewind_UnpackDelta(RewindDelta& delta)
+{
+    u32 numwords = delta.NumWords;
+    RewindWords.resize(numwords);
+
+    u8* in = delta.Data.data();
+    u8 mask = 0;
+    for (u32 i = 0; i < numwords; i++)
+    {
+        if (!(i & 1))
+            mask = *in++;
+        else
+            mask >>= 4;
+
+        u32 val = 0;
+        for (int b = 0; b < 4; b++)
+        {
+            if (mask & (1 << b))
+                val |= (u32)*in++ << (b << 3);
+        }
+        RewindWords[i] = val;
+    }
+}
+
+void Rewind_EncodeDelta(RewindDelta& delta, u32 len)
+{
+    u32* cur = (u32*)RewindScratch;
+    u32* old = (u32*)RewindState;
+    u32 numwords = (len + 3) >> 2;
+    const u32 pagewords = RewindPageSize >> 2;
+
+    RewindWords.clear();
+    for (u32 page = 0; page < numwords; page += pagewords)
+    {
+        u32 end = page + pagewords;
+        if (end > numwords) end = numwords;
+
+        if (!memcmp(&cur[page], &old[page], (end - page) << 2))
+            continue;
+
+        u32 i = page;
+        while (i < end)
+        {
+            if (cur[i] == old[i])
+            {
+                i++;
+                continue;
+            }
+
+            // extend the run over short stretches of unchanged words,
+            // a new run header costs two words
+            u32 start = i;
+            u32 last = i;
+            for (i++; i < end && i - last <= 2; i++)
+            {
+                if (cur[i] != old[i]) last = i;
+            }
+            i = last + 1;
+
+            RewindWords.push_back(start << 2);
+            RewindWords.push_back(i - start);
+            for (u32 j = start; j < i; j++)
+                RewindWords.push_back(cur[j] ^ old[j]);
+        }
+    }
+
+    Rewind_PackDelta(delta);
+}
+
+void Rewind_ApplyDelta(RewindDelta& delta)
+{
+    Rewind_UnpackDelta(delta);
+
+    u32* state = (u32*)RewindState;
+    u32* data = RewindWords.data();
+    u32* end = data + RewindWords.size();
+
+    while (data < end)
+    {
+        u32* dst = &state[data[0] >> 2];
+        u32 count = data[1];
+        data += 2;
+
+        for (u32 i = 0; i < count; i++)
+            dst[i] ^= data[i];
+        data += count;
+    }
+}
+
+void Rewind_Capture()
+{
+    for (;;)
+    {
+        if (RewindBufferSize)
+        {
+            Savestate* state = new Savestate(RewindScratch, RewindBufferSize, true);
+            NDS::DoSavestate(state);
+            bool error = state->Error;
+            delete state;
+
+            if (!error) break;
+        }
+
+        Rewind_GrowBuffers();
+    }
+
+    // total length, as patched in the header
+    u32 len = *(u32*)&RewindScratch[8];
+
+    if (RewindStateLen == len)
+    {
+        RewindDeltas.emplace_back();
+        RewindDelta& delta = RewindDeltas.back();
+        delta.Frame = RewindStateFrame;
+        Rewind_EncodeDelta(delta, len);
+    }
+    else
+    {
+        // the state layout changed (or there was no state yet)
+        // older deltas can't be applied to this one anymore
+        RewindDeltas.clear();
+    }
+
+    u8* tmp = RewindState;
+    RewindState = RewindScratch;
+    RewindScratch = tmp;
+
+    RewindStateLen = len;
+    RewindStateFrame = RewindFrame;
+
+    u32 interval = Config::RewindInterval > 0 ? Config::RewindInterval : 1;
+    u32 maxdeltas = (Config::RewindLength * 60) / interval;
+    while (RewindDeltas.size() > maxdeltas)
+        RewindDeltas.pop_front();
+}
+
+void Rewind_Frame()
+{
+    if (!Config::RewindEnable) return;
+
+    RewindFrame++;
+
+    u32 interval = Config::RewindInterval > 0 ? Config::RewindInterval : 1;
+    if (RewindStateLen == 0 || (RewindFrame - RewindStateFrame) >= interval)
+        Rewind_Capture();
+}
+
+bool Rewind_StepBack(u32 frames)
+{
+    if (RewindStateLen == 0) return false;
+
+    u32 target = (frames < RewindFrame) ? (RewindFrame - frames) : 0;
+
+    while (RewindStateFrame > target && !RewindDeltas.empty())
+    {
+        RewindDelta& delta = RewindDeltas.back();
+        Rewind_ApplyDelta(delta);
+        RewindStateFrame = delta.Frame;
+        RewindDeltas.pop_back();
+    }
+
+    Savestate* state = new Savestate(RewindState, RewindStateLen, false);
+    if (state->Error)
+    {
+        delete state;
+        Rewind_Reset();
+        return false;
+    }
+
+    NDS::DoSavestate(state);
+    delete state;
+
+    RewindFrame = RewindStateFrame;
+    return true;
+}
+
+}
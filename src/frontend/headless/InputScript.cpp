@@ -0,0 +1,249 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+#include "InputScript.h"
+#include "NDS.h"
+#include "FrontendUtil.h"
+
+
+const char* KeyNames[12] =
+{
+    "a", "b", "select", "start",
+    "right", "left", "up", "down",
+    "r", "l", "x", "y"
+};
+
+
+InputScript::InputScript(const char* filename)
+{
+    CurEvent = 0;
+    KeyMask = 0xFFF;
+
+    Error = !Load(filename);
+}
+
+InputScript::~InputScript()
+{
+    Events.clear();
+}
+
+bool InputScript::ParseKeys(char* args, u32* keys)
+{
+    *keys = 0;
+
+    char* tok = strtok(args, " \t\r\n");
+    while (tok)
+    {
+        int i;
+        for (i = 0; i < 12; i++)
+        {
+            if (!strcasecmp(tok, KeyNames[i]))
+                break;
+        }
+
+        if (i == 12)
+        {
+            printf("input script: unknown key '%s'\n", tok);
+            return false;
+        }
+
+        *keys |= (1 << i);
+        tok = strtok(NULL, " \t\r\n");
+    }
+
+    return *keys != 0;
+}
+
+bool InputScript::Load(const char* filename)
+{
+    FILE* f = fopen(filename, "r");
+    if (!f)
+    {
+        printf("input script: could not open %s\n", filename);
+        return false;
+    }
+
+    int lineno = 0;
+    char linebuf[1024];
+    while (fgets(linebuf, 1024, f))
+    {
+        linebuf[1023] = '\0';
+        lineno++;
+
+        char* start = linebuf;
+        while (start[0]==' ' || start[0]=='\t')
+            start++;
+
+        if (start[0]=='#' || start[0]=='\r' || start[0]=='\n' || start[0]=='\0')
+            continue;
+
+        u32 frame;
+        char action[16];
+        int pos = 0;
+        if (sscanf(start, "%u %15s %n", &frame, action, &pos) < 2)
+        {
+            printf("input script: malformed line %d: %s", lineno, start);
+            fclose(f);
+            return false;
+        }
+
+        char* args = &start[pos];
+
+        Event evt;
+        evt.Frame = frame;
+        evt.Keys = 0;
+        evt.TouchX = 0;
+        evt.TouchY = 0;
+        evt.Frames = 0;
+
+        bool ok = true;
+        if (!strcasecmp(action, "press") || !strcasecmp(action, "release"))
+        {
+            evt.Type = strcasecmp(action, "press") ? Evt_Release : Evt_Press;
+            ok = ParseKeys(args, &evt.Keys);
+            if (ok) Events.push_back(evt);
+        }
+        else if (!strcasecmp(action, "tap"))
+        {
+            char key[16];
+            u32 len = 1;
+            int ret = sscanf(args, "%15s %u", key, &len);
+            if (ret < 1 || len == 0)
+                ok = false;
+            else
+                ok = ParseKeys(key, &evt.Keys);
+
+            if (ok)
+            {
+                evt.Type = Evt_Press;
+                Events.push_back(evt);
+                evt.Type = Evt_Release;
+                evt.Frame = frame + len;
+                Events.push_back(evt);
+            }
+        }
+        else if (!strcasecmp(action, "touch"))
+        {
+            int x, y;
+            if (sscanf(args, "%d %d", &x, &y) < 2 || x < 0 || x > 255 || y < 0 || y > 191)
+                ok = false;
+            else
+            {
+                evt.Type = Evt_Touch;
+                evt.TouchX = x;
+                evt.TouchY = y;
+                Events.push_back(evt);
+            }
+        }
+        else if (!strcasecmp(action, "untouch"))
+        {
+            evt.Type = Evt_Untouch;
+            Events.push_back(evt);
+        }
+        else if (!strcasecmp(action, "lid"))
+        {
+            if (!strncasecmp(args, "open", 4))
+                evt.Type = Evt_LidOpen;
+            else if (!strncasecmp(args, "close", 5))
+                evt.Type = Evt_LidClose;
+            else
+                ok = false;
+
+            if (ok) Events.push_back(evt);
+        }
+        else if (!strcasecmp(action, "rewind"))
+        {
+            if (sscanf(args, "%u", &evt.Frames) < 1 || evt.Frames == 0)
+                ok = false;
+            else
+            {
+                evt.Type = Evt_Rewind;
+                Events.push_back(evt);
+            }
+        }
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            printf("input script: bad event on line %d: %s", lineno, start);
+            fclose(f);
+            return false;
+        }
+    }
+
+    fclose(f);
+
+    // events on the same frame are applied in file order
+    std::stable_sort(Events.begin(), Events.end(),
+                     [](const Event& a, const Event& b) { return a.Frame < b.Frame; });
+
+    return true;
+}
+
+void InputScript::Apply(u32 frame)
+{
+    bool keychange = false;
+
+    while (CurEvent < Events.size() && Events[CurEvent].Frame <= frame)
+    {
+        Event& evt = Events[CurEvent++];
+
+        switch (evt.Type)
+        {
+        case Evt_Press:
+            KeyMask &= ~evt.Keys;
+            keychange = true;
+            break;
+
+        case Evt_Release:
+            KeyMask |= evt.Keys;
+            keychange = true;
+            break;
+
+        case Evt_Touch:
+            NDS::TouchScreen(evt.TouchX, evt.TouchY);
+            break;
+
+        case Evt_Untouch:
+            NDS::ReleaseScreen();
+            break;
+
+        case Evt_LidOpen:
+            NDS::SetLidClosed(false);
+            break;
+
+        case Evt_LidClose:
+            NDS::SetLidClosed(true);
+            break;
+
+        case Evt_Rewind:
+            if (!Frontend::Rewind_StepBack(evt.Frames))
+                printf("input script: nothing to rewind on frame %u\n", frame);
+            break;
+        }
+    }
+
+    if (keychange)
+        NDS::SetKeyMask(KeyMask);
+}
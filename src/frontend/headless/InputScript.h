@@ -0,0 +1,86 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef INPUTSCRIPT_H
+#define INPUTSCRIPT_H
+
+#include <vector>
+
+#include "types.h"
+
+// scripted input for unattended runs
+//
+// one event per line: <frame> <action> [args...]
+// lines starting with '#' are comments
+//
+// actions:
+// * press <key> [<key>...]:   hold the given keys down
+// * release <key> [<key>...]: release the given keys
+// * tap <key> [frames]:       hold a key for the given number of frames (default 1)
+// * touch <x> <y>:            touch the bottom screen at the given coordinates
+// * untouch:                  release the touchscreen
+// * lid <open|close>:         open or close the lid
+// * rewind <frames>:          step back through the rewind buffer (needs --rewind)
+//
+// keys: a b select start right left up down r l x y
+
+class InputScript
+{
+public:
+    InputScript(const char* filename);
+    ~InputScript();
+
+    bool Error;
+
+    // apply all the events scheduled for the given frame
+    void Apply(u32 frame);
+
+    u32 GetNumEvents() { return Events.size(); }
+
+private:
+    enum
+    {
+        Evt_Press = 0,
+        Evt_Release,
+        Evt_Touch,
+        Evt_Untouch,
+        Evt_LidOpen,
+        Evt_LidClose,
+        Evt_Rewind,
+    };
+
+    typedef struct
+    {
+        u32 Frame;
+        int Type;
+        u32 Keys;
+        u16 TouchX, TouchY;
+        u32 Frames;
+
+    } Event;
+
+    std::vector<Event> Events;
+    u32 CurEvent;
+
+    u32 KeyMask;
+
+    bool Load(const char* filename);
+    bool ParseKeys(char* args, u32* keys);
+};
+
+#endif // INPUTSCRIPT_H
@@ -0,0 +1,284 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "Platform.h"
+#include "PlatformConfig.h"
+#include "LocalMP.h"
+
+// headless platform backend
+// files are opened relative to the data directory (current directory by default),
+// there is no display, no OpenGL context and no network: LAN simply behaves
+// as if nobody else was there, and so does local multiplayer unless it was
+// enabled with --local-mp, in which case instances on this computer can talk
+// through shared memory
+
+
+char* EmuDirectory;
+
+extern const char* DataDirectory;
+extern bool LocalMultiplayer;
+void emuStop();
+
+
+namespace Platform
+{
+
+struct SemaphoreImpl
+{
+    std::mutex Lock;
+    std::condition_variable Cond;
+    int Count;
+};
+
+
+void Init(int argc, char** argv)
+{
+    const char* dir = ".";
+    if (DataDirectory && DataDirectory[0] != '\0')
+        dir = DataDirectory;
+
+    int len = strlen(dir);
+    EmuDirectory = new char[len+1];
+    strncpy(EmuDirectory, dir, len);
+    EmuDirectory[len] = '\0';
+}
+
+void DeInit()
+{
+    delete[] EmuDirectory;
+}
+
+
+void StopEmu()
+{
+    emuStop();
+}
+
+
+FILE* OpenFile(const char* path, const char* mode, bool mustexist)
+{
+    if (!path || path[0] == '\0')
+        return nullptr;
+
+    if (mustexist)
+    {
+        FILE* f = fopen(path, "rb");
+        if (!f) return nullptr;
+        fclose(f);
+    }
+
+    return fopen(path, mode);
+}
+
+FILE* OpenLocalFile(const char* path, const char* mode)
+{
+    if (!path || path[0] == '\0')
+        return nullptr;
+
+    bool absolute = (path[0] == '/');
+#ifdef __WIN32__
+    if (path[0] == '\\' || (path[0] != '\0' && path[1] == ':'))
+        absolute = true;
+#endif
+
+    if (absolute)
+        return OpenFile(path, mode, mode[0] != 'w');
+
+    int len = strlen(EmuDirectory) + 1 + strlen(path) + 1;
+    char* fullpath = new char[len];
+    snprintf(fullpath, len, "%s/%s", EmuDirectory, path);
+
+    FILE* f = OpenFile(fullpath, mode, mode[0] != 'w');
+    delete[] fullpath;
+    return f;
+}
+
+FILE* OpenDataFile(const char* path)
+{
+    return OpenLocalFile(path, "rb");
+}
+
+
+Thread* Thread_Create(void (*func)())
+{
+    return (Thread*)new std::thread(func);
+}
+
+void Thread_Free(Thread* thread)
+{
+    std::thread* t = (std::thread*)thread;
+    if (t->joinable()) t->detach();
+    delete t;
+}
+
+void Thread_Wait(Thread* thread)
+{
+    std::thread* t = (std::thread*)thread;
+    if (t->joinable()) t->join();
+}
+
+
+Semaphore* Semaphore_Create()
+{
+    SemaphoreImpl* s = new SemaphoreImpl();
+    s->Count = 0;
+    return (Semaphore*)s;
+}
+
+void Semaphore_Free(Semaphore* sema)
+{
+    delete (SemaphoreImpl*)sema;
+}
+
+void Semaphore_Reset(Semaphore* sema)
+{
+    SemaphoreImpl* s = (SemaphoreImpl*)sema;
+
+    std::lock_guard<std::mutex> lock(s->Lock);
+    s->Count = 0;
+}
+
+void Semaphore_Wait(Semaphore* sema)
+{
+    SemaphoreImpl* s = (SemaphoreImpl*)sema;
+
+    std::unique_lock<std::mutex> lock(s->Lock);
+    while (s->Count == 0)
+        s->Cond.wait(lock);
+    s->Count--;
+}
+
+bool Semaphore_TryWait(Semaphore* sema, int timeout)
+{
+    SemaphoreImpl* s = (SemaphoreImpl*)sema;
+
+    std::unique_lock<std::mutex> lock(s->Lock);
+    if (!s->Cond.wait_for(lock, std::chrono::milliseconds(timeout), [s] { return s->Count > 0; }))
+        return false;
+    s->Count--;
+    return true;
+}
+
+void Semaphore_Post(Semaphore* sema)
+{
+    SemaphoreImpl* s = (SemaphoreImpl*)sema;
+
+    {
+        std::lock_guard<std::mutex> lock(s->Lock);
+        s->Count++;
+    }
+    s->Cond.notify_one();
+}
+
+
+Mutex* Mutex_Create()
+{
+    return (Mutex*)new std::mutex();
+}
+
+void Mutex_Free(Mutex* mutex)
+{
+    delete (std::mutex*)mutex;
+}
+
+void Mutex_Lock(Mutex* mutex)
+{
+    ((std::mutex*)mutex)->lock();
+}
+
+void Mutex_Unlock(Mutex* mutex)
+{
+    ((std::mutex*)mutex)->unlock();
+}
+
+bool Mutex_TryLock(Mutex* mutex)
+{
+    return ((std::mutex*)mutex)->try_lock();
+}
+
+
+void* GL_GetProcAddress(const char* proc)
+{
+    // no OpenGL context, the software renderer is always used
+    return nullptr;
+}
+
+
+INSTANCE_LOCAL bool MPActive = false;
+
+bool MP_Init()
+{
+    if (LocalMultiplayer)
+        MPActive = LocalMP::Init();
+
+    return true;
+}
+
+void MP_DeInit()
+{
+    if (MPActive)
+        LocalMP::DeInit();
+
+    MPActive = false;
+}
+
+int MP_SendPacket(u8* data, int len, u64 timestamp)
+{
+    if (MPActive)
+        return LocalMP::SendPacket(data, len, timestamp);
+
+    return len;
+}
+
+int MP_RecvPacket(u8* data, bool block, u64 timestamp)
+{
+    if (MPActive)
+        return LocalMP::RecvPacket(data, block, timestamp);
+
+    return 0;
+}
+
+
+bool LAN_Init()
+{
+    return true;
+}
+
+void LAN_DeInit()
+{
+}
+
+int LAN_SendPacket(u8* data, int len)
+{
+    return len;
+}
+
+int LAN_RecvPacket(u8* data)
+{
+    return 0;
+}
+
+}
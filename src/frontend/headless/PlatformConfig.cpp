@@ -0,0 +1,61 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "PlatformConfig.h"
+
+// the headless runner reads the same melonDS.ini as the Qt frontend
+// and only cares about the few settings that affect emulation
+
+namespace Config
+{
+
+int Threaded2D;
+int Threaded3D;
+int Threaded3DWorkers;
+
+int ConsoleType;
+int DirectBoot;
+
+int SavestateRelocSRAM;
+
+int RewindEnable;
+int RewindInterval;
+int RewindLength;
+
+ConfigEntry PlatformConfigFile[] =
+{
+    {"Threaded2D", 0, &Threaded2D, 0, NULL, 0},
+    {"Threaded3D", 0, &Threaded3D, 1, NULL, 0},
+    {"Threaded3DWorkers", 0, &Threaded3DWorkers, 0, NULL, 0},
+
+    {"ConsoleType", 0, &ConsoleType, 0, NULL, 0},
+    {"DirectBoot", 0, &DirectBoot, 1, NULL, 0},
+
+    {"SavStaRelocSRAM", 0, &SavestateRelocSRAM, 0, NULL, 0},
+
+    {"RewindEnable", 0, &RewindEnable, 0, NULL, 0},
+    {"RewindInterval", 0, &RewindInterval, 6, NULL, 0},
+    {"RewindLength", 0, &RewindLength, 30, NULL, 0},
+
+    {"", -1, NULL, 0, NULL, 0}
+};
+
+}
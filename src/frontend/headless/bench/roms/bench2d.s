@@ -0,0 +1,227 @@
+@ melonDS benchmark ROM: 2D
+@
+@ both 2D engines show four scrolling text BGs (three 4bpp, one 8bpp) and
+@ 128 32x32 sprites. the maps mostly repeat a few blank/solid tiles, like
+@ game maps do, with random tiles in between.
+@
+@ input: the D-pad changes the scroll direction, holding A makes every other
+@ sprite semi-transparent.
+@
+@ ARM9 code, position-independent. build with mkrom.py.
+@ there's no linker step, so subroutines are called with mov lr, pc / b
+@ rather than bl, which the assembler leaves as a relocation.
+
+    .arm
+    .syntax unified
+    .text
+
+start:
+    @ power: LCDs, both 2D engines, engine A on top
+    ldr r1, =0x8203
+    ldr r2, =0x04000304
+    str r1, [r2]
+
+    @ VRAM: A = engine A BG, B = engine A OBJ, C = engine B BG, D = engine B OBJ
+    ldr r1, =0x84848281
+    ldr r2, =0x04000240
+    str r1, [r2]
+
+    @ LCG for the random contents
+    ldr r9, =1664525
+    ldr r10, =1013904223
+    mov r8, #1
+
+    mov r0, #0x04000000
+    mov r1, #0x06000000
+    ldr r2, =0x06400000
+    mov r3, #0x05000000
+    mov lr, pc
+    b setup_engine
+
+    ldr r0, =0x04001000
+    ldr r1, =0x06200000
+    ldr r2, =0x06600000
+    ldr r3, =0x05000400
+    mov lr, pc
+    b setup_engine
+
+    mov r9, #0                  @ X scroll
+    mov r10, #0                 @ Y scroll
+    mov r12, #0                 @ frame counter
+
+frame:
+    @ wait for the start of VBlank
+    ldr r2, =0x04000006
+1:  ldrh r3, [r2]
+    cmp r3, #192
+    beq 1b
+2:  ldrh r3, [r2]
+    cmp r3, #192
+    bne 2b
+
+    @ keys are active low
+    ldr r2, =0x04000130
+    ldrh r7, [r2]
+
+    mov r3, #1
+    mov r4, #1
+    tst r7, #0x10               @ right
+    moveq r3, #3
+    tst r7, #0x20               @ left
+    mvneq r3, #1
+    tst r7, #0x80               @ down
+    moveq r4, #3
+    tst r7, #0x40               @ up
+    mvneq r4, #1
+    add r9, r9, r3
+    add r10, r10, r4
+
+    mov r0, #0x04000000
+    mov r1, #0x07000000
+    mov lr, pc
+    b update_engine
+
+    ldr r0, =0x04001000
+    ldr r1, =0x07000400
+    mov lr, pc
+    b update_engine
+
+    add r12, r12, #1
+    b frame
+
+
+@ r0 = I/O base, r1 = BG VRAM, r2 = OBJ VRAM, r3 = palettes
+@ r8-r10 = LCG state
+setup_engine:
+    @ mode 0, BG0-3 and OBJ on, 1D OBJ mapping
+    ldr r4, =0x00011F10
+    str r4, [r0]
+
+    @ BG0: 4bpp, char base 1, map 0
+    @ BG1: 4bpp, char base 1, map 1
+    @ BG2: 8bpp, char base 2, map 2
+    @ BG3: 4bpp, char base 1, map 3
+    ldr r4, =0x01050004
+    str r4, [r0, #0x08]
+    ldr r4, =0x0307028A
+    str r4, [r0, #0x0C]
+
+    @ semi-transparent sprites are blended with the BGs
+    ldr r4, =0x08080F50
+    str r4, [r0, #0x50]
+
+    @ BG and OBJ palettes
+    mov r5, #512
+1:  mul r11, r8, r9
+    add r8, r11, r10
+    mov r4, r8, lsr #17
+    strh r4, [r3], #2
+    subs r5, r5, #1
+    bne 1b
+
+    @ 4bpp tiles: tile 0 is blank, 1-3 are solid, the rest are random
+    add r6, r1, #0x4000
+    ldr r7, =0x11111111
+    mov r5, #0
+1:  mul r11, r8, r9
+    add r8, r11, r10
+    mov r4, r5, lsr #3
+    cmp r4, #4
+    mullt r11, r4, r7
+    movge r11, r8
+    str r11, [r6], #4
+    add r5, r5, #1
+    cmp r5, #0x800
+    blt 1b
+
+    @ 8bpp tiles
+    add r6, r1, #0x8000
+    mov r5, #0x1000
+1:  mul r11, r8, r9
+    add r8, r11, r10
+    str r8, [r6], #4
+    subs r5, r5, #1
+    bne 1b
+
+    @ maps: mostly tiles 0-3, with random flips and palettes
+    mov r6, r1
+    mov r5, #0x1000
+1:  mul r11, r8, r9
+    add r8, r11, r10
+    mov r4, r8, lsr #24
+    cmp r4, #160
+    andlt r4, r4, #3
+    movge r4, r8, lsr #16
+    andge r4, r4, #0xFF
+    and r11, r8, #0xC00
+    orr r4, r4, r11
+    and r11, r8, #0xF000
+    orr r4, r4, r11
+    strh r4, [r6], #2
+    subs r5, r5, #1
+    bne 1b
+
+    @ OBJ tiles: 8 32x32 4bpp sprites
+    mov r5, #0x400
+1:  mul r11, r8, r9
+    add r8, r11, r10
+    str r8, [r2], #4
+    subs r5, r5, #1
+    bne 1b
+
+    bx lr
+
+
+@ r0 = I/O base, r1 = OAM
+@ r7 = keys, r9/r10 = scroll, r12 = frame counter
+update_engine:
+    @ BGn scrolls at n+1 times the base speed
+    add r6, r0, #0x10
+    mov r3, r9
+    mov r4, r10
+    mov r5, #4
+1:  mov r2, r3, lsl #23
+    mov r2, r2, lsr #23
+    mov r11, r4, lsl #23
+    orr r2, r2, r11, lsr #7
+    str r2, [r6], #4
+    add r3, r3, r9
+    add r4, r4, r10
+    subs r5, r5, #1
+    bne 1b
+
+    @ sprites move diagonally, wrapping around
+    mov r2, #0
+1:  mov r11, #13
+    mul r3, r2, r11
+    add r3, r3, r12, lsr #1
+    and r3, r3, #0xFF           @ attr0: Y
+    tst r7, #0x01
+    bne 2f
+    tst r2, #1
+    orrne r3, r3, #0x400        @ semi-transparent
+
+2:  mov r11, #29
+    mul r4, r2, r11
+    add r4, r4, r12
+    mov r4, r4, lsl #23
+    mov r4, r4, lsr #23
+    orr r4, r4, #0x8000         @ attr1: X, 32x32
+    orr r3, r3, r4, lsl #16
+    str r3, [r1], #4
+
+    and r3, r2, #7
+    mov r3, r3, lsl #4          @ attr2: tile, priority, palette
+    and r4, r2, #3
+    orr r3, r3, r4, lsl #10
+    and r4, r2, #15
+    orr r3, r3, r4, lsl #12
+    strh r3, [r1], #4
+
+    add r2, r2, #1
+    cmp r2, #128
+    blt 1b
+
+    bx lr
+
+    .pool
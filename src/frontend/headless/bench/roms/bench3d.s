@@ -0,0 +1,266 @@
+@ melonDS benchmark ROM: 3D
+@
+@ draws a perspective-projected floor made of 256 textured quads, with 64
+@ translucent quads standing on it, every frame. antialiasing and edge marking
+@ are enabled. the scene slowly scrolls sideways so the rasterizer doesn't
+@ see the exact same input every frame.
+@
+@ ARM9 code, position-independent. build with mkrom.py.
+
+    .arm
+    .syntax unified
+    .text
+
+    .equ GXBASE,        0x04000400
+    .equ MTX_MODE,      0x040
+    .equ MTX_IDENTITY,  0x054
+    .equ MTX_LOAD_4x4,  0x058
+    .equ MTX_TRANS,     0x070
+    .equ COLOR,         0x080
+    .equ TEXCOORD,      0x088
+    .equ VTX_16,        0x08C
+    .equ POLYGON_ATTR,  0x0A4
+    .equ TEXIMAGE_PARAM,0x0A8
+    .equ BEGIN_VTXS,    0x100
+    .equ END_VTXS,      0x104
+    .equ SWAP_BUFFERS,  0x140
+    .equ VIEWPORT,      0x180
+
+start:
+    mov r0, #0x04000000
+
+    @ power: LCDs, both 2D engines, 3D rendering and geometry, engine A on top
+    ldr r1, =0x820F
+    ldr r2, =0x04000304
+    str r1, [r2]
+
+    @ engine A: mode 0, BG0 shows the 3D layer
+    ldr r1, =0x00010108
+    str r1, [r0]
+
+    @ upload a 64x64 direct color texture through the LCDC mapping of bank A
+    ldr r2, =0x04000240
+    mov r1, #0x80
+    strb r1, [r2]
+
+    ldr r3, =0x06800000
+    mov r4, #0                  @ y
+1:  mov r5, #0                  @ x
+2:  eor r6, r4, r5
+    and r6, r6, #0x1F
+    and r7, r5, #0x1F
+    orr r6, r6, r7, lsl #5
+    and r7, r4, #0x1F
+    orr r6, r6, r7, lsl #10
+    orr r6, r6, #0x8000
+    strh r6, [r3], #2
+    add r5, r5, #1
+    cmp r5, #64
+    blt 2b
+    add r4, r4, #1
+    cmp r4, #64
+    blt 1b
+
+    @ bank A as texture slot 0
+    mov r1, #0x83
+    strb r1, [r2]
+
+    @ DISP3DCNT: texturing, alpha blending, antialiasing, edge marking
+    mov r1, #0x39
+    strh r1, [r0, #0x60]
+
+    @ clear color (opaque grey) and depth
+    ldr r1, =0x001F4210
+    ldr r2, =0x04000350
+    str r1, [r2]
+    ldr r1, =0x7FFF
+    strh r1, [r2, #4]
+
+    ldr r0, =GXBASE
+
+    ldr r1, =0xBFFF0000
+    str r1, [r0, #VIEWPORT]
+
+    @ projection: 70 degree vertical FOV, 4:3, near 0.1, far 40
+    mov r1, #0
+    str r1, [r0, #MTX_MODE]
+    adr r2, projection
+    mov r3, #16
+1:  ldr r1, [r2], #4
+    str r1, [r0, #MTX_LOAD_4x4]
+    subs r3, r3, #1
+    bne 1b
+
+    @ texture matrix
+    mov r1, #3
+    str r1, [r0, #MTX_MODE]
+    str r1, [r0, #MTX_IDENTITY]
+
+    mov r11, #0                 @ frame counter
+
+frame:
+    @ wait for the start of VBlank
+    ldr r2, =0x04000006
+1:  ldrh r3, [r2]
+    cmp r3, #192
+    beq 1b
+2:  ldrh r3, [r2]
+    cmp r3, #192
+    bne 2b
+
+    mov r1, #2
+    str r1, [r0, #MTX_MODE]
+    str r1, [r0, #MTX_IDENTITY]
+
+    @ scroll back and forth by one unit over 256 frames
+    and r1, r11, #0xFF
+    cmp r1, #0x80
+    rsbge r1, r1, #0x100
+    sub r1, r1, #0x40
+    mov r1, r1, lsl #5
+    str r1, [r0, #MTX_TRANS]
+    mov r1, #0
+    str r1, [r0, #MTX_TRANS]
+    str r1, [r0, #MTX_TRANS]
+
+    @ floor: 16x16 opaque textured quads, x in [-4,4], z in [-1,-8], y = -1
+    @ 64x64 texture, repeat in S and T, direct color
+    ldr r1, =0x1DB30000
+    str r1, [r0, #TEXIMAGE_PARAM]
+    ldr r1, =0x001F00C0
+    str r1, [r0, #POLYGON_ATTR]
+    mov r1, #1
+    str r1, [r0, #BEGIN_VTXS]
+
+    ldr r9, =0xF0000000         @ y = -1.0, in the upper halfword
+    ldr r10, =0x04000000        @ texcoord (0, 64)
+    mov r4, #0                  @ row
+1:  mov r5, #0                  @ column
+2:  @ color: gradient across the grid
+    mov r1, r5, lsl #1
+    orr r1, r1, r4, lsl #6
+    orr r1, r1, #0x7C00
+    str r1, [r0, #COLOR]
+
+    @ x0 = -4.0 + col*0.5, z0 = -1.0 - row*0.4375
+    ldr r6, =-0x4000
+    add r6, r6, r5, lsl #11
+    add r7, r6, #0x800
+    ldr r8, =-0x1000
+    mov r12, #0x700
+    mul r3, r4, r12
+    sub r8, r8, r3
+    sub r3, r8, #0x700
+    @ coordinates are 16-bit
+    mov r6, r6, lsl #16
+    mov r6, r6, lsr #16
+    mov r7, r7, lsl #16
+    mov r7, r7, lsr #16
+    mov r8, r8, lsl #16
+    mov r8, r8, lsr #16
+    mov r3, r3, lsl #16
+    mov r3, r3, lsr #16
+
+    mov r1, #0
+    str r1, [r0, #TEXCOORD]
+    orr r1, r6, r9
+    str r1, [r0, #VTX_16]
+    str r8, [r0, #VTX_16]
+
+    mov r1, #0x400
+    str r1, [r0, #TEXCOORD]
+    orr r1, r7, r9
+    str r1, [r0, #VTX_16]
+    str r8, [r0, #VTX_16]
+
+    orr r1, r10, #0x400
+    str r1, [r0, #TEXCOORD]
+    orr r1, r7, r9
+    str r1, [r0, #VTX_16]
+    str r3, [r0, #VTX_16]
+
+    str r10, [r0, #TEXCOORD]
+    orr r1, r6, r9
+    str r1, [r0, #VTX_16]
+    str r3, [r0, #VTX_16]
+
+    add r5, r5, #1
+    cmp r5, #16
+    blt 2b
+    add r4, r4, #1
+    cmp r4, #16
+    blt 1b
+
+    mov r1, #0
+    str r1, [r0, #END_VTXS]
+
+    @ 8x8 translucent untextured quads standing on the floor, 1 unit tall
+    mov r1, #0
+    str r1, [r0, #TEXIMAGE_PARAM]
+    ldr r1, =0x011000C0
+    str r1, [r0, #POLYGON_ATTR]
+    mov r1, #1
+    str r1, [r0, #BEGIN_VTXS]
+
+    mov r4, #0                  @ row
+1:  mov r5, #0                  @ column
+2:  @ x0 = -3.5 + col, z = -1.5 - row*0.5
+    ldr r6, =-0x3800
+    add r6, r6, r5, lsl #12
+    add r7, r6, #0x800
+    mov r6, r6, lsl #16
+    mov r6, r6, lsr #16
+    mov r7, r7, lsl #16
+    mov r7, r7, lsr #16
+    ldr r8, =-0x1800
+    sub r8, r8, r4, lsl #11
+    mov r8, r8, lsl #16
+    mov r8, r8, lsr #16
+
+    @ a different color at each corner
+    mov r1, #0x1F
+    str r1, [r0, #COLOR]
+    orr r1, r6, r9
+    str r1, [r0, #VTX_16]
+    str r8, [r0, #VTX_16]
+
+    mov r1, #0x3E0
+    str r1, [r0, #COLOR]
+    orr r1, r7, r9
+    str r1, [r0, #VTX_16]
+    str r8, [r0, #VTX_16]
+
+    mov r1, #0x7C00
+    str r1, [r0, #COLOR]
+    str r7, [r0, #VTX_16]       @ y = 0
+    str r8, [r0, #VTX_16]
+
+    ldr r1, =0x7FFF
+    str r1, [r0, #COLOR]
+    str r6, [r0, #VTX_16]
+    str r8, [r0, #VTX_16]
+
+    add r5, r5, #1
+    cmp r5, #8
+    blt 2b
+    add r4, r4, #1
+    cmp r4, #8
+    blt 1b
+
+    mov r1, #0
+    str r1, [r0, #END_VTXS]
+
+    @ auto-sort translucent polygons, Z-buffering
+    str r1, [r0, #SWAP_BUFFERS]
+
+    add r11, r11, #1
+    b frame
+
+    .pool
+
+projection:
+    @ rows of the projection matrix, 20.12 fixed point
+    .word 0x1123, 0, 0, 0
+    .word 0, 0x16DA, 0, 0
+    .word 0, 0, -0x1015, -0x1000
+    .word 0, 0, -0x335, 0
@@ -0,0 +1,133 @@
+@ melonDS benchmark ROM: sound
+@
+@ plays all 16 channels at once: PCM16, PCM8 and ADPCM samples looping from
+@ main RAM, six PSG channels and two noise channels. channel 0 plays a buffer
+@ that the CPU rewrites every frame, while it's playing, like streamed music.
+@ the sample channels are restarted every 64 frames.
+@
+@ ARM7 code, position-independent. build with mkrom.py.
+
+    .arm
+    .syntax unified
+    .text
+
+    .equ BUF_PCM16,     0x023A0000
+    .equ BUF_PCM8,      0x023A1000
+    .equ BUF_ADPCM,     0x023A2000
+    .equ BUF_STREAM,    0x023A3000
+
+start:
+    @ speaker on, master enable, full volume
+    ldr r2, =0x04000304
+    mov r1, #1
+    str r1, [r2]
+    ldr r2, =0x04000500
+    ldr r1, =0x807F
+    str r1, [r2]
+
+    @ PCM16: triangle wave, 2048 samples
+    ldr r2, =BUF_PCM16
+    mov r3, #0
+1:  cmp r3, #1024
+    movlt r1, r3
+    rsbge r1, r3, #2048
+    subge r1, r1, #1
+    mov r1, r1, lsl #6
+    sub r1, r1, #0x8000
+    strh r1, [r2], #2
+    add r3, r3, #1
+    cmp r3, #2048
+    blt 1b
+
+    @ PCM8 and ADPCM: random data
+    ldr r9, =1664525
+    ldr r10, =1013904223
+    mov r8, #1
+    ldr r2, =BUF_PCM8
+    mov r3, #0x800
+1:  mul r11, r8, r9
+    add r8, r11, r10
+    str r8, [r2], #4
+    subs r3, r3, #1
+    bne 1b
+
+    @ ADPCM header: initial value 0, index 0
+    ldr r2, =BUF_ADPCM
+    mov r1, #0
+    str r1, [r2]
+
+    @ start the channels
+    ldr r0, =0x04000400
+    adr r2, channels
+    mov r3, #16
+1:  ldmia r2!, {r4-r7}
+    str r5, [r0, #0x4]          @ SAD
+    str r6, [r0, #0x8]          @ TMR, PNT
+    str r7, [r0, #0xC]          @ LEN
+    str r4, [r0]                @ CNT
+    add r0, r0, #0x10
+    subs r3, r3, #1
+    bne 1b
+
+    mov r12, #0                 @ frame counter
+
+frame:
+    @ wait for the start of VBlank
+    ldr r2, =0x04000006
+1:  ldrh r3, [r2]
+    cmp r3, #192
+    beq 1b
+2:  ldrh r3, [r2]
+    cmp r3, #192
+    bne 2b
+
+    @ rewrite the stream buffer with a sawtooth whose pitch changes every frame
+    and r4, r12, #15
+    add r4, r4, #1
+    mov r4, r4, lsl #6
+    ldr r2, =BUF_STREAM
+    mov r1, #0
+    mov r3, #1024
+1:  strh r1, [r2], #2
+    add r1, r1, r4
+    subs r3, r3, #1
+    bne 1b
+
+    @ restart channels 1-7 every 64 frames
+    tst r12, #63
+    bne 2f
+    ldr r0, =0x04000410
+    adr r2, channels+16
+    mov r3, #7
+    mov r1, #0
+1:  ldr r4, [r2], #16
+    str r1, [r0]
+    str r4, [r0]
+    add r0, r0, #0x10
+    subs r3, r3, #1
+    bne 1b
+
+2:  add r12, r12, #1
+    b frame
+
+    .pool
+
+channels:
+    @ CNT, SAD, TMR | PNT<<16, LEN
+    @ CNT: volume 32, panning across the channels, loop, format, duty
+    .word 0xA8000020, BUF_STREAM, 0x0000FC00, 512
+    .word 0xA8080020, BUF_PCM16,  0x0000FE00, 1024
+    .word 0xA8100020, BUF_PCM16,  0x0000FD00, 1024
+    .word 0xA8180020, BUF_PCM16,  0x0000FB80, 1024
+    .word 0x88200020, BUF_PCM8,   0x0000FE80, 1024
+    .word 0x88280020, BUF_PCM8,   0x0000FC80, 1024
+    .word 0xC8300020, BUF_ADPCM,  0x0001FD80, 1023
+    .word 0xC8380020, BUF_ADPCM,  0x0001FB00, 1023
+    .word 0xE8400020, 0,          0x0000FF00, 0
+    .word 0xE9480020, 0,          0x0000FE40, 0
+    .word 0xEA500020, 0,          0x0000FD40, 0
+    .word 0xEB580020, 0,          0x0000FC40, 0
+    .word 0xEC600020, 0,          0x0000FB40, 0
+    .word 0xED680020, 0,          0x0000FA40, 0
+    .word 0xE8700020, 0,          0x0000F000, 0
+    .word 0xE8780020, 0,          0x0000E000, 0
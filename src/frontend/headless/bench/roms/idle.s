@@ -0,0 +1,7 @@
+@ idle loop, for the CPU a benchmark ROM doesn't use
+
+    .arm
+    .text
+
+start:
+    b start
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+#
+# builds the benchmark ROMs from the assembly sources in this directory
+#
+# usage: mkrom.py [output directory]
+#
+# needs either devkitARM/binutils (arm-none-eabi-as, arm-none-eabi-objcopy)
+# or LLVM (llvm-mc, llvm-objcopy). the code is position-independent, so no
+# linker is involved.
+#
+# the built ROMs are checked in alongside the sources, and their CRCs are
+# pinned in ../suite.txt. if you change a source file, rebuild and update
+# the CRC there.
+
+import os
+import shutil
+import subprocess
+import struct
+import sys
+import tempfile
+
+# name: (title, game code, ARM9 source, ARM7 source)
+ROMS = {
+    "bench3d":  ("MELONBENCH3D", "MB3D", "bench3d.s", "idle.s"),
+    "bench2d":  ("MELONBENCH2D", "MB2D", "bench2d.s", "idle.s"),
+    "benchsnd": ("MELONBENCHSN", "MBSN", "idle.s", "benchsnd.s"),
+}
+
+ARM9_ROM_OFFSET = 0x8000
+ARM9_RAM_ADDR = 0x02000000
+ARM7_RAM_ADDR = 0x02380000
+
+
+def find_assembler():
+    if shutil.which("arm-none-eabi-as") and shutil.which("arm-none-eabi-objcopy"):
+        return "binutils"
+    if shutil.which("llvm-mc") and shutil.which("llvm-objcopy"):
+        return "llvm"
+    sys.exit("no ARM assembler found (need arm-none-eabi-as or llvm-mc)")
+
+
+def assemble(tool, src, arch, tmpdir):
+    obj = os.path.join(tmpdir, os.path.basename(src) + "." + arch + ".o")
+    binfile = obj + ".bin"
+
+    if tool == "binutils":
+        subprocess.check_call(["arm-none-eabi-as", "-march=" + arch, "-o", obj, src])
+        subprocess.check_call(["arm-none-eabi-objcopy", "-O", "binary", "-j", ".text", obj, binfile])
+    else:
+        subprocess.check_call(["llvm-mc", "-triple=" + arch + "-none-eabi", "-filetype=obj", "-o", obj, src])
+        subprocess.check_call(["llvm-objcopy", "-O", "binary", "-j", ".text", obj, binfile])
+
+    with open(binfile, "rb") as f:
+        return f.read()
+
+
+def align(val, to):
+    return (val + to - 1) & ~(to - 1)
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for i in range(8):
+            crc = (crc >> 1) ^ 0xA001 if (crc & 1) else (crc >> 1)
+    return crc
+
+
+def build_rom(title, gamecode, arm9, arm7):
+    arm7offset = align(ARM9_ROM_OFFSET + len(arm9), 0x200)
+    used = align(arm7offset + len(arm7), 0x200)
+
+    # smallest power of two above 128K that fits
+    capacity = 0
+    while (0x20000 << capacity) < used:
+        capacity += 1
+    romsize = 0x20000 << capacity
+
+    rom = bytearray(romsize)
+
+    hdr = bytearray(0x200)
+    hdr[0x000:0x00C] = title.encode("ascii").ljust(12, b"\0")
+    hdr[0x00C:0x010] = gamecode.encode("ascii")
+    hdr[0x010:0x012] = b"00"
+    hdr[0x014] = capacity
+    struct.pack_into("<IIII", hdr, 0x020, ARM9_ROM_OFFSET, ARM9_RAM_ADDR, ARM9_RAM_ADDR, len(arm9))
+    struct.pack_into("<IIII", hdr, 0x030, arm7offset, ARM7_RAM_ADDR, ARM7_RAM_ADDR, len(arm7))
+    struct.pack_into("<II", hdr, 0x080, used, 0x4000)
+    struct.pack_into("<H", hdr, 0x15E, crc16(hdr[0:0x15E]))
+
+    rom[0:0x200] = hdr
+    rom[ARM9_ROM_OFFSET:ARM9_ROM_OFFSET+len(arm9)] = arm9
+    rom[arm7offset:arm7offset+len(arm7)] = arm7
+    return bytes(rom)
+
+
+def main():
+    srcdir = os.path.dirname(os.path.abspath(__file__))
+    outdir = sys.argv[1] if len(sys.argv) > 1 else srcdir
+    tool = find_assembler()
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        for name, (title, gamecode, src9, src7) in ROMS.items():
+            arm9 = assemble(tool, os.path.join(srcdir, src9), "armv5te", tmpdir)
+            arm7 = assemble(tool, os.path.join(srcdir, src7), "armv4t", tmpdir)
+            rom = build_rom(title, gamecode, arm9, arm7)
+
+            path = os.path.join(outdir, name + ".nds")
+            with open(path, "wb") as f:
+                f.write(rom)
+            print("%s: %d bytes" % (path, len(rom)))
+
+
+if __name__ == "__main__":
+    main()
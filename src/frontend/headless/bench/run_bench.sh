@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# runs the benchmark suite under a few emulator configurations
+# and prints the results as CSV
+#
+# usage: run_bench.sh <melonDS-headless> [--roms <rom directory>] [extra options...]
+#
+# the ROMs are taken from roms/ next to this script unless --roms is given.
+# extra options are passed to melonDS-headless as-is (ie. --datadir,
+# --bios9 etc). a build with ENABLE_PROFILING adds per-subsystem timings
+# (in ms) to each line.
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 <melonDS-headless> [--roms <rom directory>] [extra options...]"
+    exit 1
+fi
+
+EXE="$1"
+shift
+
+BENCHDIR="$(cd "$(dirname "$0")" && pwd)"
+SUITE="$BENCHDIR/suite.txt"
+
+ROMDIR="$BENCHDIR/roms"
+if [ "$1" = "--roms" ]; then
+    ROMDIR="$2"
+    shift 2
+fi
+
+# CRC32 of a file, from the gzip trailer
+crc32() {
+    gzip -c < "$1" | tail -c 8 | od -An -N4 -tx4 | tr -d ' ' | tr 'a-f' 'A-F'
+}
+
+# name|options
+CONFIGS="interp|--jit 0 --threaded-3d 0
+interp-threaded3d|--jit 0 --threaded-3d 1
+interp-banded3d|--jit 0 --threaded-3d 1 --3d-workers 3
+jit|--jit 1 --threaded-3d 0
+jit-async|--jit 1 --jit-async 1 --threaded-3d 0
+jit-threaded3d|--jit 1 --threaded-3d 1"
+
+echo "test,config,rom,frames,seconds,fps,peak_rss_kb,video_crc,audio_crc,arm9_ms,arm7_ms,gpu3d_ms,gpu3d_render_ms,gpu2d_ms,spu_ms"
+
+grep -v '^\s*#' "$SUITE" | grep -v '^\s*$' | while read NAME ROM CRC FRAMES INPUT; do
+    if [ ! -f "$ROMDIR/$ROM" ]; then
+        echo "$NAME: $ROMDIR/$ROM not found, skipping" >&2
+        continue
+    fi
+
+    ROMCRC=$(crc32 "$ROMDIR/$ROM")
+    if [ "$ROMCRC" != "$CRC" ]; then
+        echo "$NAME: $ROMDIR/$ROM has CRC $ROMCRC, expected $CRC, skipping" >&2
+        continue
+    fi
+
+    INPUTOPT=""
+    if [ -n "$INPUT" ]; then
+        INPUTOPT="--input $BENCHDIR/$INPUT"
+    fi
+
+    echo "$CONFIGS" | while IFS='|' read CFGNAME CFGOPTS; do
+        # the core logs to stdout too, pick out the results line
+        RESULT=$("$EXE" --csv --frames "$FRAMES" $INPUTOPT $CFGOPTS "$@" "$ROMDIR/$ROM" < /dev/null | grep -F "$ROMDIR/$ROM," | tail -n 1)
+        echo "$NAME,$CFGNAME,$RESULT"
+    done
+done
@@ -0,0 +1,592 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#ifdef MULTI_INSTANCE
+#include <thread>
+#include <vector>
+#endif
+
+#ifdef __WIN32__
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "version.h"
+#include "types.h"
+#include "Platform.h"
+#include "PlatformConfig.h"
+
+#include "NDS.h"
+#include "CRC32.h"
+#include "GPU.h"
+#include "SPU.h"
+#include "Profiler.h"
+
+#include "FrontendUtil.h"
+#include "InputScript.h"
+
+// headless frame-runner
+// runs a ROM for a fixed number of frames as fast as possible, without display
+// or audio output, and reports how fast it went
+// meant for benchmarking and for catching regressions: the framebuffer/audio
+// checksums printed at the end only depend on the emulated state
+
+
+const char* DataDirectory = nullptr;
+bool LocalMultiplayer = false;
+
+INSTANCE_LOCAL bool Running;
+
+void emuStop()
+{
+    Running = false;
+}
+
+
+u64 GetPeakRSS()
+{
+    // in kilobytes
+#ifdef __WIN32__
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return pmc.PeakWorkingSetSize >> 10;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss >> 10; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+double GetTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+bool DumpFrame(const char* filename)
+{
+    // both screens stacked vertically, as a binary PPM
+    FILE* f = fopen(filename, "wb");
+    if (!f) return false;
+
+    fprintf(f, "P6\n256 384\n255\n");
+
+    int frontbuf = GPU::FrontBuffer;
+    u8 line[256*3];
+    for (int s = 0; s < 2; s++)
+    {
+        u32* src = GPU::Framebuffer[frontbuf][s];
+        for (int y = 0; y < 192; y++)
+        {
+            for (int x = 0; x < 256; x++)
+            {
+                u32 col = src[y*256 + x];
+                line[x*3 + 0] = (col >> 16) & 0xFF;
+                line[x*3 + 1] = (col >> 8) & 0xFF;
+                line[x*3 + 2] = col & 0xFF;
+            }
+            fwrite(line, 256*3, 1, f);
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+
+#ifdef MULTI_INSTANCE
+
+// with --instances, each console runs on its own thread. they all run the
+// same ROM and input script, starting from a blank save that is never written
+
+struct Instance
+{
+    std::thread Thread;
+    bool OK;
+    u32 Frames;
+    double Elapsed;
+    u32 VideoCRC;
+    u32 AudioCRC;
+};
+
+void RunInstance(Instance* inst, const char* romfile, const char* inputfile, u32 warmup, u32 numframes)
+{
+    inst->OK = false;
+    inst->Frames = 0;
+    inst->Elapsed = 0;
+    inst->VideoCRC = 0;
+    inst->AudioCRC = 0;
+
+    InputScript* input = nullptr;
+    if (inputfile)
+    {
+        input = new InputScript(inputfile);
+        if (input->Error)
+        {
+            delete input;
+            return;
+        }
+    }
+
+    NDS::Init();
+
+    GPU::RenderSettings videoSettings;
+    videoSettings.Threaded2D = false;
+    videoSettings.Soft_Threaded = false;
+    videoSettings.Soft_Workers = 0;
+    videoSettings.GL_ScaleFactor = 1;
+    videoSettings.GL_BetterPolygons = false;
+
+    GPU::InitRenderer(0);
+    GPU::SetRenderSettings(0, videoSettings);
+
+    NDS::SetConsoleType(Config::ConsoleType);
+    if (NDS::LoadROM(romfile, "", Config::DirectBoot != 0))
+    {
+        Running = true;
+
+        s16 audiobuf[1024*2];
+        u32 totalframes = warmup + numframes;
+        u32 frame;
+        double starttime = GetTime();
+
+        for (frame = 0; frame < totalframes && Running; frame++)
+        {
+            if (frame == warmup)
+                starttime = GetTime();
+
+            if (input) input->Apply(frame);
+
+            NDS::RunFrame();
+
+            for (;;)
+            {
+                int num = SPU::ReadOutput(audiobuf, 1024);
+                if (num <= 0) break;
+
+                inst->AudioCRC = CRC32((u8*)audiobuf, num*2*sizeof(s16), inst->AudioCRC);
+            }
+        }
+
+        inst->Elapsed = GetTime() - starttime;
+        inst->Frames = (frame > warmup) ? (frame - warmup) : 0;
+
+        int frontbuf = GPU::FrontBuffer;
+        inst->VideoCRC = CRC32((u8*)GPU::Framebuffer[frontbuf][0], 256*192*4, inst->VideoCRC);
+        inst->VideoCRC = CRC32((u8*)GPU::Framebuffer[frontbuf][1], 256*192*4, inst->VideoCRC);
+
+        inst->OK = true;
+    }
+
+    GPU::DeInitRenderer();
+    NDS::DeInit();
+
+    delete input;
+}
+
+int RunInstances(int num, const char* romfile, const char* inputfile, u32 warmup, u32 numframes, bool csv)
+{
+    std::vector<Instance> instances(num);
+
+    double starttime = GetTime();
+    for (int i = 0; i < num; i++)
+        instances[i].Thread = std::thread(RunInstance, &instances[i], romfile, inputfile, warmup, numframes);
+    for (int i = 0; i < num; i++)
+        instances[i].Thread.join();
+    double elapsed = GetTime() - starttime;
+
+    u64 peakrss = GetPeakRSS();
+    u32 totalframes = 0;
+    bool ok = true;
+
+    for (int i = 0; i < num; i++)
+    {
+        Instance& inst = instances[i];
+        double fps = (inst.Elapsed > 0) ? (inst.Frames / inst.Elapsed) : 0;
+        totalframes += inst.Frames;
+        if (!inst.OK) ok = false;
+
+        if (csv)
+        {
+            // rom#instance,frames,seconds,fps,peak_rss_kb,video_crc,audio_crc
+            printf("%s#%d,%u,%.3f,%.2f,%llu,%08X,%08X\n", romfile, i, inst.Frames, inst.Elapsed, fps,
+                   (unsigned long long)peakrss, inst.VideoCRC, inst.AudioCRC);
+        }
+        else if (!inst.OK)
+            printf("instance %d: failed to load %s\n", i, romfile);
+        else
+            printf("instance %d: %u frames, %.3f s, %.2f fps, video CRC %08X, audio CRC %08X\n",
+                   i, inst.Frames, inst.Elapsed, fps, inst.VideoCRC, inst.AudioCRC);
+    }
+
+    if (!csv)
+    {
+        // includes the time it took to set up the consoles
+        double fps = (elapsed > 0) ? (totalframes / elapsed) : 0;
+
+        printf("\n");
+        printf("instances:  %d\n", num);
+        printf("time:       %.3f s\n", elapsed);
+        printf("speed:      %.2f fps total\n", fps);
+        printf("peak RSS:   %llu KB\n", (unsigned long long)peakrss);
+    }
+
+    return ok ? 0 : 1;
+}
+
+#endif
+
+
+void PrintUsage(const char* exe)
+{
+    printf("usage: %s [options] <rom.nds>\n", exe);
+    printf("\n");
+    printf("options:\n");
+    printf("  --frames <n>         number of frames to run (default: 3600)\n");
+    printf("  --warmup <n>         frames to run before timing starts (default: 0)\n");
+    printf("  --input <file>       scripted input (see InputScript.h for the format)\n");
+    printf("  --datadir <dir>      where to look for melonDS.ini, BIOS and firmware (default: .)\n");
+    printf("  --bios9 <file>       override the ARM9 BIOS path\n");
+    printf("  --bios7 <file>       override the ARM7 BIOS path\n");
+    printf("  --firmware <file>    override the firmware path\n");
+    printf("  --ds                 emulate a DS\n");
+    printf("  --dsi                emulate a DSi\n");
+    printf("  --firmware-boot      boot the ROM through the firmware instead of directly\n");
+    printf("  --map-rom <0|1>      map the ROM file instead of loading it into memory\n");
+    printf("  --threaded-2d <0|1>  draw the 2D engines on their own thread\n");
+    printf("  --threaded-3d <0|1>  run the software 3D renderer on its own thread\n");
+    printf("  --3d-workers <n>     extra threads for rasterizing 3D scanline bands (0-16)\n");
+#ifdef JIT_ENABLED
+    printf("  --jit <0|1>          use the JIT recompiler\n");
+    printf("  --jit-async <0|1>    compile JIT blocks on a background thread\n");
+#endif
+#ifdef MULTI_INSTANCE
+    printf("  --instances <n>      run n consoles at once, each on its own thread\n");
+#endif
+    printf("  --local-mp           let instances on this computer play together over shared memory\n");
+    printf("  --rewind <n>         keep rewind states, taken every n frames (0 = off)\n");
+    printf("  --dump-frame <file>  write the last frame to a PPM file\n");
+    printf("  --record <path>      record the video and audio output to <path>.y4m/.wav\n");
+    printf("  --record-format <f>  y4m (default), or png for a <path>_NNNNNN.png sequence\n");
+    printf("  --record-drop        drop frames when the encoder falls behind instead of waiting\n");
+    printf("  --csv                print a single CSV line with the results\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* romfile = nullptr;
+    const char* inputfile = nullptr;
+    const char* dumpfile = nullptr;
+    const char* recordpath = nullptr;
+    int recordformat = Frontend::Capture_Y4M;
+    bool recorddrop = false;
+    const char* bios9 = nullptr;
+    const char* bios7 = nullptr;
+    const char* firmware = nullptr;
+    int consoletype = -1;
+    int directboot = -1;
+    int threaded2d = -1;
+    int threaded3d = -1;
+    int workers3d = -1;
+    int jit = -1;
+    int jitasync = -1;
+    int rewind = -1;
+    int maprom = -1;
+    int numinstances = 1;
+    u32 numframes = 3600;
+    u32 warmup = 0;
+    bool csv = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool hasval = (i+1) < argc;
+
+#define ARG(name) (!strcmp(arg, name))
+#define VALARG(name) (ARG(name) && hasval)
+
+        if      (VALARG("--frames"))      numframes = strtoul(argv[++i], NULL, 0);
+        else if (VALARG("--warmup"))      warmup = strtoul(argv[++i], NULL, 0);
+        else if (VALARG("--input"))       inputfile = argv[++i];
+        else if (VALARG("--datadir"))     DataDirectory = argv[++i];
+        else if (VALARG("--bios9"))       bios9 = argv[++i];
+        else if (VALARG("--bios7"))       bios7 = argv[++i];
+        else if (VALARG("--firmware"))    firmware = argv[++i];
+        else if (ARG("--ds"))             consoletype = 0;
+        else if (ARG("--dsi"))            consoletype = 1;
+        else if (ARG("--firmware-boot"))  directboot = 0;
+        else if (VALARG("--map-rom"))     maprom = atoi(argv[++i]) ? 1 : 0;
+        else if (VALARG("--threaded-2d")) threaded2d = atoi(argv[++i]) ? 1 : 0;
+        else if (VALARG("--threaded-3d")) threaded3d = atoi(argv[++i]) ? 1 : 0;
+        else if (VALARG("--3d-workers"))  workers3d = atoi(argv[++i]);
+        else if (VALARG("--jit"))         jit = atoi(argv[++i]) ? 1 : 0;
+        else if (VALARG("--jit-async"))   jitasync = atoi(argv[++i]) ? 1 : 0;
+        else if (VALARG("--instances"))   numinstances = atoi(argv[++i]);
+        else if (ARG("--local-mp"))       LocalMultiplayer = true;
+        else if (VALARG("--rewind"))      rewind = atoi(argv[++i]);
+        else if (VALARG("--dump-frame"))  dumpfile = argv[++i];
+        else if (VALARG("--record"))      recordpath = argv[++i];
+        else if (VALARG("--record-format"))
+        {
+            const char* fmt = argv[++i];
+            if      (!strcmp(fmt, "y4m")) recordformat = Frontend::Capture_Y4M;
+            else if (!strcmp(fmt, "png")) recordformat = Frontend::Capture_PNG;
+            else
+            {
+                printf("unknown recording format: %s\n", fmt);
+                return 1;
+            }
+        }
+        else if (ARG("--record-drop"))    recorddrop = true;
+        else if (ARG("--csv"))            csv = true;
+        else if (ARG("--help") || ARG("-h"))
+        {
+            PrintUsage(argv[0]);
+            return 0;
+        }
+        else if (arg[0] != '-' && !romfile)
+            romfile = arg;
+        else
+        {
+            printf("unknown or incomplete option: %s\n\n", arg);
+            PrintUsage(argv[0]);
+            return 1;
+        }
+
+#undef VALARG
+#undef ARG
+    }
+
+    if (!romfile)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    if (!csv)
+    {
+        printf("melonDS " MELONDS_VERSION " (headless)\n");
+        printf(MELONDS_URL "\n");
+    }
+
+    Platform::Init(argc, argv);
+
+    Config::Load();
+
+    if (bios9)    { strncpy(Config::BIOS9Path, bios9, 1023); Config::BIOS9Path[1023] = '\0'; }
+    if (bios7)    { strncpy(Config::BIOS7Path, bios7, 1023); Config::BIOS7Path[1023] = '\0'; }
+    if (firmware) { strncpy(Config::FirmwarePath, firmware, 1023); Config::FirmwarePath[1023] = '\0'; }
+    if (consoletype != -1) Config::ConsoleType = consoletype;
+    if (directboot != -1)  Config::DirectBoot = directboot;
+    if (maprom != -1)      Config::MapCartROM = maprom;
+    if (threaded2d != -1)  Config::Threaded2D = threaded2d;
+    if (threaded3d != -1)  Config::Threaded3D = threaded3d;
+    if (workers3d != -1)   Config::Threaded3DWorkers = workers3d;
+#ifdef JIT_ENABLED
+    if (jit != -1)         Config::JIT_Enable = jit;
+    if (jitasync != -1)    Config::JIT_AsyncCompile = jitasync;
+#else
+    if (jit == 1)          printf("JIT support not compiled in, using the interpreter\n");
+#endif
+    if (rewind != -1)
+    {
+        Config::RewindEnable = rewind > 0 ? 1 : 0;
+        if (rewind > 0) Config::RewindInterval = rewind;
+    }
+
+#define SANITIZE(var, min, max)  { if (var < min) var = min; else if (var > max) var = max; }
+    SANITIZE(Config::ConsoleType, 0, 1);
+    SANITIZE(Config::Threaded3DWorkers, 0, 16);
+    SANITIZE(numinstances, 1, 64);
+#undef SANITIZE
+
+
+#ifdef MULTI_INSTANCE
+    if (numinstances > 1)
+    {
+        int ret = RunInstances(numinstances, romfile, inputfile, warmup, numframes, csv);
+        Platform::DeInit();
+        return ret;
+    }
+#else
+    if (numinstances > 1)
+        printf("multi-instance support not compiled in, running a single console\n");
+#endif
+
+    InputScript* input = nullptr;
+    if (inputfile)
+    {
+        input = new InputScript(inputfile);
+        if (input->Error)
+        {
+            delete input;
+            Platform::DeInit();
+            return 1;
+        }
+    }
+
+    NDS::Init();
+
+    GPU::RenderSettings videoSettings;
+    videoSettings.Threaded2D = Config::Threaded2D != 0;
+    videoSettings.Soft_Threaded = Config::Threaded3D != 0;
+    videoSettings.Soft_Workers = Config::Threaded3DWorkers;
+    videoSettings.GL_ScaleFactor = 1;
+    videoSettings.GL_BetterPolygons = false;
+
+    GPU::InitRenderer(0);
+    GPU::SetRenderSettings(0, videoSettings);
+
+    Frontend::Init_ROM();
+
+    int res = Frontend::LoadROM(romfile, Frontend::ROMSlot_NDS);
+    if (res != Frontend::Load_OK)
+    {
+        printf("failed to load %s (error %d)\n", romfile, res);
+
+        Frontend::DeInit_ROM();
+        GPU::DeInitRenderer();
+        NDS::DeInit();
+        delete input;
+        Platform::DeInit();
+        return 1;
+    }
+
+    if (recordpath && !Frontend::Capture_Start(recordpath, recordformat, !recorddrop))
+    {
+        printf("could not start recording to %s\n", recordpath);
+        recordpath = nullptr;
+    }
+
+    Running = true;
+
+    s16 audiobuf[1024*2];
+    u32 audiocrc = 0;
+    u64 numsamples = 0;
+
+    u32 totalframes = warmup + numframes;
+    u32 frame;
+    double starttime = GetTime();
+
+    for (frame = 0; frame < totalframes && Running; frame++)
+    {
+        if (frame == warmup)
+        {
+            Profiler::Reset();
+            starttime = GetTime();
+        }
+
+        if (input) input->Apply(frame);
+
+        NDS::RunFrame();
+        Frontend::Rewind_Frame();
+        Frontend::Capture_Frame();
+
+        // drain the audio output so it doesn't just pile up
+        for (;;)
+        {
+            int num = SPU::ReadOutput(audiobuf, 1024);
+            if (num <= 0) break;
+
+            audiocrc = CRC32((u8*)audiobuf, num*2*sizeof(s16), audiocrc);
+            numsamples += num;
+        }
+    }
+
+    double elapsed = GetTime() - starttime;
+    u32 timedframes = (frame > warmup) ? (frame - warmup) : 0;
+    double fps = (elapsed > 0) ? (timedframes / elapsed) : 0;
+
+    // flushes what the encoder still has queued
+    if (recordpath) Frontend::Capture_Stop();
+
+    if (!Running && !csv)
+        printf("emulation stopped after %d frames\n", frame);
+
+    u32 videocrc = 0;
+    {
+        int frontbuf = GPU::FrontBuffer;
+        videocrc = CRC32((u8*)GPU::Framebuffer[frontbuf][0], 256*192*4, videocrc);
+        videocrc = CRC32((u8*)GPU::Framebuffer[frontbuf][1], 256*192*4, videocrc);
+    }
+
+    if (dumpfile && !DumpFrame(dumpfile))
+        printf("could not write %s\n", dumpfile);
+
+    u64 peakrss = GetPeakRSS();
+
+    if (csv)
+    {
+        // rom,frames,seconds,fps,peak_rss_kb,video_crc,audio_crc,<subsystems in ms>
+        printf("%s,%u,%.3f,%.2f,%llu,%08X,%08X", romfile, timedframes, elapsed, fps,
+               (unsigned long long)peakrss, videocrc, audiocrc);
+#ifdef PROFILING_ENABLED
+        for (u32 i = 0; i < Profiler::Prof_MAX; i++)
+            printf(",%.1f", Profiler::Time[i] / 1000000.0);
+#endif
+        printf("\n");
+    }
+    else
+    {
+        printf("\n");
+        printf("frames:     %u (+%u warmup)\n", timedframes, warmup);
+        printf("time:       %.3f s\n", elapsed);
+        printf("speed:      %.2f fps (%.1f%%)\n", fps, fps * 100.0 / 59.8261);
+        printf("peak RSS:   %llu KB\n", (unsigned long long)peakrss);
+        printf("video CRC:  %08X\n", videocrc);
+        printf("audio CRC:  %08X (%llu samples)\n", audiocrc, (unsigned long long)numsamples);
+        if (recordpath)
+            printf("recording:  %u frames and %u samples dropped\n",
+                   Frontend::Capture_FramesDropped(), Frontend::Capture_SamplesDropped());
+
+#ifdef PROFILING_ENABLED
+        printf("\n");
+        for (u32 i = 0; i < Profiler::Prof_MAX; i++)
+        {
+            double ms = Profiler::Time[i] / 1000000.0;
+            printf("%-14s %10.1f ms  %6.3f ms/frame  %5.1f%%\n",
+                   Profiler::GetName(i), ms,
+                   timedframes ? (ms / timedframes) : 0,
+                   elapsed > 0 ? (ms / (elapsed * 10.0)) : 0);
+        }
+#else
+        printf("\n(per-subsystem timings not available, build with ENABLE_PROFILING)\n");
+#endif
+    }
+
+    Frontend::DeInit_ROM();
+    GPU::DeInitRenderer();
+    NDS::DeInit();
+
+    delete input;
+
+    Platform::DeInit();
+    return 0;
+}
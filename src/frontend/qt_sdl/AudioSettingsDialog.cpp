@@ -42,6 +42,12 @@ AudioSettingsDialog::AudioSettingsDialog(QWidget* parent) : QDialog(parent), ui(
 
     ui->slVolume->setValue(Config::AudioVolume);
 
+    oldQuality = Config::AudioQuality;
+
+    ui->cbQuality->addItem("Linear");
+    ui->cbQuality->addItem("Windowed sinc");
+    ui->cbQuality->setCurrentIndex(oldQuality);
+
     grpMicMode = new QButtonGroup(this);
     grpMicMode->addButton(ui->rbMicNone,     0);
     grpMicMode->addButton(ui->rbMicExternal, 1);
@@ -74,6 +80,7 @@ void AudioSettingsDialog::on_AudioSettingsDialog_accepted()
 void AudioSettingsDialog::on_AudioSettingsDialog_rejected()
 {
     Config::AudioVolume = oldVolume;
+    Config::AudioQuality = oldQuality;
 
     closeDlg();
 }
@@ -83,6 +90,11 @@ void AudioSettingsDialog::on_slVolume_valueChanged(int val)
     Config::AudioVolume = val;
 }
 
+void AudioSettingsDialog::on_cbQuality_currentIndexChanged(int idx)
+{
+    Config::AudioQuality = idx;
+}
+
 void AudioSettingsDialog::onChangeMicMode(int mode)
 {
     bool iswav = (mode == 3);
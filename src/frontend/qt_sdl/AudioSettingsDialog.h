@@ -56,6 +56,7 @@ private slots:
     void on_AudioSettingsDialog_rejected();
 
     void on_slVolume_valueChanged(int val);
+    void on_cbQuality_currentIndexChanged(int idx);
     void onChangeMicMode(int mode);
     void on_btnMicWavBrowse_clicked();
 
@@ -63,6 +64,7 @@ private:
     Ui::AudioSettingsDialog* ui;
 
     int oldVolume;
+    int oldQuality;
     QButtonGroup* grpMicMode;
 };
 
@@ -30,6 +30,7 @@
 #include "PlatformConfig.h"
 #include "LAN_Socket.h"
 #include "LAN_PCap.h"
+#include "LocalMP.h"
 #include <string>
 
 #ifdef __WIN32__
@@ -69,6 +70,7 @@ void* oglGetProcAddress(const char* proc);
 namespace Platform
 {
 
+bool MPLocal;
 socket_t MPSocket;
 sockaddr_t MPSendAddr;
 u8 PacketBuffer[2048];
@@ -230,6 +232,11 @@ void Semaphore_Wait(Semaphore* sema)
     ((QSemaphore*) sema)->acquire();
 }
 
+bool Semaphore_TryWait(Semaphore* sema, int timeout)
+{
+    return ((QSemaphore*) sema)->tryAcquire(1, timeout);
+}
+
 void Semaphore_Post(Semaphore* sema)
 {
     ((QSemaphore*) sema)->release();
@@ -271,6 +278,19 @@ bool MP_Init()
     int opt_true = 1;
     int res;
 
+    // when the socket is only bound to localhost, every peer runs on this
+    // computer and can be reached through shared memory instead
+    MPLocal = false;
+    MPSocket = INVALID_SOCKET;
+    if (Config::MPSharedMem && !Config::SocketBindAnyAddr)
+    {
+        if (LocalMP::Init())
+        {
+            MPLocal = true;
+            return true;
+        }
+    }
+
 #ifdef __WIN32__
     WSADATA wsadata;
     if (WSAStartup(MAKEWORD(2, 2), &wsadata) != 0)
@@ -322,6 +342,13 @@ bool MP_Init()
 
 void MP_DeInit()
 {
+    if (MPLocal)
+    {
+        LocalMP::DeInit();
+        MPLocal = false;
+        return;
+    }
+
     if (MPSocket >= 0)
         closesocket(MPSocket);
 
@@ -330,8 +357,11 @@ void MP_DeInit()
 #endif // __WIN32__
 }
 
-int MP_SendPacket(u8* data, int len)
+int MP_SendPacket(u8* data, int len, u64 timestamp)
 {
+    if (MPLocal)
+        return LocalMP::SendPacket(data, len, timestamp);
+
     if (MPSocket < 0)
         return 0;
 
@@ -352,8 +382,11 @@ int MP_SendPacket(u8* data, int len)
     return slen - 8;
 }
 
-int MP_RecvPacket(u8* data, bool block)
+int MP_RecvPacket(u8* data, bool block, u64 timestamp)
 {
+    if (MPLocal)
+        return LocalMP::RecvPacket(data, block, timestamp);
+
     if (MPSocket < 0)
         return 0;
 
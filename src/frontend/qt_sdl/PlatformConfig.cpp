@@ -48,7 +48,9 @@ int ScreenVSync;
 int ScreenVSyncInterval;
 
 int _3DRenderer;
+int Threaded2D;
 int Threaded3D;
+int Threaded3DWorkers;
 
 int GL_ScaleFactor;
 int GL_BetterPolygons;
@@ -61,12 +63,18 @@ int ConsoleType;
 int DirectBoot;
 
 int SocketBindAnyAddr;
+int MPSharedMem;
 char LANDevice[128];
 int DirectLAN;
 
 int SavestateRelocSRAM;
 
+int RewindEnable;
+int RewindInterval;
+int RewindLength;
+
 int AudioVolume;
+int AudioQuality;
 int MicInputType;
 char MicWavPath[1024];
 
@@ -113,6 +121,7 @@ ConfigEntry PlatformConfigFile[] =
     {"HKKey_FullscreenToggle",    0, &HKKeyMapping[HK_FullscreenToggle],    -1, NULL, 0},
     {"HKKey_SolarSensorDecrease", 0, &HKKeyMapping[HK_SolarSensorDecrease], -1, NULL, 0},
     {"HKKey_SolarSensorIncrease", 0, &HKKeyMapping[HK_SolarSensorIncrease], -1, NULL, 0},
+    {"HKKey_Rewind",              0, &HKKeyMapping[HK_Rewind],              -1, NULL, 0},
 
     {"HKJoy_Lid",                 0, &HKJoyMapping[HK_Lid],                 -1, NULL, 0},
     {"HKJoy_Mic",                 0, &HKJoyMapping[HK_Mic],                 -1, NULL, 0},
@@ -123,6 +132,7 @@ ConfigEntry PlatformConfigFile[] =
     {"HKJoy_FastForwardToggle",   0, &HKJoyMapping[HK_FullscreenToggle],    -1, NULL, 0},
     {"HKJoy_SolarSensorDecrease", 0, &HKJoyMapping[HK_SolarSensorDecrease], -1, NULL, 0},
     {"HKJoy_SolarSensorIncrease", 0, &HKJoyMapping[HK_SolarSensorIncrease], -1, NULL, 0},
+    {"HKJoy_Rewind",              0, &HKJoyMapping[HK_Rewind],              -1, NULL, 0},
 
     {"JoystickID", 0, &JoystickID, 0, NULL, 0},
 
@@ -142,7 +152,9 @@ ConfigEntry PlatformConfigFile[] =
     {"ScreenVSyncInterval", 0, &ScreenVSyncInterval, 1, NULL, 0},
 
     {"3DRenderer", 0, &_3DRenderer, 0, NULL, 0},
+    {"Threaded2D", 0, &Threaded2D, 0, NULL, 0},
     {"Threaded3D", 0, &Threaded3D, 1, NULL, 0},
+    {"Threaded3DWorkers", 0, &Threaded3DWorkers, 0, NULL, 0},
 
     {"GL_ScaleFactor", 0, &GL_ScaleFactor, 1, NULL, 0},
     {"GL_BetterPolygons", 0, &GL_BetterPolygons, 0, NULL, 0},
@@ -155,12 +167,18 @@ ConfigEntry PlatformConfigFile[] =
     {"DirectBoot", 0, &DirectBoot, 1, NULL, 0},
 
     {"SockBindAnyAddr", 0, &SocketBindAnyAddr, 0, NULL, 0},
+    {"MPSharedMem", 0, &MPSharedMem, 1, NULL, 0},
     {"LANDevice", 1, LANDevice, 0, "", 127},
     {"DirectLAN", 0, &DirectLAN, 0, NULL, 0},
 
     {"SavStaRelocSRAM", 0, &SavestateRelocSRAM, 0, NULL, 0},
 
+    {"RewindEnable", 0, &RewindEnable, 0, NULL, 0},
+    {"RewindInterval", 0, &RewindInterval, 6, NULL, 0},
+    {"RewindLength", 0, &RewindLength, 30, NULL, 0},
+
     {"AudioVolume", 0, &AudioVolume, 256, NULL, 0},
+    {"AudioQuality", 0, &AudioQuality, 1, NULL, 0},
     {"MicInputType", 0, &MicInputType, 1, NULL, 0},
     {"MicWavPath", 1, MicWavPath, 0, "", 1023},
 
@@ -32,6 +32,7 @@ enum
     HK_FullscreenToggle,
     HK_SolarSensorDecrease,
     HK_SolarSensorIncrease,
+    HK_Rewind,
     HK_MAX
 };
 
@@ -62,7 +63,9 @@ extern int ScreenVSync;
 extern int ScreenVSyncInterval;
 
 extern int _3DRenderer;
+extern int Threaded2D;
 extern int Threaded3D;
+extern int Threaded3DWorkers;
 
 extern int GL_ScaleFactor;
 extern int GL_BetterPolygons;
@@ -75,12 +78,18 @@ extern int ConsoleType;
 extern int DirectBoot;
 
 extern int SocketBindAnyAddr;
+extern int MPSharedMem;
 extern char LANDevice[128];
 extern int DirectLAN;
 
 extern int SavestateRelocSRAM;
 
+extern int RewindEnable;
+extern int RewindInterval;
+extern int RewindLength;
+
 extern int AudioVolume;
+extern int AudioQuality;
 extern int MicInputType;
 extern char MicWavPath[1024];
 
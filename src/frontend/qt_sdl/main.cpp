@@ -79,8 +79,6 @@ bool videoSettingsDirty;
 
 SDL_AudioDeviceID audioDevice;
 int audioFreq;
-SDL_cond* audioSync;
-SDL_mutex* audioSyncLock;
 
 SDL_AudioDeviceID micDevice;
 s16 micExtBuffer[2048];
@@ -96,14 +94,15 @@ void audioCallback(void* data, Uint8* stream, int len)
 
     // resample incoming audio to match the output sample rate
 
-    int len_in = Frontend::AudioOut_GetNumSamples(len);
+    // when the emulator waits for audio, it already keeps the buffer level
+    bool ratecontrol = !Config::AudioSync;
+
+    int len_in = Frontend::AudioOut_GetNumSamples(len, ratecontrol);
     s16 buf_in[1024*2];
     int num_in;
 
-    SDL_LockMutex(audioSyncLock);
+    if (len_in > 1024) len_in = 1024;
     num_in = SPU::ReadOutput(buf_in, len_in);
-    SDL_CondSignal(audioSync);
-    SDL_UnlockMutex(audioSyncLock);
 
     if (num_in < 1)
     {
@@ -111,18 +110,18 @@ void audioCallback(void* data, Uint8* stream, int len)
         return;
     }
 
-    int margin = 6;
-    if (num_in < len_in-margin)
+    // the resampler asks for exactly what it needs, pad underruns
+    if (num_in < len_in)
     {
         int last = num_in-1;
 
-        for (int i = num_in; i < len_in-margin; i++)
+        for (int i = num_in; i < len_in; i++)
             ((u32*)buf_in)[i] = ((u32*)buf_in)[last];
 
-        num_in = len_in-margin;
+        num_in = len_in;
     }
 
-    Frontend::AudioOut_Resample(buf_in, num_in, (s16*)stream, len, Config::AudioVolume);
+    Frontend::AudioOut_Resample(buf_in, num_in, (s16*)stream, len, Config::AudioVolume, Config::AudioQuality);
 }
 
 
@@ -334,7 +333,9 @@ void EmuThread::run()
     autoScreenSizing = 0;
 
     videoSettingsDirty = false;
+    videoSettings.Threaded2D = Config::Threaded2D != 0;
     videoSettings.Soft_Threaded = Config::Threaded3D != 0;
+    videoSettings.Soft_Workers = Config::Threaded3DWorkers;
     videoSettings.GL_ScaleFactor = Config::GL_ScaleFactor;
 
 #ifdef OGLRENDERER_ENABLED
@@ -418,7 +419,9 @@ void EmuThread::run()
 
                 videoSettingsDirty = false;
 
+                videoSettings.Threaded2D = Config::Threaded2D != 0;
                 videoSettings.Soft_Threaded = Config::Threaded3D != 0;
+                videoSettings.Soft_Workers = Config::Threaded3DWorkers;
                 videoSettings.GL_ScaleFactor = Config::GL_ScaleFactor;
                 videoSettings.GL_BetterPolygons = Config::GL_BetterPolygons;
 
@@ -468,9 +471,20 @@ void EmuThread::run()
                 }
             }
 
+            // while the rewind hotkey is held, go back one rewind state per frame
+            // instead of taking new ones
+            bool rewinding = Config::RewindEnable && Input::HotkeyDown(HK_Rewind);
+            if (rewinding)
+                Frontend::Rewind_StepBack(Config::RewindInterval);
+
             // emulate
             u32 nlines = NDS::RunFrame();
 
+            if (!rewinding)
+                Frontend::Rewind_Frame();
+
+            Frontend::Capture_Frame();
+
 #ifdef MELONCAP
             MelonCap::Update();
 #endif // MELONCAP
@@ -483,13 +497,7 @@ void EmuThread::run()
 
             if (Config::AudioSync && (!fastforward) && audioDevice)
             {
-                SDL_LockMutex(audioSyncLock);
-                while (SPU::GetOutputSize() > 1024)
-                {
-                    int ret = SDL_CondWaitTimeout(audioSync, audioSyncLock, 500);
-                    if (ret == SDL_MUTEX_TIMEDOUT) break;
-                }
-                SDL_UnlockMutex(audioSyncLock);
+                SPU::WaitOutput(1024, 500);
             }
 
             double frametimeStep = nlines / (60.0 * 263.0);
@@ -1060,6 +1068,11 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 
         menu->addSeparator();
 
+        actRecord = menu->addAction("Start recording...");
+        connect(actRecord, &QAction::triggered, this, &MainWindow::onRecord);
+
+        menu->addSeparator();
+
         actQuit = menu->addAction("Quit");
         connect(actQuit, &QAction::triggered, this, &MainWindow::onQuit);
     }
@@ -1660,6 +1673,64 @@ void MainWindow::onImportSavefile()
     emuThread->emuUnpause();
 }
 
+void MainWindow::onRecord()
+{
+    emuThread->emuPause();
+
+    if (Frontend::Capture_IsActive())
+    {
+        Frontend::Capture_Stop();
+        actRecord->setText("Start recording...");
+
+        char msg[64];
+        sprintf(msg, "Recording stopped (%u frames dropped)", Frontend::Capture_FramesDropped());
+        OSD::AddMessage(0, msg);
+
+        emuThread->emuUnpause();
+        return;
+    }
+
+    // the OpenGL renderer composites the screens on the GPU, the framebuffer
+    // doesn't hold the final picture
+    if (Config::_3DRenderer != 0)
+    {
+        QMessageBox::critical(this,
+                              "melonDS",
+                              "Recording requires the software renderer.");
+        emuThread->emuUnpause();
+        return;
+    }
+
+    QString selfilter;
+    QString qfilename = QFileDialog::getSaveFileName(this,
+                                                     "Start recording",
+                                                     Config::LastROMFolder,
+                                                     "Y4M video (*.y4m);;PNG sequence (*.png)",
+                                                     &selfilter);
+    if (qfilename.isEmpty())
+    {
+        emuThread->emuUnpause();
+        return;
+    }
+
+    // the capture adds its own extensions
+    int format = selfilter.startsWith("PNG") ? Frontend::Capture_PNG : Frontend::Capture_Y4M;
+    if (qfilename.endsWith(".y4m", Qt::CaseInsensitive) || qfilename.endsWith(".png", Qt::CaseInsensitive))
+        qfilename.chop(4);
+
+    if (Frontend::Capture_Start(qfilename.toStdString().c_str(), format, false))
+    {
+        actRecord->setText("Stop recording");
+        OSD::AddMessage(0, "Recording started");
+    }
+    else
+    {
+        OSD::AddMessage(0xFFA0A0, "Could not start recording");
+    }
+
+    emuThread->emuUnpause();
+}
+
 void MainWindow::onQuit()
 {
     QApplication::quit();
@@ -2055,6 +2126,7 @@ int main(int argc, char** argv)
 #define SANITIZE(var, min, max)  { if (var < min) var = min; else if (var > max) var = max; }
     SANITIZE(Config::ConsoleType, 0, 1);
     SANITIZE(Config::_3DRenderer, 0, 1);
+    SANITIZE(Config::Threaded3DWorkers, 0, 16);
     SANITIZE(Config::ScreenVSyncInterval, 1, 20);
     SANITIZE(Config::GL_ScaleFactor, 1, 16);
     SANITIZE(Config::AudioVolume, 0, 256);
@@ -2073,9 +2145,6 @@ int main(int argc, char** argv)
     format.setSwapInterval(0);
     QSurfaceFormat::setDefaultFormat(format);
 
-    audioSync = SDL_CreateCond();
-    audioSyncLock = SDL_CreateMutex();
-
     audioFreq = 48000; // TODO: make configurable?
     SDL_AudioSpec whatIwant, whatIget;
     memset(&whatIwant, 0, sizeof(SDL_AudioSpec));
@@ -2181,8 +2250,7 @@ int main(int argc, char** argv)
     if (audioDevice) SDL_CloseAudioDevice(audioDevice);
     if (micDevice)   SDL_CloseAudioDevice(micDevice);
 
-    SDL_DestroyCond(audioSync);
-    SDL_DestroyMutex(audioSyncLock);
+    Frontend::Capture_Stop();
 
     if (micWavBuffer) delete[] micWavBuffer;
 
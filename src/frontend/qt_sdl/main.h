@@ -196,6 +196,7 @@ private slots:
     void onLoadState();
     void onUndoStateLoad();
     void onImportSavefile();
+    void onRecord();
     void onQuit();
 
     void onPause(bool checked);
@@ -249,6 +250,7 @@ public:
     QAction* actLoadState[9];
     QAction* actUndoStateLoad;
     QAction* actImportSavefile;
+    QAction* actRecord;
     QAction* actQuit;
 
     QAction* actPause;
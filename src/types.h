@@ -30,4 +30,13 @@ typedef int16_t     s16;
 typedef int32_t     s32;
 typedef int64_t     s64;
 
+// state of the emulated console
+// in multi-instance builds, every thread runs its own console and only sees
+// the state of that console
+#ifdef MULTI_INSTANCE
+#define INSTANCE_LOCAL thread_local
+#else
+#define INSTANCE_LOCAL
+#endif
+
 #endif // TYPES_H